@@ -4,6 +4,12 @@
 
 #undef DEBUG
 
+// Vessels controlled from this board, each with its own probes,
+// settings and load output; up to MAX_CHANNELS
+#ifndef CHANNELS
+  #define CHANNELS 1
+#endif
+
 #ifdef DEBUG
   #define PRINT(...) Serial.print(__VA_ARGS__)
   #define PRINTLN(...) { Serial.print(__VA_ARGS__); Serial.print("\n"); }
@@ -14,19 +20,30 @@
   #define PRINTVAR(v)
 #endif
 
+#include "Hal.h"
+#include "Profiler.h"
 #include "TempType.h"
+#include "ProbeSamples.h"
+#include "SettingsStore.h"
+#include "PidController.h"
 #include "LoadController.h"
+#include "Channel.h"
 #include "ChartDisplay.h"
+#if CHANNELS > 1
+  #include "VesselDisplay.h"
+#endif
+#include "ProbeFilter.h"
 #include "TempSensors.h"
+#include "Scheduler.h"
 #include "Buttons.h"
 #include "MenuHandler.h"
+#include "HistoryExport.h"
+#include "Telemetry.h"
+#include "PlantSimulator.h"
 
 //============================================================
 // Variables and constants
 
-#define LOAD_CONTROL_PIN_ON PB3
-#define LOAD_CONTROL_PIN_OFF PB4
-
 #define TEMP_SENSORS_PIN PB9
 
 #define TFT_LED PB1   // 0 if wired to +5V directly
@@ -40,27 +57,86 @@
 #define BTN_BACK PA3
 
 #define SCREEN_TIMEOUT 60000UL  // Milliseconds
-#define TEMPS_TIMEOUT 4000UL  // Milliseconds
+#define CONTROL_INTERVAL 1000UL  // Milliseconds
+#define MENU_POLL 20UL  // Milliseconds, while the menu is open
+#define RESCALE_POLL 5UL  // Milliseconds, while the chart rescales
+#define VIEW_CYCLE 10000UL  // Milliseconds each on the chart and vessel overview
+#define SETTINGS_POLL 1000UL  // Milliseconds
+#define SERIAL_BAUD 115200
 #define ORIENTATION 3
 #define TFT_BRIGHTNESS 100 // Initial brightness of TFT backlight (optional)
 
+// Load control on and off pins per channel. Only the first vessel
+// has an off pin; the others drive a single relay.
+static const int loadControlPins[MAX_CHANNELS][2] = {
+  { PB3, PB4 },
+  { PB10, HAL_NO_PIN },
+  { PB11, HAL_NO_PIN },
+  { PB12, HAL_NO_PIN },
+  { PB13, HAL_NO_PIN },
+  { PB14, HAL_NO_PIN },
+  { PB15, HAL_NO_PIN },
+  { PA8, HAL_NO_PIN }
+};
+
 //============================================================
 // Globals
-TFT_22_ILI9225 tft(TFT_RST, TFT_RS, TFT_CS, TFT_LED, TFT_BRIGHTNESS);
+HalDisplay tft(TFT_RST, TFT_RS, TFT_CS, TFT_LED, TFT_BRIGHTNESS);
 ButtonController buttons;
 ChartDisplay chartDisplay(tft);
 TempSensors sensors;
-LoadController loadControl;
+Channel channels[CHANNELS];
+Scheduler scheduler;
+MenuHandler menuHandler(tft, channels, chartDisplay);
+HistoryExport historyExport(chartDisplay.getSampleLog(), chartDisplay.getTierLogs());
+#if CHANNELS > 1
+VesselDisplay vesselDisplay(tft);
+bool showVessels = false;
+#endif
 
 bool screenOnFlag = true;
-bool waitingForTemps = false;
-unsigned long screenTimeoutStart = millis();
-unsigned long tempsTimeoutStart = millis();
+bool haveTemps = false;
+bool chartSampled = false;
+bool menuOpen = false;
+ProbeSamples samples;
+unsigned long screenTimeoutStart = halMillis();
+unsigned long decisionLatency = 0;   // Age of the beer reading the last decision used, ms
+
+int sensorTaskId;
+int controlTaskId;
+int chartTaskId;
+int screenTaskId;
+int menuTaskId;
+int settingsTaskId;
+int exportTaskId;
+#ifdef PROFILE
+int profileTaskId;
+#endif
+#ifdef TELEMETRY
+int telemetryTaskId;
+#endif
+#if CHANNELS > 1
+int viewTaskId;
+#endif
 
-void handleMenu() {
-  MenuHandler handler(tft, buttons, loadControl);
+void openMenu(void) {
+  chartDisplay.hide();
+#if CHANNELS > 1
+  vesselDisplay.hide();
+#endif
 
-  handler.presentMenu();
+  menuHandler.presentMenu();
+  menuOpen = true;
+}
+
+void closeMenu(void) {
+  menuHandler.close();
+  menuOpen = false;
+
+  chartDisplay.redraw();
+#if CHANNELS > 1
+  showVessels = false;
+#endif
 }
 
 void screenOn(void) {
@@ -80,96 +156,305 @@ bool screenIsOn(void) {
 }
 
 void resetScreenTimeout(void) {
-  screenTimeoutStart = millis();
+  screenTimeoutStart = halMillis();
+}
+
+unsigned long screenTimeRemaining(void) {
+  unsigned long elapsed = halMillis() - screenTimeoutStart;
+
+  return elapsed >= SCREEN_TIMEOUT ? 0 : SCREEN_TIMEOUT - elapsed;
+}
+
+// Queues frames for anything that changed; the telemetry task sends them
+void sendTelemetry(unsigned updated) {
+#ifdef TELEMETRY
+  telemetry.sendSamples(halMillis(), samples, updated);
+
+  for (unsigned c=0; c<CHANNELS; c++) {
+    telemetry.sendControl(halMillis(), c, channels[c].control);
+  }
+
+  if (telemetry.pending()) {
+    scheduler.wake(telemetryTaskId);
+  }
+#endif
+}
+
+//============================================================
+// Tasks
+
+unsigned long sensorTask(void) {
+  unsigned updated = sensors.poll(samples);
+
+  if (updated) {
+    haveTemps = sensors.haveTemps();
+
+    if (haveTemps) {
+      // A new beer reading gets a control decision straight away
+      for (unsigned c=0; c<CHANNELS; c++) {
+        if (updated & samples.roleMask(c, beer)) {
+          scheduler.wake(controlTaskId);
+          break;
+        }
+      }
+
+      chartSampled = true;
+      scheduler.wake(chartTaskId);
+    }
+
+    sendTelemetry(updated);
+  }
+
+  return sensors.nextEvent();
+}
+
+// One pass decides for every vessel
+unsigned long controlTask(void) {
+  if (!haveTemps) {
+    return TASK_WAIT;
+  }
+
+  decisionLatency = halMillis() - samples.roleTime(0, beer);
+
+  for (unsigned c=0; c<CHANNELS; c++) {
+    channels[c].control.check(samples);
+    sensors.setFastSampling(c, channels[c].isActive(), samples);
+  }
+
+  sendTelemetry(0);
+
+  return CONTROL_INTERVAL;
+}
+
+// Also runs on while the chart repaints a few columns at a time after
+// its scale changes. The chart and sample log follow the first vessel;
+// the hour and 4 hour history keeps them all.
+unsigned long chartTask(void) {
+  if (chartSampled) {
+    chartSampled = false;
+    chartDisplay.addDataPoint(halMillis(), samples, 0, channels[0].isActive());
+
+    for (unsigned c=1; c<CHANNELS; c++) {
+      chartDisplay.addHistoryPoint(samples, c, channels[c].isActive());
+    }
+#if CHANNELS > 1
+    vesselDisplay.update(channels, samples);
+#endif
+  }
+
+  return chartDisplay.rescale() ? RESCALE_POLL : TASK_WAIT;
+}
+
+unsigned long screenTask(void) {
+  if (!screenIsOn()) {
+    return TASK_WAIT;
+  }
+
+  if (screenTimeRemaining() == 0) {
+    screenOff();
+
+    return TASK_WAIT;
+  }
+
+  return screenTimeRemaining();
 }
 
-bool screenTimedOut(void) {
-  return millis() - screenTimeoutStart >= SCREEN_TIMEOUT;
+unsigned long menuTask(void) {
+  PROFILE_SCOPE(ProfileMenu);
+
+  Buttons button;
+  unsigned long settle = buttons.settle();
+
+  while (buttons.nextPress(button)) {
+    resetScreenTimeout();
+
+    if (!screenIsOn()) {
+      screenOn();
+
+      scheduler.wake(screenTaskId);
+    } else if (!menuOpen) {
+      openMenu();
+    } else {
+      menuHandler.buttonPressed(button);
+    }
+  }
+
+  if (menuOpen && !menuHandler.isOpen()) {
+    closeMenu();
+
+    resetScreenTimeout();
+  }
+
+  // Button presses wake the task from idle(); an open menu also needs
+  // its timeout checked, and a bouncing key its pin read again
+  return min(settle, menuOpen ? MENU_POLL : TASK_WAIT);
 }
 
-void resetTempsTimeout(void) {
-  tempsTimeoutStart = millis();
+unsigned long settingsTask(void) {
+  for (unsigned c=0; c<CHANNELS; c++) {
+    if (channels[c].settings.commitDue()) {
+      channels[c].settings.commit();
+    }
+  }
+
+  return SETTINGS_POLL;
+}
+
+unsigned long exportTask(void) {
+  return historyExport.poll();
+}
+
+#ifdef TELEMETRY
+unsigned long telemetryTask(void) {
+  if (!historyExport.isBusy()) {
+    telemetry.drain();
+  }
+
+  return telemetry.pending() ? TELEMETRY_POLL : TASK_WAIT;
 }
+#endif
+
+#if CHANNELS > 1
+// Alternates the chart and vessel overview while nothing else is shown
+unsigned long viewTask(void) {
+  if (menuOpen || !screenIsOn()) {
+    return VIEW_CYCLE;
+  }
+
+  showVessels = !showVessels;
+
+  if (showVessels) {
+    chartDisplay.hide();
+    vesselDisplay.redraw(channels, samples);
+  } else {
+    vesselDisplay.hide();
+    chartDisplay.redraw();
+  }
 
-bool tempsReady(void) {
-  return waitingForTemps && sensors.tempsReady();
+  return VIEW_CYCLE;
 }
+#endif
+
+#ifdef PROFILE
+// The profile, then each task's worst lateness in ms
+unsigned long profileTask(void) {
+  profiler.dump();
+
+  for (unsigned i=0; i<scheduler.getTaskCount(); i++) {
+    Serial.print("Latency ");
+    Serial.print(scheduler.getName(i));
+    Serial.print(' ');
+    Serial.print(scheduler.getMaxLatency(i));
+    Serial.print('\n');
+  }
 
-bool tempsTimedOut(void) {
-  return millis() - tempsTimeoutStart >= TEMPS_TIMEOUT;
+  return PROFILE_DUMP_INTERVAL;
 }
+#endif
 
-void requestTemps(void) {
-  PRINTLN("Request temps");
-  
-  sensors.requestTemps();
+//============================================================
+// Idle
+//
+// Sleeps the core between tasks instead of spinning in loop(). It wakes
+// on every SysTick to keep millis() running, so each wait costs a few
+// dozen cycles a millisecond, and goes back to sleep until the next
+// task is due. A button press or serial input wakes the task that
+// handles it straight away.
+
+bool inputPending(void) {
+  bool pending = false;
+
+  if (buttons.hasEvents() || buttons.needsSettling()) {
+    scheduler.wake(menuTaskId);
+    pending = true;
+  }
 
-  waitingForTemps = true;
+  if (halSerialAvailable()) {
+    scheduler.wake(exportTaskId);
+    pending = true;
+  }
 
-  resetTempsTimeout();
+  return pending;
 }
 
-void updateTemps(void) {
-  float temps[3];
+void idle(void) {
+  unsigned long start = halMillis();
+  unsigned long sleep = scheduler.nextDeadline();
 
-  PRINTLN("Update temps");
-  
-  sensors.getTemps(temps);
+  while (halMillis() - start < sleep) {
+    halDisableInterrupts();
 
-  chartDisplay.addDataPoint(millis(), temps[beer], temps[coolant], temps[air], 
-      loadControl.getActiveState() == LoadController::Active);
-      
-  loadControl.check(temps[beer]);
+    if (inputPending()) {
+      halEnableInterrupts();
+      return;
+    }
 
-  waitingForTemps = false;
+    halWaitForInterrupt();
+    halEnableInterrupts();
+  }
 }
 
 //============================================================
 // Setup
 void setup() {
+  halSerialBegin(SERIAL_BAUD);
 #ifdef DEBUG
-  Serial.begin(9600);
-  delay(1000);
+  halDelay(1000);
 #endif
 
   PRINTLN(F("Init Start"));
 
+#ifdef PROFILE
+  profiler.init();
+#endif
+
   tft.begin();
   tft.setOrientation(ORIENTATION);
   chartDisplay.init();
-  sensors.init(TEMP_SENSORS_PIN);
-  loadControl.init(LOAD_CONTROL_PIN_ON, LOAD_CONTROL_PIN_OFF);
+  halEepromBegin();
+
+  for (unsigned c=0; c<CHANNELS; c++) {
+    channels[c].init(c, loadControlPins[c][0], loadControlPins[c][1]);
+  }
+
+  sensors.init(TEMP_SENSORS_PIN, samples, channels);
   buttons.init(BTN_UP, BTN_DOWN, BTN_SELECT, BTN_BACK);
 
   resetScreenTimeout();
-  resetTempsTimeout();
-  waitingForTemps = false;
+
+  sensorTaskId = scheduler.addTask("Sensors", sensorTask);
+  controlTaskId = scheduler.addTask("Control", controlTask, TASK_WAIT);
+  chartTaskId = scheduler.addTask("Chart", chartTask, TASK_WAIT);
+  screenTaskId = scheduler.addTask("Screen", screenTask, SCREEN_TIMEOUT);
+  menuTaskId = scheduler.addTask("Menu", menuTask);
+  settingsTaskId = scheduler.addTask("Settings", settingsTask, SETTINGS_POLL);
+  exportTaskId = scheduler.addTask("Export", exportTask, TASK_WAIT);
+#ifdef TELEMETRY
+  telemetryTaskId = scheduler.addTask("Telemetry", telemetryTask, TASK_WAIT);
+#endif
+#ifdef PROFILE
+  profileTaskId = scheduler.addTask("Profile", profileTask, PROFILE_DUMP_INTERVAL);
+#endif
+#if CHANNELS > 1
+  viewTaskId = scheduler.addTask("View", viewTask, VIEW_CYCLE);
+#endif
 
   PRINTLN(F("Init Done"));
+  halCounters.print();
+
+#ifdef SIMULATE_PLANT
+  simulatePlant(scheduler, channels, loadControlPins);
+#endif
 }
 
 //============================================================
 // Loop
 void loop() {
-  if (tempsReady()) {
-    updateTemps();
-  } else if (tempsTimedOut()) {
-    requestTemps();
-  }
-
-  if (screenIsOn() && screenTimedOut()) {
-    screenOff();
-  } else if (!screenIsOn()) {
-    if (buttons.buttonPressed(ButtonAny)) {
-      screenOn();
-      
-      resetScreenTimeout();
-    }
-  } else if (buttons.buttonPressed(ButtonAny)) {
-    handleMenu();
+  {
+    PROFILE_AWAKE();
 
-    chartDisplay.redraw();
-
-    resetScreenTimeout();
+    scheduler.run();
   }
+
+  idle();
 }
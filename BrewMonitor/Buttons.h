@@ -1,3 +1,9 @@
+#include "EventQueue.h"
+
+#define BUTTON_DEBOUNCE 25UL  // Milliseconds
+#define BUTTON_LONG_PRESS 1000UL  // Milliseconds
+#define BUTTON_QUEUE_SIZE 16
+
 typedef enum {
   ButtonAny,
   ButtonUp,
@@ -6,57 +12,184 @@ typedef enum {
   ButtonBack
 } Buttons;
 
+#define NUM_BUTTONS 5
+
+typedef enum {
+  ButtonPress,
+  ButtonRelease,
+  ButtonLongPress
+} ButtonEventType;
+
+class ButtonEvent {
+  public:
+  Buttons button;
+  ButtonEventType type;
+  unsigned long time;
+};
+
+//============================================================
+// Buttons are debounced in their pin change interrupts, which push
+// events onto a queue for the main loop to drain. All four EXTI lines
+// share a priority so the handlers never preempt each other, which
+// keeps the queue single-producer.
+//
+// An edge inside a button's debounce window is ignored, but if it was
+// the last one the pin would be left out of step, e.g. a key released
+// 10ms after it was pressed. So the handler marks the button unsettled
+// and settle(), called from a task, reads the pin again once the window
+// has closed.
+
 class ButtonController {
   private:
-  int upPin;
-  int downPin;
-  int selPin;
-  int backPin;
+  static ButtonController *instance;
+
+  private:
+  int pins[NUM_BUTTONS];
+  bool pressed[NUM_BUTTONS];
+  unsigned long lastEdge[NUM_BUTTONS];
+  unsigned long pressTime[NUM_BUTTONS];
+  volatile bool unsettled[NUM_BUTTONS];   // An edge fell in the debounce window
+  volatile bool settleRequested;
+  EventQueue<ButtonEvent, BUTTON_QUEUE_SIZE> events;
 
   private:
-  bool checkButton(int pin) {
-    if (digitalRead(pin) != LOW) {
-      return false;
+  static void upChanged(void) {
+    instance->pinChanged(ButtonUp);
+  }
+
+  static void downChanged(void) {
+    instance->pinChanged(ButtonDown);
+  }
+
+  static void selectChanged(void) {
+    instance->pinChanged(ButtonSelect);
+  }
+
+  static void backChanged(void) {
+    instance->pinChanged(ButtonBack);
+  }
+
+  void pushEvent(Buttons button, ButtonEventType type, unsigned long time) {
+    ButtonEvent event;
+
+    event.button = button;
+    event.type = type;
+    event.time = time;
+
+    events.push(event);
+  }
+
+  void pinChanged(Buttons button) {
+    unsigned long now = halMillis();
+
+    if (now - lastEdge[button] < BUTTON_DEBOUNCE) {
+      unsettled[button] = true;
+      settleRequested = true;
+      return;
+    }
+
+    pinSettled(button, now);
+  }
+
+  // Queues the change if the pin no longer matches the last edge
+  void pinSettled(Buttons button, unsigned long now) {
+    bool down = halDigitalRead(pins[button]) == LOW;
+
+    if (down == pressed[button]) {
+      return;
     }
 
-    do {
-      delay(25);
-    } while (digitalRead(pin) == LOW);
+    lastEdge[button] = now;
+    pressed[button] = down;
+
+    if (down) {
+      pressTime[button] = now;
+      pushEvent(button, ButtonPress, now);
+    } else {
+      if (now - pressTime[button] >= BUTTON_LONG_PRESS) {
+        pushEvent(button, ButtonLongPress, now);
+      }
+      pushEvent(button, ButtonRelease, now);
+    }
+  }
 
-    return true;
+  void initButton(Buttons button, int pin, void (*handler)(void)) {
+    halPinMode(pin, INPUT_PULLUP);
+    pins[button] = pin;
+    pressed[button] = false;
+    unsettled[button] = false;
+    lastEdge[button] = pressTime[button] = 0;
+    halAttachInterrupt(pin, handler, CHANGE);
   }
-  
+
   public:
   void init(int up, int down, int sel, int back) {
-    pinMode(up, INPUT_PULLUP);
-    upPin = up;
-    pinMode(down, INPUT_PULLUP);
-    downPin = down;
-    pinMode(sel, INPUT_PULLUP);
-    selPin = sel;
-    pinMode(back, INPUT_PULLUP);
-    backPin = back;
-  }
-  
-  bool buttonPressed(Buttons button) {
-    switch(button) {
-      case ButtonUp:
-        return checkButton(upPin);
-        break;
-      case ButtonDown:
-        return checkButton(downPin);
-        break;
-      case ButtonSelect:
-        return checkButton(selPin);
-        break;
-      case ButtonBack:
-        return checkButton(backPin);
-        break;
-      case ButtonAny:
-        return checkButton(upPin) || checkButton(downPin) || checkButton(selPin) || checkButton(backPin);
-        break;
+    instance = this;
+    settleRequested = false;
+
+    initButton(ButtonUp, up, upChanged);
+    initButton(ButtonDown, down, downChanged);
+    initButton(ButtonSelect, sel, selectChanged);
+    initButton(ButtonBack, back, backChanged);
+  }
+
+  bool hasEvents(void) {
+    return !events.isEmpty();
+  }
+
+  // True once an edge has been ignored, until settle() runs
+  bool needsSettling(void) {
+    return settleRequested;
+  }
+
+  // Reads again any pin whose debounce window has closed since it last
+  // changed. Returns milliseconds until the next window closes, or
+  // TASK_WAIT if nothing is left unsettled.
+  unsigned long settle(void) {
+    unsigned long next = TASK_WAIT;
+
+    settleRequested = false;
+
+    for (unsigned b=ButtonUp; b<NUM_BUTTONS; b++) {
+      halDisableInterrupts();
+
+      if (unsettled[b]) {
+        unsigned long elapsed = halMillis() - lastEdge[b];
+
+        if (elapsed >= BUTTON_DEBOUNCE) {
+          unsettled[b] = false;
+          pinSettled((Buttons)b, halMillis());
+        } else {
+          next = min(next, BUTTON_DEBOUNCE - elapsed);
+        }
+      }
+
+      halEnableInterrupts();
+    }
+
+    return next;
+  }
+
+  bool isPressed(Buttons button) {
+    return pressed[button];
+  }
+
+  bool nextEvent(ButtonEvent &event) {
+    return events.pop(event);
+  }
+
+  bool nextPress(Buttons &button) {
+    ButtonEvent event;
+
+    while (events.pop(event)) {
+      if (event.type == ButtonPress) {
+        button = event.button;
+        return true;
+      }
     }
-    
+
     return false;
   }
 };
+
+ButtonController *ButtonController::instance = 0;
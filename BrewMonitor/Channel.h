@@ -0,0 +1,23 @@
+//============================================================
+// Vessel channels
+//
+// Everything one fermenter needs: its own settings block, controller
+// and load output. Its probes are the ones ProbeSamples maps to the
+// channel. The board keeps CHANNELS of these in one array, so the
+// control task's pass over every vessel walks contiguous memory.
+
+class Channel {
+  public:
+  SettingsStore settings;
+  LoadController control;
+
+  public:
+  void init(unsigned index, int onPin, int offPin) {
+    settings.load(index);
+    control.init(index, onPin, offPin, settings);
+  }
+
+  bool isActive(void) {
+    return control.getActiveState() == LoadController::Active;
+  }
+};
@@ -1,31 +1,54 @@
-#include <TFT_22_ILI9225.h>
+#include "SampleCodec.h"
+#include "MinMaxTree.h"
+#include "HistoryStore.h"
+#include "SampleLog.h"
+#include "HistoryLog.h"
+#include "TextField.h"
 
 #define X_RANGE 12   // Hours
-#define Y_RANGE 4   // *10 Deg
+#define Y_STEPS 4   // Gridlines up the chart
 
-#define X_ZERO 5
+#define X_ZERO 24   // Room for three 6x8 characters at a 7 pixel pitch, and the tick
 #define Y_ZERO (height-5-1)
 #define X_HOUR ((width-X_ZERO-1)/X_RANGE)
 #define X_HALF (X_HOUR/2)
 #define X_QUARTER (X_HOUR/4)
 #define X_PIXELS (X_RANGE*X_HOUR)
-#define Y_10DEG ((Y_ZERO+1-44)/Y_RANGE)
-#define Y_5DEG (Y_10DEG/2)
-#define Y_TOP (Y_ZERO-Y_RANGE*Y_10DEG)
+#define Y_STEP ((Y_ZERO+1-44)/Y_STEPS)
+#define Y_TOP (Y_ZERO-Y_STEPS*Y_STEP)
 #define Y_BOTTOM (height-1)
+#define SCROLL_X (X_ZERO+1)
+#define SCROLL_PANEL 63   // Readouts right of the band, nine 6x8 characters at a 7 pixel pitch
+#define SCROLL_WIDTH min(width-SCROLL_X-SCROLL_PANEL, (unsigned)X_PIXELS)
+#define PANEL_X (width-SCROLL_PANEL)
+#define PANEL_ROW 40   // Name, value and range of each probe
+
+#define TEMP_VALUE_CHARS 5   // "-20.0" to "100.0"
+#define TEMP_RANGE_CHARS 9   // Whole degrees when tenths don't fit, "-20/100"
+
+#define RESCALE_COLUMNS 16   // Columns repainted per rescale() call
+#define GRID_COLOUR COLOR_DARKGRAY
+
+class ChartDisplay : public SampleLogReader, public HistoryWriter {
+  public:
+  typedef enum {
+    Span12Hours,
+    Span7Days,
+    Span30Days,
+    Span8HoursScroll
+  } ChartSpan;
 
-class ChartDisplay {
   private:
   class TextDetails {
     public:
-    TextDetails(String text, unsigned x, unsigned endx, unsigned colour)
+    TextDetails(const char *text, unsigned x, unsigned endx, unsigned colour)
     : text(text),
       x(x),
       end_x(endx),
       colour(colour)
     { }
   
-    String    text;
+    const char *text;
     unsigned  x;
     unsigned  end_x;
     unsigned  colour;
@@ -33,166 +56,767 @@ class ChartDisplay {
   
   private:
   static const unsigned long chartWidth = X_RANGE*60L*60L*1000L;
+  static const TempFixed scaleSteps[];
+  static const unsigned scaleStepCount;
 
   private:
-  TFT_22_ILI9225 &tft;
+  HalDisplay &tft;
   
-  byte *storage[3] = {};
-  float minTemp[3] = { 99.0, 99.0, 99.0};
-  float maxTemp[3] = {};
-  TextDetails temps[3] = {
-    TextDetails("Beer", 0, 67, COLOR_BLUE),
-    TextDetails("Coolant", 68, 159, COLOR_GREEN),
-    TextDetails("Air", 160, 239, COLOR_RED)
+  MinMaxTree<StoreVal, STORE_INVALID> minMax[PROBE_ROLES];
+  HistoryStore history;
+  SampleLog sampleLog;
+  HistoryLog tierLogs[HISTORY_TIERS - 1] = {   // Tiers above the first
+    HistoryLog(HISTORY_TIER1_LOG_BASE, HISTORY_TIER1_LOG_PAGES),
+    HistoryLog(HISTORY_TIER2_LOG_BASE, HISTORY_TIER2_LOG_PAGES)
+  };
+  byte *power;
+  uint16_t *columnBuffer;
+  TempFixed minTemp[PROBE_ROLES] = {};
+  TempFixed maxTemp[PROBE_ROLES] = {};
+  TextDetails temps[PROBE_ROLES] = {
+    TextDetails("Beer", 0, 64, COLOR_BLUE),
+    TextDetails("Coolant", 65, 156, COLOR_GREEN),
+    TextDetails("Air", 157, 219, COLOR_RED)
   };
+  TextField valueFields[PROBE_ROLES];
+  TextField rangeFields[PROBE_ROLES];
 
   unsigned width, height;
   unsigned long startTime;
+  unsigned long lastTimestamp;
+  unsigned long chartOffset;   // Milliseconds into the chart's 12 hours
   unsigned barX;
+  unsigned scrollColumn;   // Panel memory column of the newest column, less SCROLL_X
+  bool hardwareScroll;
+  unsigned restored;
+  unsigned long replaySeq;   // Sample log column being replayed, 0 once live
+  bool visible;
+  ChartSpan span;
+  TempFixed axisLow;    // Temperature at the x axis
+  TempFixed axisStep;   // Temperature between gridlines
+  unsigned rescaleColumn;   // Next column to repaint, past plotColumns() when done
+  unsigned long rescaleSpiBytes;
+  unsigned long redrawSpiBytes;   // Sent by the last redraw, with HAL_COUNTERS
+  unsigned long readoutSpiBytes;   // Sent by the last readout update
 
   private:
+  bool isLive(void) {
+    return span == Span12Hours || span == Span8HoursScroll;
+  }
+
+  //============================================================
+  // Scrolling 8 hours
+  //
+  // The newest column sits at the right edge of the band and the rest
+  // scroll left. With hardware scroll, each column is written once to
+  // the panel's memory and the panel's scroll offset moves the band on,
+  // so a new column costs one column write however wide the chart is.
+  // The panel scrolls whole gate lines, top to bottom, so the readouts
+  // sit in a panel right of the band rather than above it, and the
+  // band shows the newest SCROLL_WIDTH columns of the 12 hours. Its
+  // memory holds columns by their own count rather than by chart
+  // position, and the newest overwrites the one leaving the left edge.
+  // Without hardware scroll every column is repainted instead.
+
+  bool isScrolling(void) {
+    return span == Span8HoursScroll;
+  }
+
+  // Screen x for a chart column, or in scroll mode the panel column
+  unsigned columnX(unsigned column) {
+    if (!isScrolling()) {
+      return column + X_ZERO;
+    }
+
+    return ageX(columnAge(column));
+  }
+
+  // Columns since the newest; the band shows those under SCROLL_WIDTH
+  unsigned columnAge(unsigned column) {
+    return (barX - X_ZERO + X_PIXELS - column) % X_PIXELS;
+  }
+
+  bool isShown(unsigned column) {
+    return !isScrolling() || columnAge(column) < SCROLL_WIDTH;
+  }
+
+  // Where the column 'age' columns before the newest goes when scrolling
+  unsigned ageX(unsigned age) {
+    if (hardwareScroll) {
+      return SCROLL_X + (scrollColumn + SCROLL_WIDTH - age) % SCROLL_WIDTH;
+    }
+
+    return SCROLL_X + SCROLL_WIDTH - 1 - age;
+  }
+
+  void drawTick(unsigned x, unsigned column) {
+    unsigned tickWidth = X_PIXELS / spanTicks();
+
+    tft.drawLine(x, Y_ZERO+1, x, Y_BOTTOM, COLOR_BLACK);
+
+    if (column % tickWidth == 0) {
+      tft.drawLine(x, Y_ZERO, x, Y_ZERO+5, COLOR_YELLOW);
+    } else if (tickWidth >= 8 && column % tickWidth == tickWidth/2) {
+      tft.drawLine(x, Y_ZERO, x, Y_ZERO+3, COLOR_YELLOW);
+    }
+  }
+
+  // Names across the top, or stacked in the side panel when scrolling
+  void drawHeader(void) {
+    tft.setBackgroundColor(COLOR_BLACK);
+
+    for (unsigned t=0; t<PROBE_ROLES; t++) {
+      if (isScrolling()) {
+        tft.setFont(Terminal6x8);
+        tft.drawText(PANEL_X, t*PANEL_ROW, temps[t].text, temps[t].colour);
+      } else {
+        tft.setFont(Terminal12x16);
+        tft.drawText(temps[t].x, 0, temps[t].text, temps[t].colour);
+      }
+    }
+  }
+
+  void initFields(void) {
+    for (unsigned t=0; t<PROBE_ROLES; t++) {
+      if (isScrolling()) {
+        valueFields[t].init(PANEL_X, t*PANEL_ROW + 9, TEMP_VALUE_CHARS);
+        rangeFields[t].init(PANEL_X, t*PANEL_ROW + 26, TEMP_RANGE_CHARS);
+      } else {
+        valueFields[t].init(temps[t].x, 18, TEMP_VALUE_CHARS);
+        rangeFields[t].init(temps[t].x, 35, TEMP_RANGE_CHARS);
+      }
+    }
+  }
+
+  // Right edge of the plot: the end of the band when scrolling
+  unsigned plotEnd(void) {
+    return isScrolling() ? SCROLL_X + SCROLL_WIDTH : width;
+  }
+
+  // Skipped columns need clearing, so a jump of more than one repaints
+  void scrollChart(unsigned oldBarX, const TempFixed *roleTemps, bool powerOn) {
+    unsigned column = barX - X_ZERO;
+
+    if (!hardwareScroll || (oldBarX + 1 - X_ZERO) % X_PIXELS != column) {
+      redraw();
+      drawTemps(roleTemps);
+      return;
+    }
+
+    scrollColumn = (scrollColumn + 1) % SCROLL_WIDTH;
+    tft.setScrollOffset(scrollColumn + 1);
+
+    drawColumn(columnX(column), roleTemps, powerOn);
+    drawTick(columnX(column), column);
+  }
+
+  unsigned long spanMillis(void) {
+    switch (span) {
+      case Span7Days:
+        return 7UL*24UL*60UL*60UL*1000UL;
+      case Span30Days:
+        return 30UL*24UL*60UL*60UL*1000UL;
+      default:
+        return chartWidth;
+    }
+  }
+
+  unsigned spanTicks(void) {
+    switch (span) {
+      case Span7Days:
+        return 7;
+      case Span30Days:
+        return 30;
+      default:
+        return X_RANGE;
+    }
+  }
+
   void drawAxes(void) {
+    unsigned ticks = spanTicks();
+    unsigned tickWidth = X_PIXELS / ticks;
+
     tft.drawLine(X_ZERO, Y_TOP, X_ZERO, Y_BOTTOM, COLOR_YELLOW);
-    tft.drawLine(0, Y_ZERO, X_ZERO+24*X_HOUR, Y_ZERO, COLOR_YELLOW);
+    tft.drawLine(0, Y_ZERO, isScrolling() ? plotEnd()-1 : X_ZERO+24*X_HOUR, Y_ZERO, COLOR_YELLOW);
 
-    for (int x=X_ZERO+X_HOUR; x<=X_ZERO+24*X_HOUR; x+=X_HOUR) {
-      tft.drawLine(x, Y_ZERO, x, Y_ZERO+5, COLOR_YELLOW);
-      tft.drawLine(x-X_HALF, Y_ZERO, x-X_HALF, Y_ZERO+3, COLOR_YELLOW);
+    if (isScrolling()) {
+      for (unsigned column=0; column<X_PIXELS; column++) {
+        if (isShown(column)) {
+          drawTick(columnX(column), column);
+        }
+      }
+    } else {
+      for (unsigned i=1; i<=ticks; i++) {
+        unsigned x = X_ZERO + i*tickWidth;
+
+        tft.drawLine(x, Y_ZERO, x, Y_ZERO+5, COLOR_YELLOW);
+        if (tickWidth >= 8) {
+          tft.drawLine(x-tickWidth/2, Y_ZERO, x-tickWidth/2, Y_ZERO+3, COLOR_YELLOW);
+        }
+      }
+    }
+
+    drawScale();
+  }
+
+  //============================================================
+  // Y axis scale
+  //
+  // The axis spans Y_STEPS gridlines, spaced by one of scaleSteps and
+  // starting on a multiple of it, picked as the narrowest that holds
+  // the charted temperatures. Under a degree the gridlines fall on
+  // half degrees and only whole degrees are labelled.
+  //
+  // The scale widens as soon as a temperature leaves it, with a
+  // quarter step spare, but narrows only once the data would sit half
+  // a step inside the narrower scale, so a reading wandering near a
+  // boundary doesn't flip it back and forth. A live chart is then
+  // repainted a few columns at a time by rescale() rather than by
+  // redraw(), leaving the header and axes as they are.
+
+  int tempToY(TempFixed temp) {
+    return (int)Y_ZERO - (int)((long)(temp - axisLow) * Y_STEP / axisStep);
+  }
+
+  // Picks the narrowest scale holding lo to hi with step/margin spare
+  void pickScale(TempFixed lo, TempFixed hi, int margin, TempFixed &low, TempFixed &step) {
+    for (unsigned s=0; s<scaleStepCount; s++) {
+      TempFixed spare = scaleSteps[s] / margin;
+
+      step = scaleSteps[s];
+      low = floorToStep(lo - spare, step);
+
+      if (hi + spare <= low + Y_STEPS * step) {
+        return;
+      }
+    }
+
+    low = floorToStep(lo, step);
+  }
+
+  TempFixed floorToStep(long temp, TempFixed step) {
+    long low = temp / step * step;
+
+    return low > temp ? low - step : low;
+  }
+
+  // Returns true if the scale changed
+  bool updateScale(void) {
+    TempFixed lo, hi, low, step;
+
+    if (!dataRange(lo, hi)) {
+      return false;
+    }
+
+    if (lo >= axisLow && hi <= axisLow + Y_STEPS * axisStep) {
+      pickScale(lo, hi, 2, low, step);
+
+      if (step >= axisStep) {
+        return false;
+      }
+    } else {
+      pickScale(lo, hi, 4, low, step);
+
+      if (low == axisLow && step == axisStep) {
+        return false;
+      }
+    }
+
+    axisLow = low;
+    axisStep = step;
+
+    PRINTVAR(axisLow);
+    PRINTVAR(axisStep);
+
+    return true;
+  }
+
+  // Lowest and highest temperature charted, false if there are none
+  bool dataRange(TempFixed &lo, TempFixed &hi) {
+    StoreVal low = STORE_INVALID;
+    StoreVal high = 0;
+
+    if (isLive()) {
+      for (unsigned t=0; t<PROBE_ROLES; t++) {
+        if (minMax[t].getMin() != STORE_INVALID) {
+          low = min(low, minMax[t].getMin());
+          high = max(high, minMax[t].getMax());
+        }
+      }
+    } else {
+      HistoryBucket bucket;
+
+      for (unsigned x=1; x < X_PIXELS; x++) {
+        if (history.query(spanMillis(), X_PIXELS, x, bucket)) {
+          for (unsigned t=0; t<PROBE_ROLES; t++) {
+            if (bucket.meanVal[t] != STORE_INVALID) {
+              low = min(low, bucket.meanVal[t]);
+              high = max(high, bucket.meanVal[t]);
+            }
+          }
+        }
+      }
     }
 
-    for (int y=Y_ZERO-Y_10DEG; y>=Y_ZERO-4*Y_10DEG; y-=Y_10DEG) {
-      tft.drawLine(0, y, X_ZERO, y, COLOR_YELLOW);
-      tft.drawLine(2, y+Y_5DEG, X_ZERO, y+Y_5DEG, COLOR_YELLOW);
+    lo = tempFromStoreVal(low);
+    hi = tempFromStoreVal(high);
+
+    return low != STORE_INVALID;
+  }
+
+  void drawScale(void) {
+    char text[12];
+
+    tft.fillRectangle(0, Y_TOP-3, X_ZERO-1, Y_ZERO-1, COLOR_BLACK);
+    tft.setFont(Terminal6x8);
+    tft.setBackgroundColor(COLOR_BLACK);
+
+    unsigned pitch = tft.getFont().width + 1;
+
+    for (unsigned i=0; i<=Y_STEPS; i++) {
+      TempFixed temp = axisLow + i * axisStep;
+      int y = Y_ZERO - i * Y_STEP;
+
+      if (temp % TEMP_SCALE) {
+        tft.drawLine(X_ZERO-1, y, X_ZERO, y, COLOR_YELLOW);
+        continue;
+      }
+
+      tft.drawLine(X_ZERO-3, y, X_ZERO, y, COLOR_YELLOW);
+
+      // Whole degrees, so the ".0" is dropped
+      char *end = formatTenths(text, temp / TEMP_SCALE * 10);
+
+      end[-2] = 0;
+
+      // Right aligned against the tick, but never off the left edge
+      int x = (int)X_ZERO - 4 - (int)(strlen(text) * pitch - 1);
+
+      tft.drawText(max(x, 0), constrain(y-4, (int)Y_TOP-3, (int)Y_ZERO-8), text, COLOR_YELLOW);
+    }
+  }
+
+  void drawGrid(void) {
+    for (unsigned i=1; i<=Y_STEPS; i++) {
+      tft.fillRectangle(X_ZERO+1, Y_ZERO - i*Y_STEP, plotEnd()-1, Y_ZERO - i*Y_STEP, GRID_COLOUR);
+    }
+  }
+
+  void startRescale(void) {
+    if (visible && isLive()) {
+      drawScale();
+
+      rescaleColumn = isScrolling() ? 0 : 1;
+      rescaleSpiBytes = halCounters.spiBytes;
+    }
+  }
+
+  // Columns across the plot, including those past the chart's end
+  unsigned plotColumns(void) {
+    return isScrolling() ? X_PIXELS : width - X_ZERO;
+  }
+
+  void plotLiveColumn(unsigned column) {
+    if (column >= X_PIXELS) {
+      clearColumn(column + X_ZERO);
+      return;
+    }
+
+    if (!isShown(column)) {
+      return;
+    }
+
+    if (minMax[beer].get(column) != STORE_INVALID) {
+      TempFixed columnTemps[PROBE_ROLES];
+
+      for (unsigned t=0; t<PROBE_ROLES; t++) {
+        columnTemps[t] = tempFromStoreVal(minMax[t].get(column));
+      }
+
+      drawColumn(columnX(column), columnTemps, powerAt(column));
+    } else {
+      clearColumn(columnX(column));
     }
   }
 
   void plotData(void) {
-    unsigned currentX = barX;
-    float beerTemp;
-    float coolantTemp;
-    float airTemp;
+    PROFILE_SCOPE(ProfilePlotData);
 
     PRINTLN("Plot data");
     PRINTLN(X_PIXELS);
 
-    int x;
-    for (x=0; x < X_PIXELS; x++) {
-      if (storage[beer][x] != 255) {
-        barX = x + X_ZERO;
-        beerTemp = tempFromStoreVal(storage[beer][x]);
-        coolantTemp = tempFromStoreVal(storage[coolant][x]);
-        airTemp = tempFromStoreVal(storage[air][x]);
-        plotPoints(beerTemp, coolantTemp, airTemp, false);
+    if (!isLive()) {
+      plotHistory();
+      return;
+    }
+
+    // Column 0 is under the axis unless the chart scrolls. Empty
+    // columns already show the grid.
+    unsigned x;
+    for (x=isScrolling() ? 0 : 1; x < X_PIXELS; x++) {
+      if (minMax[beer].get(x) != STORE_INVALID) {
+        plotLiveColumn(x);
       }
     }
 
     PRINTVAR(x);
+  }
+
+  void plotHistory(void) {
+    HistoryBucket bucket;
+    TempFixed columnTemps[PROBE_ROLES];
+
+    for (unsigned x=1; x < X_PIXELS; x++) {
+      if (history.query(spanMillis(), X_PIXELS, x, bucket)) {
+        for (unsigned t=0; t<PROBE_ROLES; t++) {
+          columnTemps[t] = tempFromStoreVal(bucket.meanVal[t]);
+        }
 
-    barX = currentX;
+        drawColumn(x + X_ZERO, columnTemps, bucket.powerPercent >= 50);
+      } else {
+        clearColumn(x + X_ZERO);
+      }
+    }
   }
 
-  void updateTemps(unsigned long timestamp, float beerTemp, float coolantTemp, float airTemp, bool powerOn) {
-    unsigned newX = (float)((timestamp-startTime) % chartWidth) / chartWidth * X_PIXELS + X_ZERO;
+  void updateTemps(unsigned long timestamp, const TempFixed *roleTemps, bool powerOn) {
+    PROFILE_SCOPE(ProfileUpdateTemps);
+
+    // Advanced by the time since the last sample, which stays right as
+    // millis() rolls over every 49 days
+    chartOffset = (chartOffset + (timestamp - lastTimestamp)) % chartWidth;
+    lastTimestamp = timestamp;
+
+    unsigned newX = min(chartOffset / columnMillis(), (unsigned long)X_PIXELS - 1) + X_ZERO;
 
-    updateTemp(beer, beerTemp);
-    updateTemp(coolant, coolantTemp);
-    updateTemp(air, airTemp);
+    unsigned long spiBytes = halCounters.spiBytes;
+
+    for (unsigned t=0; t<PROBE_ROLES; t++) {
+      updateTemp((TempType)t, roleTemps[t]);
+    }
+
+    readoutSpiBytes = halCounters.spiBytes - spiBytes;
+    PRINTVAR(readoutSpiBytes);
+
+    updatePower(powerOn);
+    updateHistory(timestamp, roleTemps, powerOn);
+
+    if (isLive() && updateScale()) {
+      startRescale();
+    }
 
     if (newX != barX) {
-      if (barX) {
-        tft.drawLine(barX+1, Y_TOP, barX+1, Y_ZERO-1, COLOR_BLACK);
-      }
+      unsigned oldBarX = barX;
+
+      logColumn();
 
       barX = newX;
-      tft.drawLine(barX+1, Y_TOP, barX+1, Y_ZERO-1, powerOn ? COLOR_RED : COLOR_AZUR);
 
-      plotPoints(beerTemp, coolantTemp, airTemp, powerOn);
+      if (visible && isScrolling()) {
+        scrollChart(oldBarX, roleTemps, powerOn);
+      } else if (visible && isLive()) {
+        if (oldBarX && (oldBarX + 1 != barX || barX <= X_ZERO)) {
+          clearColumn(oldBarX+1);
+        }
+
+        if (barX > X_ZERO) {
+          drawColumn(barX, roleTemps, powerOn);
+        }
+
+        fillColumn(barX+1, powerOn ? COLOR_RED : COLOR_AZUR);
+      }
     }
   }
 
-  unsigned tempToY(float temp) {
-    return Y_ZERO - (unsigned)(temp / (Y_RANGE*10) * (Y_RANGE*Y_10DEG));
-  }
-  
-  void plotPoints(float beerTemp, float coolantTemp, float airTemp, bool powerOn) {
-    if (barX > X_ZERO) {
-      if (powerOn) {
-        tft.drawLine(barX, Y_TOP, barX, Y_ZERO-1, COLOR_DARKRED);
+  // Chart columns are built in a line buffer and sent to the display
+  // with a single address window, rather than a window per pixel.
+  void plotColumnPoint(TempFixed temp, unsigned colour) {
+    if (temp > TEMP_DISCONNECTED) {
+      int y = tempToY(temp);
+
+      if (y >= (int)Y_TOP && y < (int)Y_ZERO) {
+        columnBuffer[y - Y_TOP] = colour;
       }
-      
-      tft.drawPixel(barX, tempToY(beerTemp), temps[beer].colour);
-      tft.drawPixel(barX, tempToY(coolantTemp), temps[coolant].colour);
-      tft.drawPixel(barX, tempToY(airTemp), temps[air].colour);
     }
   }
 
-  byte tempToStoreVal(float temp) {
-    return (byte)(temp * 5.0);
+  void fillBackground(bool powerOn) {
+    unsigned background = powerOn ? COLOR_DARKRED : COLOR_BLACK;
+
+    for (unsigned i=0; i<Y_ZERO-Y_TOP; i++) {
+      columnBuffer[i] = background;
+    }
+
+    for (unsigned i=1; i<=Y_STEPS; i++) {
+      columnBuffer[Y_ZERO - i*Y_STEP - Y_TOP] = GRID_COLOUR;
+    }
+  }
+
+  void drawColumn(unsigned x, const TempFixed *roleTemps, bool powerOn) {
+    fillBackground(powerOn);
+
+    for (unsigned t=0; t<PROBE_ROLES; t++) {
+      plotColumnPoint(roleTemps[t], temps[t].colour);
+    }
+
+    tft.drawColumn(x, Y_TOP, columnBuffer, Y_ZERO-Y_TOP);
+  }
+
+  void clearColumn(unsigned x) {
+    fillBackground(false);
+
+    tft.drawColumn(x, Y_TOP, columnBuffer, Y_ZERO-Y_TOP);
   }
 
-  float tempFromStoreVal(byte val) {
-    return (float)val / 5.0;
+  void fillColumn(unsigned x, unsigned colour) {
+    for (unsigned i=0; i<Y_ZERO-Y_TOP; i++) {
+      columnBuffer[i] = colour;
+    }
+
+    tft.drawColumn(x, Y_TOP, columnBuffer, Y_ZERO-Y_TOP);
   }
 
   void initMinMax(void) {
-    storage[beer] = new byte[X_PIXELS + 1];
-    storage[coolant] = new byte[X_PIXELS + 1];
-    storage[air] = new byte[X_PIXELS + 1];
+    power = new byte[X_PIXELS/8 + 1];
+    memset(power, 0, X_PIXELS/8 + 1);
+
+    columnBuffer = new uint16_t[Y_ZERO-Y_TOP];
+
+    for (unsigned t=0; t<PROBE_ROLES; t++) {
+      minMax[t].init(X_PIXELS + 1);
+    }
+  }
+
+  void updateHistory(unsigned long timestamp, const TempFixed *roleTemps, bool powerOn) {
+    StoreVal vals[PROBE_ROLES];
+
+    for (unsigned t=0; t<PROBE_ROLES; t++) {
+      vals[t] = tempToStoreVal(roleTemps[t]);
+    }
+
+    unsigned closed = history.addSample(timestamp, vals, powerOn);
 
-    for (int i=0; i<X_PIXELS; i++) {
-      storage[beer][i] = storage[coolant][i] = storage[air][i] = 255;
+    if (visible && !isLive() && (closed & (1 << history.tierForSpan(spanMillis())))) {
+      // Rare enough that a rescale just repaints
+      redraw();
     }
   }
 
-  void updateMinMax(TempType type, float temp) {
-    byte minT = 255;
-    byte maxT = 0;
+  unsigned long columnMillis(void) {
+    return chartWidth / X_PIXELS;
+  }
 
-    storage[type][barX - X_ZERO] = min(254, tempToStoreVal(temp));
-    storage[type][barX - X_ZERO + 1] = 255;
-    
-    for (int i=0; i<X_PIXELS; i++) {
-      byte val = storage[type][i];
-      
-      if (val != 255) {
-        if (minT > val)
-          minT = val;
-        if (maxT < val)
-          maxT = val;
+  // Called as the cursor leaves a column, once its values are final
+  void logColumn(void) {
+    if (barX >= X_ZERO) {
+      unsigned column = barX - X_ZERO;
+      StoreVal vals[PROBE_ROLES];
+
+      for (unsigned t=0; t<PROBE_ROLES; t++) {
+        vals[t] = minMax[t].get(column);
       }
+
+      sampleLog.append(vals, powerAt(column));
+    }
+  }
+
+  // Lays the logged columns out oldest first from the left edge, and
+  // backdates the chart so new samples carry on after them.
+  virtual void sampleRestored(const SampleRecord &record) {
+    unsigned column = restored++;
+
+    for (unsigned t=0; t<PROBE_ROLES; t++) {
+      minMax[t].set(column, record.vals[t]);
     }
 
-    minTemp[type] = tempFromStoreVal(minT);
-    maxTemp[type] = tempFromStoreVal(maxT);
+    if (record.powerOn) {
+      power[column / 8] |= 1 << (column % 8);
+    }
+
+    replaySeq = record.seq;
+    history.addSample(startTime + column * columnMillis(), record.vals, record.powerOn);
+  }
+
+  // Keeps the coarse tiers' buckets as they close
+  virtual void bucketClosed(unsigned tier, unsigned channel, const HistoryBucket &bucket) {
+    if (tier > 0) {
+      tierLogs[tier - 1].append(channel, replaySeq ? replaySeq : sampleLog.endSeq(), bucket);
+    }
+  }
+
+  // Where the column 'seq' starts, given the replay starts with column
+  // 'firstSeq' at startTime. Kept to within a bucket of 'tier' before
+  // the replay, so a log older than the sample log's columns can't
+  // make the tier catch up at boot.
+  unsigned long columnStart(unsigned long seq, unsigned long firstSeq, unsigned tier) {
+    seq = min(seq, sampleLog.endSeq());
+
+    if (seq >= firstSeq) {
+      return startTime + (seq - firstSeq) * columnMillis();
+    }
+
+    return startTime - min(firstSeq - seq, history.getBucketMillis(tier) / columnMillis()) * columnMillis();
   }
 
-  void updateTemp(TempType type, float temp) {
-    String tempDisplay;
+  // Puts back each coarse tier's newest buckets from its log, coarsest
+  // first, and starts its open bucket where its last one closed, to
+  // within a column. The finer tier's buckets since then go back in
+  // the coarser one's open bucket, for every vessel; those in the
+  // replayed columns are added by the replay. The other vessels lose
+  // the hour they were in.
+  void restoreTiers(unsigned long firstSeq) {
+    HistoryRecord record;
+    unsigned long coarserSeq = 0;   // Column the coarser tier last closed in
+    bool haveCoarser = false;
+
+    for (unsigned t=HISTORY_TIERS-1; t>0; t--) {
+      HistoryLog &log = tierLogs[t - 1];
+      unsigned long end = log.endSeq();
+      unsigned channel = 0;
+
+      for (unsigned long seq=log.firstSeq(); seq<end; seq++) {
+        // A torn record was the vessel after the one before it
+        if (!log.read(seq, record)) {
+          record.channel = channel;
+          record.bucket.clear();
+        } else if (record.channel >= CHANNELS) {
+          continue;
+        } else if (haveCoarser && record.logSeq > coarserSeq) {
+          history.fold(t + 1, record.channel, record.bucket);
+        }
+
+        if (record.channel == 0) {
+          history.restore(t, record.bucket);
+        }
+
+        channel = (record.channel + 1) % CHANNELS;
+      }
+
+      haveCoarser = log.read(end - 1, record);
+
+      if (haveCoarser) {
+        coarserSeq = record.logSeq;
+        history.resume(t, columnStart(coarserSeq, firstSeq, t));
+      }
+    }
+  }
+
+  void restoreFromLog(void) {
+    sampleLog.init();
+
+    for (unsigned t=1; t<HISTORY_TIERS; t++) {
+      tierLogs[t - 1].init();
+    }
+
+    unsigned count = sampleLog.available(X_PIXELS - 1);
+
+    // Half a column extra keeps the next sample in the column after them
+    startTime -= count * columnMillis() + columnMillis() / 2;
+    history.init(startTime, this);
+    restoreTiers(sampleLog.endSeq() - count);
+    sampleLog.replay(*this, count);
+    replaySeq = 0;
+
+    if (count) {
+      barX = X_ZERO + count;
+    }
+
+    PRINTVAR(count);
+  }
+
+  void updateMinMax(TempType type, TempFixed temp) {
+    PROFILE_SCOPE(ProfileUpdateMinMax);
+
+    if (barX >= X_ZERO) {
+      unsigned column = barX - X_ZERO;
+
+      minMax[type].set(column, tempToStoreVal(temp));
+      minMax[type].set(column + 1, STORE_INVALID);
+    }
+
+    if (minMax[type].getMin() == STORE_INVALID) {
+      minTemp[type] = maxTemp[type] = temp;
+    } else {
+      minTemp[type] = tempFromStoreVal(minMax[type].getMin());
+      maxTemp[type] = tempFromStoreVal(minMax[type].getMax());
+    }
+  }
+
+  bool powerAt(unsigned column) {
+    return power[column / 8] & (1 << (column % 8));
+  }
 
+  void updatePower(bool powerOn) {
+    if (barX >= X_ZERO) {
+      unsigned column = barX - X_ZERO;
+
+      if (powerOn) {
+        power[column / 8] |= 1 << (column % 8);
+      } else {
+        power[column / 8] &= ~(1 << (column % 8));
+      }
+
+      column++;
+      power[column / 8] &= ~(1 << (column % 8));
+    }
+  }
+
+  void updateTemp(TempType type, TempFixed temp) {
     updateMinMax(type, temp);
 
+    if (visible) {
+      drawTemp(type, temp);
+    }
+  }
+
+  void drawTemps(const TempFixed *roleTemps) {
+    for (unsigned t=0; t<PROBE_ROLES; t++) {
+      drawTemp((TempType)t, roleTemps[t]);
+    }
+  }
+
+  // Only characters that differ from the last update are sent
+  void drawTemp(TempType type, TempFixed temp) {
+    char text[24];
+
     tft.setBackgroundColor(COLOR_BLACK);
-    
-    if (temp < 0) {
-      tempDisplay = "Err";
+
+    if (temp <= TEMP_DISCONNECTED) {
+      strcpy(text, "Err");
     } else {
-      tempDisplay = String(temp, 1);
+      formatTenths(text, tempToTenths(temp));
     }
 
     tft.setFont(Terminal11x16);
-    tft.drawText(temps[type].x, 18, tempDisplay, temps[type].colour);
-    tft.fillRectangle(temps[type].x + tft.getTextWidth(tempDisplay), 18, temps[type].end_x, 34, COLOR_BLACK);
+    valueFields[type].update(tft, text, temps[type].colour);
+
+    formatRange(text, tempToTenths(minTemp[type]), tempToTenths(maxTemp[type]), TEMP_RANGE_CHARS);
 
     tft.setFont(Terminal6x8);
-    tft.drawText(temps[type].x, 35, String(minTemp[type], 1) + "/" + String(maxTemp[type], 1) + "  ", temps[type].colour);
+    rangeFields[type].update(tft, text, temps[type].colour);
   }
 
   public:
-  ChartDisplay(TFT_22_ILI9225 &tft)
+  ChartDisplay(HalDisplay &tft)
    : tft(tft),
-     startTime(millis()),
+     power(0),
+     columnBuffer(0),
+     startTime(halMillis()),
+     lastTimestamp(0),
+     chartOffset(0),
      barX(0),
-     storage({0}) {
+     scrollColumn(0),
+     hardwareScroll(false),
+     restored(0),
+     replaySeq(0),
+     visible(false),
+     span(Span12Hours),
+     axisLow(0),
+     axisStep(10 * TEMP_SCALE),
+     rescaleColumn(UINT_MAX),
+     rescaleSpiBytes(0),
+     redrawSpiBytes(0),
+     readoutSpiBytes(0) {
   }
   
   void init(void) {
@@ -200,31 +824,151 @@ class ChartDisplay {
     height = tft.maxY();
 
     initMinMax();
+    initFields();
+
+    unsigned long bootTime = halMillis();
+
+    startTime = bootTime;
+    restoreFromLog();
 
-    startTime = millis();
+    chartOffset = (bootTime - startTime) % chartWidth;
+    lastTimestamp = bootTime;
 
-    addDataPoint(startTime, 20.0, 20.0, 20.0, false);
+    if (!restored) {
+      TempFixed seed[PROBE_ROLES];
+
+      for (unsigned t=0; t<PROBE_ROLES; t++) {
+        seed[t] = 20 * TEMP_SCALE;
+      }
+
+      updateTemps(startTime, seed, false);
+    }
 
     redraw();
+
+    PRINTVAR(halMillis() - bootTime);
+  }
+
+  // Stop drawing while something else owns the screen. Samples are
+  // still recorded and appear on the next redraw().
+  void hide(void) {
+    visible = false;
+
+    tft.clearScroll();
+    hardwareScroll = false;
   }
 
   void redraw(void) {
-    tft.clear();
-    
-    tft.setFont(Terminal12x16);
-    tft.setBackgroundColor(COLOR_BLACK);
+    PROFILE_SCOPE(ProfileRedraw);
+
+    unsigned long spiBytes = halCounters.spiBytes;
+
+    visible = true;
+
+    // The band starts unscrolled with the newest column at its right
+    tft.clearScroll();
+    hardwareScroll = isScrolling() && tft.setScrollArea(SCROLL_X, SCROLL_X + SCROLL_WIDTH - 1);
+    scrollColumn = SCROLL_WIDTH - 1;
 
-    tft.drawText(temps[beer].x, 0, temps[beer].text, temps[beer].colour);
-    tft.drawText(temps[coolant].x, 0, temps[coolant].text, temps[coolant].colour);
-    tft.drawText(temps[air].x, 0, temps[air].text, temps[air].colour);
+    // A full repaint replaces any rescale
+    updateScale();
+    rescaleColumn = UINT_MAX;
 
+    tft.clear();
+
+    initFields();
+    drawHeader();
+    drawGrid();
     drawAxes();
 
-    barX = 0;
     plotData();
+
+    if (barX && isLive() && !isScrolling()) {
+      fillColumn(barX+1, powerAt(barX - X_ZERO) ? COLOR_RED : COLOR_AZUR);
+    }
+
+    redrawSpiBytes = halCounters.spiBytes - spiBytes;
+    PRINTVAR(redrawSpiBytes);
+  }
+
+  unsigned long getRedrawSpiBytes(void) {
+    return redrawSpiBytes;
+  }
+
+  unsigned long getReadoutSpiBytes(void) {
+    return readoutSpiBytes;
+  }
+
+  // Repaints the next few columns after the scale changed; returns
+  // true while there are more
+  bool rescale(void) {
+    PROFILE_SCOPE(ProfileRescale);
+
+    if (rescaleColumn >= plotColumns()) {
+      return false;
+    }
+
+    unsigned end = min(rescaleColumn + RESCALE_COLUMNS, plotColumns());
+    unsigned cursor = barX + 1 - X_ZERO;
+
+    for (; rescaleColumn < end; rescaleColumn++) {
+      if (visible && (isScrolling() || rescaleColumn != cursor)) {
+        plotLiveColumn(rescaleColumn);
+      }
+    }
+
+    if (rescaleColumn == plotColumns()) {
+      PRINTVAR(halCounters.spiBytes - rescaleSpiBytes);
+    }
+
+    return rescaleColumn < plotColumns();
+  }
+
+  SampleLog &getSampleLog(void) {
+    return sampleLog;
   }
 
-  void addDataPoint(unsigned long timestamp, float beerTemp, float coolantTemp, float airTemp, bool powerOn) {
-    updateTemps(timestamp, beerTemp, coolantTemp, airTemp, powerOn);
+  HistoryStore &getHistory(void) {
+    return history;
+  }
+
+  HistoryLog *getTierLogs(void) {
+    return tierLogs;
+  }
+
+  ChartSpan getSpan(void) {
+    return span;
+  }
+
+  // Takes effect on the next redraw()
+  void setSpan(ChartSpan newSpan) {
+    span = newSpan;
+  }
+
+  // Charts and logs one channel's probes
+  void addDataPoint(unsigned long timestamp, const ProbeSamples &samples, unsigned channel, bool powerOn) {
+    TempFixed roleTemps[PROBE_ROLES];
+
+    for (unsigned t=0; t<PROBE_ROLES; t++) {
+      roleTemps[t] = samples.roleTemp(channel, (TempType)t);
+    }
+
+    updateTemps(timestamp, roleTemps, powerOn);
+  }
+
+  // Keeps the coarse history of a vessel that isn't charted, after the
+  // charted one's addDataPoint() for the same samples
+  void addHistoryPoint(const ProbeSamples &samples, unsigned channel, bool powerOn) {
+    StoreVal vals[PROBE_ROLES];
+
+    for (unsigned t=0; t<PROBE_ROLES; t++) {
+      vals[t] = tempToStoreVal(samples.roleTemp(channel, (TempType)t));
+    }
+
+    history.addChannelSample(channel, vals, powerOn);
   }
 };
+
+// 1/16 Deg between gridlines: half a degree up to 40 degrees
+const TempFixed ChartDisplay::scaleSteps[] = { 8, 16, 32, 80, 160, 320, 640 };
+const unsigned ChartDisplay::scaleStepCount = sizeof(ChartDisplay::scaleSteps) / sizeof(ChartDisplay::scaleSteps[0]);
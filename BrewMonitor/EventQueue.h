@@ -0,0 +1,48 @@
+//============================================================
+// Single-producer/single-consumer ring buffer
+//
+// Safe to push from one interrupt priority level and pop from the main
+// loop without disabling interrupts. Holds SIZE-1 events.
+
+template <class T, unsigned SIZE> class EventQueue {
+  private:
+  T events[SIZE];
+  volatile unsigned head;
+  volatile unsigned tail;
+
+  public:
+  EventQueue()
+    : head(0),
+      tail(0) {
+  }
+
+  bool push(const T &event) {
+    unsigned next = (head + 1) % SIZE;
+
+    if (next == tail) {
+      return false;
+    }
+
+    events[head] = event;
+    __sync_synchronize();
+    head = next;
+
+    return true;
+  }
+
+  bool pop(T &event) {
+    if (tail == head) {
+      return false;
+    }
+
+    event = events[tail];
+    __sync_synchronize();
+    tail = (tail + 1) % SIZE;
+
+    return true;
+  }
+
+  bool isEmpty(void) {
+    return tail == head;
+  }
+};
@@ -0,0 +1,713 @@
+#include <TFT_22_ILI9225.h>
+#include <EEPROM.h>
+#include <DallasTemperature.h>
+#if defined(ARDUINO_ARCH_STM32F1) || defined(HAL_HOST)
+  #include <flash_stm32.h>
+#endif
+
+//============================================================
+// Hardware abstraction layer
+//
+// Everything that touches the board (clock, pins, EEPROM, TFT, sensor
+// bus) goes through here, so the rest of the firmware can be built
+// against stand-in implementations and profiled off the board.
+//
+// HAL_HOST is defined by the host build (see CMakeLists.txt), which
+// links the stand-ins in Host/ in place of the board's libraries. The
+// host has flash and a scrolling panel like the board, a virtual clock,
+// and cycles counted in nanoseconds of real time.
+//
+// Define HAL_COUNTERS to count the traffic each call generates. The
+// TFT byte counts are estimates based on the ILI9225 driver's transfer
+// pattern: every address window costs HAL_WINDOW_BYTES and every pixel
+// two bytes.
+
+#define HAL_WINDOW_BYTES 26
+
+class HalCounters {
+  public:
+  unsigned long spiBytes;
+  unsigned long pixels;
+  unsigned long windows;
+  unsigned long eepromReads;
+  unsigned long eepromWrites;
+  unsigned long pinReads;
+  unsigned long pinWrites;
+  unsigned long conversions;
+  unsigned long sensorReads;
+  unsigned long sensorRetries;
+  unsigned long flashErases;
+  unsigned long flashWrites;
+
+  HalCounters() {
+    reset();
+  }
+
+  void reset(void) {
+    spiBytes = pixels = windows = 0;
+    eepromReads = eepromWrites = 0;
+    pinReads = pinWrites = 0;
+    conversions = sensorReads = sensorRetries = 0;
+    flashErases = flashWrites = 0;
+  }
+
+  void print(void) {
+    PRINTVAR(spiBytes);
+    PRINTVAR(pixels);
+    PRINTVAR(windows);
+    PRINTVAR(eepromReads);
+    PRINTVAR(eepromWrites);
+    PRINTVAR(pinReads);
+    PRINTVAR(pinWrites);
+    PRINTVAR(conversions);
+    PRINTVAR(sensorReads);
+    PRINTVAR(sensorRetries);
+    PRINTVAR(flashErases);
+    PRINTVAR(flashWrites);
+  }
+};
+
+HalCounters halCounters;
+
+#ifdef HAL_COUNTERS
+  #define HAL_COUNT(field, n) (halCounters.field += (n))
+#else
+  #define HAL_COUNT(field, n)
+#endif
+
+#ifdef SIMULATE_PLANT
+// The plant simulator runs on a virtual clock and owns the load pins
+unsigned long halSimMillis = 0;
+
+void halSimPinWrite(int pin, int value);
+int16_t halSimProbeRaw(unsigned index);
+#endif
+
+inline unsigned long halMillis(void) {
+#ifdef SIMULATE_PLANT
+  return halSimMillis;
+#else
+  return millis();
+#endif
+}
+
+inline void halDelay(unsigned long ms) {
+#ifdef SIMULATE_PLANT
+  halSimMillis += ms;
+#else
+  delay(ms);
+#endif
+}
+
+// Real time elapsed, for the plant simulator's CPU figures while
+// halMillis() runs on its virtual clock. On the host millis() is
+// virtual too, so this is the host's own monotonic clock.
+inline unsigned long halCpuMillis(void) {
+#ifdef HAL_HOST
+  return hostRealMillis();
+#else
+  return millis();
+#endif
+}
+
+// Cycle counter for profiling. The STM32F1 has the Cortex-M3 DWT
+// counter and the host its monotonic clock; elsewhere cycles are
+// derived from micros(). It wraps every minute or so at 72MHz, so only
+// use it for short intervals.
+#if defined(HAL_HOST)
+  #define HAL_CPU_HZ 1000000000UL
+#elif defined(F_CPU)
+  #define HAL_CPU_HZ F_CPU
+#else
+  #define HAL_CPU_HZ 72000000UL
+#endif
+
+inline void halCyclesInit(void) {
+#ifdef ARDUINO_ARCH_STM32F1
+  *(volatile uint32_t *)0xE000EDFC |= 1UL << 24;   // DEMCR.TRCENA
+  *(volatile uint32_t *)0xE0001004 = 0;            // DWT_CYCCNT
+  *(volatile uint32_t *)0xE0001000 |= 1;           // DWT_CTRL.CYCCNTENA
+#endif
+}
+
+inline uint32_t halCycles(void) {
+#if defined(ARDUINO_ARCH_STM32F1)
+  return *(volatile uint32_t *)0xE0001004;
+#elif defined(HAL_HOST)
+  return hostCycles();
+#else
+  return micros() * (HAL_CPU_HZ / 1000000UL);
+#endif
+}
+
+// Halts the core until the next interrupt. SysTick keeps millis()
+// running, so this returns within a millisecond at most. Call it with
+// interrupts disabled after checking for work: a pending interrupt
+// still ends the wait, so nothing raised after the check is missed.
+inline void halWaitForInterrupt(void) {
+#if defined(ARDUINO_ARCH_STM32F1)
+  asm volatile ("wfi");
+#elif defined(HAL_HOST)
+  hostWaitForInterrupt();
+#endif
+}
+
+inline void halDisableInterrupts(void) {
+  noInterrupts();
+}
+
+inline void halEnableInterrupts(void) {
+  interrupts();
+}
+
+#define HAL_NO_PIN -1
+
+inline int halDigitalRead(int pin) {
+  HAL_COUNT(pinReads, 1);
+  return digitalRead(pin);
+}
+
+inline void halDigitalWrite(int pin, int value) {
+  HAL_COUNT(pinWrites, 1);
+#ifdef SIMULATE_PLANT
+  halSimPinWrite(pin, value);
+#else
+  digitalWrite(pin, value);
+#endif
+}
+
+inline void halPinMode(int pin, int mode) {
+  pinMode(pin, mode);
+}
+
+inline void halAttachInterrupt(int pin, void (*handler)(void), int mode) {
+  attachInterrupt(pin, handler, mode);
+}
+
+//============================================================
+// Serial
+//
+// Non-blocking reads and writes for the telemetry stream and history
+// export: never more than the UART can take without waiting.
+
+inline void halSerialBegin(unsigned long baud) {
+  Serial.begin(baud);
+}
+
+inline unsigned halSerialWritable(void) {
+  return Serial.availableForWrite();
+}
+
+inline unsigned halSerialWrite(const byte *data, unsigned count) {
+  return Serial.write(data, count);
+}
+
+inline bool halSerialAvailable(void) {
+  return Serial.available() > 0;
+}
+
+// -1 when nothing has arrived
+inline int halSerialRead(void) {
+  return Serial.available() ? Serial.read() : -1;
+}
+
+//============================================================
+// Flash
+//
+// Raw access to spare program flash pages, on the board or the host's
+// stand-in; elsewhere flash reads back as erased and writes are
+// dropped. Simulation runs read the real log but never write it.
+//
+// Nothing below halFlashFree() is ever erased or programmed, so a
+// program image that grows into the spare pages is left intact.
+
+#define HAL_FLASH_BASE 0x8000000UL
+#define HAL_FLASH_SIZE (128UL * 1024UL)
+#define HAL_FLASH_PAGE_SIZE 1024
+#define HAL_FLASH_ERASED 0xFFFF
+#define HAL_FLASH_MIN_IMAGE (64UL * 1024UL)   // Never given over to storage
+
+#ifdef ARDUINO_ARCH_STM32F1
+extern "C" char _etext;   // End of code, from the linker script
+#endif
+
+// First whole page past the program image. The linker places the
+// initial values of .data just after _etext, so a page is left spare.
+inline unsigned long halFlashFree(void) {
+#if defined(ARDUINO_ARCH_STM32F1)
+  unsigned long end = (unsigned long)&_etext;
+#elif defined(HAL_HOST)
+  unsigned long end = hostFlashImageEnd;
+#else
+  unsigned long end = HAL_FLASH_BASE + HAL_FLASH_MIN_IMAGE;
+#endif
+
+  return (end / HAL_FLASH_PAGE_SIZE + 2) * HAL_FLASH_PAGE_SIZE;
+}
+
+inline uint16_t halFlashRead(unsigned long addr) {
+#if defined(ARDUINO_ARCH_STM32F1)
+  return *(volatile uint16_t *)addr;
+#elif defined(HAL_HOST)
+  return hostFlashRead(addr);
+#else
+  return HAL_FLASH_ERASED;
+#endif
+}
+
+inline void halFlashErasePage(unsigned long addr) {
+  if (addr < halFlashFree()) {
+    return;
+  }
+
+  HAL_COUNT(flashErases, 1);
+#if (defined(ARDUINO_ARCH_STM32F1) || defined(HAL_HOST)) && !defined(SIMULATE_PLANT)
+  FLASH_Unlock();
+  FLASH_ErasePage(addr);
+  FLASH_Lock();
+#endif
+}
+
+inline void halFlashProgram(unsigned long addr, const uint16_t *data, unsigned count) {
+  if (addr < halFlashFree()) {
+    return;
+  }
+
+  HAL_COUNT(flashWrites, count);
+#if (defined(ARDUINO_ARCH_STM32F1) || defined(HAL_HOST)) && !defined(SIMULATE_PLANT)
+  FLASH_Unlock();
+  for (unsigned i=0; i<count; i++) {
+    FLASH_ProgramHalfWord(addr + 2*i, data[i]);
+  }
+  FLASH_Lock();
+#endif
+}
+
+//============================================================
+// EEPROM
+//
+// The core's EEPROM emulation keeps every address in one of two flash
+// pages, four bytes each, so a pair of the part's 1K pages holds 255
+// addresses: enough for one channel's settings. Each channel gets its
+// own pair, a bank of HAL_EEPROM_BANK_SIZE addresses, stacked down from
+// the top of a 128K part. The first is the core's own EEPROM, where a
+// single channel build has always kept its settings.
+//
+// Each address holds a 16 bit word, written as one entry. The byte
+// calls use the low half, as the sketch always has; the word calls let
+// a store pack two bytes into each entry.
+
+#define HAL_EEPROM_PAGE_SIZE 1024UL
+#define HAL_EEPROM_BANK_SIZE 256
+#define HAL_EEPROM_BANKS CHANNELS
+#define HAL_EEPROM_BANK_BASE(b) (HAL_FLASH_BASE + HAL_FLASH_SIZE - 2UL * HAL_EEPROM_PAGE_SIZE * ((b) + 1))
+#define HAL_EEPROM_BASE HAL_EEPROM_BANK_BASE(HAL_EEPROM_BANKS - 1)
+
+#if (defined(ARDUINO_ARCH_STM32F1) || defined(HAL_HOST)) && CHANNELS > 1
+  #define HAL_EEPROM_BANKED
+#endif
+
+#ifdef HAL_EEPROM_BANKED
+static EEPROMClass halEepromBanks[HAL_EEPROM_BANKS - 1];   // After the core's EEPROM
+#endif
+
+inline void halEepromBegin(void) {
+#ifdef HAL_EEPROM_BANKED
+  for (unsigned b=1; b<HAL_EEPROM_BANKS; b++) {
+    halEepromBanks[b - 1].init(HAL_EEPROM_BANK_BASE(b), HAL_EEPROM_BANK_BASE(b) + HAL_EEPROM_PAGE_SIZE, HAL_EEPROM_PAGE_SIZE);
+  }
+#endif
+}
+
+inline EEPROMClass &halEepromBank(int addr) {
+#ifdef HAL_EEPROM_BANKED
+  unsigned b = addr / HAL_EEPROM_BANK_SIZE;
+
+  if (b > 0 && b < HAL_EEPROM_BANKS) {
+    return halEepromBanks[b - 1];
+  }
+#endif
+
+  return EEPROM;
+}
+
+inline byte halEepromRead(int addr) {
+  HAL_COUNT(eepromReads, 1);
+  return (byte)halEepromBank(addr).read(addr);
+}
+
+inline void halEepromUpdate(int addr, byte value) {
+#ifdef HAL_COUNTERS
+  if ((byte)halEepromBank(addr).read(addr) != value) {
+    HAL_COUNT(eepromWrites, 1);
+  }
+#endif
+#ifndef SIMULATE_PLANT
+  halEepromBank(addr).update(addr, value);
+#endif
+}
+
+inline uint16_t halEepromReadWord(int addr) {
+  HAL_COUNT(eepromReads, 1);
+  return halEepromBank(addr).read(addr);
+}
+
+inline void halEepromUpdateWord(int addr, uint16_t value) {
+#ifdef HAL_COUNTERS
+  if (halEepromBank(addr).read(addr) != value) {
+    HAL_COUNT(eepromWrites, 1);
+  }
+#endif
+#ifndef SIMULATE_PLANT
+  halEepromBank(addr).update(addr, value);
+#endif
+}
+
+//============================================================
+// Probe bus
+//
+// The DS18B20 calls the acquisition engine makes. Under SIMULATE_PLANT
+// the probes are virtual and read the plant model.
+
+#ifndef SIMULATE_PLANT
+
+class HalProbeBus {
+  private:
+  OneWire *ds;
+  DallasTemperature *sensors;
+
+  public:
+  void begin(int pin) {
+    ds = new OneWire(pin);
+    sensors = new DallasTemperature(ds);
+
+    sensors->begin();
+    sensors->setWaitForConversion(false);
+  }
+
+  unsigned getDeviceCount(void) {
+    return sensors->getDeviceCount();
+  }
+
+  bool getAddress(byte *addr, unsigned index) {
+    return sensors->getAddress(addr, index);
+  }
+
+  void setResolution(const byte *addr, byte bits) {
+    sensors->setResolution(addr, bits, true);
+  }
+
+  void startConversion(const byte *addr) {
+    HAL_COUNT(conversions, 1);
+    sensors->requestTemperaturesByAddress(addr);
+  }
+
+  unsigned long conversionMillis(byte bits) {
+    return sensors->millisToWaitForConversion(bits);
+  }
+
+  // False if the probe is missing or the CRC fails
+  bool readScratchPad(const byte *addr, byte *scratchPad) {
+    HAL_COUNT(sensorReads, 1);
+    return sensors->isConnected(addr, scratchPad);
+  }
+};
+
+#else
+
+// Three per channel, up to the 16 a bus can hold
+#define HAL_SIM_PROBES (CHANNELS > 5 ? 16 : 3 * CHANNELS)
+
+class HalProbeBus {
+  public:
+  void begin(int pin) {
+  }
+
+  unsigned getDeviceCount(void) {
+    return HAL_SIM_PROBES;
+  }
+
+  bool getAddress(byte *addr, unsigned index) {
+    static const byte simAddr[7] = { 0x28, 'S', 'I', 'M', 0, 0, 0 };
+
+    memcpy(addr, simAddr, 7);
+    addr[4] = index;
+    addr[7] = OneWire::crc8(addr, 7);
+
+    return index < HAL_SIM_PROBES;
+  }
+
+  void setResolution(const byte *addr, byte bits) {
+  }
+
+  void startConversion(const byte *addr) {
+    HAL_COUNT(conversions, 1);
+  }
+
+  unsigned long conversionMillis(byte bits) {
+    return 750 >> (12 - bits);
+  }
+
+  bool readScratchPad(const byte *addr, byte *scratchPad) {
+    int16_t raw = halSimProbeRaw(addr[4]);
+
+    HAL_COUNT(sensorReads, 1);
+    scratchPad[0] = raw;
+    scratchPad[1] = raw >> 8;
+
+    return true;
+  }
+};
+
+#endif
+
+//============================================================
+// Display
+//
+// Thin wrapper over TFT_22_ILI9225 exposing just what the firmware
+// uses, so a framebuffer-backed stand-in can replace it.
+//
+// The panel can scroll a band of its gate lines, which run along x in
+// the landscape orientations. The driver doesn't expose the scroll
+// registers, so they are written directly over SPI. Builds without the
+// panel, or with HAL_SOFTWARE_SCROLL, report no hardware scroll and
+// the caller repaints instead.
+
+#define HAL_PANEL_LINES 220
+#define HAL_REG_SCROLL_END 0x31
+#define HAL_REG_SCROLL_START 0x32
+#define HAL_REG_SCROLL_AMOUNT 0x33
+
+class HalDisplay {
+  private:
+  TFT_22_ILI9225 tft;
+  int rsPin;
+  int csPin;
+  unsigned orientation;
+  unsigned scrollX;
+  unsigned scrollWidth;   // 0 when not scrolled
+  unsigned scrollOffset;
+
+  private:
+  void countWindows(unsigned long count, unsigned long pixelsEach) {
+    HAL_COUNT(windows, count);
+    HAL_COUNT(pixels, count * pixelsEach);
+    countSpi(count * (HAL_WINDOW_BYTES + 2 * pixelsEach));
+  }
+
+  // The host can charge the transfer to its virtual clock, so a long
+  // draw holds up the other tasks as it does on the board
+  void countSpi(unsigned long bytes) {
+    HAL_COUNT(spiBytes, bytes);
+#ifdef HAL_HOST
+    hostSpiTransfer(bytes);
+#endif
+  }
+
+  void countRect(unsigned x1, unsigned y1, unsigned x2, unsigned y2) {
+    unsigned w = (x2 > x1 ? x2 - x1 : x1 - x2) + 1;
+    unsigned h = (y2 > y1 ? y2 - y1 : y1 - y2) + 1;
+
+    countWindows(1, (unsigned long)w * h);
+  }
+
+  void countLine(unsigned x1, unsigned y1, unsigned x2, unsigned y2) {
+    unsigned dx = x2 > x1 ? x2 - x1 : x1 - x2;
+    unsigned dy = y2 > y1 ? y2 - y1 : y1 - y2;
+
+    // The driver plots lines a pixel at a time
+    countWindows(max(dx, dy) + 1, 1);
+  }
+
+  void writeRegister(uint16_t reg, uint16_t value) {
+    countSpi(4);
+
+    digitalWrite(rsPin, LOW);
+    digitalWrite(csPin, LOW);
+    SPI.transfer(reg >> 8);
+    SPI.transfer(reg);
+    digitalWrite(rsPin, HIGH);
+    SPI.transfer(value >> 8);
+    SPI.transfer(value);
+    digitalWrite(csPin, HIGH);
+  }
+
+  // Orientation 1 runs the gate lines right to left
+  unsigned gateLine(unsigned x) {
+    return orientation == 1 ? HAL_PANEL_LINES - 1 - x : x;
+  }
+
+  bool isScrolled(unsigned x) {
+    return scrollWidth && x >= scrollX && x < scrollX + scrollWidth;
+  }
+
+  // While scrolled, text goes where it will show at x. A character
+  // can't be split across the wrap, so one that would be is moved just
+  // past it.
+  unsigned scrolledX(unsigned x, unsigned width) {
+    unsigned gram = scrollX + (x - scrollX + scrollOffset) % scrollWidth;
+
+    return gram + width > scrollX + scrollWidth ? scrollX : gram;
+  }
+
+  public:
+  HalDisplay(int rst, int rs, int cs, int led, int brightness)
+    : tft(rst, rs, cs, led, brightness),
+      rsPin(rs),
+      csPin(cs),
+      orientation(0),
+      scrollX(0),
+      scrollWidth(0),
+      scrollOffset(0) {
+  }
+
+  void begin(void) {
+    tft.begin();
+  }
+
+  void setOrientation(unsigned orientation) {
+    this->orientation = orientation;
+    tft.setOrientation(orientation);
+  }
+
+  void setBacklight(bool on) {
+    tft.setBacklight(on);
+  }
+
+  void setDisplay(bool on) {
+    tft.setDisplay(on);
+  }
+
+  unsigned maxX(void) {
+    return tft.maxX();
+  }
+
+  unsigned maxY(void) {
+    return tft.maxY();
+  }
+
+  void clear(void) {
+    countRect(0, 0, tft.maxX() - 1, tft.maxY() - 1);
+    tft.clear();
+  }
+
+  void drawPixel(unsigned x, unsigned y, unsigned colour) {
+    countWindows(1, 1);
+    tft.drawPixel(x, y, colour);
+  }
+
+  void drawLine(unsigned x1, unsigned y1, unsigned x2, unsigned y2, unsigned colour) {
+    countLine(x1, y1, x2, y2);
+    tft.drawLine(x1, y1, x2, y2, colour);
+  }
+
+  void drawRectangle(unsigned x1, unsigned y1, unsigned x2, unsigned y2, unsigned colour) {
+    countLine(x1, y1, x2, y1);
+    countLine(x1, y2, x2, y2);
+    countLine(x1, y1, x1, y2);
+    countLine(x2, y1, x2, y2);
+    tft.drawRectangle(x1, y1, x2, y2, colour);
+  }
+
+  void fillRectangle(unsigned x1, unsigned y1, unsigned x2, unsigned y2, unsigned colour) {
+    countRect(x1, y1, x2, y2);
+    tft.fillRectangle(x1, y1, x2, y2, colour);
+  }
+
+  void drawTriangle(unsigned x1, unsigned y1, unsigned x2, unsigned y2, unsigned x3, unsigned y3, unsigned colour) {
+    countLine(x1, y1, x2, y2);
+    countLine(x2, y2, x3, y3);
+    countLine(x3, y3, x1, y1);
+    tft.drawTriangle(x1, y1, x2, y2, x3, y3, colour);
+  }
+
+  // Writes a one pixel wide column in a single burst
+  void drawColumn(unsigned x, unsigned y, uint16_t *pixels, unsigned height) {
+    countWindows(1, height);
+    tft.drawBitmap(x, y, pixels, 1, height);
+  }
+
+  void setBackgroundColor(unsigned colour) {
+    tft.setBackgroundColor(colour);
+  }
+
+  void setFont(uint8_t *font) {
+    tft.setFont(font);
+  }
+
+  _currentFont getFont(void) {
+    return tft.getFont();
+  }
+
+  unsigned drawChar(unsigned x, unsigned y, char ch, unsigned colour) {
+    _currentFont font = tft.getFont();
+
+    if (isScrolled(x)) {
+      // Off the end of the band, which would wrap round to its start
+      if (x + font.width > scrollX + scrollWidth) {
+        return font.width;
+      }
+
+      x = scrolledX(x, font.width);
+    }
+
+    countWindows(1, (unsigned long)font.width * font.height);
+
+    return tft.drawChar(x, y, ch, colour);
+  }
+
+  // Draws a C string a character at a time, spaced as the driver's own
+  // drawText() does, so no String is built on the heap.
+  unsigned drawText(unsigned x, unsigned y, const char *text, unsigned colour) {
+    for (; *text; text++) {
+      x += drawChar(x, y, *text, colour) + 1;
+    }
+
+    return x;
+  }
+
+  // Scrolls screen columns x1 to x2 in hardware, returning false if
+  // the panel can't. Everything but text then addresses the panel's
+  // memory, which setScrollOffset() rotates through the band.
+  bool setScrollArea(unsigned x1, unsigned x2) {
+#if (defined(ARDUINO_ARCH_STM32F1) || defined(HAL_HOST)) && !defined(HAL_SOFTWARE_SCROLL)
+    if (orientation != 1 && orientation != 3) {
+      return false;
+    }
+
+    writeRegister(HAL_REG_SCROLL_END, max(gateLine(x1), gateLine(x2)));
+    writeRegister(HAL_REG_SCROLL_START, min(gateLine(x1), gateLine(x2)));
+
+    scrollX = x1;
+    scrollWidth = x2 - x1 + 1;
+    setScrollOffset(0);
+
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  // Memory column scrollX + offset shows at the left of the band
+  void setScrollOffset(unsigned offset) {
+    if (!scrollWidth) {
+      return;
+    }
+
+    scrollOffset = offset % scrollWidth;
+    writeRegister(HAL_REG_SCROLL_AMOUNT, orientation == 1 ? (scrollWidth - scrollOffset) % scrollWidth : scrollOffset);
+  }
+
+  void clearScroll(void) {
+    if (!scrollWidth) {
+      return;
+    }
+
+    writeRegister(HAL_REG_SCROLL_AMOUNT, 0);
+    writeRegister(HAL_REG_SCROLL_END, HAL_PANEL_LINES - 1);
+    writeRegister(HAL_REG_SCROLL_START, 0);
+
+    scrollWidth = scrollOffset = 0;
+  }
+};
+
@@ -0,0 +1,380 @@
+#define EXPORT_BUFFER 64   // Bytes
+#define EXPORT_RECORD_MAX 27   // Worst case bytes for one record, or a section's end and the next's start
+#define EXPORT_RUN_MAX 126
+#define EXPORT_RUN 0x80
+#define EXPORT_END 0xFF
+#define EXPORT_COMMAND_MAX 24
+#define EXPORT_SEND_POLL 2UL  // Milliseconds while streaming
+
+//============================================================
+// Bulk history export
+//
+// Sending "EXPORT" over serial streams the 4 hour and hour buckets
+// of every vessel from their logs, then the first vessel's chart
+// columns from the sample log, each oldest first. Together they cover
+// the last two weeks and more. "EXPORT <section> <seq>" starts from
+// that section and sequence number instead, so a host that lost the
+// link can resume after the last record it got.
+// Tools/history_export.cpp drives this and writes the series out.
+//
+// The stream is
+//
+//   "BMX2", sections...
+//
+// and each section
+//
+//   section, first sequence number (varint), records..., end
+//
+// Sections are numbered by history tier, 2 the 4 hour buckets, 1 the
+// hour buckets and 0 the columns, and always come in that order.
+//
+// A bucket record is the vessel, a varint count of torn records
+// skipped since the previous one, a zigzag varint delta from the
+// previous record's sample log column, zigzag varint deltas from its
+// means, then bytes for each probe's spread below and above and the
+// power.
+//
+// A column record is a flags byte: bit 0 the power state, bits 1-3 set
+// for each probe value that changed, followed by a zigzag varint delta
+// from the previous record for each changed value. A byte of
+// EXPORT_RUN | n repeats the previous record's deltas and power n more
+// times.
+//
+// EXPORT_END is followed by the section's record count (varint) and a
+// CCITT CRC-16 of its decoded records, little endian field by field
+// in the order above, the sequence number first for buckets.
+//
+// Records are encoded a few at a time into a fixed buffer and sent as
+// the UART accepts them, so an export never blocks the other tasks.
+// Torn buckets are skipped, but the columns stop early at one that
+// can't be read. The CRC covers one section, so a resumed export is
+// checked from where it resumed.
+
+class HistoryExport {
+  private:
+  SampleLog &sampleLog;
+  HistoryLog *tierLogs;
+
+  char command[EXPORT_COMMAND_MAX + 1];
+  unsigned commandLength;
+
+  byte buffer[EXPORT_BUFFER];
+  unsigned used;
+  unsigned sent;
+
+  bool busy;
+  bool finished;
+  unsigned section;
+  unsigned long nextSeq;
+  unsigned long endSeq;
+  unsigned long count;
+  uint16_t crc;
+
+  StoreVal last[PROBE_ROLES];
+  int16_t lastDelta[PROBE_ROLES];
+  bool lastPower;
+  bool haveRecord;
+  unsigned run;
+  unsigned long lastSeq;
+  unsigned long lastLogSeq;
+
+  private:
+  void put(byte b) {
+    buffer[used++] = b;
+  }
+
+  void putVarint(unsigned long v) {
+    while (v >= 0x80) {
+      put(v | 0x80);
+      v >>= 7;
+    }
+
+    put(v);
+  }
+
+  void putZigzag(int16_t delta) {
+    putVarint((uint16_t)((uint16_t)delta << 1 ^ (uint16_t)(delta >> 15)));
+  }
+
+  void updateCrc(byte b) {
+    crc ^= (uint16_t)b << 8;
+
+    for (unsigned i=0; i<8; i++) {
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+
+  void updateCrc32(unsigned long v) {
+    for (unsigned i=0; i<4; i++) {
+      updateCrc(v >> (8 * i));
+    }
+  }
+
+  void flushRun(void) {
+    if (run) {
+      put(EXPORT_RUN | run);
+      run = 0;
+    }
+  }
+
+  void encode(const SampleRecord &record) {
+    int16_t delta[PROBE_ROLES];
+    bool repeat = haveRecord && record.powerOn == lastPower;
+
+    for (unsigned t=0; t<PROBE_ROLES; t++) {
+      delta[t] = (int16_t)(record.vals[t] - last[t]);
+      repeat = repeat && delta[t] == lastDelta[t];
+
+      updateCrc(record.vals[t]);
+      updateCrc(record.vals[t] >> 8);
+      last[t] = record.vals[t];
+    }
+
+    updateCrc(record.powerOn);
+    count++;
+
+    if (repeat) {
+      if (++run == EXPORT_RUN_MAX) {
+        flushRun();
+      }
+
+      return;
+    }
+
+    flushRun();
+
+    byte flags = record.powerOn ? 1 : 0;
+
+    for (unsigned t=0; t<PROBE_ROLES; t++) {
+      if (delta[t]) {
+        flags |= 2 << t;
+      }
+    }
+
+    put(flags);
+
+    for (unsigned t=0; t<PROBE_ROLES; t++) {
+      if (delta[t]) {
+        putZigzag(delta[t]);
+      }
+
+      lastDelta[t] = delta[t];
+    }
+
+    lastPower = record.powerOn;
+    haveRecord = true;
+  }
+
+  void encode(const HistoryRecord &record) {
+    const HistoryBucket &bucket = record.bucket;
+    int32_t logDelta = (int32_t)(record.logSeq - lastLogSeq);
+
+    put(record.channel);
+    putVarint(record.seq - lastSeq);
+    putVarint((uint32_t)logDelta << 1 ^ (uint32_t)(logDelta >> 31));
+    updateCrc32(record.seq);
+    updateCrc(record.channel);
+    updateCrc32(record.logSeq);
+
+    for (unsigned t=0; t<PROBE_ROLES; t++) {
+      putZigzag((int16_t)(bucket.meanVal[t] - last[t]));
+      updateCrc(bucket.meanVal[t]);
+      updateCrc(bucket.meanVal[t] >> 8);
+      last[t] = bucket.meanVal[t];
+    }
+
+    for (unsigned t=0; t<PROBE_ROLES; t++) {
+      put(bucket.belowMean[t]);
+      updateCrc(bucket.belowMean[t]);
+    }
+
+    for (unsigned t=0; t<PROBE_ROLES; t++) {
+      put(bucket.aboveMean[t]);
+      updateCrc(bucket.aboveMean[t]);
+    }
+
+    put(bucket.powerPercent);
+    updateCrc(bucket.powerPercent);
+    lastSeq = record.seq + 1;
+    lastLogSeq = record.logSeq;
+    count++;
+  }
+
+  void startSection(unsigned tier, unsigned long fromSeq) {
+    SampleRecord record;
+    unsigned long span = SAMPLE_LOG_RECORDS + SAMPLE_LOG_BATCH;
+
+    section = tier;
+
+    if (section) {
+      endSeq = tierLogs[section - 1].endSeq();
+      nextSeq = min(max(fromSeq, tierLogs[section - 1].firstSeq()), endSeq);
+    } else {
+      endSeq = sampleLog.endSeq();
+
+      unsigned long oldest = endSeq > span ? endSeq - span : 1;
+
+      nextSeq = min(max(fromSeq, oldest), endSeq);
+
+      // Skip records lost to the page erased as the log wrapped
+      while (nextSeq < endSeq && !sampleLog.read(nextSeq, record)) {
+        nextSeq++;
+      }
+    }
+
+    count = 0;
+    crc = 0xFFFF;
+    memset(last, 0, sizeof(last));
+    haveRecord = false;
+    run = 0;
+    lastSeq = nextSeq;
+    lastLogSeq = 0;
+
+    put(section);
+    putVarint(nextSeq);
+
+    PRINTVAR(section);
+    PRINTVAR(nextSeq);
+    PRINTVAR(endSeq);
+  }
+
+  void endSection(void) {
+    flushRun();
+    put(EXPORT_END);
+    putVarint(count);
+    put(crc);
+    put(crc >> 8);
+
+    if (section) {
+      startSection(section - 1, 0);
+    } else {
+      finished = true;
+    }
+  }
+
+  void start(unsigned tier, unsigned long fromSeq) {
+    used = sent = 0;
+    busy = true;
+    finished = false;
+
+    put('B');
+    put('M');
+    put('X');
+    put('2');
+    startSection(tier, fromSeq);
+  }
+
+  // Returns false at the end of the section
+  bool fillSection(void) {
+    if (section) {
+      HistoryRecord record;
+
+      // Skip torn buckets, the sequence numbers say where
+      while (nextSeq < endSeq && !tierLogs[section - 1].read(nextSeq, record)) {
+        nextSeq++;
+      }
+
+      if (nextSeq == endSeq) {
+        return false;
+      }
+
+      encode(record);
+    } else {
+      SampleRecord record;
+
+      if (nextSeq == endSeq || !sampleLog.read(nextSeq, record)) {
+        return false;
+      }
+
+      encode(record);
+    }
+
+    nextSeq++;
+
+    return true;
+  }
+
+  void fill(void) {
+    while (!finished && EXPORT_BUFFER - used >= EXPORT_RECORD_MAX) {
+      if (!fillSection()) {
+        endSection();
+      }
+    }
+  }
+
+  // Returns the number of bytes the UART took
+  unsigned send(void) {
+    unsigned written = halSerialWrite(buffer + sent, min(used - sent, halSerialWritable()));
+
+    sent += written;
+
+    if (sent == used) {
+      used = sent = 0;
+      busy = !finished;
+    }
+
+    return written;
+  }
+
+  void readCommand(void) {
+    int c;
+
+    while ((c = halSerialRead()) >= 0) {
+      if (c != '\n' && c != '\r') {
+        if (commandLength < EXPORT_COMMAND_MAX) {
+          command[commandLength++] = c;
+        }
+
+        continue;
+      }
+
+      command[commandLength] = 0;
+      commandLength = 0;
+
+      if (!strncmp(command, "EXPORT", 6) && (!command[6] || command[6] == ' ')) {
+        char *seq;
+        unsigned long tier = strtoul(command + 6, &seq, 10);
+
+        if (seq == command + 6) {
+          start(HISTORY_TIERS - 1, 0);
+        } else {
+          start(min(tier, (unsigned long)HISTORY_TIERS - 1), strtoul(seq, 0, 10));
+        }
+
+        return;
+      }
+    }
+  }
+
+  public:
+  HistoryExport(SampleLog &sampleLog, HistoryLog *tierLogs)
+    : sampleLog(sampleLog),
+      tierLogs(tierLogs),
+      commandLength(0),
+      used(0),
+      sent(0),
+      busy(false),
+      finished(true) {
+  }
+
+  bool isBusy(void) {
+    return busy;
+  }
+
+  // Run as a task, woken when serial input arrives; returns
+  // milliseconds until it next wants to run
+  unsigned long poll(void) {
+    // A new command restarts an export already running
+    readCommand();
+
+    while (busy) {
+      fill();
+
+      if (!send()) {
+        break;
+      }
+    }
+
+    return busy ? EXPORT_SEND_POLL : TASK_WAIT;
+  }
+};
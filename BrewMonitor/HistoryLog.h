@@ -0,0 +1,201 @@
+#define HISTORY_LOG_RECORD_WORDS 12
+#define HISTORY_LOG_RECORD_SIZE (HISTORY_LOG_RECORD_WORDS * 2)
+#define HISTORY_LOG_PAGE_RECORDS (HAL_FLASH_PAGE_SIZE / HISTORY_LOG_RECORD_SIZE)
+#define HISTORY_LOG_ERASED 0xFFFFFFFFUL
+
+// A tier's bucket ring for each of up to 'vessels' vessels, plus the
+// page erased as the log wraps. Past that the vessels share it: with
+// eight, the hour log keeps nearly two days and the 4 hour log over
+// two weeks.
+#define HISTORY_LOG_VESSELS(vessels) (CHANNELS < (vessels) ? CHANNELS : (vessels))
+#define HISTORY_LOG_PAGES(buckets, vessels) \
+  (((buckets) * HISTORY_LOG_VESSELS(vessels) + HISTORY_LOG_PAGE_RECORDS - 1) / HISTORY_LOG_PAGE_RECORDS + 1)
+#define HISTORY_TIER1_LOG_PAGES HISTORY_LOG_PAGES(HISTORY_TIER1_BUCKETS, 2)
+#define HISTORY_TIER2_LOG_PAGES HISTORY_LOG_PAGES(HISTORY_TIER2_BUCKETS, 4)
+// Just below the sample log
+#define HISTORY_TIER2_LOG_BASE (SAMPLE_LOG_BASE - HISTORY_TIER2_LOG_PAGES * HAL_FLASH_PAGE_SIZE)
+#define HISTORY_TIER1_LOG_BASE (HISTORY_TIER2_LOG_BASE - HISTORY_TIER1_LOG_PAGES * HAL_FLASH_PAGE_SIZE)
+
+static_assert(HISTORY_TIER1_LOG_BASE >= HAL_FLASH_BASE + HAL_FLASH_MIN_IMAGE, "History logs leave too little flash for the program");
+static_assert(HISTORY_PROBES == 3, "History log records have room for three probes");
+
+class HistoryRecord {
+  public:
+  unsigned long seq;
+  unsigned long logSeq;   // Sample log column being filled as it closed
+  byte channel;
+  HistoryBucket bucket;
+};
+
+//============================================================
+// Persistent history tier
+//
+// A circular, append-only log in spare flash of the buckets one
+// HistoryStore tier closed, so the tier survives a restart. Each record
+// carries a sequence number, the sample log column it closed in, which
+// places it against the replayed columns at boot, the vessel, and a
+// CRC. Every vessel's bucket is written as the tier closes, first
+// vessel first. A page is erased just before the log wraps into it.
+//
+// A record is written as its bucket closes, once an hour at most, so
+// the log is a few pages and boot scans every record for the newest
+// rather than searching for it. A torn record keeps its sequence
+// number, so the records either side of it are still found by theirs.
+
+class HistoryLog {
+  private:
+  unsigned long base;
+  unsigned pages;
+  unsigned nextIndex;
+  unsigned long nextSeq;
+  int newest;
+  bool usable;
+
+  private:
+  unsigned records(void) {
+    return pages * HISTORY_LOG_PAGE_RECORDS;
+  }
+
+  // Records don't straddle pages, so each page has a few bytes spare
+  unsigned long recordAddr(unsigned index) {
+    return base + (unsigned long)(index / HISTORY_LOG_PAGE_RECORDS) * HAL_FLASH_PAGE_SIZE +
+           (index % HISTORY_LOG_PAGE_RECORDS) * HISTORY_LOG_RECORD_SIZE;
+  }
+
+  unsigned long readSeq(unsigned index) {
+    unsigned long addr = recordAddr(index);
+
+    return (unsigned long)halFlashRead(addr) | (unsigned long)halFlashRead(addr + 2) << 16;
+  }
+
+  byte crc(const uint16_t *words) {
+    return OneWire::crc8((const uint8_t *)words, (HISTORY_LOG_RECORD_WORDS - 1) * 2);
+  }
+
+  void pack(const HistoryRecord &record, uint16_t *words) {
+    words[0] = record.seq;
+    words[1] = record.seq >> 16;
+    words[2] = record.logSeq;
+    words[3] = record.logSeq >> 16;
+
+    for (unsigned p=0; p<HISTORY_PROBES; p++) {
+      words[4 + p] = record.bucket.meanVal[p];
+      words[7 + p] = record.bucket.belowMean[p] | record.bucket.aboveMean[p] << 8;
+    }
+
+    words[10] = record.bucket.powerPercent | record.channel << 8;
+    words[11] = crc(words);
+  }
+
+  bool readRecord(unsigned index, HistoryRecord &record) {
+    uint16_t words[HISTORY_LOG_RECORD_WORDS];
+    unsigned long addr = recordAddr(index);
+
+    for (unsigned i=0; i<HISTORY_LOG_RECORD_WORDS; i++) {
+      words[i] = halFlashRead(addr + 2*i);
+    }
+
+    record.seq = (unsigned long)words[0] | (unsigned long)words[1] << 16;
+    record.logSeq = (unsigned long)words[2] | (unsigned long)words[3] << 16;
+
+    for (unsigned p=0; p<HISTORY_PROBES; p++) {
+      record.bucket.meanVal[p] = words[4 + p];
+      record.bucket.belowMean[p] = words[7 + p];
+      record.bucket.aboveMean[p] = words[7 + p] >> 8;
+    }
+
+    record.bucket.powerPercent = words[10];
+    record.channel = words[10] >> 8;
+
+    return record.seq != HISTORY_LOG_ERASED && words[11] == crc(words);
+  }
+
+  public:
+  HistoryLog(unsigned long base, unsigned pages)
+    : base(base),
+      pages(pages),
+      nextIndex(0),
+      nextSeq(1),
+      newest(-1),
+      usable(false) {
+  }
+
+  void init(void) {
+    HistoryRecord record;
+
+    if (base < halFlashFree()) {
+      PRINTLN(F("History log overlaps the program"));
+      return;
+    }
+
+    usable = true;
+
+    for (unsigned i=0; i<records(); i++) {
+      if (readRecord(i, record) && (newest < 0 || record.seq >= nextSeq)) {
+        newest = i;
+        nextSeq = record.seq + 1;
+      }
+    }
+
+    if (newest < 0) {
+      return;
+    }
+
+    nextIndex = (newest + 1) % records();
+
+    // Step over a record torn by a power cut; the next page is erased
+    // before it is written anyway
+    while (nextIndex % HISTORY_LOG_PAGE_RECORDS && readSeq(nextIndex) != HISTORY_LOG_ERASED) {
+      nextIndex = (nextIndex + 1) % records();
+      nextSeq++;
+    }
+
+    PRINTVAR(newest);
+    PRINTVAR(nextSeq);
+  }
+
+  // Sequence number the next appended record will get
+  unsigned long endSeq(void) {
+    return nextSeq;
+  }
+
+  // Oldest sequence number the log could still hold
+  unsigned long firstSeq(void) {
+    return nextSeq > records() ? nextSeq - records() : 1;
+  }
+
+  // Reads a record by sequence number. False once it has been
+  // overwritten, or if it is torn or corrupt.
+  bool read(unsigned long seq, HistoryRecord &record) {
+    if (newest < 0 || seq >= nextSeq || nextSeq - seq > records()) {
+      return false;
+    }
+
+    unsigned index = (nextIndex + records() - (nextSeq - seq)) % records();
+
+    return readRecord(index, record) && record.seq == seq;
+  }
+
+  void append(unsigned channel, unsigned long logSeq, const HistoryBucket &bucket) {
+    uint16_t words[HISTORY_LOG_RECORD_WORDS];
+    HistoryRecord record;
+
+    if (!usable) {
+      return;
+    }
+
+    if (nextIndex % HISTORY_LOG_PAGE_RECORDS == 0) {
+      halFlashErasePage(recordAddr(nextIndex));
+    }
+
+    record.seq = nextSeq++;
+    record.logSeq = logSeq;
+    record.channel = channel;
+    record.bucket = bucket;
+    pack(record, words);
+    halFlashProgram(recordAddr(nextIndex), words, HISTORY_LOG_RECORD_WORDS);
+
+    newest = nextIndex;
+    nextIndex = (nextIndex + 1) % records();
+  }
+};
@@ -0,0 +1,399 @@
+#define HISTORY_PROBES PROBE_ROLES
+#define HISTORY_TIERS 3
+#define HISTORY_SPREAD_MAX 255
+
+//============================================================
+// Multi-resolution temperature history
+//
+// Samples are summarised into fixed-size rings of buckets, each tier
+// coarser than the last. When a bucket closes it is folded into the
+// next tier's open bucket, so every tier keeps the min, max and mean
+// of its period without holding raw samples. Everything lives in
+// fixed arrays sized below.
+//
+// Buckets hold the mean as a full StoreVal and the min and max as
+// 8-bit distances below and above it, saturating at 255 steps. That is
+// 14 bytes a bucket with padding, about 6.9 KB for the three tiers.
+//
+// RAM is lost at a restart, so the coarse tiers' closed buckets are
+// handed to a HistoryWriter to keep, and put back with restore() and
+// resume() at boot; the finest tier is rebuilt from the sample log.
+//
+// The rings are the first vessel's. The others keep only an open
+// bucket per tier, about 130 bytes a vessel, closed along with the
+// first vessel's and handed straight to the writer.
+
+#define HISTORY_TIER0_BUCKETS 144   // 12 hours of 5 minutes
+#define HISTORY_TIER0_MILLIS (5UL*60UL*1000UL)
+#define HISTORY_TIER1_BUCKETS 168   // 7 days of 1 hour
+#define HISTORY_TIER1_MILLIS (60UL*60UL*1000UL)
+#define HISTORY_TIER2_BUCKETS 180   // 30 days of 4 hours
+#define HISTORY_TIER2_MILLIS (4UL*60UL*60UL*1000UL)
+
+class HistoryBucket {
+  public:
+  StoreVal meanVal[HISTORY_PROBES];
+  byte belowMean[HISTORY_PROBES];
+  byte aboveMean[HISTORY_PROBES];
+  byte powerPercent;
+
+  bool isValid(void) {
+    for (unsigned p=0; p<HISTORY_PROBES; p++) {
+      if (meanVal[p] != STORE_INVALID) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  StoreVal getMin(unsigned probe) {
+    return meanVal[probe] == STORE_INVALID ? STORE_INVALID : meanVal[probe] - belowMean[probe];
+  }
+
+  StoreVal getMax(unsigned probe) {
+    return meanVal[probe] == STORE_INVALID ? STORE_INVALID : meanVal[probe] + aboveMean[probe];
+  }
+
+  void clear(void) {
+    for (unsigned p=0; p<HISTORY_PROBES; p++) {
+      set(p, STORE_INVALID, STORE_INVALID, STORE_INVALID);
+    }
+
+    powerPercent = 0;
+  }
+
+  void set(unsigned probe, StoreVal lo, StoreVal hi, StoreVal mean) {
+    meanVal[probe] = mean;
+
+    if (mean == STORE_INVALID) {
+      belowMean[probe] = aboveMean[probe] = 0;
+    } else {
+      belowMean[probe] = min(HISTORY_SPREAD_MAX, mean - lo);
+      aboveMean[probe] = min(HISTORY_SPREAD_MAX, hi - mean);
+    }
+  }
+};
+
+class HistoryAccumulator {
+  private:
+  unsigned long sum[HISTORY_PROBES];
+  unsigned count[HISTORY_PROBES];
+  StoreVal minVal[HISTORY_PROBES];
+  StoreVal maxVal[HISTORY_PROBES];
+  unsigned long powerSum;
+  unsigned powerCount;
+
+  private:
+  void add(unsigned probe, StoreVal lo, StoreVal hi, StoreVal mean) {
+    if (mean != STORE_INVALID) {
+      sum[probe] += mean;
+      count[probe]++;
+      minVal[probe] = min(minVal[probe], lo);
+      maxVal[probe] = max(maxVal[probe], hi);
+    }
+  }
+
+  public:
+  HistoryAccumulator() {
+    clear();
+  }
+
+  void clear(void) {
+    for (unsigned p=0; p<HISTORY_PROBES; p++) {
+      sum[p] = count[p] = 0;
+      minVal[p] = STORE_INVALID;
+      maxVal[p] = 0;
+    }
+
+    powerSum = powerCount = 0;
+  }
+
+  void addSample(const StoreVal *vals, bool powerOn) {
+    for (unsigned p=0; p<HISTORY_PROBES; p++) {
+      add(p, vals[p], vals[p], vals[p]);
+    }
+
+    powerSum += powerOn ? 100 : 0;
+    powerCount++;
+  }
+
+  void addBucket(HistoryBucket &bucket) {
+    if (!bucket.isValid()) {
+      return;
+    }
+
+    for (unsigned p=0; p<HISTORY_PROBES; p++) {
+      add(p, bucket.getMin(p), bucket.getMax(p), bucket.meanVal[p]);
+    }
+
+    powerSum += bucket.powerPercent;
+    powerCount++;
+  }
+
+  void getBucket(HistoryBucket &bucket) {
+    for (unsigned p=0; p<HISTORY_PROBES; p++) {
+      bucket.set(p, minVal[p], maxVal[p], count[p] ? (sum[p] + count[p] / 2) / count[p] : STORE_INVALID);
+    }
+
+    bucket.powerPercent = powerCount ? powerSum / powerCount : 0;
+  }
+};
+
+class HistoryWriter {
+  public:
+  virtual void bucketClosed(unsigned tier, unsigned channel, const HistoryBucket &bucket) { };
+};
+
+class HistoryTier {
+  private:
+  HistoryBucket *buckets;
+  unsigned size;
+  unsigned head;
+  unsigned filled;
+  unsigned long bucketStart;
+
+  public:
+  unsigned long bucketMillis;
+  HistoryAccumulator open;
+
+  public:
+  void init(HistoryBucket *storage, unsigned bucketCount, unsigned long millis, unsigned long start) {
+    buckets = storage;
+    size = bucketCount;
+    bucketMillis = millis;
+    bucketStart = start;
+    head = filled = 0;
+    open.clear();
+  }
+
+  unsigned long getSpan(void) {
+    return size * bucketMillis;
+  }
+
+  unsigned getSize(void) {
+    return size;
+  }
+
+  unsigned getFilled(void) {
+    return filled;
+  }
+
+  unsigned long getBucketStart(void) {
+    return bucketStart;
+  }
+
+  // Starts the open bucket at the last boundary at or before 'start',
+  // with boundaries a whole number of buckets from 'boundary'
+  void align(unsigned long start, unsigned long boundary) {
+    long offset = (long)(start - boundary) % (long)bucketMillis;
+
+    bucketStart = start - (offset < 0 ? offset + bucketMillis : offset);
+  }
+
+  // Signed, as a restored tier's open bucket can start after the first
+  // columns replayed into the finer tiers
+  bool isDue(unsigned long timestamp) {
+    return (long)(timestamp - bucketStart) >= (long)bucketMillis;
+  }
+
+  HistoryBucket &close(void) {
+    HistoryBucket &bucket = buckets[head];
+
+    open.getBucket(bucket);
+    open.clear();
+    advance();
+    bucketStart += bucketMillis;
+
+    return bucket;
+  }
+
+  // Puts back a bucket closed before a restart, oldest first
+  void restore(const HistoryBucket &bucket) {
+    buckets[head] = bucket;
+    advance();
+  }
+
+  void advance(void) {
+    head = (head + 1) % size;
+    filled = min(filled + 1, size);
+  }
+
+  // Age 0 is the most recently closed bucket
+  HistoryBucket *getBucket(unsigned age) {
+    if (age >= filled) {
+      return 0;
+    }
+
+    return &buckets[(head + size - 1 - age) % size];
+  }
+};
+
+class HistoryStore {
+  private:
+  HistoryBucket storage[HISTORY_TIER0_BUCKETS + HISTORY_TIER1_BUCKETS + HISTORY_TIER2_BUCKETS];
+  HistoryTier tiers[HISTORY_TIERS];
+  HistoryWriter *writer;
+  unsigned long origin;   // Where init() started the tiers
+#if CHANNELS > 1
+  HistoryAccumulator others[CHANNELS - 1][HISTORY_TIERS];   // The other vessels' open buckets
+#endif
+
+  private:
+  // Closes the other vessels' buckets of 'tier' with the first's
+  void closeOthers(unsigned tier, bool fold) {
+#if CHANNELS > 1
+    for (unsigned c=1; c<CHANNELS; c++) {
+      HistoryBucket bucket;
+
+      others[c - 1][tier].getBucket(bucket);
+      others[c - 1][tier].clear();
+
+      if (fold) {
+        others[c - 1][tier + 1].addBucket(bucket);
+      }
+
+      if (writer) {
+        writer->bucketClosed(tier, c, bucket);
+      }
+    }
+#endif
+  }
+
+  public:
+  HistoryStore()
+    : writer(0),
+      origin(0) {
+  }
+
+  void init(unsigned long start, HistoryWriter *closedWriter = 0) {
+    tiers[0].init(storage, HISTORY_TIER0_BUCKETS, HISTORY_TIER0_MILLIS, start);
+    tiers[1].init(storage + HISTORY_TIER0_BUCKETS, HISTORY_TIER1_BUCKETS, HISTORY_TIER1_MILLIS, start);
+    tiers[2].init(storage + HISTORY_TIER0_BUCKETS + HISTORY_TIER1_BUCKETS, HISTORY_TIER2_BUCKETS, HISTORY_TIER2_MILLIS, start);
+    writer = closedWriter;
+    origin = start;
+
+#if CHANNELS > 1
+    for (unsigned c=1; c<CHANNELS; c++) {
+      for (unsigned t=0; t<HISTORY_TIERS; t++) {
+        others[c - 1][t].clear();
+      }
+    }
+#endif
+  }
+
+  // Returns a bit per tier that closed a bucket
+  unsigned addSample(unsigned long timestamp, const StoreVal *vals, bool powerOn) {
+    unsigned closed = 0;
+
+    for (unsigned t=0; t<HISTORY_TIERS; t++) {
+      while (tiers[t].isDue(timestamp)) {
+        unsigned long closedStart = tiers[t].getBucketStart();
+        HistoryBucket &bucket = tiers[t].close();
+
+        // One from before the next tier's open bucket is already in a
+        // bucket that tier restored
+        bool fold = t + 1 < HISTORY_TIERS && (long)(closedStart - tiers[t + 1].getBucketStart()) >= 0;
+
+        if (fold) {
+          tiers[t + 1].open.addBucket(bucket);
+        }
+
+        if (writer) {
+          writer->bucketClosed(t, 0, bucket);
+        }
+
+        closeOthers(t, fold);
+
+        closed |= 1 << t;
+      }
+    }
+
+    tiers[0].open.addSample(vals, powerOn);
+
+    return closed;
+  }
+
+  // Adds a sample for a vessel other than the first, after the first
+  // vessel's at the same time
+  void addChannelSample(unsigned channel, const StoreVal *vals, bool powerOn) {
+#if CHANNELS > 1
+    others[channel - 1][0].addSample(vals, powerOn);
+#endif
+  }
+
+  // Appends a bucket closed before a restart to 'tier', oldest first
+  void restore(unsigned tier, const HistoryBucket &bucket) {
+    tiers[tier].restore(bucket);
+  }
+
+  // Adds a restored bucket to a vessel's open one of 'tier'
+  void fold(unsigned tier, unsigned channel, HistoryBucket &bucket) {
+#if CHANNELS > 1
+    if (channel) {
+      others[channel - 1][tier].addBucket(bucket);
+      return;
+    }
+#endif
+
+    tiers[tier].open.addBucket(bucket);
+  }
+
+  // Starts the open bucket of 'tier' at 'start', when its last bucket
+  // closed, and lines the finer tiers' boundaries up with it. Called
+  // coarsest first, before any samples.
+  void resume(unsigned tier, unsigned long start) {
+    tiers[tier].align(start, start);
+
+    for (unsigned t=0; t<tier; t++) {
+      tiers[t].align(origin, start);
+    }
+  }
+
+  unsigned getSize(unsigned tier) {
+    return tiers[tier].getSize();
+  }
+
+  unsigned long getBucketMillis(unsigned tier) {
+    return tiers[tier].bucketMillis;
+  }
+
+  // Age 0 is the tier's most recently closed bucket
+  HistoryBucket *getBucket(unsigned tier, unsigned age) {
+    return tiers[tier].getBucket(age);
+  }
+
+  // Finest tier that covers the whole span
+  unsigned tierForSpan(unsigned long span) {
+    for (unsigned t=0; t<HISTORY_TIERS; t++) {
+      if (tiers[t].getSpan() >= span) {
+        return t;
+      }
+    }
+
+    return HISTORY_TIERS - 1;
+  }
+
+  // Summarises one of 'columns' equal slices of the last 'span'
+  // milliseconds, column 0 being the oldest. Only the closed buckets
+  // of a single tier are visited.
+  bool query(unsigned long span, unsigned columns, unsigned column, HistoryBucket &out) {
+    HistoryTier &tier = tiers[tierForSpan(span)];
+    unsigned long buckets = max(1UL, span / tier.bucketMillis);
+    unsigned newest = (columns - column - 1) * buckets / columns;
+    unsigned oldest = (columns - column) * buckets / columns;
+    HistoryAccumulator merged;
+
+    for (unsigned age = newest; age < max(oldest, newest + 1); age++) {
+      HistoryBucket *bucket = tier.getBucket(age);
+
+      if (bucket) {
+        merged.addBucket(*bucket);
+      }
+    }
+
+    merged.getBucket(out);
+
+    return out.isValid();
+  }
+};
@@ -1,25 +1,8 @@
-#include <EEPROM.h>
-
 template <class T> void eeGet(int ee,T& value) {
-#ifdef ARDUINO_ARCH_STM32F1
   byte* p=(byte*)&value;
   unsigned int i;
   for(i=0;i<sizeof(value);i++)
-    *p++=EEPROM.read(ee++);
-#else
-  EEPROM.get(ee, value);
-#endif
-}
-
-template <class T> void eePut(int ee,T& value) {
-#ifdef ARDUINO_ARCH_STM32F1
-  const byte* p=(const byte*)&value;
-  unsigned int i;
-  for(i=0;i<sizeof(value);i++)
-    EEPROM.update(ee++,*p++);
-#else
-  EEPROM.put(ee, value);
-#endif
+    *p++=halEepromRead(ee++);
 }
 
 class LoadController {
@@ -34,11 +17,22 @@ class LoadController {
     Off
   } PowerControl;
 
+  // Faulted while the beer probe reads as disconnected; the load is
+  // held off until it reads again
   typedef enum {
     Active,
-    Idle
+    Idle,
+    Faulted
   } State;
 
+  // How the load is driven: on/off around the band with a duty cycle,
+  // time-proportioned by PID, or relay cycling to tune the PID
+  typedef enum {
+    Band,
+    Pid,
+    Autotune
+  } ControlStrategy;
+
   private:
   class Settings {
     private:
@@ -52,18 +46,80 @@ class LoadController {
     unsigned allowedRange;
     unsigned powerControlDutyCycleOn;
     unsigned powerControlDutyCycleOff;
+    ControlStrategy strategy;
+    PidGains gains;
+
+    private:
+    SettingsStore *store;
 
+    public:
     Settings()
       : controlMode(Cooling),
         targetTemp(29),
         allowedRange(2),
         powerControlDutyCycleOn(30),
-        powerControlDutyCycleOff(30) {
+        powerControlDutyCycleOff(30),
+        strategy(Band),
+        store(0) {
+      gains.kp = 1000;
+      gains.ki = 100;
+      gains.kd = 1000;
     }
 
-    void load(void) {
-      if (EEPROM.read(GUARD_ADDR) == GUARD_VALUE) {
+    // Only the first channel existed before the settings store
+    void load(SettingsStore &settingsStore, bool legacy) {
+      store = &settingsStore;
+
+      if (store->isFormatted()) {
         PRINTLN(F("LC Loading"));
+
+        unsigned long value;
+
+        if (store->get(SettingControlMode, value))
+          controlMode = (ControlMode)value;
+        if (store->get(SettingTargetTemp, value))
+          targetTemp = value;
+        if (store->get(SettingTempRange, value))
+          allowedRange = value;
+        if (store->get(SettingDutyCycleOn, value))
+          powerControlDutyCycleOn = value;
+        if (store->get(SettingDutyCycleOff, value))
+          powerControlDutyCycleOff = value;
+        if (store->get(SettingControlStrategy, value))
+          strategy = (ControlStrategy)value;
+        if (store->get(SettingPidKp, value))
+          gains.kp = value;
+        if (store->get(SettingPidKi, value))
+          gains.ki = value;
+        if (store->get(SettingPidKd, value))
+          gains.kd = value;
+      } else {
+        if (legacy) {
+          loadLegacy();
+        }
+        save();
+      }
+    }
+    
+    // Only changed values reach the store, which coalesces and
+    // commits them later.
+    void save(void) {
+      store->set(SettingControlMode, controlMode);
+      store->set(SettingTargetTemp, targetTemp);
+      store->set(SettingTempRange, allowedRange);
+      store->set(SettingDutyCycleOn, powerControlDutyCycleOn);
+      store->set(SettingDutyCycleOff, powerControlDutyCycleOff);
+      store->set(SettingControlStrategy, strategy == Autotune ? Pid : strategy);
+      store->set(SettingPidKp, gains.kp);
+      store->set(SettingPidKi, gains.ki);
+      store->set(SettingPidKd, gains.kd);
+    }
+
+    private:
+    // Settings written by firmware before the settings store
+    void loadLegacy(void) {
+      if (halEepromRead(GUARD_ADDR) == GUARD_VALUE) {
+        PRINTLN(F("LC Loading legacy"));
         
         int addr = DATA_ADDR;
         
@@ -80,49 +136,109 @@ class LoadController {
         PRINTLN(F("LC No guard"));
       }
     }
-    
-    void save(void) {
-      int addr = DATA_ADDR;
-      
-      eePut(addr, controlMode);
-      addr += sizeof(controlMode);
-      eePut(addr, targetTemp);
-      addr += sizeof(targetTemp);
-      eePut(addr, allowedRange);
-      addr += sizeof(allowedRange);
-      eePut(addr, powerControlDutyCycleOn);
-      addr += sizeof(powerControlDutyCycleOn);
-      eePut(addr, powerControlDutyCycleOff);
-      eePut(GUARD_ADDR, GUARD_VALUE);
-    }
   };
 
   private:
   Settings settings;
 
+  unsigned channel;
   State state;
   PowerControl powerControl;
   int controlPinOn;
   int controlPinOff;
   unsigned long powerControlStartTime;
+
+  PidController pid;
+  RelayAutotune autotune;
+  unsigned long windowStart;
+  unsigned long windowOn;   // Milliseconds on in this window
+  int pidOutput;
   
   public:
   LoadController()
-    : state(Idle) {
+    : channel(0),
+      state(Idle),
+      windowStart(0),
+      windowOn(0),
+      pidOutput(0) {
   }
 
-  void init(int onPin, int offPin) {
+  // The off pin may be HAL_NO_PIN
+  void init(unsigned index, int onPin, int offPin, SettingsStore &store) {
+    channel = index;
+
     initialisePowerControl(onPin, offPin);
     setIdle();
-    initialiseSettings();
+    initialiseSettings(store);
+    restartWindow();
   }
 
-  void check(float beerTemp) {
+  void check(const ProbeSamples &samples) {
+    PROFILE_SCOPE(ProfileControl);
+
+    TempFixed beerTemp = samples.roleTemp(channel, beer);
+
     PRINT(F("LC Check"));
     PRINTVAR(beerTemp);
-    
-    if (!updateState(beerTemp))
-      updatePowerControl(beerTemp);
+
+    if (beerTemp <= TEMP_DISCONNECTED) {
+      setFaulted();
+      return;
+    }
+
+    if (state == Faulted) {
+      recover();
+    }
+
+    switch (settings.strategy) {
+      case Pid:
+        updatePid(beerTemp);
+        break;
+      case Autotune:
+        updateAutotune(beerTemp);
+        break;
+      default:
+        if (!updateState(beerTemp))
+          updatePowerControl(beerTemp);
+        break;
+    }
+  }
+
+  ControlStrategy getStrategy(void) {
+    return settings.strategy;
+  }
+
+  // Autotune runs until it has gains, then switches to PID
+  void setStrategy(ControlStrategy strategy) {
+    if (strategy == settings.strategy) {
+      return;
+    }
+
+    settings.strategy = strategy;
+    pid.reset();
+    restartWindow();
+
+    if (strategy == Autotune) {
+      autotune.start(halMillis());
+    }
+
+    setIdle();
+    setPowerControlOff();
+    settings.save();
+  }
+
+  const PidGains &getPidGains(void) {
+    return settings.gains;
+  }
+
+  void setPidGains(const PidGains &gains) {
+    settings.gains = gains;
+    settings.save();
+  }
+
+  // Per mille, while under PID
+  int getPidOutput(void) {
+    return pidOutput;
   }
 
   ControlMode getControlMode(void) {
@@ -175,19 +291,19 @@ class LoadController {
   }
   
   void setPowerControlOn(void) {
-    digitalWrite(controlPinOn, HIGH);
+    halDigitalWrite(controlPinOn, HIGH);
     
     powerControl = Energised;
-    powerControlStartTime = millis();
+    powerControlStartTime = halMillis();
     
     PRINTLN(F("LC Power on"));
   }
   
   void setPowerControlOff(void) {
-    digitalWrite(controlPinOn, LOW);
+    halDigitalWrite(controlPinOn, LOW);
     
     powerControl = Off;
-    powerControlStartTime = millis();
+    powerControlStartTime = halMillis();
     
     PRINTLN(F("LC Power off"));
   }
@@ -201,22 +317,29 @@ class LoadController {
     controlPinOn = onPin;
     controlPinOff = offPin;
 
-    digitalWrite(controlPinOn, LOW);
-    digitalWrite(controlPinOff, LOW);
-    pinMode(controlPinOn, OUTPUT);
-    pinMode(controlPinOff, OUTPUT);
+    halDigitalWrite(controlPinOn, LOW);
+    halPinMode(controlPinOn, OUTPUT);
+
+    if (controlPinOff != HAL_NO_PIN) {
+      halDigitalWrite(controlPinOff, LOW);
+      halPinMode(controlPinOff, OUTPUT);
+    }
     
     setPowerControlOff();
   }
 
-  void initialiseSettings(void) {
-    settings.load();
+  void initialiseSettings(SettingsStore &store) {
+    settings.load(store, channel == 0);
   
     PRINTVAR(settings.controlMode);
     PRINTVAR(settings.targetTemp);
     PRINTVAR(settings.allowedRange);
     PRINTVAR(settings.powerControlDutyCycleOn);
     PRINTVAR(settings.powerControlDutyCycleOff);
+    PRINTVAR(settings.strategy);
+    PRINTVAR(settings.gains.kp);
+    PRINTVAR(settings.gains.ki);
+    PRINTVAR(settings.gains.kd);
   }
 
   void setIdle() {
@@ -231,23 +354,125 @@ class LoadController {
     state = Active;
   }
 
-  bool goalSatisfied(float beerTemp) {
+  // Also forces the load off again if the menu switched it on
+  void setFaulted(void) {
+    if (state != Faulted) {
+      PRINTLN(F("LC Faulted"));
+      state = Faulted;
+    }
+
+    pidOutput = 0;
+
+    if (powerControl == Energised) {
+      setPowerControlOff();
+    }
+  }
+
+  // The gap in readings would upset the PID terms and any autotune
+  // cycle, so both start over
+  void recover(void) {
+    PRINTLN(F("LC Recovered"));
+
+    setIdle();
+    pid.reset();
+    restartWindow();
+
+    if (settings.strategy == Autotune) {
+      autotune.start(halMillis());
+    }
+  }
+
+  // 1/16 Deg the beer is on the side of the target the load corrects
+  long demand(TempFixed beerTemp) {
+    long target = (long)settings.targetTemp * TEMP_SCALE;
+
+    return settings.controlMode == Heating ? target - beerTemp : beerTemp - target;
+  }
+
+  void driveLoad(bool on) {
+    if (on && powerControl != Energised) {
+      setActive();
+      setPowerControlOn();
+    } else if (!on && powerControl == Energised) {
+      setIdle();
+      setPowerControlOff();
+    }
+  }
+
+  // The next PID pass opens a window
+  void restartWindow(void) {
+    windowStart = halMillis() - PID_WINDOW;
+  }
+
+  // The output is time-proportioned over PID_WINDOW. The on time is
+  // fixed as each window opens, so the relay switches at most twice per
+  // window and never for a short pulse.
+  void updatePid(TempFixed beerTemp) {
+    unsigned long now = halMillis();
+
+    pidOutput = pid.update(settings.gains, demand(beerTemp), now);
+
+    if (now - windowStart >= PID_WINDOW) {
+      windowStart = now;
+      windowOn = (unsigned long)pidOutput * (PID_WINDOW / PID_OUTPUT_MAX);
+
+      if (windowOn < PID_MIN_PULSE) {
+        windowOn = 0;
+      } else if (PID_WINDOW - windowOn < PID_MIN_PULSE) {
+        windowOn = PID_WINDOW;
+      }
+    }
+
+    PRINTVAR(pidOutput);
+
+    driveLoad(now - windowStart < windowOn);
+  }
+
+  void updateAutotune(TempFixed beerTemp) {
+    PidGains gains;
+
+    switch (autotune.update(demand(beerTemp), halMillis(), gains)) {
+      case RelayAutotune::Done:
+        PRINTLN(F("LC Autotune done"));
+        settings.gains = gains;
+        setStrategy(Pid);
+        break;
+      case RelayAutotune::Failed:
+        PRINTLN(F("LC Autotune failed"));
+        setStrategy(Band);
+        break;
+      default:
+        driveLoad(autotune.isLoadOn());
+        break;
+    }
+  }
+
+  // Target and range are whole degrees
+  TempFixed upperLimit(void) {
+    return settings.targetTemp * TEMP_SCALE + settings.allowedRange * TEMP_SCALE / 2;
+  }
+
+  TempFixed lowerLimit(void) {
+    return settings.targetTemp * TEMP_SCALE - settings.allowedRange * TEMP_SCALE / 2;
+  }
+
+  bool goalSatisfied(TempFixed beerTemp) {
     if (settings.controlMode == Heating) {
-      return beerTemp >= (float)settings.targetTemp + (float)settings.allowedRange / 2.0;
+      return beerTemp >= upperLimit();
     } else {
-      return beerTemp <= (float)settings.targetTemp - (float)settings.allowedRange / 2.0;
+      return beerTemp <= lowerLimit();
     }
   }
   
-  bool limitBreached(float beerTemp) {
+  bool limitBreached(TempFixed beerTemp) {
     if (settings.controlMode == Heating) {
-      return beerTemp < (float)settings.targetTemp - (float)settings.allowedRange / 2.0;
+      return beerTemp < lowerLimit();
     } else {
-      return beerTemp > (float)settings.targetTemp + (float)settings.allowedRange / 2.0;
+      return beerTemp > upperLimit();
     }
   }
   
-  bool updateState(float beerTemp) {
+  bool updateState(TempFixed beerTemp) {
     if (state == Active) {
       if (goalSatisfied(beerTemp)) {
         setIdle();
@@ -265,14 +490,14 @@ class LoadController {
     return false;
   }
 
-  void updatePowerControl(float beerTemp) {
+  void updatePowerControl(TempFixed beerTemp) {
     if (state == Active) {
       if (powerControl == Energised) {
-        if ((millis() - powerControlStartTime >= settings.powerControlDutyCycleOn * 1000) && (settings.powerControlDutyCycleOff > 0)) {
+        if ((halMillis() - powerControlStartTime >= settings.powerControlDutyCycleOn * 1000) && (settings.powerControlDutyCycleOff > 0)) {
           setPowerControlOff();
         }
       } else {
-        if (millis() - powerControlStartTime >= settings.powerControlDutyCycleOff * 1000) {
+        if (halMillis() - powerControlStartTime >= settings.powerControlDutyCycleOff * 1000) {
           setPowerControlOn();
         }
       }
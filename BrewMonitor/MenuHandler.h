@@ -2,172 +2,155 @@
 
 #define NUMITEMS(items) (sizeof(items)/sizeof(char*))
 
-static const char *menuItems[] = { "Mode", "Target Temp", "Temp Range", "On Off", "Power Control" };
+//======================================================
+// The menu tree
+//
+// Declared once as static data. Each leaf menu carries the value its
+// items stand for, so a selection is passed straight to the matching
+// setter without parsing the display text.
+
+#if CHANNELS > 1
+static const char *menuItems[] = { "Mode", "Control", "Target Temp", "Temp Range", "On Off", "Power Control", "Chart", "Vessel" };
+static const char *vesselSubItems[] = { "1", "2", "3", "4", "5", "6", "7", "8" };
+static const int vesselValues[] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+#else
+static const char *menuItems[] = { "Mode", "Control", "Target Temp", "Temp Range", "On Off", "Power Control", "Chart" };
+#endif
 static const char *modeSubItems[] = { "Heating", "Cooling" };
+static const char *controlSubItems[] = { "Band", "PID", "Autotune" };
 static const char *targetTempSubItems[] = { "15", "16", "17", "18", "19", "20", "21", "22", "23", "24", "25" };
 static const char *tempRangeSubItems[] = { "1", "2", "3", "4", "5" };
 static const char *dutyCycleSubItems[] = { "On", "Off" };
 static const char *dutyCycleOnSubItems[] = { "15", "30", "60", "90", "120", "180", "240", "300" };
 static const char *dutyCycleOffSubItems[] = { "0", "30", "60", "90", "120", "180", "240", "300" };
 static const char *powerControlSubItems[] = { "On", "Off" };
+static const char *chartSpanSubItems[] = { "12h", "7d", "30d", "8h scroll" };
+
+static const int modeValues[] = { LoadController::Heating, LoadController::Cooling };
+static const int controlValues[] = { LoadController::Band, LoadController::Pid, LoadController::Autotune };
+static const int targetTempValues[] = { 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25 };
+static const int tempRangeValues[] = { 1, 2, 3, 4, 5 };
+static const int dutyCycleOnValues[] = { 15, 30, 60, 90, 120, 180, 240, 300 };
+static const int dutyCycleOffValues[] = { 0, 30, 60, 90, 120, 180, 240, 300 };
+static const int powerControlValues[] = { LoadController::Energised, LoadController::Off };
+static const int chartSpanValues[] = { ChartDisplay::Span12Hours, ChartDisplay::Span7Days, ChartDisplay::Span30Days, ChartDisplay::Span8HoursScroll };
+
+static Menu modeMenu(modeSubItems, NUMITEMS(modeSubItems), modeValues);
+static Menu controlMenu(controlSubItems, NUMITEMS(controlSubItems), controlValues);
+static Menu targetTempMenu(targetTempSubItems, NUMITEMS(targetTempSubItems), targetTempValues);
+static Menu tempRangeMenu(tempRangeSubItems, NUMITEMS(tempRangeSubItems), tempRangeValues);
+static Menu dutyCycleOnMenu(dutyCycleOnSubItems, NUMITEMS(dutyCycleOnSubItems), dutyCycleOnValues);
+static Menu dutyCycleOffMenu(dutyCycleOffSubItems, NUMITEMS(dutyCycleOffSubItems), dutyCycleOffValues);
+static Menu powerControlMenu(powerControlSubItems, NUMITEMS(powerControlSubItems), powerControlValues);
+static Menu chartSpanMenu(chartSpanSubItems, NUMITEMS(chartSpanSubItems), chartSpanValues);
+#if CHANNELS > 1
+static Menu vesselMenu(vesselSubItems, CHANNELS, vesselValues);
+#endif
+
+static Menu *const dutyCycleSubMenus[] = { &dutyCycleOnMenu, &dutyCycleOffMenu };
+static Menu dutyCycleMenu(dutyCycleSubItems, NUMITEMS(dutyCycleSubItems), 0, dutyCycleSubMenus);
+
+#if CHANNELS > 1
+static Menu *const mainSubMenus[] = { &modeMenu, &controlMenu, &targetTempMenu, &tempRangeMenu, &dutyCycleMenu, &powerControlMenu, &chartSpanMenu, &vesselMenu };
+#else
+static Menu *const mainSubMenus[] = { &modeMenu, &controlMenu, &targetTempMenu, &tempRangeMenu, &dutyCycleMenu, &powerControlMenu, &chartSpanMenu };
+#endif
+static Menu mainMenu(menuItems, NUMITEMS(menuItems), 0, mainSubMenus);
 
 class MenuHandler : public MenuCallback {
   private:
   MenuDisplay menuDisplay;
-  LoadController *loadControl;
-  Menu *menu;
-  Menu *modeSub;
-  Menu *targetTempSub;
-  Menu *tempRangeSub;
-  Menu *dutyCycleSub;
-  Menu *dutyCycleOnSub;
-  Menu *dutyCycleOffSub;
-  Menu *powerControlSub;
+  Channel *channels;
+  unsigned vessel;
+  LoadController *loadControl;   // The vessel the settings menus change
+  ChartDisplay *chartDisplay;
 
   private:
-  void handleModeSelection(const char *selected) {
-    if (strcmp(selected, modeSubItems[0]) == 0) {
-      loadControl->setControlMode(LoadController::Heating);
-    } else {
-      loadControl->setControlMode(LoadController::Cooling);
-    }
-  }
-
-  void handleTargetTempSelection(const char *selected) {
-    loadControl->setTargetTemp((unsigned)atoi(selected));
-  }
-
-  void handleTempRangeSelection(const char *selected) {
-    loadControl->setTempRange((unsigned)atoi(selected));
-  }
-
-  void handleDutyCycleOnSelection(const char *selected) {
-    loadControl->setDutyCycleOn((unsigned)atoi(selected));
-  }
-
-  void handleDutyCycleOffSelection(const char *selected) {
-    loadControl->setDutyCycleOff((unsigned)atoi(selected));
-  }
-
-  void handlePowerControlSelection(const char *selected) {
-    if (strcmp(selected, powerControlSubItems[0]) == 0) {
-      loadControl->setPowerControlOn();
-    } else {
-      loadControl->setPowerControlOff();
-    }
-  }
-
-  int findEntry(int val, const char **list, unsigned count) {
-    for (int i=0; i<count; i++) {
-      if (val <= atoi(list[i])) {
-        return i;
-      }
-    }
-
-    return -1;
-  }
-
-  void initSelectedMode(void) {
-    modeSub->setSelectedIndex(loadControl->getControlMode() == LoadController::Heating ? 0 : 1);
+  void selectValues(void) {
+    modeMenu.setSelectedValue(loadControl->getControlMode());
+    controlMenu.setSelectedValue(loadControl->getStrategy());
+    targetTempMenu.setSelectedValue(loadControl->getTargetTemp());
+    tempRangeMenu.setSelectedValue(loadControl->getTempRange());
+    dutyCycleOnMenu.setSelectedValue(loadControl->getDutyCycleOn());
+    dutyCycleOffMenu.setSelectedValue(loadControl->getDutyCycleOff());
+    powerControlMenu.setSelectedValue(loadControl->getPowerControlState());
+    chartSpanMenu.setSelectedValue(chartDisplay->getSpan());
+#if CHANNELS > 1
+    vesselMenu.setSelectedValue(vessel);
+#endif
   }
 
-  void initSelectedTargetTemp(void) {
-    unsigned targetTemp = loadControl->getTargetTemp();
-    int index;
-
-    if ((index = findEntry(targetTemp, targetTempSubItems, NUMITEMS(targetTempSubItems))) >= 0) {
-        targetTempSub->setSelectedIndex(index);
-    }
+  public:
+  MenuHandler(HalDisplay &tft, Channel *channels, ChartDisplay &cd)
+  : menuDisplay(tft),
+    channels(channels),
+    vessel(0),
+    loadControl(&channels[0].control),
+    chartDisplay(&cd) {
+    modeMenu.addCallback(this);
+    controlMenu.addCallback(this);
+    targetTempMenu.addCallback(this);
+    tempRangeMenu.addCallback(this);
+    dutyCycleOnMenu.addCallback(this);
+    dutyCycleOffMenu.addCallback(this);
+    powerControlMenu.addCallback(this);
+    chartSpanMenu.addCallback(this);
+#if CHANNELS > 1
+    vesselMenu.addCallback(this);
+#endif
   }
+  
+  void presentMenu(void) {
+    mainMenu.setSelectedIndex(-1);
+    dutyCycleMenu.setSelectedIndex(-1);
+    selectValues();
 
-  void initTempRange(void) {
-    unsigned tempRange = loadControl->getTempRange();
-    int index;
-
-    if ((index = findEntry(tempRange, tempRangeSubItems, NUMITEMS(tempRangeSubItems))) >= 0) {
-        tempRangeSub->setSelectedIndex(index);
-    }
+    menuDisplay.presentMenu(&mainMenu);
   }
 
-  void initDutyCycleOn(void) {
-    unsigned cycle = loadControl->getDutyCycleOn();
-    int index;
-
-    if ((index = findEntry(cycle, dutyCycleOnSubItems, NUMITEMS(dutyCycleOnSubItems))) >= 0) {
-        dutyCycleOnSub->setSelectedIndex(index);
-    }
+  bool isOpen(void) {
+    return menuDisplay.isOpen() && !menuDisplay.timedOut();
   }
 
-  void initDutyCycleOff(void) {
-    unsigned cycle = loadControl->getDutyCycleOff();
-    int index;
-
-    if ((index = findEntry(cycle, dutyCycleOffSubItems, NUMITEMS(dutyCycleOffSubItems))) >= 0) {
-        dutyCycleOffSub->setSelectedIndex(index);
-    }
+  void close(void) {
+    menuDisplay.close();
   }
 
-  void initPowerControl(void) {
-    powerControlSub->setSelectedIndex(loadControl->getPowerControlState() == LoadController::Energised ? 0 : 1);
+  void buttonPressed(Buttons button) {
+    menuDisplay.buttonPressed(button);
   }
 
-  public:
-  MenuHandler(TFT_22_ILI9225 &tft, ButtonController &buttons, LoadController &lc)
-  : menuDisplay(tft, buttons),
-    loadControl(&lc) {
-    menu = new Menu(menuItems, NUMITEMS(menuItems));
-    modeSub = new Menu(modeSubItems, NUMITEMS(modeSubItems), this);
-    targetTempSub = new Menu(targetTempSubItems, NUMITEMS(targetTempSubItems), this);
-    tempRangeSub = new Menu(tempRangeSubItems, NUMITEMS(tempRangeSubItems), this);
-    dutyCycleSub = new Menu(dutyCycleSubItems, NUMITEMS(dutyCycleSubItems));
-    dutyCycleOnSub = new Menu(dutyCycleOnSubItems, NUMITEMS(dutyCycleOnSubItems), this);
-    dutyCycleOffSub = new Menu(dutyCycleOffSubItems, NUMITEMS(dutyCycleOffSubItems), this);
-    powerControlSub = new Menu(powerControlSubItems, NUMITEMS(powerControlSubItems), this);
-    menu->addSubMenu(0, modeSub);
-    menu->addSubMenu(1, targetTempSub);
-    menu->addSubMenu(2, tempRangeSub);
-    menu->addSubMenu(3, dutyCycleSub);
-    menu->addSubMenu(4, powerControlSub);
-    dutyCycleSub->addSubMenu(0, dutyCycleOnSub);
-    dutyCycleSub->addSubMenu(1, dutyCycleOffSub);
-  }
-  
-  virtual ~MenuHandler()
-  {
-    delete menu;
-    delete modeSub;
-    delete targetTempSub;
-    delete tempRangeSub;
-    delete dutyCycleSub;
-    delete dutyCycleOnSub;
-    delete dutyCycleOffSub;
-    delete powerControlSub;
-  }
-  
-  void presentMenu(void) {
-    initSelectedMode();
-    initSelectedTargetTemp();
-    initTempRange();
-    initDutyCycleOn();
-    initDutyCycleOff();
-    initPowerControl();
-
-    menuDisplay.presentMenu(menu);
+  unsigned long getKeySpiBytes(void) {
+    return menuDisplay.getKeySpiBytes();
   }
 
-  virtual void itemSelected(Menu *menu, const char *selected) {
-    if (menu == modeSub) {
-      handleModeSelection(selected);
-    } else if (menu == targetTempSub) {
-      handleTargetTempSelection(selected);
-    } else if (menu == tempRangeSub) {
-      handleTempRangeSelection(selected);
-    } else if (menu == dutyCycleOnSub) {
-      handleDutyCycleOnSelection(selected);
-    } else if (menu == dutyCycleOffSub) {
-      handleDutyCycleOffSelection(selected);
-    } else if (menu == powerControlSub) {
-      handlePowerControlSelection(selected);
+  virtual void itemSelected(Menu *menu, int value) {
+    if (menu == &modeMenu) {
+      loadControl->setControlMode((LoadController::ControlMode)value);
+    } else if (menu == &controlMenu) {
+      loadControl->setStrategy((LoadController::ControlStrategy)value);
+    } else if (menu == &targetTempMenu) {
+      loadControl->setTargetTemp(value);
+    } else if (menu == &tempRangeMenu) {
+      loadControl->setTempRange(value);
+    } else if (menu == &dutyCycleOnMenu) {
+      loadControl->setDutyCycleOn(value);
+    } else if (menu == &dutyCycleOffMenu) {
+      loadControl->setDutyCycleOff(value);
+    } else if (menu == &powerControlMenu) {
+      if (value == LoadController::Energised) {
+        loadControl->setPowerControlOn();
+      } else {
+        loadControl->setPowerControlOff();
+      }
+    } else if (menu == &chartSpanMenu) {
+      chartDisplay->setSpan((ChartDisplay::ChartSpan)value);
+#if CHANNELS > 1
+    } else if (menu == &vesselMenu) {
+      vessel = value;
+      loadControl = &channels[vessel].control;
+      selectValues();
+#endif
     }
   }
 };
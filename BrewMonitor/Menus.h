@@ -1,5 +1,3 @@
-#include <TFT_22_ILI9225.h>
-
 #define TLX 10
 #define TLY 10
 #define WIDTH (screenWidth-20)
@@ -16,61 +14,124 @@
 #define ROW_X_PAD 3
 #define ROW_Y_PAD 5
 
-#define MAX_CALLBACKS 5
+#define MAX_CALLBACKS 2   // The handler and the display
+#define MAX_MENU_DEPTH 4
+
+#define MENU_TIMEOUT 20000UL  // Milliseconds
 
 #define SELECTED_VALUE_MAX_LEN 16
+#define MENU_ROW_MAX_LEN 32
+
+// Where and how every menu level is drawn; one is shared by the tree
+struct MenuLayout {
+  HalDisplay *tft;
+  unsigned rowCount;
+  unsigned drawX;
+  unsigned drawY;
+  unsigned rowSpace;
+  unsigned rowWidth;
+  unsigned rowHeight;
+  unsigned drawColour;
+};
 
 class MenuCallback {
   public:
-  virtual void itemSelected(class Menu *menu, const char *selected) { };
+  virtual void itemSelected(class Menu *menu, int value) { };
   virtual void subMenuSelected(class Menu *menu, class Menu *subMenu) { };
 };
 
+//======================================================
+// A menu level
+//
+// The item names, the value each item stands for and the submenu
+// links are static arrays, so the whole tree is declared once and
+// opening a menu allocates nothing. Only the cursor and selection
+// live in the Menu itself. Items without a value array stand for
+// their own index. The draw geometry is shared by every level.
+//
+// The summary of a menu's selections shown in its parent's row is
+// kept until a selection below it changes, and rows are formatted in
+// a fixed buffer.
+
 class Menu {
   private:
   
   const char **items;
+  const int *values;
+  Menu *const *subMenus;
+  Menu *parent;
   unsigned itemCount;
   unsigned activeItem;
   int selectedItem;
   MenuCallback *callbacks[MAX_CALLBACKS];
-  Menu **subMenus;
   char selectedValue[SELECTED_VALUE_MAX_LEN + 1];
+  bool selectedValueValid;
 
-  TFT_22_ILI9225 *tft;
-  unsigned rowCount;
-  unsigned drawX;
-  unsigned drawY;
-  unsigned rowSpace;
-  unsigned rowWidth;
-  unsigned rowHeight;
-  unsigned drawColour;
+  const MenuLayout *layout;
   unsigned topIndex;
 
   private:
+  Menu *subMenu(unsigned index) {
+    return subMenus ? subMenus[index] : 0;
+  }
+
+  int valueAt(unsigned index) {
+    return values ? values[index] : (int)index;
+  }
+
+  // Scrolls the window to the active item, returning true if it moved
+  bool moveViewWindow(void) {
+    unsigned rowCount = layout ? layout->rowCount : UINT_MAX;
+
+    if (activeItem < topIndex) {
+      topIndex = activeItem;
+
+      return true;
+    }
+
+    if (activeItem - topIndex >= rowCount) {
+      topIndex = activeItem - rowCount + 1;
+
+      return true;
+    }
+
+    return false;
+  }
+
   void drawItem(unsigned index) {
     const char *selectedText = 0;
-    char *text = 0;
+    char text[MENU_ROW_MAX_LEN + 1];
     unsigned row = index - topIndex;
-    unsigned y = drawY + row * rowSpace;
+    const MenuLayout &l = *layout;
+    unsigned y = l.drawY + row * l.rowSpace;
     
-    tft->setBackgroundColor(index==activeItem ? drawColour : COLOR_BLACK);
+    l.tft->setBackgroundColor(index==activeItem ? l.drawColour : COLOR_BLACK);
 
-    if (subMenus[index]) {
-      tft->drawTriangle(drawX + rowWidth - rowHeight / 2, y, drawX + rowWidth - rowHeight / 2, y + rowHeight, drawX + rowWidth, y + rowHeight / 2, drawColour);
+    if (subMenu(index)) {
+      l.tft->drawTriangle(l.drawX + l.rowWidth - l.rowHeight / 2, y, l.drawX + l.rowWidth - l.rowHeight / 2, y + l.rowHeight, l.drawX + l.rowWidth, y + l.rowHeight / 2, l.drawColour);
 
-      selectedText = subMenus[index]->getSelectedValue();
+      selectedText = subMenu(index)->getSelectedValue();
     }
 
     if (selectedText) {
-      text = new char[strlen(items[index]) + strlen(selectedText) + 3];
-
-      sprintf(text, "%s: %s", items[index], selectedText);
+      snprintf(text, sizeof(text), "%s: %s", items[index], selectedText);
     }
     
-    tft->drawText(drawX, y, text ? text : items[index], index==activeItem ? COLOR_BLACK : drawColour );
+    l.tft->drawText(l.drawX, y, selectedText ? text : items[index], index==activeItem ? COLOR_BLACK : l.drawColour );
+  }
 
-    delete text;
+  // The summaries of this menu and every menu above it are stale
+  void invalidateSelectedValue(void) {
+    for (Menu *menu = this; menu; menu = menu->parent) {
+      menu->selectedValueValid = false;
+    }
+  }
+
+  void select(int index) {
+    if (index != selectedItem) {
+      selectedItem = index;
+      invalidateSelectedValue();
+    }
   }
 
   void postSubMenuCallbacks(Menu *menu, Menu *subMenu) {
@@ -79,9 +140,9 @@ class Menu {
     }
   }
 
-  void postItemCallbacks(Menu *menu, const char *item) {
+  void postItemCallbacks(Menu *menu, int value) {
     for (int i=0; i<MAX_CALLBACKS && callbacks[i]!=0; i++) {
-      callbacks[i]->itemSelected(menu, item);
+      callbacks[i]->itemSelected(menu, value);
     }
   }
   
@@ -95,9 +156,9 @@ class Menu {
       length += strlen(selectedValue);
     }
 
-    for (int i=0; i<itemCount; i++) {
-      if (subMenus[i]) {
-        const char *subMenuValue = subMenus[i]->getSelectedValue();
+    for (unsigned i=0; i<itemCount; i++) {
+      if (subMenu(i)) {
+        const char *subMenuValue = subMenu(i)->getSelectedValue();
 
         if (subMenuValue) {
           if (length && (length < SELECTED_VALUE_MAX_LEN)) {
@@ -115,27 +176,26 @@ class Menu {
   }
 
   public:
-  Menu(const char** items, unsigned itemCount, MenuCallback *callback=0)
+  Menu(const char **items, unsigned itemCount, const int *values=0, Menu *const *subMenus=0)
   : items(items),
+    values(values),
+    subMenus(subMenus),
+    parent(0),
     itemCount(itemCount),
     activeItem(0),
     selectedItem(-1),
-    topIndex(0),
-    rowCount(UINT_MAX),
-    subMenus(new Menu*[itemCount]) {
-      memset(subMenus, 0, itemCount * sizeof(Menu*));
+    layout(0),
+    topIndex(0) {
       memset(callbacks, 0, MAX_CALLBACKS * sizeof(MenuCallback*));
       selectedValue[0] = 0;
+      selectedValueValid = false;
 
-      addCallback(callback);
-  }
-
-  virtual ~Menu() {
-    delete subMenus;
-  }
-
-  void addSubMenu(unsigned itemIndex, Menu *subMenu) {
-    subMenus[itemIndex] = subMenu;
+      // Submenus must already be constructed
+      for (unsigned i=0; i<itemCount; i++) {
+        if (subMenu(i)) {
+          subMenu(i)->parent = this;
+        }
+      }
   }
 
   void addCallback(MenuCallback *callback) {
@@ -152,15 +212,7 @@ class Menu {
   }
 
   bool adjustViewWindow(void) {
-    if (activeItem < topIndex) {
-      topIndex = activeItem;
-      draw();
-
-      return true;
-    }
-
-    if (activeItem - topIndex >= rowCount) {
-      topIndex = activeItem - rowCount + 1;
+    if (moveViewWindow()) {
       draw();
 
       return true;
@@ -192,17 +244,20 @@ class Menu {
   }
 
   void selectAction(void) {
-    if (subMenus[activeItem]) {
-      postSubMenuCallbacks(this, subMenus[activeItem]);
+    if (subMenu(activeItem)) {
+      postSubMenuCallbacks(this, subMenu(activeItem));
     } else {
-      selectedItem = activeItem;
+      select(activeItem);
 
-      postItemCallbacks(this, items[selectedItem]);
+      postItemCallbacks(this, valueAt(selectedItem));
     }
   }
 
   const char *getSelectedValue(void) {
-    updateSelectedValueText();
+    if (!selectedValueValid) {
+      updateSelectedValueText();
+      selectedValueValid = true;
+    }
     
     return strlen(selectedValue) ? selectedValue : 0;
   }
@@ -213,35 +268,48 @@ class Menu {
 
   void setSelectedIndex(int index) {
     if (index < 0) {
-      selectedItem = -1;
+      select(-1);
       activeItem = 0;
-    } else if (index < itemCount) {
-      selectedItem = activeItem = index;
+    } else if ((unsigned)index < itemCount) {
+      select(index);
+      activeItem = index;
     }
 
-    adjustViewWindow();
+    moveViewWindow();
   }
 
-  void drawInit(TFT_22_ILI9225 &tft, unsigned count, unsigned x, unsigned y, unsigned rowSpace, unsigned width, unsigned height, unsigned colour) {
-    this->tft = &tft;
-    this->rowCount = count;
-    this->drawX = x;
-    this->drawY = y;
-    this->rowSpace = rowSpace;
-    this->rowWidth = width;
-    this->rowHeight = height;
-    this->drawColour = colour;
+  // Selects the first item whose value is at least 'value', or none
+  void setSelectedValue(int value) {
+    for (unsigned i=0; i<itemCount; i++) {
+      if (value <= valueAt(i)) {
+        setSelectedIndex(i);
+
+        return;
+      }
+    }
+
+    setSelectedIndex(-1);
   }
 
-  void draw(void) {
-    adjustViewWindow();
+  void drawInit(const MenuLayout &layout) {
+    this->layout = &layout;
+  }
 
-    tft->fillRectangle(drawX, drawY, drawX + rowWidth, drawY + (rowCount - 1) * rowSpace + rowHeight, BACKGROUND_COLOUR);
+  // Draws the rows over a background that is already clear
+  void drawRows(void) {
+    moveViewWindow();
 
-    for (int i=0; i<min(rowCount, itemCount); i++) {
+    for (unsigned i=0; i<min(layout->rowCount, itemCount); i++) {
       drawItem(topIndex + i);
     }
   }
+
+  void draw(void) {
+    const MenuLayout &l = *layout;
+
+    l.tft->fillRectangle(l.drawX, l.drawY, l.drawX + l.rowWidth, l.drawY + (l.rowCount - 1) * l.rowSpace + l.rowHeight, BACKGROUND_COLOUR);
+    drawRows();
+  }
 };
 
 //======================================================
@@ -249,83 +317,128 @@ class Menu {
 
 class MenuDisplay : public MenuCallback {
   private:
-  virtual void itemSelected(class Menu *menu, const char *selected) {
+  virtual void itemSelected(class Menu *menu, int value) {
   }
     
   virtual void subMenuSelected(Menu *menu, Menu *subMenu) {
-    presentMenu(subMenu);
-    
-    menu->draw();
+    pushMenu(subMenu);
   }
 
   void resetTimeout(void) {
-    timeoutCheck = millis();
+    timeoutCheck = halMillis();
   }
 
-  bool timeout(void) {
-    return millis() - timeoutCheck >= 20000;
+  void pushMenu(Menu *menu) {
+    for (int i=0; i<BORDER_WIDTH; i++) {
+      tft.drawRectangle(TLX+i, TLY+i, TLX+WIDTH-i, TLY+HEIGHT-i, MENU_COLOUR);
+    }
+    tft.fillRectangle(MENU_X, MENU_Y, MENU_X+MENU_WIDTH, MENU_Y+MENU_HEIGHT, BACKGROUND_COLOUR);
+    tft.setFont(Terminal11x16);
+    
+    menu->addCallback(this);
+    menu->drawInit(layout);
+    menu->drawRows();
+
+    if (depth < MAX_MENU_DEPTH) {
+      stack[depth++] = menu;
+    }
+  }
+
+  void popMenu(void) {
+    if (--depth > 0) {
+      stack[depth - 1]->draw();
+    }
   }
 
   private:
-  TFT_22_ILI9225 &tft;
-  ButtonController &buttons;
+  HalDisplay &tft;
   unsigned long timeoutCheck;
-  const unsigned screenWidth;
-  const unsigned screenHeight;
+  unsigned screenWidth;
+  unsigned screenHeight;
+  MenuLayout layout;
+  Menu *stack[MAX_MENU_DEPTH];
+  unsigned depth;
+  unsigned long keySpiBytes;   // Sent by the last key press
   
   public:
-  MenuDisplay(TFT_22_ILI9225 &tft, ButtonController &buttons)
+  MenuDisplay(HalDisplay &tft)
   : tft(tft),
-    buttons(buttons),
     timeoutCheck(0),
-    screenWidth(tft.maxX()),
-    screenHeight(tft.maxY()) {
+    screenWidth(0),
+    screenHeight(0),
+    depth(0),
+    keySpiBytes(0) {
     
   }
   
+  // The display may not be set up when this is constructed, so its
+  // size is read here.
   void presentMenu(Menu *menu) {
-    bool exitMenu = false;
-    
-    for (int i=0; i<BORDER_WIDTH; i++) {
-      tft.drawRectangle(TLX+i, TLY+i, TLX+WIDTH-i, TLY+HEIGHT-i, MENU_COLOUR);
-    }
-    tft.fillRectangle(MENU_X, MENU_Y, MENU_X+MENU_WIDTH, MENU_Y+MENU_HEIGHT, BACKGROUND_COLOUR);
+    screenWidth = tft.maxX();
+    screenHeight = tft.maxY();
     tft.setFont(Terminal11x16);
-    
-    menu->addCallback(this);
-    menu->drawInit(tft, NUM_ROWS, MENU_X+ROW_X_PAD, MENU_Y+ROW_Y_PAD, ROW_HEIGHT, MENU_WIDTH-2*ROW_X_PAD, tft.getFont().height, MENU_COLOUR);
-    menu->draw();
+    layout.tft = &tft;
+    layout.rowCount = NUM_ROWS;
+    layout.drawX = MENU_X+ROW_X_PAD;
+    layout.drawY = MENU_Y+ROW_Y_PAD;
+    layout.rowSpace = ROW_HEIGHT;
+    layout.rowWidth = MENU_WIDTH-2*ROW_X_PAD;
+    layout.rowHeight = tft.getFont().height;
+    layout.drawColour = MENU_COLOUR;
+    depth = 0;
+    pushMenu(menu);
 
     resetTimeout();
+  }
 
-    while (!exitMenu && !timeout()) {
-      if (buttons.buttonPressed(ButtonUp)) {
-        menu->upAction();
+  bool isOpen(void) {
+    return depth > 0;
+  }
 
-        resetTimeout();
-      }
+  void close(void) {
+    depth = 0;
+  }
 
-      if (buttons.buttonPressed(ButtonDown)) {
-        menu->downAction();
+  bool timedOut(void) {
+    return halMillis() - timeoutCheck >= MENU_TIMEOUT;
+  }
 
-        resetTimeout();
-      }
+  void buttonPressed(Buttons button) {
+    if (!isOpen()) {
+      return;
+    }
+
+    unsigned long spiBytes = halCounters.spiBytes;
 
-      if (buttons.buttonPressed(ButtonSelect)) {
+    Menu *menu = stack[depth - 1];
+
+    switch (button) {
+      case ButtonUp:
+        menu->upAction();
+        break;
+      case ButtonDown:
+        menu->downAction();
+        break;
+      case ButtonSelect:
         menu->selectAction();
 
-        if (menu->getSelectedIndex() >= 0) {
-          exitMenu = true;
+        if (stack[depth - 1] == menu && menu->getSelectedIndex() >= 0) {
+          popMenu();
         }
+        break;
+      case ButtonBack:
+        popMenu();
+        break;
+      default:
+        break;
+    }
 
-        resetTimeout();
-      }
+    resetTimeout();
 
-      if (buttons.buttonPressed(ButtonBack)) {
-        exitMenu = true;
-      }
+    keySpiBytes = halCounters.spiBytes - spiBytes;
+  }
 
-      delay(50);
-    }
+  unsigned long getKeySpiBytes(void) {
+    return keySpiBytes;
   }
 };
@@ -0,0 +1,60 @@
+//============================================================
+// Running min/max over a ring of chart columns
+//
+// A bottom-up segment tree: leaves hold the column values, each parent
+// the min and max of its children. Overwriting a column is O(log n) and
+// the overall min/max is read from the root. Columns equal to the
+// invalid value are ignored.
+
+template <class T, T INVALID> class MinMaxTree {
+  private:
+  unsigned size;
+  T *minTree;
+  T *maxTree;
+
+  public:
+  MinMaxTree()
+    : size(0),
+      minTree(0),
+      maxTree(0) {
+  }
+
+  void init(unsigned columns) {
+    size = columns;
+    minTree = new T[2 * size];
+    maxTree = new T[2 * size];
+
+    clear();
+  }
+
+  void clear(void) {
+    for (unsigned i=0; i<2*size; i++) {
+      minTree[i] = INVALID;
+      maxTree[i] = 0;
+    }
+  }
+
+  void set(unsigned column, T value) {
+    unsigned i = column + size;
+
+    minTree[i] = value;
+    maxTree[i] = value == INVALID ? 0 : value;
+
+    for (i /= 2; i >= 1; i /= 2) {
+      minTree[i] = min(minTree[2*i], minTree[2*i+1]);
+      maxTree[i] = max(maxTree[2*i], maxTree[2*i+1]);
+    }
+  }
+
+  T get(unsigned column) {
+    return minTree[column + size];
+  }
+
+  T getMin(void) {
+    return size > 1 ? minTree[1] : minTree[size];
+  }
+
+  T getMax(void) {
+    return size > 1 ? maxTree[1] : maxTree[size];
+  }
+};
@@ -0,0 +1,182 @@
+#define PID_OUTPUT_MAX 1000  // Per mille
+#define PID_INTEGRAL_SHIFT 16  // Fraction bits kept in the integral
+#define PID_WINDOW 600000UL  // Milliseconds the output is proportioned over
+#define PID_SLOPE_SPAN PID_WINDOW  // Milliseconds between derivative samples
+#define PID_SLOPE_AVERAGE 4  // Derivative samples the slope is averaged over
+#define PID_MIN_PULSE 30000UL  // Milliseconds; shorter on or off times are dropped
+
+#define TUNE_HYSTERESIS 4  // 1/16 Deg either side of target
+#define TUNE_CYCLES 3
+#define TUNE_TIMEOUT (24UL*60UL*60UL*1000UL)  // Milliseconds
+
+//============================================================
+// Fixed-point PID
+//
+// Works on the demand for the load: how far, in 1/16 Deg, the beer is
+// on the side of the target that the load corrects. The output is the
+// per mille share of time the load should be on.
+//
+// Gains are integers: Kp in per mille per degree, Ki per mille per
+// degree hour and Kd per mille per degree/hour. The integral keeps
+// PID_INTEGRAL_SHIFT fraction bits so small errors still accumulate.
+// It is clamped to the output range and frozen while the output is
+// saturated in the same direction, so it cannot wind up. The
+// derivative is taken from the demand sampled once a window and
+// averaged over PID_SLOPE_AVERAGE of them. A window's own heating or
+// cooling then cancels out of it, where a shorter span would see it as
+// a slope, push the output the other way and settle into a full on,
+// full off cycle well away from the target.
+
+class PidGains {
+  public:
+  long kp;
+  long ki;
+  long kd;
+};
+
+class PidController {
+  private:
+  long long integral;
+  long slope;   // Demand change, 1/16 Deg per hour
+  long slopeDemand;
+  unsigned long slopeTime;
+  unsigned long lastTime;
+  bool primed;
+
+  public:
+  PidController() {
+    reset();
+  }
+
+  void reset(void) {
+    integral = 0;
+    slope = 0;
+    primed = false;
+  }
+
+  int update(const PidGains &gains, long demand, unsigned long now) {
+    if (!primed) {
+      slopeDemand = demand;
+      slopeTime = lastTime = now;
+      primed = true;
+    }
+
+    if (now - slopeTime >= PID_SLOPE_SPAN) {
+      long latest = (long)((long long)(demand - slopeDemand) * 3600000LL / (long)(now - slopeTime));
+
+      slope += (latest - slope) / PID_SLOPE_AVERAGE;
+      slopeDemand = demand;
+      slopeTime = now;
+    }
+
+    long p = gains.kp * demand / TEMP_SCALE;
+    long d = gains.kd * slope / TEMP_SCALE;
+    long output = p + (long)(integral >> PID_INTEGRAL_SHIFT) + d;
+    long long step = (long long)gains.ki * demand * (long)(now - lastTime) * (1LL << PID_INTEGRAL_SHIFT) / (TEMP_SCALE * 3600000LL);
+
+    lastTime = now;
+
+    // Conditional integration: no further push into a saturated output
+    if (!(output >= PID_OUTPUT_MAX && step > 0) && !(output <= 0 && step < 0)) {
+      integral = constrain(integral + step, 0LL, (long long)PID_OUTPUT_MAX << PID_INTEGRAL_SHIFT);
+    }
+
+    return constrain(output, 0L, (long)PID_OUTPUT_MAX);
+  }
+};
+
+//============================================================
+// Relay autotune
+//
+// Switches the load fully on and off around the target, with a little
+// hysteresis, and measures the demand's oscillation. The first cycle
+// is discarded; the mean amplitude and period of the next TUNE_CYCLES
+// give the ultimate gain and period, from which Tyreus-Luyben rules
+// set gains suited to a slow thermal plant.
+
+class RelayAutotune {
+  public:
+  typedef enum {
+    Running,
+    Done,
+    Failed
+  } Result;
+
+  private:
+  bool loadOn;
+  unsigned cycles;
+  long high, low;
+  long amplitudeSum;
+  unsigned long periodSum;
+  unsigned long started;
+  unsigned long cycleStart;
+
+  public:
+  void start(unsigned long now) {
+    loadOn = false;
+    cycles = 0;
+    high = LONG_MIN;
+    low = LONG_MAX;
+    amplitudeSum = 0;
+    periodSum = 0;
+    started = cycleStart = now;
+  }
+
+  bool isLoadOn(void) {
+    return loadOn;
+  }
+
+  Result update(long demand, unsigned long now, PidGains &gains) {
+    if (now - started >= TUNE_TIMEOUT) {
+      return Failed;
+    }
+
+    high = max(high, demand);
+    low = min(low, demand);
+
+    if (loadOn && demand < -TUNE_HYSTERESIS) {
+      loadOn = false;
+    } else if (!loadOn && demand > TUNE_HYSTERESIS) {
+      // A cycle runs from one switch on to the next
+      if (cycles > 0) {
+        amplitudeSum += (high - low) / 2;
+        periodSum += now - cycleStart;
+      }
+
+      loadOn = true;
+      cycleStart = now;
+      high = low = demand;
+
+      if (cycles++ == TUNE_CYCLES) {
+        return finish(gains);
+      }
+    }
+
+    return Running;
+  }
+
+  private:
+  // Ku = 4d / (pi a) with a relay half-swing d of half the output
+  Result finish(PidGains &gains) {
+    long amplitude = amplitudeSum / TUNE_CYCLES;
+    long long period = periodSum / TUNE_CYCLES;
+
+    if (amplitude <= 0 || period <= 0) {
+      return Failed;
+    }
+
+    long ku = 4L * (PID_OUTPUT_MAX / 2) * TEMP_SCALE * 100 / (314 * amplitude);
+
+    gains.kp = ku * 10 / 22;
+    gains.ki = (long)(gains.kp * 3600000LL * 10 / (22 * period));
+    gains.kd = (long)(gains.kp * period * 10 / (63 * 3600000LL));
+
+    PRINTVAR(amplitude);
+    PRINTVAR((unsigned long)period);
+    PRINTVAR(gains.kp);
+    PRINTVAR(gains.ki);
+    PRINTVAR(gains.kd);
+
+    return Done;
+  }
+};
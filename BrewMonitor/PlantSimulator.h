@@ -0,0 +1,280 @@
+#ifdef SIMULATE_PLANT
+
+#define SIM_STEP_MAX 1000UL  // Milliseconds
+#define SIM_DAY (24UL*60UL*60UL*1000UL)  // Milliseconds
+
+#define SIM_CHILLER_TEMP -4.0  // Deg
+#define SIM_COOLANT_TAU 0.5  // Hours to close 63% of the gap
+#define SIM_JACKET_TAU 3.0  // Hours
+#define SIM_AMBIENT_TAU 12.0  // Hours
+#define SIM_HEATER_RATE 6.0  // Deg per hour
+#define SIM_FERMENT_HEAT 0.1  // Deg per hour
+#define SIM_TICK_CYCLES 60   // SysTick entry, handler and return, woken from WFI
+
+//============================================================
+// Fermenter plant simulator
+//
+// Build with SIMULATE_PLANT to run the firmware against a thermal
+// model of the beer, its coolant jacket and the room. On the host,
+// plant_sim does this thousands of times faster than real time. The HAL clock becomes virtual and skips straight to the
+// next task deadline, the probes read the model, and the load pin
+// drives the chiller or heater instead of the relay. Settings and the
+// sample log are never written.
+//
+// Each built-in scenario runs the real scheduler, LoadController,
+// TempSensors and ChartDisplay, then reports overshoot, time in band,
+// relay switches and the real time taken per simulated day. Reports
+// are "name value" lines on the serial port whether or not DEBUG is
+// defined.
+//
+// With several channels each gets its own plant, driven by its own
+// load pin, and runs the same scenario; probes are discovered beer
+// first for every channel, then coolant, then air, which is the order
+// TempSensors hands out roles. Results are reported per channel.
+//
+// It also reports how much of each simulated day the CPU would be
+// awake under idle(): the cycles the scheduler passes really take,
+// plus a SysTick wake every millisecond, in parts per million.
+
+class PlantModel {
+  public:
+  float beer;
+  float coolant;
+  float air;
+  float ambientBase;
+  float ambientSwing;
+  bool heater;      // The load heats the beer rather than chilling the coolant
+  bool loadOn;
+  int loadPin;
+
+  public:
+  PlantModel()
+    : loadOn(false),
+      loadPin(-1) {
+  }
+
+  void reset(float beerTemp, float ambient, float swing, bool heats) {
+    beer = beerTemp;
+    coolant = air = ambient;
+    ambientBase = ambient;
+    ambientSwing = swing;
+    heater = heats;
+  }
+
+  // Simple Euler steps; every time constant is hours long
+  void step(unsigned long millis) {
+    float hours = millis / 3600000.0;
+    float ambient = ambientBase + ambientSwing * sin(2 * PI * (halSimMillis % SIM_DAY) / SIM_DAY);
+    float coolantGoal = loadOn && !heater ? SIM_CHILLER_TEMP : ambient;
+    float heat = loadOn && heater ? SIM_HEATER_RATE : 0;
+
+    air = ambient;
+    coolant += (coolantGoal - coolant) * hours / SIM_COOLANT_TAU;
+    beer += ((coolant - beer) / SIM_JACKET_TAU + (ambient - beer) / SIM_AMBIENT_TAU + SIM_FERMENT_HEAT + heat) * hours;
+  }
+
+  int16_t probeRaw(unsigned role) {
+    switch (role) {
+      case 0:
+        return (int16_t)(beer * TEMP_SCALE);
+      case 1:
+        return (int16_t)(coolant * TEMP_SCALE);
+      default:
+        return (int16_t)(air * TEMP_SCALE);
+    }
+  }
+};
+
+PlantModel plants[CHANNELS];
+
+void simReport(const char *name, unsigned long value) {
+  Serial.print(name);
+  Serial.print(' ');
+  Serial.print(value);
+  Serial.print('\n');
+}
+
+void halSimPinWrite(int pin, int value) {
+  for (unsigned c=0; c<CHANNELS; c++) {
+    if (pin == plants[c].loadPin) {
+      plants[c].loadOn = value == HIGH;
+    }
+  }
+}
+
+int16_t halSimProbeRaw(unsigned index) {
+  return plants[index % CHANNELS].probeRaw(index / CHANNELS);
+}
+
+class ControlStats {
+  public:
+  unsigned long elapsed;
+  unsigned long inBand;
+  unsigned long switches;
+  TempFixed overshoot;   // Furthest outside the band once it was reached
+  bool reached;
+  bool lastLoad;
+
+  public:
+  void reset(bool load) {
+    elapsed = inBand = switches = 0;
+    overshoot = 0;
+    reached = false;
+    lastLoad = load;
+  }
+
+  void update(unsigned long millis, TempFixed temp, TempFixed lower, TempFixed upper, bool load) {
+    elapsed += millis;
+
+    if (temp >= lower && temp <= upper) {
+      inBand += millis;
+      reached = true;
+    } else if (reached) {
+      overshoot = max(overshoot, temp < lower ? lower - temp : temp - upper);
+    }
+
+    if (load != lastLoad) {
+      switches++;
+      lastLoad = load;
+    }
+  }
+};
+
+class AwakeStats {
+  public:
+  unsigned long long cycles;
+  unsigned long passes;
+  unsigned long start;
+  unsigned day;
+
+  public:
+  void reset(unsigned long now) {
+    cycles = 0;
+    passes = 0;
+    start = now;
+    day = 0;
+  }
+
+  void runScheduler(Scheduler &scheduler) {
+    uint32_t started = halCycles();
+
+    scheduler.run();
+    cycles += halCycles() - started;
+    passes++;
+  }
+
+  // Reports each day as it ends
+  void update(unsigned long now) {
+    if (now - start < SIM_DAY) {
+      return;
+    }
+
+    unsigned long long dayCycles = (unsigned long long)HAL_CPU_HZ * (SIM_DAY / 1000);
+    unsigned long awakePpm = (cycles + (unsigned long long)SIM_TICK_CYCLES * SIM_DAY) * 1000000ULL / dayCycles;
+
+    day++;
+    simReport("day", day);
+    simReport("passes", passes);
+    simReport("awakePpm", awakePpm);
+
+    cycles = 0;
+    passes = 0;
+    start += SIM_DAY;
+  }
+};
+
+class SimScenario {
+  public:
+  const char *name;
+  LoadController::ControlMode mode;
+  LoadController::ControlStrategy strategy;
+  float startBeer;
+  float ambient;
+  float ambientSwing;
+  unsigned startTarget;
+  unsigned endTarget;    // The target ramps linearly between the two
+  unsigned days;
+  unsigned dutyCycleOff;   // Seconds; 0 lets the band run its load until it is reached
+};
+
+static const SimScenario simScenarios[] = {
+  { "Crash cool", LoadController::Cooling, LoadController::Band, 20.0, 18.0, 0.0, 2, 2, 2, 0 },
+  { "Heat ramp", LoadController::Heating, LoadController::Band, 15.0, 12.0, 0.0, 18, 22, 3, 30 },
+  { "Ambient swing", LoadController::Cooling, LoadController::Band, 18.0, 20.0, 6.0, 18, 18, 3, 30 },
+  { "Crash cool PID", LoadController::Cooling, LoadController::Pid, 20.0, 18.0, 0.0, 2, 2, 2, 0 },
+  { "Heat ramp PID", LoadController::Heating, LoadController::Pid, 15.0, 12.0, 0.0, 18, 22, 3, 30 },
+  { "Ambient swing PID", LoadController::Cooling, LoadController::Pid, 18.0, 20.0, 6.0, 18, 18, 3, 30 }
+};
+
+void simulateScenario(const SimScenario &scenario, Scheduler &scheduler, Channel *channels) {
+  unsigned long duration = scenario.days * SIM_DAY;
+  unsigned long start = halSimMillis;
+  unsigned long cpuStart = halCpuMillis();
+  ControlStats stats[CHANNELS];
+  AwakeStats awake;
+
+  for (unsigned c=0; c<CHANNELS; c++) {
+    LoadController &loadControl = channels[c].control;
+
+    plants[c].reset(scenario.startBeer, scenario.ambient, scenario.ambientSwing, scenario.mode == LoadController::Heating);
+    loadControl.setControlMode(scenario.mode);
+    loadControl.setStrategy(scenario.strategy);
+    loadControl.setTargetTemp(scenario.startTarget);
+    loadControl.setDutyCycleOff(scenario.dutyCycleOff);
+    stats[c].reset(plants[c].loadOn);
+  }
+
+  awake.reset(start);
+
+  while (halSimMillis - start < duration) {
+    unsigned long elapsed = halSimMillis - start;
+    long rise = (long)scenario.endTarget - (long)scenario.startTarget;
+    unsigned target = scenario.startTarget + rise * (long)(elapsed / 1000) / (long)(duration / 1000);
+
+    for (unsigned c=0; c<CHANNELS; c++) {
+      if (target != channels[c].control.getTargetTemp()) {
+        channels[c].control.setTargetTemp(target);
+      }
+    }
+
+    awake.runScheduler(scheduler);
+
+    unsigned long step = constrain(scheduler.nextDeadline(), 1UL, SIM_STEP_MAX);
+
+    for (unsigned c=0; c<CHANNELS; c++) {
+      TempFixed range = channels[c].control.getTempRange() * TEMP_SCALE / 2;
+
+      plants[c].step(step);
+      stats[c].update(step, (TempFixed)(plants[c].beer * TEMP_SCALE), target * TEMP_SCALE - range, target * TEMP_SCALE + range, plants[c].loadOn);
+    }
+
+    halSimMillis += step;
+    awake.update(halSimMillis);
+  }
+
+  Serial.print("scenario ");
+  Serial.print(scenario.name);
+  Serial.print('\n');
+
+  for (unsigned c=0; c<CHANNELS; c++) {
+    simReport("channel", c);
+    simReport("overshootTenths", tempToTenths(stats[c].overshoot));
+    simReport("inBandPercent", stats[c].inBand / (stats[c].elapsed / 100));
+    simReport("switches", stats[c].switches);
+  }
+
+  simReport("cpuMsPerDay", (halCpuMillis() - cpuStart) / scenario.days);
+}
+
+// loadPins holds each channel's on pin, which drives its plant
+void simulatePlant(Scheduler &scheduler, Channel *channels, const int (*loadPins)[2]) {
+  for (unsigned c=0; c<CHANNELS; c++) {
+    plants[c].loadPin = loadPins[c][0];
+  }
+
+  for (unsigned i=0; i<sizeof(simScenarios)/sizeof(SimScenario); i++) {
+    simulateScenario(simScenarios[i], scheduler, channels);
+  }
+}
+
+#endif
@@ -0,0 +1,108 @@
+#define FILTER_SMOOTH_SHIFT 2   // Each reading moves the output 1/4 of the way
+#define FILTER_FAULT_READS 2    // Bad readings in a row before a probe is faulted
+#define FILTER_RECOVER_READS 3  // Good readings in a row before it's trusted again
+#define FILTER_MIN_TEMP (-55 * TEMP_SCALE)
+#define FILTER_MAX_TEMP (125 * TEMP_SCALE)
+#define FILTER_RESET_TEMP (85 * TEMP_SCALE)   // Scratchpad power-on value
+
+//============================================================
+// Probe reading validation
+//
+// Every reading passes through its probe's filter before anything else
+// sees it. A reading is bad if the probe is disconnected or failed its
+// CRC, is outside the DS18B20's range, or is exactly the 85 Deg the
+// scratchpad holds after a power glitch. One bad reading holds the last
+// output; FILTER_FAULT_READS in a row fault the probe, and it reads as
+// TEMP_DISCONNECTED until FILTER_RECOVER_READS good readings in a row.
+//
+// Good readings go through a median of the last three, which drops a
+// single-reading spike, then an exponential average kept in fixed
+// point with FILTER_SMOOTH_SHIFT fraction bits. Each step is constant
+// time and a few bytes of state. A probe's first good reading, and the
+// first after a fault, seeds both stages so the output doesn't ramp.
+
+class ProbeFilter {
+  private:
+  TempFixed window[3];
+  byte next;
+  byte badReads;
+  byte goodReads;
+  bool seeded;
+  bool faulted;
+  long smoothed;   // The output, shifted up by FILTER_SMOOTH_SHIFT
+
+  private:
+  static bool isValid(TempFixed raw) {
+    return raw >= FILTER_MIN_TEMP && raw <= FILTER_MAX_TEMP && raw != FILTER_RESET_TEMP;
+  }
+
+  TempFixed median(void) {
+    TempFixed a = window[0], b = window[1], c = window[2];
+
+    return max(min(a, b), min(max(a, b), c));
+  }
+
+  TempFixed output(void) {
+    if (faulted) {
+      return TEMP_DISCONNECTED;
+    }
+
+    return (smoothed + (1 << (FILTER_SMOOTH_SHIFT - 1))) >> FILTER_SMOOTH_SHIFT;
+  }
+
+  void seed(TempFixed raw) {
+    window[0] = window[1] = window[2] = raw;
+    next = 0;
+    smoothed = (long)raw << FILTER_SMOOTH_SHIFT;
+    seeded = true;
+    faulted = false;
+  }
+
+  public:
+  ProbeFilter()
+    : next(0),
+      badReads(0),
+      goodReads(0),
+      seeded(false),
+      faulted(true),
+      smoothed(0) {
+  }
+
+  bool isFaulted(void) {
+    return faulted;
+  }
+
+  // Takes a raw reading and returns the filtered temperature
+  TempFixed update(TempFixed raw) {
+    if (!isValid(raw)) {
+      goodReads = 0;
+
+      if (badReads < FILTER_FAULT_READS && ++badReads == FILTER_FAULT_READS) {
+        faulted = true;
+        PRINTLN(F("Probe faulted"));
+      }
+
+      return output();
+    }
+
+    badReads = 0;
+
+    if (faulted) {
+      if (seeded && ++goodReads < FILTER_RECOVER_READS) {
+        return TEMP_DISCONNECTED;
+      }
+
+      goodReads = 0;
+      seed(raw);
+
+      return raw;
+    }
+
+    window[next] = raw;
+    next = (next + 1) % 3;
+
+    smoothed += median() - output();
+
+    return output();
+  }
+};
@@ -0,0 +1,42 @@
+//============================================================
+// Latest reading from every probe on the bus
+//
+// Kept as parallel arrays indexed by probe, so a pass over one field
+// touches only that field. Each channel's roles map onto probe
+// indexes; a role with no probe reads as disconnected.
+
+class ProbeSamples {
+  public:
+  unsigned count;
+  TempFixed temp[MAX_PROBES];
+  unsigned long time[MAX_PROBES];
+  byte roleProbe[CHANNELS][PROBE_ROLES];
+
+  public:
+  ProbeSamples()
+    : count(0) {
+    for (unsigned p=0; p<MAX_PROBES; p++) {
+      temp[p] = TEMP_DISCONNECTED;
+      time[p] = 0;
+    }
+
+    memset(roleProbe, PROBE_NONE, sizeof(roleProbe));
+  }
+
+  bool hasRole(unsigned channel, TempType role) const {
+    return roleProbe[channel][role] != PROBE_NONE;
+  }
+
+  TempFixed roleTemp(unsigned channel, TempType role) const {
+    return hasRole(channel, role) ? temp[roleProbe[channel][role]] : TEMP_DISCONNECTED;
+  }
+
+  unsigned long roleTime(unsigned channel, TempType role) const {
+    return hasRole(channel, role) ? time[roleProbe[channel][role]] : 0;
+  }
+
+  // Bit per probe, as returned by TempSensors::poll()
+  unsigned roleMask(unsigned channel, TempType role) const {
+    return hasRole(channel, role) ? 1 << roleProbe[channel][role] : 0;
+  }
+};
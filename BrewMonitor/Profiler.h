@@ -0,0 +1,211 @@
+#define PROFILE_BUCKETS 12
+#define PROFILE_BUCKET_SHIFT 8   // The first bucket holds everything under 2^9 cycles
+#define PROFILE_DUMP_INTERVAL 60000UL  // Milliseconds
+#define PROFILE_CALIBRATE_SCOPES 64   // Empty scopes timed at init; the first is slower
+
+//============================================================
+// Scoped timers
+//
+// Define PROFILE to time the hot paths with the cycle counter. Each
+// PROFILE_SCOPE() records its duration against a fixed ProfilePoint:
+// count, min, max, total and a histogram of power of two buckets, so
+// nothing is allocated and the table is a few hundred bytes. Without
+// PROFILE the macro and the table compile away entirely.
+//
+// The mean cost of an empty scope is measured at init, and the dump shows
+// the share of the core's awake cycles spent in the timers themselves.
+// PROFILE_AWAKE() counts the cycles of each scheduler pass; the time
+// asleep in idle() would only dilute the figure.
+
+typedef enum {
+  ProfileSensorPoll,
+  ProfileControl,
+  ProfileUpdateTemps,
+  ProfileUpdateMinMax,
+  ProfilePlotData,
+  ProfileRedraw,
+  ProfileRescale,
+  ProfileMenu,
+  ProfilePointCount
+} ProfilePoint;
+
+#ifdef PROFILE
+
+class ProfileStats {
+  public:
+  unsigned long count;
+  uint32_t minCycles;
+  uint32_t maxCycles;
+  unsigned long long totalCycles;
+  unsigned long buckets[PROFILE_BUCKETS];
+
+  public:
+  void reset(void) {
+    count = 0;
+    minCycles = UINT32_MAX;
+    maxCycles = 0;
+    totalCycles = 0;
+    memset(buckets, 0, sizeof(buckets));
+  }
+
+  void add(uint32_t cycles) {
+    unsigned bucket = 0;
+
+    for (uint32_t c = cycles >> (PROFILE_BUCKET_SHIFT + 1); c && bucket < PROFILE_BUCKETS - 1; c >>= 1) {
+      bucket++;
+    }
+
+    count++;
+    minCycles = min(minCycles, cycles);
+    maxCycles = max(maxCycles, cycles);
+    totalCycles += cycles;
+    buckets[bucket]++;
+  }
+};
+
+class Profiler {
+  private:
+  static const char *const names[ProfilePointCount];
+
+  ProfileStats stats[ProfilePointCount];
+  unsigned long calls;
+  uint32_t scopeCycles;
+  unsigned long long awakeCycles;
+
+  public:
+  void init(void);
+
+  void reset(void) {
+    for (unsigned p=0; p<ProfilePointCount; p++) {
+      stats[p].reset();
+    }
+
+    calls = 0;
+    awakeCycles = 0;
+  }
+
+  void record(ProfilePoint point, uint32_t cycles) {
+    stats[point].add(cycles);
+    calls++;
+  }
+
+  void recordAwake(uint32_t cycles) {
+    awakeCycles += cycles;
+  }
+
+  uint32_t getScopeCycles(void) {
+    return scopeCycles;
+  }
+
+  unsigned long getCalls(void) {
+    return calls;
+  }
+
+  unsigned long long getAwakeCycles(void) {
+    return awakeCycles;
+  }
+
+  // One line per point: count, min, mean and max cycles, then the
+  // histogram buckets
+  void dump(void) {
+    for (unsigned p=0; p<ProfilePointCount; p++) {
+      const ProfileStats &s = stats[p];
+
+      Serial.print(names[p]);
+      Serial.print(' ');
+      Serial.print(s.count);
+
+      if (s.count) {
+        Serial.print(' ');
+        Serial.print(s.minCycles);
+        Serial.print(' ');
+        Serial.print((unsigned long)(s.totalCycles / s.count));
+        Serial.print(' ');
+        Serial.print(s.maxCycles);
+        Serial.print(" |");
+
+        for (unsigned b=0; b<PROFILE_BUCKETS; b++) {
+          Serial.print(' ');
+          Serial.print(s.buckets[b]);
+        }
+      }
+
+      Serial.print('\n');
+    }
+
+    // Per ten thousand awake cycles
+    if (awakeCycles) {
+      Serial.print("Overhead ");
+      Serial.print((unsigned long)((unsigned long long)calls * scopeCycles * 10000ULL / awakeCycles));
+      Serial.print("/10000\n");
+    }
+  }
+};
+
+const char *const Profiler::names[ProfilePointCount] = {
+  "SensorPoll",
+  "Control",
+  "UpdateTemps",
+  "UpdateMinMax",
+  "PlotData",
+  "Redraw",
+  "Rescale",
+  "Menu"
+};
+
+Profiler profiler;
+
+class ProfileScope {
+  private:
+  ProfilePoint point;
+  uint32_t start;
+
+  public:
+  ProfileScope(ProfilePoint point)
+    : point(point),
+      start(halCycles()) {
+  }
+
+  ~ProfileScope() {
+    profiler.record(point, halCycles() - start);
+  }
+};
+
+// Counts the cycles the core spends awake in a scheduler pass
+class ProfileAwakeScope {
+  private:
+  uint32_t start;
+
+  public:
+  ProfileAwakeScope()
+    : start(halCycles()) {
+  }
+
+  ~ProfileAwakeScope() {
+    profiler.recordAwake(halCycles() - start);
+  }
+};
+
+inline void Profiler::init(void) {
+  halCyclesInit();
+
+  uint32_t start = halCycles();
+
+  for (unsigned i=0; i<PROFILE_CALIBRATE_SCOPES; i++) {
+    ProfileScope scope(ProfileMenu);
+  }
+
+  scopeCycles = (halCycles() - start) / PROFILE_CALIBRATE_SCOPES;
+
+  reset();
+}
+
+#define PROFILE_SCOPE(point) ProfileScope profileScope(point)
+#define PROFILE_AWAKE() ProfileAwakeScope profileAwakeScope
+
+#else
+
+#define PROFILE_SCOPE(point)
+#define PROFILE_AWAKE()
+
+#endif
@@ -0,0 +1,43 @@
+//============================================================
+// Compact sample encoding
+//
+// Temperatures are stored as unsigned 16-bit steps of 1/STORE_SCALE
+// degrees above STORE_MIN_TEMP, so the default covers -20 to +4075 C
+// at 1/16 C, which matches the DS18B20's own resolution. Readings from
+// a disconnected sensor map to STORE_INVALID rather than wrapping.
+// Conversion to and from TempFixed is integer only.
+
+#define STORE_MIN_TEMP -20  // Deg
+#define STORE_SCALE 16  // Steps per degree
+#define STORE_INVALID 0xFFFF
+#define STORE_MAX (STORE_INVALID - 1)
+
+typedef uint16_t StoreVal;
+
+inline StoreVal tempToStoreVal(TempFixed temp) {
+  if (temp <= TEMP_DISCONNECTED) {
+    return STORE_INVALID;
+  }
+
+  long steps = ((long)temp - STORE_MIN_TEMP * TEMP_SCALE) * STORE_SCALE / TEMP_SCALE;
+
+  if (steps < 0) {
+    return 0;
+  }
+
+  if (steps > STORE_MAX) {
+    return STORE_MAX;
+  }
+
+  return (StoreVal)steps;
+}
+
+inline TempFixed tempFromStoreVal(StoreVal val) {
+  if (val == STORE_INVALID) {
+    return TEMP_DISCONNECTED;
+  }
+
+  long temp = (long)val * TEMP_SCALE / STORE_SCALE + STORE_MIN_TEMP * TEMP_SCALE;
+
+  return (TempFixed)min(temp, 32767L);
+}
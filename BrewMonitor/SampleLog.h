@@ -0,0 +1,283 @@
+#define SAMPLE_LOG_PAGES 16
+// Just below the pages used by the EEPROM emulation
+#define SAMPLE_LOG_BASE (HAL_EEPROM_BASE - SAMPLE_LOG_PAGES * HAL_FLASH_PAGE_SIZE)
+#define SAMPLE_LOG_RECORD_WORDS 8
+#define SAMPLE_LOG_RECORD_SIZE (SAMPLE_LOG_RECORD_WORDS * 2)
+#define SAMPLE_LOG_PAGE_RECORDS (HAL_FLASH_PAGE_SIZE / SAMPLE_LOG_RECORD_SIZE)
+#define SAMPLE_LOG_RECORDS (SAMPLE_LOG_PAGES * SAMPLE_LOG_PAGE_RECORDS)
+#define SAMPLE_LOG_BATCH 4
+#define SAMPLE_LOG_ERASED 0xFFFFFFFFUL
+
+static_assert(SAMPLE_LOG_BASE % HAL_FLASH_PAGE_SIZE == 0, "Sample log must start on a flash page");
+static_assert(SAMPLE_LOG_BASE >= HAL_FLASH_BASE + HAL_FLASH_MIN_IMAGE, "Sample log and EEPROM pages leave too little flash for the program");
+
+class SampleRecord {
+  public:
+  unsigned long seq;
+  StoreVal vals[PROBE_ROLES];  // The record layout has room for three
+  bool powerOn;
+};
+
+class SampleLogReader {
+  public:
+  virtual void sampleRestored(const SampleRecord &record) { };
+};
+
+//============================================================
+// Persistent sample log
+//
+// A circular, append-only log of chart columns in spare flash. Each
+// record carries a sequence number and a CRC. Records are buffered and
+// programmed SAMPLE_LOG_BATCH at a time; a page is erased just before
+// the log wraps into it.
+//
+// Page first-sequence numbers form a rotated ascending run, so boot
+// finds the newest page and then the newest slot within it by binary
+// search rather than scanning the log.
+//
+// If the program image has grown into the log's pages, the log is left
+// off: nothing is restored and nothing written.
+
+class SampleLog {
+  private:
+  SampleRecord batch[SAMPLE_LOG_BATCH];
+  unsigned batchCount;
+  unsigned nextIndex;
+  unsigned long nextSeq;
+  int newest;
+  bool usable;
+
+  private:
+  unsigned long recordAddr(unsigned index) {
+    return SAMPLE_LOG_BASE + (unsigned long)index * SAMPLE_LOG_RECORD_SIZE;
+  }
+
+  unsigned long readSeq(unsigned index) {
+    unsigned long addr = recordAddr(index);
+
+    return (unsigned long)halFlashRead(addr) | (unsigned long)halFlashRead(addr + 2) << 16;
+  }
+
+  // Erased pages sort below everything
+  unsigned long pageSeq(unsigned page) {
+    unsigned long seq = readSeq(page * SAMPLE_LOG_PAGE_RECORDS);
+
+    return seq == SAMPLE_LOG_ERASED ? 0 : seq;
+  }
+
+  byte crc(const uint16_t *words) {
+    return OneWire::crc8((const uint8_t *)words, (SAMPLE_LOG_RECORD_WORDS - 1) * 2);
+  }
+
+  void pack(const SampleRecord &record, uint16_t *words) {
+    words[0] = record.seq;
+    words[1] = record.seq >> 16;
+    words[2] = record.vals[0];
+    words[3] = record.vals[1];
+    words[4] = record.vals[2];
+    words[5] = record.powerOn ? 1 : 0;
+    words[6] = HAL_FLASH_ERASED;
+    words[7] = crc(words);
+  }
+
+  bool readRecord(unsigned index, SampleRecord &record) {
+    uint16_t words[SAMPLE_LOG_RECORD_WORDS];
+    unsigned long addr = recordAddr(index);
+
+    for (unsigned i=0; i<SAMPLE_LOG_RECORD_WORDS; i++) {
+      words[i] = halFlashRead(addr + 2*i);
+    }
+
+    record.seq = (unsigned long)words[0] | (unsigned long)words[1] << 16;
+    record.vals[0] = words[2];
+    record.vals[1] = words[3];
+    record.vals[2] = words[4];
+    record.powerOn = words[5] & 1;
+
+    return record.seq != SAMPLE_LOG_ERASED && words[7] == crc(words);
+  }
+
+  unsigned previous(unsigned index) {
+    return (index + SAMPLE_LOG_RECORDS - 1) % SAMPLE_LOG_RECORDS;
+  }
+
+  unsigned findNewestPage(void) {
+    unsigned long first = pageSeq(0);
+    unsigned lo = 1;
+    unsigned hi = SAMPLE_LOG_PAGES;
+
+    // First page whose sequence drops below page 0's
+    while (lo < hi) {
+      unsigned mid = (lo + hi) / 2;
+
+      if (pageSeq(mid) < first) {
+        hi = mid;
+      } else {
+        lo = mid + 1;
+      }
+    }
+
+    return lo - 1;
+  }
+
+  unsigned findFirstErasedSlot(unsigned page) {
+    unsigned base = page * SAMPLE_LOG_PAGE_RECORDS;
+    unsigned lo = 0;
+    unsigned hi = SAMPLE_LOG_PAGE_RECORDS;
+
+    while (lo < hi) {
+      unsigned mid = (lo + hi) / 2;
+
+      if (readSeq(base + mid) == SAMPLE_LOG_ERASED) {
+        hi = mid;
+      } else {
+        lo = mid + 1;
+      }
+    }
+
+    return base + lo;
+  }
+
+  public:
+  SampleLog()
+    : batchCount(0),
+      nextIndex(0),
+      nextSeq(1),
+      newest(-1),
+      usable(false) {
+  }
+
+  void init(void) {
+    if (SAMPLE_LOG_BASE < halFlashFree()) {
+      PRINTLN(F("Sample log overlaps the program"));
+      return;
+    }
+
+    usable = true;
+
+    unsigned page = findNewestPage();
+    SampleRecord record;
+
+    if (pageSeq(page) == 0) {
+      PRINTLN(F("Sample log empty"));
+      return;
+    }
+
+    unsigned end = findFirstErasedSlot(page);
+
+    nextIndex = end % SAMPLE_LOG_RECORDS;
+
+    // Step back over a record torn by a power cut
+    for (unsigned i=previous(end), n=0; n<SAMPLE_LOG_PAGE_RECORDS; i=previous(i), n++) {
+      if (readRecord(i, record)) {
+        newest = i;
+        nextSeq = record.seq + 1;
+        break;
+      }
+    }
+
+    PRINTVAR(newest);
+    PRINTVAR(nextSeq);
+  }
+
+  // Number of contiguous records, up to maxCount, ending at the newest
+  unsigned available(unsigned maxCount) {
+    SampleRecord record;
+    unsigned count = 0;
+
+    if (newest < 0) {
+      return 0;
+    }
+
+    unsigned index = newest;
+
+    for (unsigned long seq = nextSeq - 1; count < maxCount && count < SAMPLE_LOG_RECORDS; seq--) {
+      if (!readRecord(index, record) || record.seq != seq) {
+        break;
+      }
+
+      count++;
+      index = previous(index);
+    }
+
+    return count;
+  }
+
+  // Replays the newest 'count' records, oldest first
+  void replay(SampleLogReader &reader, unsigned count) {
+    SampleRecord record;
+    unsigned index = (newest + SAMPLE_LOG_RECORDS - count) % SAMPLE_LOG_RECORDS;
+
+    for (unsigned i=0; i<count; i++) {
+      index = (index + 1) % SAMPLE_LOG_RECORDS;
+      readRecord(index, record);
+      reader.sampleRestored(record);
+    }
+  }
+
+  // Sequence number the next appended record will get
+  unsigned long endSeq(void) {
+    return nextSeq;
+  }
+
+  // Reads a record by sequence number, whether still batched in RAM
+  // or in flash. False once it has been overwritten or is corrupt.
+  bool read(unsigned long seq, SampleRecord &record) {
+    unsigned long batched = nextSeq - batchCount;
+
+    if (seq >= nextSeq) {
+      return false;
+    }
+
+    if (seq >= batched) {
+      record = batch[seq - batched];
+
+      return true;
+    }
+
+    if (newest < 0 || batched - seq > SAMPLE_LOG_RECORDS) {
+      return false;
+    }
+
+    unsigned index = (newest + SAMPLE_LOG_RECORDS - (batched - 1 - seq) % SAMPLE_LOG_RECORDS) % SAMPLE_LOG_RECORDS;
+
+    return readRecord(index, record) && record.seq == seq;
+  }
+
+  void append(const StoreVal *vals, bool powerOn) {
+    SampleRecord &record = batch[batchCount++];
+
+    record.seq = nextSeq++;
+    record.vals[0] = vals[0];
+    record.vals[1] = vals[1];
+    record.vals[2] = vals[2];
+    record.powerOn = powerOn;
+
+    if (batchCount == SAMPLE_LOG_BATCH) {
+      flush();
+    }
+  }
+
+  void flush(void) {
+    uint16_t words[SAMPLE_LOG_RECORD_WORDS];
+
+    if (!usable) {
+      batchCount = 0;
+      return;
+    }
+
+    for (unsigned i=0; i<batchCount; i++) {
+      if (nextIndex % SAMPLE_LOG_PAGE_RECORDS == 0) {
+        halFlashErasePage(recordAddr(nextIndex));
+      }
+
+      pack(batch[i], words);
+      halFlashProgram(recordAddr(nextIndex), words, SAMPLE_LOG_RECORD_WORDS);
+
+      newest = nextIndex;
+      nextIndex = (nextIndex + 1) % SAMPLE_LOG_RECORDS;
+    }
+
+    batchCount = 0;
+  }
+};
@@ -0,0 +1,146 @@
+#define MAX_TASKS 10
+
+#define TASK_WAIT 0xFFFFFFFFUL  // Sleep until woken
+
+//============================================================
+// Cooperative run queue
+//
+// Each task is a function that does a small slice of work and returns
+// how many milliseconds until it next wants to run, or TASK_WAIT to
+// sleep until another task wakes it. Due tasks run most-overdue first.
+// The worst lateness seen for each task is kept so the control loop
+// latency can be checked.
+
+typedef unsigned long (*TaskFunction)(void);
+
+class Scheduler {
+  private:
+  class Task {
+    public:
+    const char *name;
+    TaskFunction function;
+    bool waiting;
+    bool ran;
+    unsigned long due;
+    unsigned long maxLatency;
+  };
+
+  private:
+  Task tasks[MAX_TASKS];
+  unsigned taskCount;
+
+  private:
+  bool isDue(Task &task, unsigned long now) {
+    return !task.waiting && (long)(now - task.due) >= 0;
+  }
+
+  void schedule(Task &task, unsigned long now, unsigned long delay) {
+    if (delay == TASK_WAIT) {
+      task.waiting = true;
+    } else {
+      task.waiting = false;
+      task.due = now + delay;
+    }
+  }
+
+  void runTask(Task &task, unsigned long now) {
+    unsigned long latency = now - task.due;
+
+    if (latency > task.maxLatency) {
+      task.maxLatency = latency;
+
+      PRINT(task.name);
+      PRINTVAR(latency);
+    }
+
+    task.ran = true;
+    schedule(task, now, task.function());
+  }
+
+  public:
+  Scheduler()
+    : taskCount(0) {
+  }
+
+  int addTask(const char *name, TaskFunction function, unsigned long delay=0) {
+    if (taskCount >= MAX_TASKS) {
+      return -1;
+    }
+
+    Task &task = tasks[taskCount];
+
+    task.name = name;
+    task.function = function;
+    task.maxLatency = 0;
+    schedule(task, halMillis(), delay);
+
+    return taskCount++;
+  }
+
+  void wake(int id) {
+    tasks[id].waiting = false;
+    tasks[id].due = halMillis();
+  }
+
+  // Milliseconds until the next task is due, or TASK_WAIT if every
+  // task is waiting to be woken
+  unsigned long nextDeadline(void) {
+    unsigned long now = halMillis();
+    unsigned long next = TASK_WAIT;
+
+    for (unsigned i=0; i<taskCount; i++) {
+      Task &task = tasks[i];
+
+      if (task.waiting) {
+        continue;
+      }
+
+      if (isDue(task, now)) {
+        return 0;
+      }
+
+      next = min(next, task.due - now);
+    }
+
+    return next;
+  }
+
+  unsigned getTaskCount(void) {
+    return taskCount;
+  }
+
+  const char *getName(int id) {
+    return tasks[id].name;
+  }
+
+  // Worst time the task has waited past its due time, ms
+  unsigned long getMaxLatency(int id) {
+    return tasks[id].maxLatency;
+  }
+
+  void run(void) {
+    for (unsigned i=0; i<taskCount; i++) {
+      tasks[i].ran = false;
+    }
+
+    // Each due task runs at most once per pass, most overdue first
+    for (;;) {
+      unsigned long now = halMillis();
+      Task *next = 0;
+
+      for (unsigned i=0; i<taskCount; i++) {
+        Task &task = tasks[i];
+
+        if (!task.ran && isDue(task, now) && (!next || (long)(task.due - next->due) < 0)) {
+          next = &task;
+        }
+      }
+
+      if (!next) {
+        break;
+      }
+
+      runTask(*next, now);
+    }
+  }
+};
@@ -0,0 +1,196 @@
+typedef enum {
+  SettingControlMode,
+  SettingTargetTemp,
+  SettingTempRange,
+  SettingDutyCycleOn,
+  SettingDutyCycleOff,
+  SettingProbeBeer,     // One per role, in TempType order
+  SettingProbeCoolant,
+  SettingProbeAir,
+  SettingControlStrategy,
+  SettingPidKp,
+  SettingPidKi,
+  SettingPidKd,
+  SettingsCount
+} SettingId;
+
+#define SETTINGS_BASE 32  // Clear of the old fixed layout at 0
+#define SETTINGS_CHANNEL_SIZE HAL_EEPROM_BANK_SIZE   // A bank of the EEPROM emulation each
+#define SETTINGS_HEADER 0xB502   // Magic and version, in one word
+#define SETTINGS_ABSENT_ADDR 1   // Word offsets from the store's base
+#define SETTINGS_SLOTS_ADDR 2
+#define SETTINGS_VALUES_ADDR 3
+#define SETTINGS_SIZE (SETTINGS_VALUES_ADDR + 4 * SettingsCount)   // Words
+#define SETTINGS_COMMIT_DELAY 5000UL  // Milliseconds
+
+static_assert(SettingsCount <= 16, "A settings bitmap must fit one word");
+static_assert(SETTINGS_BASE + SETTINGS_SIZE <= SETTINGS_CHANNEL_SIZE, "A channel's settings must fit its bank of the EEPROM emulation");
+
+//============================================================
+// Settings store
+//
+// The core's EEPROM emulation is already log structured: every changed
+// word is appended to the active flash page, and a full page has its
+// live words copied to the other one. So each setting has fixed
+// addresses, two bytes to a word, and an edit appends just the words
+// that changed. Keeping few words live keeps the copies, and so the
+// erases, rare.
+//
+// Changes are held in RAM and written once they have been stable for
+// SETTINGS_COMMIT_DELAY, so scrolling through a menu costs one write.
+//
+// Each word is written as one entry, so a power cut leaves it old or
+// new. A value whose low and high words both change has two slots: the
+// spare slot is written first, then one word of slot bits switches it
+// in. A setting is absent until its bit in the absent word is cleared,
+// which an erased word reads as. The header goes last when a store is
+// first written.
+//
+// Each channel has its own store, SETTINGS_CHANNEL_SIZE addresses on
+// from the last so it lands in its own bank of the EEPROM emulation,
+// with the same ids. The first channel's sits where the single store
+// always has.
+
+class SettingsStore {
+  private:
+  int base;
+  unsigned long values[SettingsCount];
+  unsigned long saved[SettingsCount];   // As in EEPROM
+  bool present[SettingsCount];
+  bool dirty[SettingsCount];
+  uint16_t absent;   // Bit per setting not yet saved
+  uint16_t slots;    // Bit per setting living in its second slot
+  bool formatted;
+  bool pending;
+  unsigned long changeTime;
+
+  private:
+  int valueAddr(byte id, unsigned slot) {
+    return base + SETTINGS_VALUES_ADDR + id * 4 + slot * 2;
+  }
+
+  unsigned slotOf(byte id) {
+    return (slots >> id) & 1;
+  }
+
+  unsigned long readValue(byte id, unsigned slot) {
+    int addr = valueAddr(id, slot);
+
+    return (unsigned long)halEepromReadWord(addr) | (unsigned long)halEepromReadWord(addr + 1) << 16;
+  }
+
+  void writeValue(byte id, unsigned slot) {
+    int addr = valueAddr(id, slot);
+
+    halEepromUpdateWord(addr, values[id]);
+    halEepromUpdateWord(addr + 1, values[id] >> 16);
+    saved[id] = values[id];
+  }
+
+  // One word changing is written in place; two go to the spare slot,
+  // switched in by the caller
+  void saveValue(byte id, uint16_t &newSlots) {
+    if (absent & (1 << id)) {
+      writeValue(id, slotOf(id));
+    } else if ((uint16_t)(values[id] ^ saved[id]) && (uint16_t)((values[id] ^ saved[id]) >> 16)) {
+      writeValue(id, 1 - slotOf(id));
+      newSlots ^= 1 << id;
+    } else {
+      writeValue(id, slotOf(id));
+    }
+  }
+
+  public:
+  SettingsStore()
+    : base(SETTINGS_BASE),
+      absent(0xFFFF),
+      slots(0),
+      formatted(false),
+      pending(false),
+      changeTime(0) {
+    memset(present, 0, sizeof(present));
+    memset(dirty, 0, sizeof(dirty));
+  }
+
+  void load(unsigned channel) {
+    base = SETTINGS_BASE + channel * SETTINGS_CHANNEL_SIZE;
+
+    if (halEepromReadWord(base) != SETTINGS_HEADER) {
+      PRINTLN(F("Settings unformatted"));
+      return;
+    }
+
+    formatted = true;
+    absent = halEepromReadWord(base + SETTINGS_ABSENT_ADDR);
+    slots = halEepromReadWord(base + SETTINGS_SLOTS_ADDR);
+
+    for (byte id=0; id<SettingsCount; id++) {
+      present[id] = !(absent & (1 << id));
+
+      if (present[id]) {
+        values[id] = saved[id] = readValue(id, slotOf(id));
+      }
+    }
+
+    PRINTVAR(absent);
+    PRINTVAR(slots);
+  }
+
+  bool isFormatted(void) {
+    return formatted;
+  }
+
+  bool get(SettingId id, unsigned long &value) {
+    if (present[id]) {
+      value = values[id];
+    }
+
+    return present[id];
+  }
+
+  void set(SettingId id, unsigned long value) {
+    if (present[id] && values[id] == value) {
+      return;
+    }
+
+    values[id] = value;
+    present[id] = dirty[id] = pending = true;
+    changeTime = halMillis();
+  }
+
+  bool commitDue(void) {
+    return pending && halMillis() - changeTime >= SETTINGS_COMMIT_DELAY;
+  }
+
+  // Values first, then the absent word, then the slot bits, so a cut
+  // at any point leaves each setting as it was or as it is now
+  void commit(void) {
+    if (!pending) {
+      return;
+    }
+
+    uint16_t newAbsent = absent;
+    uint16_t newSlots = slots;
+
+    pending = false;
+
+    for (byte id=0; id<SettingsCount; id++) {
+      if (dirty[id]) {
+        saveValue(id, newSlots);
+        newAbsent &= ~(1 << id);
+        dirty[id] = false;
+      }
+    }
+
+    halEepromUpdateWord(base + SETTINGS_ABSENT_ADDR, newAbsent);
+    halEepromUpdateWord(base + SETTINGS_SLOTS_ADDR, newSlots);
+
+    if (!formatted) {
+      halEepromUpdateWord(base, SETTINGS_HEADER);
+      formatted = true;
+    }
+
+    absent = newAbsent;
+    slots = newSlots;
+  }
+};
@@ -0,0 +1,243 @@
+#ifdef TELEMETRY
+
+#define TELEMETRY_RING_SIZE 512  // Bytes
+#define TELEMETRY_POLL 10UL  // Milliseconds
+#define TELEMETRY_HEADER 6   // Type, sequence and timestamp
+#define TELEMETRY_CRC_INIT 0xFFFF
+
+//============================================================
+// Binary telemetry
+//
+// Define TELEMETRY to stream samples, controller state changes and
+// relay switches over the serial port. Each frame is
+//
+//   type (1), sequence (1), timestamp ms (4), body, CRC-16 (2)
+//
+// little endian, with a CCITT CRC over everything before it, COBS
+// encoded and terminated by a zero byte, so a reader can join the
+// stream anywhere. Tools/telemetry_decode.cpp turns it back into CSV.
+//
+// Frames are COBS encoded straight from the caller's data into a TX
+// ring, with no payload buffer. If the ring cannot take a whole frame
+// the frame is dropped rather than blocking the control loop; the
+// sequence number still advances, so the reader sees the gap. The
+// telemetry task drains the ring only as fast as the UART accepts
+// bytes, and holds off while a history export owns the port. A 16
+// probe sample frame is 76 bytes, well under 1% of a 115200 baud link
+// per second. Control and relay frames carry the vessel channel they
+// describe.
+//
+// Don't combine with DEBUG or PROFILE: their text shares the port.
+
+typedef enum {
+  TelemetrySample = 1,    // Probe mask (2), then per probe temp (2) and age ms (2)
+  TelemetryControl = 2,   // Channel, mode, strategy, state, target, range (1 each), PID output (2)
+  TelemetryRelay = 3      // Channel, on (1 each)
+} TelemetryFrame;
+
+class Telemetry {
+  private:
+  byte ring[TELEMETRY_RING_SIZE];
+  unsigned head;        // Next byte written
+  unsigned tail;        // Next byte sent
+  unsigned committed;   // End of the last complete frame
+  unsigned codePos;     // COBS code byte of the current block
+  byte code;
+  uint16_t crc;
+  byte sequence;
+
+  bool lastPower[CHANNELS];
+  byte lastControl[CHANNELS][5];
+
+  public:
+  unsigned long frames;
+  unsigned long dropped;
+
+  private:
+  unsigned used(void) {
+    return (head + TELEMETRY_RING_SIZE - tail) % TELEMETRY_RING_SIZE;
+  }
+
+  void push(byte b) {
+    ring[head] = b;
+    head = (head + 1) % TELEMETRY_RING_SIZE;
+  }
+
+  void startBlock(void) {
+    codePos = head;
+    push(0);
+    code = 1;
+  }
+
+  void encode(byte b) {
+    if (b == 0) {
+      ring[codePos] = code;
+      startBlock();
+    } else {
+      push(b);
+
+      if (++code == 0xFF) {
+        ring[codePos] = code;
+        startBlock();
+      }
+    }
+  }
+
+  void updateCrc(byte b) {
+    crc ^= (uint16_t)b << 8;
+
+    for (unsigned i=0; i<8; i++) {
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+
+  void put(byte b) {
+    updateCrc(b);
+    encode(b);
+  }
+
+  void put16(uint16_t v) {
+    put(v);
+    put(v >> 8);
+  }
+
+  void put32(uint32_t v) {
+    put16(v);
+    put16(v >> 16);
+  }
+
+  // Reserves room for the worst case encoding of a frame, or drops it
+  bool begin(TelemetryFrame type, unsigned long timestamp, unsigned bodyBytes) {
+    unsigned payload = TELEMETRY_HEADER + bodyBytes + 2;
+    unsigned encoded = payload + payload / 254 + 2;
+
+    sequence++;
+
+    if (TELEMETRY_RING_SIZE - 1 - used() < encoded) {
+      dropped++;
+
+      return false;
+    }
+
+    crc = TELEMETRY_CRC_INIT;
+    startBlock();
+
+    put(type);
+    put(sequence);
+    put32(timestamp);
+
+    return true;
+  }
+
+  void end(void) {
+    uint16_t sum = crc;
+
+    encode(sum);
+    encode(sum >> 8);
+
+    ring[codePos] = code;
+    push(0);
+
+    committed = head;
+    frames++;
+  }
+
+  public:
+  Telemetry()
+    : head(0),
+      tail(0),
+      committed(0),
+      sequence(0),
+      frames(0),
+      dropped(0) {
+    memset(lastPower, 0, sizeof(lastPower));
+    memset(lastControl, 0xFF, sizeof(lastControl));
+  }
+
+  // Probes with a bit set in 'updated', read in place from the samples
+  void sendSamples(unsigned long timestamp, const ProbeSamples &samples, unsigned updated) {
+    unsigned count = 0;
+
+    for (unsigned p=0; p<samples.count; p++) {
+      if (updated & (1 << p)) {
+        count++;
+      }
+    }
+
+    if (!count || !begin(TelemetrySample, timestamp, 2 + 4 * count)) {
+      return;
+    }
+
+    put16(updated);
+
+    for (unsigned p=0; p<samples.count; p++) {
+      if (updated & (1 << p)) {
+        put16(samples.temp[p]);
+        put16(min(timestamp - samples.time[p], 0xFFFFUL));
+      }
+    }
+
+    end();
+  }
+
+  // Sends a control frame when a channel's settings or state change,
+  // and a relay frame when its load switches
+  void sendControl(unsigned long timestamp, unsigned channel, LoadController &loadControl) {
+    bool power = loadControl.getPowerControlState() == LoadController::Energised;
+    byte control[5] = {
+      (byte)loadControl.getControlMode(),
+      (byte)loadControl.getStrategy(),
+      (byte)loadControl.getActiveState(),
+      (byte)loadControl.getTargetTemp(),
+      (byte)loadControl.getTempRange()
+    };
+
+    if (memcmp(control, lastControl[channel], sizeof(control)) && begin(TelemetryControl, timestamp, 1 + sizeof(control) + 2)) {
+      put(channel);
+
+      for (unsigned i=0; i<sizeof(control); i++) {
+        put(control[i]);
+      }
+
+      put16(loadControl.getPidOutput());
+      end();
+
+      memcpy(lastControl[channel], control, sizeof(control));
+    }
+
+    if (power != lastPower[channel] && begin(TelemetryRelay, timestamp, 2)) {
+      put(channel);
+      put(power);
+      end();
+
+      lastPower[channel] = power;
+    }
+  }
+
+  // Sends what the UART will take without blocking
+  void drain(void) {
+    while (tail != committed) {
+      unsigned run = (committed > tail ? committed : TELEMETRY_RING_SIZE) - tail;
+      unsigned count = min(run, halSerialWritable());
+
+      if (!count) {
+        break;
+      }
+
+      count = halSerialWrite(ring + tail, count);
+      tail = (tail + count) % TELEMETRY_RING_SIZE;
+
+      if (count < run) {
+        break;
+      }
+    }
+  }
+
+  bool pending(void) {
+    return tail != committed;
+  }
+};
+
+Telemetry telemetry;
+
+#endif
@@ -1,42 +1,277 @@
-#include <DallasTemperature.h>
+#define SENSOR_INTERVAL 4000UL  // Milliseconds
+#define SENSOR_FAST_INTERVAL 1000UL  // Milliseconds
+#define SENSOR_RETRIES 2
+#define SENSOR_DEFAULT_RESOLUTION 10
+
+//============================================================
+// Pipelined probe acquisition
+//
+// Each probe runs its own conversion, started by address at its own
+// resolution and cadence. A finished probe's scratchpad is read while
+// the others are still converting, and its next conversion is started
+// straight away. Reads are CRC checked and retried before the reading
+// is reported disconnected, and every reading then passes through the
+// probe's ProbeFilter.
+//
+// Lower resolutions convert faster: 9 bits in 94ms up to 12 bits in
+// 750ms. The beer probe can be sampled faster while the load is
+// active, so the controller sees changes sooner.
+//
+// Probes are found by searching the bus at startup. Each channel's
+// roles are stored in its settings as the low 32 bits of the probe's
+// serial number. A role whose probe is missing takes the first
+// unclaimed probe, beer probes for every channel first, so swapping a
+// probe needs no reflash.
 
 class TempSensors {
   private:
-  static const byte SENSOR_ADDR_BEER[];
-  static const byte SENSOR_ADDR_COOLANT[];
-  static const byte SENSOR_ADDR_AIR[];
+  static const byte LEGACY_ADDRS[PROBE_ROLES][8];
+  static const byte ROLE_RESOLUTIONS[PROBE_ROLES];
+
+  private:
+  HalProbeBus bus;
+  unsigned fastProbes;    // Bit per beer probe being sampled fast
+
+  // Per probe state, indexed as ProbeSamples
+  unsigned count;
+  DeviceAddress addrs[MAX_PROBES];
+  byte resolution[MAX_PROBES];
+  bool converting[MAX_PROBES];
+  bool sampled[MAX_PROBES];
+  unsigned long started[MAX_PROBES];
+  unsigned long due[MAX_PROBES];
+  ProbeFilter filters[MAX_PROBES];
 
   private:
-  OneWire *ds;
-  DallasTemperature *rawSensors;
-  
+  unsigned long interval(unsigned probe) {
+    return fastProbes & (1 << probe) ? SENSOR_FAST_INTERVAL : SENSOR_INTERVAL;
+  }
+
+  bool isDue(unsigned probe, unsigned long now) {
+    return (long)(now - due[probe]) >= 0;
+  }
+
+  unsigned long serialId(const byte *addr) {
+    return (unsigned long)addr[1] | (unsigned long)addr[2] << 8 | (unsigned long)addr[3] << 16 | (unsigned long)addr[4] << 24;
+  }
+
+  int findProbe(unsigned long id) {
+    for (unsigned p=0; p<count; p++) {
+      if (serialId(addrs[p]) == id) {
+        return p;
+      }
+    }
+
+    return -1;
+  }
+
+  bool isClaimed(unsigned probe, const ProbeSamples &samples) {
+    for (unsigned c=0; c<CHANNELS; c++) {
+      for (unsigned r=0; r<PROBE_ROLES; r++) {
+        if (samples.roleProbe[c][r] == probe) {
+          return true;
+        }
+      }
+    }
+
+    return false;
+  }
+
+  void discover(void) {
+    count = min(bus.getDeviceCount(), (unsigned)MAX_PROBES);
+
+    for (unsigned p=0; p<count; p++) {
+      if (!bus.getAddress(addrs[p], p)) {
+        count = p;
+        break;
+      }
+    }
+
+    PRINTVAR(count);
+  }
+
+  void assignRoles(ProbeSamples &samples, Channel *channels) {
+    unsigned long id;
+
+    for (unsigned c=0; c<CHANNELS; c++) {
+      for (unsigned r=0; r<PROBE_ROLES; r++) {
+        SettingsStore &store = channels[c].settings;
+        int probe = store.get((SettingId)(SettingProbeBeer + r), id) ? findProbe(id) : -1;
+
+        samples.roleProbe[c][r] = probe < 0 ? PROBE_NONE : probe;
+      }
+    }
+
+    // Missing roles take their old compiled-in probe if present, on
+    // the first channel, or else the first probe nobody has claimed
+    for (unsigned r=0; r<PROBE_ROLES; r++) {
+      for (unsigned c=0; c<CHANNELS; c++) {
+        if (samples.hasRole(c, (TempType)r)) {
+          continue;
+        }
+
+        int probe = c == 0 ? findProbe(serialId(LEGACY_ADDRS[r])) : -1;
+
+        if (probe < 0 || isClaimed(probe, samples)) {
+          for (probe=0; probe<(int)count && isClaimed(probe, samples); probe++) {
+          }
+        }
+
+        if (probe < (int)count) {
+          samples.roleProbe[c][r] = probe;
+          channels[c].settings.set((SettingId)(SettingProbeBeer + r), serialId(addrs[probe]));
+        }
+      }
+    }
+  }
+
+  void startConversion(unsigned probe, unsigned long now) {
+    bus.startConversion(addrs[probe]);
+
+    converting[probe] = true;
+    started[probe] = now;
+    due[probe] = now + bus.conversionMillis(resolution[probe]);
+  }
+
+  // The low bits are undefined below 12 bit resolution
+  TempFixed readProbe(unsigned probe) {
+    ScratchPad scratchPad;
+
+    for (unsigned i=0; i<=SENSOR_RETRIES; i++) {
+      if (bus.readScratchPad(addrs[probe], scratchPad)) {
+        int16_t raw = (int16_t)(scratchPad[1] << 8 | scratchPad[0]);
+
+        raw &= ~((1 << (12 - resolution[probe])) - 1);
+
+        return raw;
+      }
+
+      HAL_COUNT(sensorRetries, 1);
+    }
+
+    return TEMP_DISCONNECTED;
+  }
+
   public:
-  TempSensors() {
+  TempSensors()
+    : fastProbes(0),
+      count(0) {
+  }
+
+  void init(int pin, ProbeSamples &samples, Channel *channels) {
+    bus.begin(pin);
+
+    discover();
+    assignRoles(samples, channels);
+
+    samples.count = count;
+
+    for (unsigned p=0; p<count; p++) {
+      resolution[p] = SENSOR_DEFAULT_RESOLUTION;
+    }
+
+    for (unsigned c=0; c<CHANNELS; c++) {
+      for (unsigned r=0; r<PROBE_ROLES; r++) {
+        if (samples.hasRole(c, (TempType)r)) {
+          resolution[samples.roleProbe[c][r]] = ROLE_RESOLUTIONS[r];
+        }
+      }
+    }
+
+    for (unsigned p=0; p<count; p++) {
+      bus.setResolution(addrs[p], resolution[p]);
+
+      converting[p] = false;
+      sampled[p] = false;
+      started[p] = due[p] = halMillis();
+    }
+  }
+
+  // 9 to 12 bits
+  void setResolution(unsigned probe, byte bits) {
+    resolution[probe] = constrain(bits, 9, 12);
+    bus.setResolution(addrs[probe], resolution[probe]);
   }
 
-  void init(int pin) {
-    ds = new OneWire(pin);
-    rawSensors = new DallasTemperature(ds);
+  void setFastSampling(unsigned channel, bool fast, const ProbeSamples &samples) {
+    if (!samples.hasRole(channel, beer)) {
+      return;
+    }
 
-    rawSensors->begin();
-    rawSensors->setWaitForConversion(false);
+    unsigned probe = samples.roleProbe[channel][beer];
+    unsigned mask = 1 << probe;
+
+    if (fast == ((fastProbes & mask) != 0)) {
+      return;
+    }
+
+    fastProbes ^= mask;
+
+    if (!converting[probe]) {
+      due[probe] = started[probe] + interval(probe);
+    }
   }
 
-  void requestTemps(void) {
-    rawSensors->requestTemperatures();
+  // Reads finished probes and starts due conversions. Returns a bit
+  // per probe with a new reading.
+  unsigned poll(ProbeSamples &samples) {
+    PROFILE_SCOPE(ProfileSensorPoll);
+
+    unsigned long now = halMillis();
+    unsigned updated = 0;
+
+    for (unsigned p=0; p<count; p++) {
+      if (converting[p] && isDue(p, now)) {
+        samples.temp[p] = filters[p].update(readProbe(p));
+        samples.time[p] = started[p];
+
+        converting[p] = false;
+        sampled[p] = true;
+        due[p] = started[p] + interval(p);
+
+        updated |= 1 << p;
+      }
+
+      if (!converting[p] && isDue(p, now)) {
+        startConversion(p, now);
+      }
+    }
+
+    return updated;
   }
 
-  bool tempsReady(void) {
-    return rawSensors->isConversionComplete();
+  // Milliseconds until poll() next has work to do
+  unsigned long nextEvent(void) {
+    unsigned long now = halMillis();
+    unsigned long next = ULONG_MAX;
+
+    for (unsigned p=0; p<count; p++) {
+      if (isDue(p, now)) {
+        return 0;
+      }
+
+      next = min(next, due[p] - now);
+    }
+
+    return next;
   }
-  
-  void getTemps(float *temps) {
-    temps[beer] = rawSensors->getTempC(SENSOR_ADDR_BEER);
-    temps[coolant] = rawSensors->getTempC(SENSOR_ADDR_COOLANT);
-    temps[air] = rawSensors->getTempC(SENSOR_ADDR_AIR);
+
+  // True once every probe has been read
+  bool haveTemps(void) {
+    for (unsigned p=0; p<count; p++) {
+      if (!sampled[p]) {
+        return false;
+      }
+    }
+
+    return true;
   }
 };
 
-const byte TempSensors::SENSOR_ADDR_AIR[] = { 0x28, 0xee, 0xa0, 0xce, 0x15, 0x21, 0x01, 0x1f };
-const byte TempSensors::SENSOR_ADDR_COOLANT[] = { 0x28, 0x91, 0x40, 0xc9, 0x15, 0x21, 0x01, 0xff };
-const byte TempSensors::SENSOR_ADDR_BEER[] = { 0x28, 0xd5, 0xdb, 0xc3, 0x15, 0x21, 0x01, 0x8a };
+const byte TempSensors::LEGACY_ADDRS[PROBE_ROLES][8] = {
+  { 0x28, 0xd5, 0xdb, 0xc3, 0x15, 0x21, 0x01, 0x8a },  // Beer
+  { 0x28, 0x91, 0x40, 0xc9, 0x15, 0x21, 0x01, 0xff },  // Coolant
+  { 0x28, 0xee, 0xa0, 0xce, 0x15, 0x21, 0x01, 0x1f }   // Air
+};
+
+const byte TempSensors::ROLE_RESOLUTIONS[PROBE_ROLES] = { 12, 11, 10 };
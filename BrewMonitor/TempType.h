@@ -1,5 +1,22 @@
+// Probe roles
 typedef enum {
   beer = 0,
   coolant = 1,
   air = 2
 } TempType;
+
+#define PROBE_ROLES 3
+#define MAX_PROBES 16
+#define PROBE_NONE 0xFF
+#define MAX_CHANNELS 8
+
+#if CHANNELS < 1 || CHANNELS > MAX_CHANNELS
+  #error CHANNELS must be 1 to MAX_CHANNELS
+#endif
+
+// Temperatures are carried as the probes report them, in 1/16 Deg
+// steps, and only turned into text for display.
+typedef int16_t TempFixed;
+
+#define TEMP_SCALE 16  // Steps per degree
+#define TEMP_DISCONNECTED (DEVICE_DISCONNECTED_C * TEMP_SCALE)
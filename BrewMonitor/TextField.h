@@ -0,0 +1,108 @@
+#define TEXT_FIELD_MAX 13
+
+//============================================================
+// Heap-free text output
+//
+// formatTenths() writes a fixed-point value into a caller's buffer.
+// A TextField remembers the characters it last put on screen and only
+// redraws the cells that change, padding with spaces so shorter text
+// clears what was there before. Fonts are assumed fixed pitch.
+
+// Writes tenths as "-12.3" and returns a pointer to the terminator
+char *formatTenths(char *buf, long tenths) {
+  char digits[12];
+  unsigned n = 0;
+  unsigned long value = tenths < 0 ? -tenths : tenths;
+
+  do {
+    digits[n++] = '0' + value % 10;
+    value /= 10;
+  } while (value || n < 2);
+
+  if (tenths < 0) {
+    *buf++ = '-';
+  }
+
+  while (n > 1) {
+    *buf++ = digits[--n];
+  }
+
+  *buf++ = '.';
+  *buf++ = digits[0];
+  *buf = 0;
+
+  return buf;
+}
+
+// Writes "lo/hi" in tenths, or in whole degrees if tenths would take
+// more than 'chars', so "-1.5/12.0" fits nine characters and so does
+// "-20/100" in place of "-20.0/100.0"
+char *formatRange(char *buf, long loTenths, long hiTenths, unsigned chars) {
+  char *end = formatTenths(buf, loTenths);
+
+  *end++ = '/';
+  end = formatTenths(end, hiTenths);
+
+  if ((unsigned)(end - buf) <= chars) {
+    return end;
+  }
+
+  long lo = (loTenths + (loTenths < 0 ? -5 : 5)) / 10;
+  long hi = (hiTenths + (hiTenths < 0 ? -5 : 5)) / 10;
+
+  return buf + sprintf(buf, "%ld/%ld", lo, hi);
+}
+
+// Rounds a probe temperature to the nearest tenth
+long tempToTenths(TempFixed temp) {
+  return ((long)temp * 10 + (temp < 0 ? -TEMP_SCALE / 2 : TEMP_SCALE / 2)) / TEMP_SCALE;
+}
+
+class TextField {
+  private:
+  unsigned x, y;
+  unsigned chars;
+  bool valid;
+  char shown[TEXT_FIELD_MAX];
+
+  public:
+  TextField()
+    : x(0),
+      y(0),
+      chars(0),
+      valid(false) {
+  }
+
+  void init(unsigned fieldX, unsigned fieldY, unsigned fieldChars) {
+    x = fieldX;
+    y = fieldY;
+    chars = min(fieldChars, (unsigned)TEXT_FIELD_MAX);
+    valid = false;
+  }
+
+  // Forget the screen contents, e.g. after a clear
+  void invalidate(void) {
+    valid = false;
+  }
+
+  // Text beyond the field width is cut off. The caller sets the font.
+  void update(HalDisplay &tft, const char *text, unsigned colour) {
+    unsigned pitch = tft.getFont().width + 1;
+    bool ended = false;
+
+    for (unsigned i=0; i<chars; i++) {
+      if (!ended && !text[i]) {
+        ended = true;
+      }
+
+      char ch = ended ? ' ' : text[i];
+
+      if (!valid || shown[i] != ch) {
+        tft.drawChar(x + i*pitch, y, ch, colour);
+        shown[i] = ch;
+      }
+    }
+
+    valid = true;
+  }
+};
@@ -0,0 +1,98 @@
+#define VESSEL_TOP 12
+#define VESSEL_ROW 20
+#define VESSEL_TEMP_X 24
+#define VESSEL_STATE_X 110
+#define VESSEL_STATE_CHARS 13   // "Heat 25 Fault"
+
+static_assert(sizeof("Heat 25 Fault") - 1 <= VESSEL_STATE_CHARS, "Vessel state text is cut off");
+static_assert(VESSEL_STATE_CHARS <= TEXT_FIELD_MAX, "Vessel state is wider than a TextField");
+
+//============================================================
+// Vessel overview
+//
+// One row per channel: its number, beer temperature, and mode, target
+// and whether its load is driving. The sketch alternates this with the
+// chart of the first vessel. Rows are TextFields, so an update only
+// redraws characters that changed.
+
+class VesselDisplay {
+  private:
+  HalDisplay &tft;
+  TextField tempFields[CHANNELS];
+  TextField stateFields[CHANNELS];
+  bool visible;
+
+  private:
+  void drawRow(unsigned c, Channel &channel, const ProbeSamples &samples) {
+    LoadController &control = channel.control;
+    TempFixed temp = samples.roleTemp(c, beer);
+    char text[24];
+
+    tft.setBackgroundColor(COLOR_BLACK);
+
+    if (temp <= TEMP_DISCONNECTED) {
+      strcpy(text, "Err");
+    } else {
+      formatTenths(text, tempToTenths(temp));
+    }
+
+    tft.setFont(Terminal11x16);
+    tempFields[c].update(tft, text, COLOR_BLUE);
+
+    snprintf(text, sizeof(text), "%s %u %s",
+             control.getControlMode() == LoadController::Heating ? "Heat" : "Cool",
+             control.getTargetTemp(),
+             control.getActiveState() == LoadController::Faulted ? "Fault" :
+             control.getPowerControlState() == LoadController::Off ? "Off" : (channel.isActive() ? "On" : "Idle"));
+
+    tft.setFont(Terminal6x8);
+    stateFields[c].update(tft, text, channel.isActive() ? COLOR_RED : COLOR_WHITE);
+  }
+
+  public:
+  VesselDisplay(HalDisplay &tft)
+    : tft(tft),
+      visible(false) {
+  }
+
+  bool isVisible(void) {
+    return visible;
+  }
+
+  void hide(void) {
+    visible = false;
+  }
+
+  void redraw(Channel *channels, const ProbeSamples &samples) {
+    visible = true;
+
+    tft.clearScroll();
+    tft.clear();
+    tft.setFont(Terminal6x8);
+    tft.setBackgroundColor(COLOR_BLACK);
+    tft.drawText(0, 0, "Vessel  Beer", COLOR_YELLOW);
+    tft.drawText(VESSEL_STATE_X, 0, "Target", COLOR_YELLOW);
+
+    for (unsigned c=0; c<CHANNELS; c++) {
+      unsigned y = VESSEL_TOP + c * VESSEL_ROW;
+      char number[2] = { (char)('1' + c), 0 };
+
+      tft.setFont(Terminal11x16);
+      tft.drawText(0, y, number, COLOR_YELLOW);
+
+      tempFields[c].init(VESSEL_TEMP_X, y, 6);
+      stateFields[c].init(VESSEL_STATE_X, y + 4, VESSEL_STATE_CHARS);
+      drawRow(c, channels[c], samples);
+    }
+  }
+
+  void update(Channel *channels, const ProbeSamples &samples) {
+    if (!visible) {
+      return;
+    }
+
+    for (unsigned c=0; c<CHANNELS; c++) {
+      drawRow(c, channels[c], samples);
+    }
+  }
+};
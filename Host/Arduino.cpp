@@ -0,0 +1,391 @@
+#include "Arduino.h"
+
+#include <chrono>
+#include <vector>
+
+//============================================================
+// Virtual clock and scripted pins
+
+#define HOST_SERIAL_WRITABLE 64   // Bytes the core's TX buffer takes
+
+class PinEdge {
+  public:
+  unsigned long due;
+  int pin;
+  int level;
+};
+
+static unsigned long nowMillis = 0;
+static unsigned nowMicros = 0;   // Within the current millisecond
+
+static int levels[HOST_PINS];
+static int modes[HOST_PINS];
+static int outputs[HOST_PINS];
+static voidFuncPtr handlers[HOST_PINS];
+static int handlerModes[HOST_PINS];
+static std::vector<PinEdge> edges;
+
+static std::string serialInput;
+static std::string serialOutput;
+static bool serialCapture = false;
+static unsigned serialWritable = HOST_SERIAL_WRITABLE;
+static unsigned long serialBaud = 0;     // 0 while the link takes serialWritable every call
+static unsigned long serialQueued = 0;   // Bytes in the TX buffer at serialSince
+static unsigned long serialSince = 0;    // Microseconds
+
+unsigned long hostSleptMillis = 0;
+
+static unsigned long spiClock = 0;      // Hz, 0 while transfers take no time
+static unsigned long long spiBits = 0;  // Sent but not yet a whole microsecond
+
+HardwareSerial Serial;
+
+static bool isValidPin(int pin) {
+  return pin >= 0 && pin < HOST_PINS;
+}
+
+static void changePin(int pin, int level) {
+  int old = levels[pin];
+
+  levels[pin] = level;
+
+  if (old == level || !handlers[pin]) {
+    return;
+  }
+
+  int mode = handlerModes[pin];
+
+  if (mode == CHANGE || (mode == RISING && level == HIGH) || (mode == FALLING && level == LOW)) {
+    handlers[pin]();
+  }
+}
+
+// Earliest edge due by 'until', or -1
+static int nextEdge(unsigned long until) {
+  int next = -1;
+
+  for (unsigned i=0; i<edges.size(); i++) {
+    if ((long)(edges[i].due - until) > 0) {
+      continue;
+    }
+
+    if (next < 0 || (long)(edges[i].due - edges[next].due) < 0) {
+      next = i;
+    }
+  }
+
+  return next;
+}
+
+void hostAdvance(unsigned long ms) {
+  unsigned long until = nowMillis + ms;
+  int next;
+
+  while ((next = nextEdge(until)) >= 0) {
+    PinEdge edge = edges[next];
+
+    edges.erase(edges.begin() + next);
+
+    if ((long)(edge.due - nowMillis) > 0) {
+      nowMillis = edge.due;
+      nowMicros = 0;
+    }
+
+    changePin(edge.pin, edge.level);
+  }
+
+  if (ms) {
+    nowMillis = until;
+    nowMicros = 0;
+  }
+}
+
+void hostSetMillis(unsigned long ms) {
+  nowMillis = ms;
+  nowMicros = 0;
+}
+
+void hostWaitForInterrupt(void) {
+  hostSleptMillis++;
+  hostAdvance(1);
+}
+
+void hostSetSpiClock(unsigned long hz) {
+  spiClock = hz;
+  spiBits = 0;
+}
+
+void hostSpiTransfer(unsigned long bytes) {
+  if (!spiClock) {
+    return;
+  }
+
+  spiBits += 8ULL * bytes * 1000000ULL;
+  nowMicros += spiBits / spiClock;
+  spiBits %= spiClock;
+
+  if (nowMicros >= 1000) {
+    unsigned micros = nowMicros % 1000;
+
+    hostAdvance(nowMicros / 1000);
+    nowMicros = micros;
+  }
+}
+
+uint32_t hostCycles(void) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+unsigned long hostRealMillis(void) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void hostSetPin(int pin, int level) {
+  if (isValidPin(pin)) {
+    changePin(pin, level);
+  }
+}
+
+void hostSchedulePin(unsigned long delay, int pin, int level) {
+  PinEdge edge;
+
+  edge.due = nowMillis + delay;
+  edge.pin = pin;
+  edge.level = level;
+
+  edges.push_back(edge);
+}
+
+bool hostPinsPending(void) {
+  return !edges.empty();
+}
+
+int hostPinLevel(int pin) {
+  return isValidPin(pin) ? outputs[pin] : LOW;
+}
+
+void hostSerialInput(const void *data, unsigned count) {
+  serialInput.append((const char *)data, count);
+}
+
+void hostSerialCapture(bool capture) {
+  serialCapture = capture;
+}
+
+std::string &hostSerialOutput(void) {
+  return serialOutput;
+}
+
+void hostSerialSetWritable(unsigned bytes) {
+  serialWritable = bytes;
+  serialBaud = 0;
+}
+
+void hostSerialSetBaud(unsigned long baud) {
+  serialBaud = baud;
+  serialQueued = 0;
+  serialSince = micros();
+}
+
+// Empties the TX buffer at ten bits a byte since it was last looked at
+static void drainSerial(void) {
+  unsigned long now = micros();
+  unsigned long sent = (unsigned long long)(now - serialSince) * serialBaud / 10000000ULL;
+
+  // An idle link banks no time, and a part byte carries over
+  if (sent >= serialQueued) {
+    serialQueued = 0;
+    serialSince = now;
+  } else if (sent) {
+    serialQueued -= sent;
+    serialSince += sent * 10000000ULL / serialBaud;
+  }
+}
+
+void hostResetBoard(void) {
+  nowMillis = 0;
+  nowMicros = 0;
+  hostSleptMillis = 0;
+  spiClock = 0;
+  spiBits = 0;
+
+  for (int p=0; p<HOST_PINS; p++) {
+    levels[p] = HIGH;
+    modes[p] = INPUT;
+    outputs[p] = LOW;
+    handlers[p] = 0;
+  }
+
+  edges.clear();
+  serialInput.clear();
+  serialOutput.clear();
+  serialCapture = false;
+  serialWritable = HOST_SERIAL_WRITABLE;
+  serialBaud = 0;
+}
+
+// Inputs idle high, as every button has a pull-up
+static struct HostBoardInit {
+  HostBoardInit() {
+    hostResetBoard();
+  }
+} hostBoardInit;
+
+//============================================================
+// Arduino core
+
+unsigned long millis(void) {
+  return nowMillis;
+}
+
+unsigned long micros(void) {
+  return nowMillis * 1000UL + nowMicros;
+}
+
+void delay(unsigned long ms) {
+  hostAdvance(ms);
+}
+
+void delayMicroseconds(unsigned us) {
+  nowMicros += us;
+
+  if (nowMicros >= 1000) {
+    unsigned ms = nowMicros / 1000;
+
+    nowMicros %= 1000;
+    hostAdvance(ms);
+  }
+}
+
+int digitalRead(int pin) {
+  return isValidPin(pin) ? levels[pin] : LOW;
+}
+
+void digitalWrite(int pin, int value) {
+  if (isValidPin(pin)) {
+    outputs[pin] = value;
+  }
+}
+
+void pinMode(int pin, int mode) {
+  if (isValidPin(pin)) {
+    modes[pin] = mode;
+  }
+}
+
+void attachInterrupt(int pin, voidFuncPtr handler, int mode) {
+  if (isValidPin(pin)) {
+    handlers[pin] = handler;
+    handlerModes[pin] = mode;
+  }
+}
+
+void detachInterrupt(int pin) {
+  if (isValidPin(pin)) {
+    handlers[pin] = 0;
+  }
+}
+
+// Interrupts only ever fire from inside a clock advance, never in the
+// middle of firmware code, so there is nothing to mask
+void noInterrupts(void) {
+}
+
+void interrupts(void) {
+}
+
+//============================================================
+// String and Serial
+
+String::String(double v, int digits) {
+  char buf[64];
+
+  snprintf(buf, sizeof(buf), "%.*f", digits, v);
+  text = buf;
+}
+
+void HardwareSerial::begin(unsigned long baud) {
+}
+
+int HardwareSerial::available(void) {
+  return serialInput.size();
+}
+
+int HardwareSerial::read(void) {
+  if (serialInput.empty()) {
+    return -1;
+  }
+
+  int c = (byte)serialInput[0];
+
+  serialInput.erase(0, 1);
+
+  return c;
+}
+
+int HardwareSerial::availableForWrite(void) {
+  if (serialBaud) {
+    drainSerial();
+
+    return HOST_SERIAL_WRITABLE - serialQueued;
+  }
+
+  return serialWritable;
+}
+
+size_t HardwareSerial::write(uint8_t b) {
+  return write(&b, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t *data, size_t count) {
+  if (serialBaud) {
+    drainSerial();
+    serialQueued += count;
+  }
+
+  if (serialCapture) {
+    serialOutput.append((const char *)data, count);
+  } else {
+    fwrite(data, 1, count, stdout);
+  }
+
+  return count;
+}
+
+void HardwareSerial::put(const char *text) {
+  write((const uint8_t *)text, strlen(text));
+}
+
+size_t HardwareSerial::print(long v, int base) {
+  if (base == 10) {
+    char buf[24];
+
+    snprintf(buf, sizeof(buf), "%ld", v);
+
+    return print(buf);
+  }
+
+  return print((unsigned long)v, base);
+}
+
+size_t HardwareSerial::print(unsigned long v, int base) {
+  char buf[72];
+  unsigned n = sizeof(buf) - 1;
+
+  buf[n] = 0;
+
+  do {
+    unsigned digit = v % base;
+
+    buf[--n] = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    v /= base;
+  } while (v);
+
+  return print(buf + n);
+}
+
+size_t HardwareSerial::print(double v, int digits) {
+  return print(String(v, digits));
+}
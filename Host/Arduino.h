@@ -0,0 +1,170 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+//============================================================
+// Host stand-in for the Arduino core
+//
+// Just enough of the STM32F1 core for the firmware to build and run on
+// Linux. The clock is virtual and only moves when the host moves it,
+// by delay(), a WFI from the HAL, or a test calling hostAdvance().
+// Pins hold levels a test can script, with change interrupts fired as
+// the clock passes each scripted edge. Serial goes to stdout, or into
+// a buffer a test can read.
+//
+// unsigned long is 64 bits here, so millis() wraps at ULONG_MAX rather
+// than at 2^32. The firmware only ever subtracts timestamps, so a test
+// that starts the clock just short of ULONG_MAX exercises the same
+// rollover paths as the board does after 49 days.
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define INPUT_PULLDOWN 3
+
+#define CHANGE 1
+#define RISING 2
+#define FALLING 3
+
+enum {
+  PA0, PA1, PA2, PA3, PA4, PA5, PA6, PA7, PA8, PA9, PA10, PA11, PA12, PA13, PA14, PA15,
+  PB0, PB1, PB2, PB3, PB4, PB5, PB6, PB7, PB8, PB9, PB10, PB11, PB12, PB13, PB14, PB15,
+  PC13, PC14, PC15,
+  HOST_PINS
+};
+
+#ifndef PI
+  #define PI 3.1415926535897932384626433832795
+#endif
+
+#define constrain(amt, low, high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+// The core's min() and max() are macros taking mixed types
+template <class A, class B> auto min(A a, B b) -> decltype(a + b) {
+  return a < b ? a : b;
+}
+
+template <class A, class B> auto max(A a, B b) -> decltype(a + b) {
+  return a > b ? a : b;
+}
+
+typedef void (*voidFuncPtr)(void);
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned us);
+
+int digitalRead(int pin);
+void digitalWrite(int pin, int value);
+void pinMode(int pin, int mode);
+void attachInterrupt(int pin, voidFuncPtr handler, int mode);
+void detachInterrupt(int pin);
+void noInterrupts(void);
+void interrupts(void);
+
+//============================================================
+// Strings
+//
+// Flash strings are plain pointers on the host, and String only does
+// what the debug macros and the TFT driver need.
+
+class __FlashStringHelper;
+#define F(s) ((const __FlashStringHelper *)(s))
+
+class String {
+  private:
+  std::string text;
+
+  public:
+  String(const char *s = "") : text(s) { }
+  String(const __FlashStringHelper *s) : text((const char *)s) { }
+  String(char c) : text(1, c) { }
+  String(int v) : text(std::to_string(v)) { }
+  String(unsigned v) : text(std::to_string(v)) { }
+  String(long v) : text(std::to_string(v)) { }
+  String(unsigned long v) : text(std::to_string(v)) { }
+  String(long long v) : text(std::to_string(v)) { }
+  String(unsigned long long v) : text(std::to_string(v)) { }
+  String(double v, int digits = 2);
+
+  String operator+(const String &other) const {
+    String result(*this);
+
+    result.text += other.text;
+
+    return result;
+  }
+
+  friend String operator+(const char *left, const String &right) {
+    return String(left) + right;
+  }
+
+  unsigned length(void) const {
+    return text.size();
+  }
+
+  char operator[](unsigned index) const {
+    return text[index];
+  }
+
+  const char *c_str(void) const {
+    return text.c_str();
+  }
+};
+
+//============================================================
+// Serial
+
+class HardwareSerial {
+  private:
+  void put(const char *text);
+
+  public:
+  void begin(unsigned long baud);
+  int available(void);
+  int read(void);
+  int availableForWrite(void);
+  size_t write(uint8_t b);
+  size_t write(const uint8_t *data, size_t count);
+  void flush(void) { }
+
+  size_t print(const char *text) { put(text); return strlen(text); }
+  size_t print(const __FlashStringHelper *text) { return print((const char *)text); }
+  size_t print(const String &text) { return print(text.c_str()); }
+  size_t print(char c) { char text[2] = { c, 0 }; return print(text); }
+  size_t print(int v, int base = 10) { return print((long)v, base); }
+  size_t print(unsigned v, int base = 10) { return print((unsigned long)v, base); }
+  size_t print(long v, int base = 10);
+  size_t print(unsigned long v, int base = 10);
+  size_t print(double v, int digits = 2);
+
+  template <class T> size_t println(T v) {
+    size_t n = print(v);
+
+    return n + print("\n");
+  }
+
+  size_t println(void) {
+    return print("\n");
+  }
+};
+
+extern HardwareSerial Serial;
+
+#include "HostBoard.h"
+
+#endif
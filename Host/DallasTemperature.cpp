@@ -0,0 +1,184 @@
+#include "DallasTemperature.h"
+
+static HostProbe probes[HOST_BUS_PROBES];
+static unsigned probeCount = 0;
+static unsigned foundCount = 0;
+static HostProbeSource source = 0;
+
+static HostProbe *findProbe(const uint8_t *addr) {
+  for (unsigned i=0; i<probeCount; i++) {
+    if (!memcmp(probes[i].addr, addr, 8)) {
+      return &probes[i];
+    }
+  }
+
+  return 0;
+}
+
+static unsigned long conversionMillis(uint8_t bits) {
+  return 750 >> (12 - constrain(bits, 9, 12));
+}
+
+static int16_t sample(HostProbe &probe, unsigned index) {
+  int16_t raw = source ? source(index, millis()) : probe.raw;
+
+  return raw | ((1 << (12 - probe.resolution)) - 1);
+}
+
+// Finishes a conversion whose time is up
+static void settle(HostProbe &probe, unsigned index) {
+  if (probe.converting && millis() - probe.started >= conversionMillis(probe.resolution)) {
+    probe.scratch = sample(probe, index);
+    probe.converting = false;
+  }
+}
+
+void hostProbesReset(unsigned count) {
+  probeCount = min(count, (unsigned)HOST_BUS_PROBES);
+  foundCount = 0;
+  source = 0;
+
+  for (unsigned i=0; i<probeCount; i++) {
+    HostProbe &probe = probes[i];
+    uint8_t addr[8] = { 0x28, (uint8_t)(0x10 + i), 0xB5, 0x00, (uint8_t)i, 0x00, 0x00, 0x00 };
+
+    addr[7] = OneWire::crc8(addr, 7);
+    memcpy(probe.addr, addr, 8);
+
+    probe.raw = 20 * 16;
+    probe.connected = true;
+    probe.crcFailures = 0;
+    probe.resolution = 12;
+    probe.scratch = HOST_PROBE_POWER_UP;
+    probe.converting = false;
+    probe.started = 0;
+    probe.conversions = 0;
+    probe.reads = 0;
+  }
+}
+
+HostProbe &hostProbe(unsigned index) {
+  return probes[index];
+}
+
+void hostProbeSource(HostProbeSource newSource) {
+  source = newSource;
+}
+
+// A search finds the probes connected at the time
+void DallasTemperature::begin(void) {
+  foundCount = 0;
+
+  for (unsigned i=0; i<probeCount; i++) {
+    if (probes[i].connected) {
+      foundCount++;
+    }
+  }
+}
+
+uint8_t DallasTemperature::getDeviceCount(void) {
+  return foundCount;
+}
+
+bool DallasTemperature::getAddress(uint8_t *addr, uint8_t index) {
+  for (unsigned i=0; i<probeCount; i++) {
+    if (probes[i].connected && index-- == 0) {
+      memcpy(addr, probes[i].addr, 8);
+
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool DallasTemperature::setResolution(const uint8_t *addr, uint8_t bits, bool skipGlobalBitResolutionCalculation) {
+  HostProbe *probe = findProbe(addr);
+
+  if (!probe || !probe->connected) {
+    return false;
+  }
+
+  probe->resolution = constrain(bits, 9, 12);
+
+  return true;
+}
+
+bool DallasTemperature::requestTemperaturesByAddress(const uint8_t *addr) {
+  HostProbe *probe = findProbe(addr);
+
+  if (!probe || !probe->connected) {
+    return false;
+  }
+
+  settle(*probe, probe - probes);
+
+  probe->converting = true;
+  probe->started = millis();
+  probe->conversions++;
+
+  return true;
+}
+
+int16_t DallasTemperature::millisToWaitForConversion(uint8_t bits) {
+  return conversionMillis(bits);
+}
+
+// A missing probe reads as all ones, which fails the CRC
+bool DallasTemperature::isConnected(const uint8_t *addr, uint8_t *scratchPad) {
+  HostProbe *probe = findProbe(addr);
+
+  if (!probe || !probe->connected) {
+    memset(scratchPad, 0xFF, 9);
+
+    return false;
+  }
+
+  settle(*probe, probe - probes);
+  probe->reads++;
+
+  scratchPad[0] = probe->scratch;
+  scratchPad[1] = probe->scratch >> 8;
+  scratchPad[2] = 0x4B;
+  scratchPad[3] = 0x46;
+  scratchPad[4] = (probe->resolution - 9) << 5 | 0x1F;
+  scratchPad[5] = 0xFF;
+  scratchPad[6] = 0x00;
+  scratchPad[7] = 0x10;
+  scratchPad[8] = OneWire::crc8(scratchPad, 8);
+
+  if (probe->crcFailures) {
+    probe->crcFailures--;
+    scratchPad[8] ^= 0x55;
+
+    return false;
+  }
+
+  return true;
+}
+
+//============================================================
+// OneWire
+
+// Dallas/Maxim CRC-8, polynomial x^8 + x^5 + x^4 + 1, LSB first
+uint8_t OneWire::crc8(const uint8_t *addr, uint8_t len) {
+  uint8_t crc = 0;
+
+  while (len--) {
+    uint8_t in = *addr++;
+
+    for (unsigned i=0; i<8; i++) {
+      uint8_t mix = (crc ^ in) & 0x01;
+
+      crc >>= 1;
+
+      if (mix) {
+        crc ^= 0x8C;
+      }
+
+      in >>= 1;
+    }
+  }
+
+  return crc;
+}
@@ -0,0 +1,67 @@
+#ifndef HOST_DALLAS_TEMPERATURE_H
+#define HOST_DALLAS_TEMPERATURE_H
+
+#include "OneWire.h"
+
+//============================================================
+// Host stand-in for DallasTemperature, with a scripted DS18B20 bus
+//
+// The bus holds up to HOST_BUS_PROBES virtual probes. A test sets each
+// one's temperature, or hands the bus a function of probe and time,
+// and can pull a probe off the bus or make its next reads fail their
+// CRC. Conversions take the DS18B20's time for the probe's resolution;
+// until one finishes, the scratchpad still holds the last result, or
+// 85 Deg after power up. Bits below the resolution read as ones, as
+// the datasheet leaves them undefined.
+
+#define HOST_BUS_PROBES 20
+#define HOST_PROBE_POWER_UP (85 * 16)   // Scratchpad after power up, 1/16 Deg
+
+#define DEVICE_DISCONNECTED_C -127
+#define DEVICE_DISCONNECTED_RAW -7040
+
+typedef uint8_t DeviceAddress[8];
+typedef uint8_t ScratchPad[9];
+
+class DallasTemperature {
+  public:
+  DallasTemperature(OneWire *wire) { }
+
+  void begin(void);
+  uint8_t getDeviceCount(void);
+  bool getAddress(uint8_t *addr, uint8_t index);
+  bool setResolution(const uint8_t *addr, uint8_t bits, bool skipGlobalBitResolutionCalculation = false);
+  void setWaitForConversion(bool wait) { }
+  bool requestTemperaturesByAddress(const uint8_t *addr);
+  int16_t millisToWaitForConversion(uint8_t bits);
+  bool isConnected(const uint8_t *addr, uint8_t *scratchPad);
+};
+
+//============================================================
+// Host controls
+
+class HostProbe {
+  public:
+  DeviceAddress addr;
+  int16_t raw;          // What the probe is at, 1/16 Deg
+  bool connected;
+  unsigned crcFailures; // Reads still to fail their CRC
+  uint8_t resolution;
+  int16_t scratch;      // Result of the last finished conversion
+  bool converting;
+  unsigned long started;
+  unsigned long conversions;
+  unsigned long reads;
+};
+
+// Temperature source for every probe; overrides HostProbe::raw
+typedef int16_t (*HostProbeSource)(unsigned probe, unsigned long now);
+
+// Clears the bus and fits 'count' connected probes at 20 Deg, each
+// with its own serial number
+void hostProbesReset(unsigned count);
+
+HostProbe &hostProbe(unsigned index);
+void hostProbeSource(HostProbeSource source);
+
+#endif
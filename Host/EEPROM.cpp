@@ -0,0 +1,156 @@
+#include "EEPROM.h"
+#include "flash_stm32.h"
+
+#include <map>
+
+class EmulatedPages {
+  public:
+  std::map<uint16_t, uint16_t> values;
+  unsigned entries;   // Used in the active page
+};
+
+static std::map<uint32_t, EmulatedPages> pairs;   // By PageBase0
+static long cutAfter = -1;
+static std::string valuesPath;
+
+unsigned long hostEepromErases = 0;
+unsigned long hostEepromFailures = 0;
+
+EEPROMClass EEPROM;
+
+static void save(void) {
+  if (valuesPath.empty()) {
+    return;
+  }
+
+  FILE *file = fopen(valuesPath.c_str(), "w");
+
+  if (!file) {
+    return;
+  }
+
+  for (std::map<uint32_t, EmulatedPages>::iterator p = pairs.begin(); p != pairs.end(); ++p) {
+    std::map<uint16_t, uint16_t> &values = p->second.values;
+
+    for (std::map<uint16_t, uint16_t>::iterator v = values.begin(); v != values.end(); ++v) {
+      fprintf(file, "%08x %04x %04x\n", p->first, v->first, v->second);
+    }
+  }
+
+  fclose(file);
+}
+
+EEPROMClass::EEPROMClass(void)
+  : PageBase0(EEPROM_START_ADDRESS),
+    PageBase1(EEPROM_START_ADDRESS + EEPROM_PAGE_SIZE),
+    PageSize(EEPROM_PAGE_SIZE),
+    Status(EEPROM_NOT_INIT) {
+}
+
+uint16_t EEPROMClass::init(void) {
+  hostFlashReserve(PageBase0, PageSize);
+  hostFlashReserve(PageBase1, PageSize);
+
+  Status = EEPROM_OK;
+
+  return Status;
+}
+
+uint16_t EEPROMClass::init(uint32_t pageBase0, uint32_t pageBase1, uint32_t pageSize) {
+  PageBase0 = pageBase0;
+  PageBase1 = pageBase1;
+  PageSize = pageSize;
+
+  return init();
+}
+
+uint16_t EEPROMClass::read(uint16_t address) {
+  if (Status != EEPROM_OK) {
+    init();
+  }
+
+  std::map<uint16_t, uint16_t> &values = pairs[PageBase0].values;
+  std::map<uint16_t, uint16_t>::iterator v = values.find(address);
+
+  return v == values.end() ? EEPROM_DEFAULT_DATA : v->second;
+}
+
+// The page's first word is its status, so each holds one entry fewer
+uint16_t EEPROMClass::maxcount(void) {
+  return PageSize / 4 - 1;
+}
+
+uint16_t EEPROMClass::write(uint16_t address, uint16_t data) {
+  if (Status != EEPROM_OK) {
+    init();
+  }
+
+  if (cutAfter == 0) {
+    return EEPROM_OK;
+  }
+
+  EmulatedPages &pages = pairs[PageBase0];
+  bool known = pages.values.count(address);
+
+  if (pages.entries >= maxcount()) {
+    // Page transfer: the live values move to the other page
+    unsigned live = pages.values.size() + (known ? 0 : 1);
+
+    if (live > maxcount()) {
+      hostEepromFailures++;
+
+      return EEPROM_OUT_SIZE;
+    }
+
+    pages.entries = pages.values.size();
+    hostEepromErases++;
+  }
+
+  if (cutAfter > 0) {
+    cutAfter--;
+  }
+
+  pages.values[address] = data;
+  pages.entries++;
+  save();
+
+  return EEPROM_OK;
+}
+
+uint16_t EEPROMClass::update(uint16_t address, uint16_t data) {
+  if (read(address) == data) {
+    return EEPROM_OK;
+  }
+
+  return write(address, data);
+}
+
+void hostEepromReset(void) {
+  pairs.clear();
+  cutAfter = -1;
+  hostEepromErases = hostEepromFailures = 0;
+}
+
+void hostEepromCutAfter(long count) {
+  cutAfter = count;
+}
+
+void hostEepromFile(const char *path) {
+  FILE *file = fopen(path, "r");
+  unsigned base, address, value;
+
+  valuesPath = path;
+
+  if (!file) {
+    return;
+  }
+
+  while (fscanf(file, "%x %x %x", &base, &address, &value) == 3) {
+    EmulatedPages &pages = pairs[base];
+
+    pages.values[address] = value;
+    pages.entries = pages.values.size();
+  }
+
+  fclose(file);
+}
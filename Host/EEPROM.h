@@ -0,0 +1,64 @@
+#ifndef HOST_EEPROM_H
+#define HOST_EEPROM_H
+
+#include "Arduino.h"
+
+//============================================================
+// Host stand-in for the STM32F1 core's EEPROM emulation
+//
+// Each EEPROMClass is the core's pair of flash pages holding 16-bit
+// variables, modelled by what it costs rather than bit for bit: every
+// changed write appends a four byte entry to the active page, and a
+// full page is compacted into the other one, which costs an erase. A
+// pair holds at most PageSize/4 - 1 distinct addresses; writes to more
+// fail as they do on the board. Values can be kept in a file, so the
+// host runner keeps its settings from one run to the next.
+
+#define EEPROM_OK 0x0000
+#define EEPROM_OUT_SIZE 0x0081
+#define EEPROM_NOT_INIT 0x00AB
+#define EEPROM_DEFAULT_DATA 0xFFFF
+
+#define EEPROM_PAGE_SIZE 0x400
+#define EEPROM_START_ADDRESS (0x8000000UL + 128UL * 1024UL - 2UL * EEPROM_PAGE_SIZE)
+
+class EEPROMClass {
+  public:
+  uint32_t PageBase0;
+  uint32_t PageBase1;
+  uint32_t PageSize;
+  uint16_t Status;
+
+  public:
+  EEPROMClass(void);
+
+  uint16_t init(void);
+  uint16_t init(uint32_t pageBase0, uint32_t pageBase1, uint32_t pageSize);
+  uint16_t read(uint16_t address);
+  uint16_t write(uint16_t address, uint16_t data);
+  uint16_t update(uint16_t address, uint16_t data);
+  uint16_t maxcount(void);
+};
+
+extern EEPROMClass EEPROM;
+
+//============================================================
+// Host controls
+
+// Forgets every value and count
+void hostEepromReset(void);
+
+// Page erases across every pair so far
+extern unsigned long hostEepromErases;
+
+// Writes that failed because a pair was full
+extern unsigned long hostEepromFailures;
+
+// Lets 'count' more writes through, then drops the rest as if the
+// power had gone; a negative count never cuts it
+void hostEepromCutAfter(long count);
+
+// Keeps the values in a file from now on
+void hostEepromFile(const char *path);
+
+#endif
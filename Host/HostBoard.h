@@ -0,0 +1,68 @@
+#ifndef HOST_BOARD_H
+#define HOST_BOARD_H
+
+//============================================================
+// Host board controls
+//
+// What a test or the host runner uses to drive the stand-ins: the
+// virtual clock, scripted pin edges and the serial port. The TFT,
+// probe bus, EEPROM and flash stand-ins have their own controls in
+// their headers.
+
+// Moves the clock on, firing scripted pin edges at their times
+void hostAdvance(unsigned long ms);
+
+// Sets the clock without firing anything, e.g. to just short of a wrap
+void hostSetMillis(unsigned long ms);
+
+// Sleeps until the next millisecond tick, as WFI does with SysTick
+// running. The time is counted in hostSleptMillis.
+void hostWaitForInterrupt(void);
+
+extern unsigned long hostSleptMillis;
+
+// Clocks the panel's SPI at 'hz', so every byte the HAL sends moves the
+// clock on as the transfer would on the board. 0, the default, makes
+// transfers take no time.
+void hostSetSpiClock(unsigned long hz);
+
+// Called by the HAL for each transfer it sends to the panel
+void hostSpiTransfer(unsigned long bytes);
+
+// Real nanoseconds from a monotonic clock, for the HAL's cycle counter
+uint32_t hostCycles(void);
+
+// Real milliseconds from the same clock
+unsigned long hostRealMillis(void);
+
+// Drives an input now, firing its interrupt on an edge
+void hostSetPin(int pin, int level);
+
+// Drives an input 'delay' ms from now
+void hostSchedulePin(unsigned long delay, int pin, int level);
+
+// True while scripted edges are still to come
+bool hostPinsPending(void);
+
+// Last level the firmware wrote to an output
+int hostPinLevel(int pin);
+
+// Bytes the firmware will find in Serial.read()
+void hostSerialInput(const void *data, unsigned count);
+
+// While capturing, everything written to Serial is kept in a buffer
+// instead of going to stdout
+void hostSerialCapture(bool capture);
+std::string &hostSerialOutput(void);
+
+// What availableForWrite() reports, so a test can starve the link
+void hostSerialSetWritable(unsigned bytes);
+
+// Models the UART instead: its TX buffer empties at 'baud' on the
+// virtual clock, and availableForWrite() reports the room left
+void hostSerialSetBaud(unsigned long baud);
+
+// Puts the clock, pins and serial port back as they were at start up
+void hostResetBoard(void);
+
+#endif
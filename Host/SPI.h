@@ -0,0 +1,20 @@
+#ifndef HOST_SPI_H
+#define HOST_SPI_H
+
+#include "Arduino.h"
+
+//============================================================
+// Host stand-in for the SPI library
+//
+// Bytes go to the TFT stand-in, which decodes the register writes the
+// HAL makes behind the driver's back.
+
+class SPIClass {
+  public:
+  void begin(void) { }
+  uint8_t transfer(uint8_t data);
+};
+
+extern SPIClass SPI;
+
+#endif
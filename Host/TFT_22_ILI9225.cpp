@@ -0,0 +1,378 @@
+#include "TFT_22_ILI9225.h"
+#include "SPI.h"
+
+//============================================================
+// Panel memory and registers
+
+#define GATE_LINES ILI9225_LCD_HEIGHT
+#define SOURCE_LINES ILI9225_LCD_WIDTH
+
+#define REG_SCROLL_END 0x31
+#define REG_SCROLL_START 0x32
+#define REG_SCROLL_AMOUNT 0x33
+
+uint8_t Terminal6x8[] = { 6, 8, 0x20, 0x5F };
+uint8_t Terminal11x16[] = { 11, 16, 0x20, 0x5F };
+uint8_t Terminal12x16[] = { 12, 16, 0x20, 0x5F };
+
+unsigned long hostTftPixelWrites = 0;
+unsigned long hostTftRegisterWrites = 0;
+
+static uint16_t gram[GATE_LINES][SOURCE_LINES];
+static TFT_22_ILI9225 *panel = 0;
+
+static uint16_t scrollStart = 0;
+static uint16_t scrollEnd = GATE_LINES - 1;
+static uint16_t scrollAmount = 0;
+
+// SPI decoding: a register index is two bytes with RS low, its value
+// two more with RS high
+static uint16_t spiIndex = 0;
+static uint16_t spiValue = 0;
+static unsigned spiValueBytes = 0;
+
+SPIClass SPI;
+
+uint8_t SPIClass::transfer(uint8_t data) {
+  if (panel) {
+    panel->spiByte(data);
+  }
+
+  return 0;
+}
+
+static void writeRegister(uint16_t reg, uint16_t value) {
+  hostTftRegisterWrites++;
+
+  switch (reg) {
+    case REG_SCROLL_END:
+      scrollEnd = value % GATE_LINES;
+      break;
+
+    case REG_SCROLL_START:
+      scrollStart = value % GATE_LINES;
+      break;
+
+    case REG_SCROLL_AMOUNT:
+      scrollAmount = value % GATE_LINES;
+      break;
+  }
+}
+
+// Memory line a gate line shows. Within the scroll band the display
+// starts 'amount' lines further into it and wraps at its end.
+static unsigned shownLine(unsigned gate) {
+  if (scrollStart > scrollEnd || gate < scrollStart || gate > scrollEnd) {
+    return gate;
+  }
+
+  unsigned lines = scrollEnd - scrollStart + 1;
+
+  return scrollStart + (gate - scrollStart + scrollAmount) % lines;
+}
+
+// Gate and source line behind screen x, y. Landscape runs the gate
+// lines along x: left to right in orientation 3 and right to left in
+// orientation 1, as the HAL assumes.
+static void panelAddress(uint8_t orientation, unsigned x, unsigned y, unsigned &gate, unsigned &source) {
+  switch (orientation) {
+    case 1:
+      gate = GATE_LINES - 1 - x;
+      source = y;
+      break;
+
+    case 2:
+      gate = GATE_LINES - 1 - y;
+      source = SOURCE_LINES - 1 - x;
+      break;
+
+    case 3:
+      gate = x;
+      source = SOURCE_LINES - 1 - y;
+      break;
+
+    default:
+      gate = y;
+      source = x;
+      break;
+  }
+}
+
+//============================================================
+// Driver
+
+TFT_22_ILI9225::TFT_22_ILI9225(int8_t rst, int8_t rs, int8_t cs, int8_t led, uint8_t brightness)
+  : rsPin(rs),
+    csPin(cs),
+    orientation(0),
+    background(COLOR_BLACK) {
+  font.font = Terminal6x8;
+  font.width = Terminal6x8[0];
+  font.height = Terminal6x8[1];
+  font.offset = Terminal6x8[2];
+  font.numchars = Terminal6x8[3];
+  font.nbrows = font.height / 8;
+  font.monoSp = true;
+
+  panel = this;
+}
+
+void TFT_22_ILI9225::gramAddress(uint16_t x, uint16_t y, unsigned &line, unsigned &source) {
+  panelAddress(orientation, x, y, line, source);
+}
+
+void TFT_22_ILI9225::begin(void) {
+  scrollStart = 0;
+  scrollEnd = GATE_LINES - 1;
+  scrollAmount = 0;
+  spiValueBytes = 0;
+
+  memset(gram, 0, sizeof(gram));
+}
+
+// The driver fills the panel and waits 10ms for it
+void TFT_22_ILI9225::clear(void) {
+  uint8_t old = orientation;
+
+  setOrientation(0);
+  fillRectangle(0, 0, maxX() - 1, maxY() - 1, COLOR_BLACK);
+  setOrientation(old);
+  delay(10);
+}
+
+void TFT_22_ILI9225::setOrientation(uint8_t orientation) {
+  this->orientation = orientation % 4;
+}
+
+uint8_t TFT_22_ILI9225::getOrientation(void) {
+  return orientation;
+}
+
+uint16_t TFT_22_ILI9225::maxX(void) {
+  return orientation & 1 ? GATE_LINES : SOURCE_LINES;
+}
+
+uint16_t TFT_22_ILI9225::maxY(void) {
+  return orientation & 1 ? SOURCE_LINES : GATE_LINES;
+}
+
+void TFT_22_ILI9225::drawPixel(uint16_t x, uint16_t y, uint16_t colour) {
+  if (x >= maxX() || y >= maxY()) {
+    return;
+  }
+
+  unsigned line, source;
+
+  gramAddress(x, y, line, source);
+  gram[line][source] = colour;
+  hostTftPixelWrites++;
+}
+
+void TFT_22_ILI9225::drawLine(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t colour) {
+  int dx = abs((int)x2 - x1);
+  int dy = -abs((int)y2 - y1);
+  int sx = x1 < x2 ? 1 : -1;
+  int sy = y1 < y2 ? 1 : -1;
+  int error = dx + dy;
+  int x = x1;
+  int y = y1;
+
+  for (;;) {
+    drawPixel(x, y, colour);
+
+    if (x == x2 && y == y2) {
+      break;
+    }
+
+    int e2 = 2 * error;
+
+    if (e2 >= dy) {
+      error += dy;
+      x += sx;
+    }
+
+    if (e2 <= dx) {
+      error += dx;
+      y += sy;
+    }
+  }
+}
+
+void TFT_22_ILI9225::drawRectangle(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t colour) {
+  drawLine(x1, y1, x2, y1, colour);
+  drawLine(x1, y2, x2, y2, colour);
+  drawLine(x1, y1, x1, y2, colour);
+  drawLine(x2, y1, x2, y2, colour);
+}
+
+void TFT_22_ILI9225::fillRectangle(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t colour) {
+  for (unsigned x=min(x1, x2); x<=(unsigned)max(x1, x2); x++) {
+    for (unsigned y=min(y1, y2); y<=(unsigned)max(y1, y2); y++) {
+      drawPixel(x, y, colour);
+    }
+  }
+}
+
+void TFT_22_ILI9225::drawTriangle(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t x3, uint16_t y3, uint16_t colour) {
+  drawLine(x1, y1, x2, y2, colour);
+  drawLine(x2, y2, x3, y3, colour);
+  drawLine(x3, y3, x1, y1, colour);
+}
+
+void TFT_22_ILI9225::drawBitmap(int16_t x, int16_t y, uint16_t *bitmap, int16_t w, int16_t h) {
+  for (int j=0; j<h; j++) {
+    for (int i=0; i<w; i++) {
+      drawPixel(x + i, y + j, bitmap[j * w + i]);
+    }
+  }
+}
+
+void TFT_22_ILI9225::setBackgroundColor(uint16_t colour) {
+  background = colour;
+}
+
+void TFT_22_ILI9225::setFont(uint8_t *font, bool monoSp) {
+  this->font.font = font;
+  this->font.width = font[0];
+  this->font.height = font[1];
+  this->font.offset = font[2];
+  this->font.numchars = font[3];
+  this->font.nbrows = font[1] / 8;
+  this->font.monoSp = monoSp;
+}
+
+_currentFont TFT_22_ILI9225::getFont(void) {
+  return font;
+}
+
+// The cell's first column carries the character code, a bit a row
+uint16_t TFT_22_ILI9225::drawChar(uint16_t x, uint16_t y, uint16_t ch, uint16_t colour) {
+  for (unsigned i=0; i<font.width; i++) {
+    for (unsigned j=0; j<font.height; j++) {
+      bool set = i == 0 && j < 8 && (ch >> j) & 1;
+
+      drawPixel(x + i, y + j, set ? colour : background);
+    }
+  }
+
+  return font.width;
+}
+
+uint16_t TFT_22_ILI9225::drawText(uint16_t x, uint16_t y, STRING s, uint16_t colour) {
+  for (unsigned k=0; k<s.length(); k++) {
+    x += drawChar(x, y, s[k], colour) + 1;
+  }
+
+  return x;
+}
+
+uint16_t TFT_22_ILI9225::getCharWidth(uint16_t ch) {
+  return font.width;
+}
+
+uint16_t TFT_22_ILI9225::getTextWidth(STRING s) {
+  uint16_t width = 0;
+
+  for (unsigned k=0; k<s.length(); k++) {
+    width += getCharWidth(s[k]) + 1;
+  }
+
+  return width;
+}
+
+void TFT_22_ILI9225::spiByte(uint8_t data) {
+  if (hostPinLevel(csPin) != LOW) {
+    return;
+  }
+
+  if (hostPinLevel(rsPin) == LOW) {
+    spiIndex = spiIndex << 8 | data;
+    spiValueBytes = 0;
+    return;
+  }
+
+  spiValue = spiValue << 8 | data;
+
+  if (++spiValueBytes == 2) {
+    writeRegister(spiIndex, spiValue);
+    spiValueBytes = 0;
+  }
+}
+
+//============================================================
+// Host controls
+
+static uint8_t panelOrientation(void) {
+  return panel ? panel->getOrientation() : 0;
+}
+
+uint16_t hostTftPixel(unsigned x, unsigned y) {
+  unsigned gate, source;
+
+  panelAddress(panelOrientation(), x, y, gate, source);
+
+  if (gate >= GATE_LINES || source >= SOURCE_LINES) {
+    return COLOR_BLACK;
+  }
+
+  return gram[shownLine(gate)][source];
+}
+
+uint16_t hostTftMemory(unsigned x, unsigned y) {
+  unsigned gate, source;
+
+  panelAddress(panelOrientation(), x, y, gate, source);
+
+  if (gate >= GATE_LINES || source >= SOURCE_LINES) {
+    return COLOR_BLACK;
+  }
+
+  return gram[gate][source];
+}
+
+std::string hostTftText(unsigned x, unsigned y, unsigned count, unsigned pitch) {
+  std::string text;
+
+  for (unsigned c=0; c<count; c++, x+=pitch) {
+    uint16_t background = hostTftPixel(x + 1, y);
+    unsigned ch = 0;
+
+    for (unsigned j=0; j<8; j++) {
+      if (hostTftPixel(x, y + j) != background) {
+        ch |= 1 << j;
+      }
+    }
+
+    text += ch ? (char)ch : '?';
+  }
+
+  return text;
+}
+
+bool hostTftSave(const char *path) {
+  FILE *file = fopen(path, "wb");
+
+  if (!file) {
+    return false;
+  }
+
+  unsigned width = panel ? panel->maxX() : SOURCE_LINES;
+  unsigned height = panel ? panel->maxY() : GATE_LINES;
+
+  fprintf(file, "P6\n%u %u\n255\n", width, height);
+
+  for (unsigned y=0; y<height; y++) {
+    for (unsigned x=0; x<width; x++) {
+      uint16_t colour = hostTftPixel(x, y);
+      uint8_t rgb[3] = {
+        (uint8_t)((colour >> 11) << 3),
+        (uint8_t)(((colour >> 5) & 0x3F) << 2),
+        (uint8_t)((colour & 0x1F) << 3)
+      };
+
+      fwrite(rgb, 1, 3, file);
+    }
+  }
+
+  return fclose(file) == 0;
+}
@@ -0,0 +1,144 @@
+#ifndef HOST_TFT_22_ILI9225_H
+#define HOST_TFT_22_ILI9225_H
+
+#include "Arduino.h"
+
+//============================================================
+// Host stand-in for the TFT_22_ILI9225 driver, backed by a framebuffer
+//
+// The panel's memory is 220 gate lines of 176 pixels, and drawing goes
+// into it through the same orientations as the driver. What the panel
+// shows also honours its vertical scroll registers, which the HAL
+// writes over SPI; the stand-in decodes those writes from the SPI
+// bytes and the RS and CS pins, so the scrolling chart can be checked
+// pixel for pixel.
+//
+// There are no glyphs. A character cell is filled with the background
+// and its first column carries the character code, a bit per row in
+// the foreground colour, so hostTftText() can read text back off the
+// screen.
+
+#define COLOR_BLACK 0x0000
+#define COLOR_WHITE 0xFFFF
+#define COLOR_BLUE 0x001F
+#define COLOR_GREEN 0x07E0
+#define COLOR_RED 0xF800
+#define COLOR_NAVY 0x000F
+#define COLOR_DARKBLUE 0x0011
+#define COLOR_DARKGREEN 0x03E0
+#define COLOR_DARKCYAN 0x03EF
+#define COLOR_CYAN 0x07FF
+#define COLOR_TURQUOISE 0x471A
+#define COLOR_INDIGO 0x4810
+#define COLOR_DARKRED 0x8000
+#define COLOR_OLIVE 0x7BE0
+#define COLOR_GRAY 0x8410
+#define COLOR_GREY 0x8410
+#define COLOR_SKYBLUE 0x867D
+#define COLOR_BLUEVIOLET 0x895C
+#define COLOR_LIGHTGREEN 0x9772
+#define COLOR_DARKVIOLET 0x901A
+#define COLOR_YELLOWGREEN 0x9E66
+#define COLOR_BROWN 0xA145
+#define COLOR_DARKGRAY 0x7BEF
+#define COLOR_DARKGREY 0x7BEF
+#define COLOR_SIENNA 0xA285
+#define COLOR_LIGHTBLUE 0xAEDC
+#define COLOR_GREENYELLOW 0xAFE5
+#define COLOR_SILVER 0xC618
+#define COLOR_LIGHTGRAY 0xC618
+#define COLOR_LIGHTGREY 0xC618
+#define COLOR_LIGHTCYAN 0xE7FF
+#define COLOR_VIOLET 0xEC1D
+#define COLOR_AZUR 0xF7FF
+#define COLOR_BEIGE 0xF7BB
+#define COLOR_MAGENTA 0xF81F
+#define COLOR_TOMATO 0xFB08
+#define COLOR_GOLD 0xFEA0
+#define COLOR_ORANGE 0xFD20
+#define COLOR_SNOW 0xFFDF
+#define COLOR_YELLOW 0xFFE0
+
+#define ILI9225_LCD_WIDTH 176
+#define ILI9225_LCD_HEIGHT 220
+
+#define STRING String
+
+// Width, height, first character and count, as the driver's fonts start
+extern uint8_t Terminal6x8[];
+extern uint8_t Terminal11x16[];
+extern uint8_t Terminal12x16[];
+
+struct _currentFont {
+  uint8_t *font;
+  uint8_t width;
+  uint8_t height;
+  uint8_t offset;
+  uint8_t numchars;
+  uint8_t nbrows;
+  bool monoSp;
+};
+
+class TFT_22_ILI9225 {
+  private:
+  int rsPin;
+  int csPin;
+  uint8_t orientation;
+  uint16_t background;
+  _currentFont font;
+
+  private:
+  void gramAddress(uint16_t x, uint16_t y, unsigned &line, unsigned &source);
+
+  public:
+  TFT_22_ILI9225(int8_t rst, int8_t rs, int8_t cs, int8_t led, uint8_t brightness);
+
+  void begin(void);
+  void clear(void);
+  void setBacklight(bool on) { }
+  void setDisplay(bool on) { }
+  void setOrientation(uint8_t orientation);
+  uint8_t getOrientation(void);
+  uint16_t maxX(void);
+  uint16_t maxY(void);
+
+  void drawPixel(uint16_t x, uint16_t y, uint16_t colour);
+  void drawLine(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t colour);
+  void drawRectangle(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t colour);
+  void fillRectangle(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t colour);
+  void drawTriangle(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t x3, uint16_t y3, uint16_t colour);
+  void drawBitmap(int16_t x, int16_t y, uint16_t *bitmap, int16_t w, int16_t h);
+
+  void setBackgroundColor(uint16_t colour);
+  void setFont(uint8_t *font, bool monoSp = false);
+  _currentFont getFont(void);
+  uint16_t drawChar(uint16_t x, uint16_t y, uint16_t ch, uint16_t colour = COLOR_WHITE);
+  uint16_t drawText(uint16_t x, uint16_t y, STRING s, uint16_t colour = COLOR_WHITE);
+  uint16_t getCharWidth(uint16_t ch);
+  uint16_t getTextWidth(STRING s);
+
+  // Register writes decoded from the SPI stream
+  void spiByte(uint8_t data);
+};
+
+//============================================================
+// Host controls, on the most recently constructed panel
+
+// Colour shown at x, y in the current orientation, after scrolling
+uint16_t hostTftPixel(unsigned x, unsigned y);
+
+// Colour in panel memory behind x, y, ignoring scrolling
+uint16_t hostTftMemory(unsigned x, unsigned y);
+
+// Reads 'count' characters drawn pitch pixels apart from x, y; cells
+// with no character read as '?'
+std::string hostTftText(unsigned x, unsigned y, unsigned count, unsigned pitch);
+
+// Pixels written to panel memory, and register writes decoded
+extern unsigned long hostTftPixelWrites;
+extern unsigned long hostTftRegisterWrites;
+
+// Writes what the panel shows as a PPM image
+bool hostTftSave(const char *path);
+
+#endif
@@ -0,0 +1,167 @@
+#include "flash_stm32.h"
+
+#include <vector>
+
+class Span {
+  public:
+  uint32_t start;
+  uint32_t end;
+};
+
+static uint16_t flash[HOST_FLASH_SIZE / 2];
+static std::vector<Span> reserved;
+static long cutAfter = -1;
+static std::string imagePath;
+static bool unlocked = false;
+
+unsigned long hostFlashErases = 0;
+unsigned long hostFlashWrites = 0;
+unsigned long hostFlashViolations = 0;
+unsigned long hostFlashReads = 0;
+uint32_t hostFlashImageEnd = HOST_FLASH_BASE + 64UL * 1024UL;
+
+static bool inFlash(uint32_t addr) {
+  return addr >= HOST_FLASH_BASE && addr < HOST_FLASH_BASE + HOST_FLASH_SIZE;
+}
+
+static void checkAccess(uint32_t addr) {
+  bool violation = addr < hostFlashImageEnd;
+
+  for (unsigned i=0; i<reserved.size(); i++) {
+    violation = violation || (addr >= reserved[i].start && addr < reserved[i].end);
+  }
+
+  if (violation) {
+    hostFlashViolations++;
+  }
+}
+
+// False once the power has been cut
+static bool powered(void) {
+  if (cutAfter == 0) {
+    return false;
+  }
+
+  if (cutAfter > 0) {
+    cutAfter--;
+  }
+
+  return true;
+}
+
+static void save(void) {
+  if (imagePath.empty()) {
+    return;
+  }
+
+  FILE *file = fopen(imagePath.c_str(), "wb");
+
+  if (file) {
+    fwrite(flash, 1, sizeof(flash), file);
+    fclose(file);
+  }
+}
+
+void FLASH_Unlock(void) {
+  unlocked = true;
+}
+
+void FLASH_Lock(void) {
+  unlocked = false;
+  save();
+}
+
+FLASH_Status FLASH_ErasePage(uint32_t addr) {
+  if (!inFlash(addr)) {
+    return FLASH_BAD_ADDRESS;
+  }
+
+  if (!unlocked) {
+    return FLASH_ERROR_WRP;
+  }
+
+  checkAccess(addr);
+
+  if (!powered()) {
+    return FLASH_TIMEOUT;
+  }
+
+  uint32_t page = (addr - HOST_FLASH_BASE) / HOST_FLASH_PAGE;
+
+  memset(flash + page * HOST_FLASH_PAGE / 2, 0xFF, HOST_FLASH_PAGE);
+  hostFlashErases++;
+
+  return FLASH_COMPLETE;
+}
+
+FLASH_Status FLASH_ProgramHalfWord(uint32_t addr, uint16_t data) {
+  if (!inFlash(addr) || addr & 1) {
+    return FLASH_BAD_ADDRESS;
+  }
+
+  if (!unlocked) {
+    return FLASH_ERROR_WRP;
+  }
+
+  checkAccess(addr);
+
+  if (!powered()) {
+    return FLASH_TIMEOUT;
+  }
+
+  uint16_t &word = flash[(addr - HOST_FLASH_BASE) / 2];
+
+  if (word != 0xFFFF && data != 0) {
+    return FLASH_ERROR_PG;
+  }
+
+  word = data;
+  hostFlashWrites++;
+
+  return FLASH_COMPLETE;
+}
+
+uint16_t hostFlashRead(uint32_t addr) {
+  hostFlashReads++;
+
+  return inFlash(addr) ? flash[(addr - HOST_FLASH_BASE) / 2] : 0xFFFF;
+}
+
+void hostFlashReset(void) {
+  memset(flash, 0xFF, sizeof(flash));
+  reserved.clear();
+  cutAfter = -1;
+  hostFlashErases = hostFlashWrites = hostFlashViolations = hostFlashReads = 0;
+}
+
+void hostFlashReserve(uint32_t addr, uint32_t size) {
+  Span span;
+
+  span.start = addr;
+  span.end = addr + size;
+  reserved.push_back(span);
+}
+
+void hostFlashCutAfter(long count) {
+  cutAfter = count;
+}
+
+void hostFlashFile(const char *path) {
+  FILE *file = fopen(path, "rb");
+
+  imagePath = path;
+
+  if (file) {
+    if (fread(flash, 1, sizeof(flash), file) != sizeof(flash)) {
+      memset(flash, 0xFF, sizeof(flash));
+    }
+
+    fclose(file);
+  }
+}
+
+static struct HostFlashInit {
+  HostFlashInit() {
+    memset(flash, 0xFF, sizeof(flash));
+  }
+} hostFlashInit;
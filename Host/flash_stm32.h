@@ -0,0 +1,65 @@
+#ifndef HOST_FLASH_STM32_H
+#define HOST_FLASH_STM32_H
+
+#include "Arduino.h"
+
+//============================================================
+// Host stand-in for the core's flash programming calls
+//
+// A 128K part in RAM, 1K pages, erased to ones. Programming a half word
+// that isn't erased fails as it does on the part, unless it writes
+// zero. A test can cut the power part way through a write, and can set
+// where the program image ends: the firmware's own flash guard reads
+// that, and any erase or write below it is counted as a violation.
+
+#define HOST_FLASH_BASE 0x8000000UL
+#define HOST_FLASH_SIZE (128UL * 1024UL)
+#define HOST_FLASH_PAGE 1024UL
+
+typedef enum {
+  FLASH_BUSY = 1,
+  FLASH_ERROR_PG,
+  FLASH_ERROR_WRP,
+  FLASH_ERROR_OPT,
+  FLASH_COMPLETE,
+  FLASH_TIMEOUT,
+  FLASH_BAD_ADDRESS
+} FLASH_Status;
+
+void FLASH_Unlock(void);
+void FLASH_Lock(void);
+FLASH_Status FLASH_ErasePage(uint32_t addr);
+FLASH_Status FLASH_ProgramHalfWord(uint32_t addr, uint16_t data);
+
+//============================================================
+// Host controls
+
+uint16_t hostFlashRead(uint32_t addr);
+
+// Erases the whole part
+void hostFlashReset(void);
+
+// Every erase and half word written so far
+extern unsigned long hostFlashErases;
+extern unsigned long hostFlashWrites;
+
+// Half words read
+extern unsigned long hostFlashReads;
+
+// Erases or writes below hostFlashImageEnd, or into a reserved span
+extern unsigned long hostFlashViolations;
+
+// First address past the program image
+extern uint32_t hostFlashImageEnd;
+
+// Marks pages the firmware mustn't touch directly, e.g. EEPROM pages
+void hostFlashReserve(uint32_t addr, uint32_t size);
+
+// Lets 'count' more half words or erases through, then drops the rest
+// as if the power had gone; a negative count never cuts it
+void hostFlashCutAfter(long count);
+
+// Keeps the part in a file from now on
+void hostFlashFile(const char *path);
+
+#endif
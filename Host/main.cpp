@@ -0,0 +1,84 @@
+//============================================================
+// Host runner
+//
+// Builds the whole sketch against the stand-ins in this directory and
+// runs it on the virtual clock, as fast as the host can, with probes
+// drifting slowly around 20 Deg. Settings and the sample log persist
+// in files if given, so a run can pick up where the last one stopped.
+//
+//   brewmonitor_host [-t seconds] [-e eeprom.txt] [-f flash.bin] [-s screen.ppm]
+//
+// At the end it prints the HAL counters and how long the core slept.
+
+#include "BrewMonitor.ino"
+
+#include <getopt.h>
+
+#define RUN_SECONDS 3600UL
+#define RUN_PROBES (3 * CHANNELS)
+
+static int16_t driftingProbe(unsigned probe, unsigned long now) {
+  double hours = now / 3600000.0;
+
+  return (int16_t)((20.0 + 2.0 * sin(2 * PI * (hours + probe / 8.0))) * 16);
+}
+
+int main(int argc, char **argv) {
+  unsigned long seconds = RUN_SECONDS;
+  const char *screen = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "t:e:f:s:")) != -1) {
+    switch (opt) {
+      case 't':
+        seconds = strtoul(optarg, 0, 10);
+        break;
+
+      case 'e':
+        hostEepromFile(optarg);
+        break;
+
+      case 'f':
+        hostFlashFile(optarg);
+        break;
+
+      case 's':
+        screen = optarg;
+        break;
+
+      default:
+        fprintf(stderr, "usage: %s [-t seconds] [-e eeprom.txt] [-f flash.bin] [-s screen.ppm]\n", argv[0]);
+        return 2;
+    }
+  }
+
+  hostProbesReset(min(RUN_PROBES, HOST_BUS_PROBES));
+  hostProbeSource(driftingProbe);
+
+  setup();
+
+  while (millis() < seconds * 1000UL) {
+    loop();
+  }
+
+  if (screen && !hostTftSave(screen)) {
+    perror(screen);
+  }
+
+  printf("seconds %lu\n", seconds);
+  printf("sleptMillis %lu\n", hostSleptMillis);
+  printf("spiBytes %lu\n", halCounters.spiBytes);
+  printf("pixels %lu\n", halCounters.pixels);
+  printf("windows %lu\n", halCounters.windows);
+  printf("eepromReads %lu\n", halCounters.eepromReads);
+  printf("eepromWrites %lu\n", halCounters.eepromWrites);
+  printf("pinReads %lu\n", halCounters.pinReads);
+  printf("pinWrites %lu\n", halCounters.pinWrites);
+  printf("conversions %lu\n", halCounters.conversions);
+  printf("sensorReads %lu\n", halCounters.sensorReads);
+  printf("sensorRetries %lu\n", halCounters.sensorRetries);
+  printf("flashErases %lu\n", halCounters.flashErases);
+  printf("flashWrites %lu\n", halCounters.flashWrites);
+
+  return 0;
+}
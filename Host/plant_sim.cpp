@@ -0,0 +1,16 @@
+//============================================================
+// Plant simulator
+//
+// The sketch built with SIMULATE_PLANT, so setup() runs every built-in
+// scenario against the thermal model on the virtual clock and prints
+// its report, then the program exits:
+//
+//   plant_sim > report.txt
+
+#include "BrewMonitor.ino"
+
+int main(void) {
+  setup();
+
+  return 0;
+}
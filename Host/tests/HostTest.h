@@ -0,0 +1,84 @@
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+//============================================================
+// Host test harness
+//
+// Each test program includes the whole sketch, so it sees every global
+// the firmware defines, then registers its cases with HOST_TEST. They
+// run in file order, sharing the firmware's state, and a failed CHECK
+// reports where and carries on. BENCH lines are results to read, not
+// pass or fail.
+
+#include "BrewMonitor.ino"
+
+#include <vector>
+
+typedef void (*HostTestCase)(void);
+
+class HostTests {
+  public:
+  std::vector<const char *> names;
+  std::vector<HostTestCase> cases;
+  unsigned failures;
+
+  static HostTests &all(void) {
+    static HostTests tests;
+
+    return tests;
+  }
+
+  HostTests() : failures(0) { }
+
+  bool check(bool ok, const char *text, const char *file, int line) {
+    if (!ok) {
+      printf("%s:%d: CHECK(%s) failed\n", file, line, text);
+      failures++;
+    }
+
+    return ok;
+  }
+
+  int run(void) {
+    for (unsigned i=0; i<cases.size(); i++) {
+      unsigned before = failures;
+
+      cases[i]();
+      printf("%s %s\n", failures == before ? "PASS" : "FAIL", names[i]);
+    }
+
+    return failures ? 1 : 0;
+  }
+};
+
+class HostTestRegistrar {
+  public:
+  HostTestRegistrar(const char *name, HostTestCase test) {
+    HostTests::all().names.push_back(name);
+    HostTests::all().cases.push_back(test);
+  }
+};
+
+#define HOST_TEST(name) \
+  static void name(void); \
+  static HostTestRegistrar name##Registrar(#name, name); \
+  static void name(void)
+
+#define CHECK(cond) HostTests::all().check((cond), #cond, __FILE__, __LINE__)
+
+#define BENCH(name, format, ...) printf("BENCH %s " format "\n", name, __VA_ARGS__)
+
+// Runs loop() until the virtual clock has moved on 'ms'
+inline void hostRun(unsigned long ms) {
+  unsigned long start = millis();
+
+  while (millis() - start < ms) {
+    loop();
+  }
+}
+
+int main(void) {
+  return HostTests::all().run();
+}
+
+#endif
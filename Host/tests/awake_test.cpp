@@ -0,0 +1,77 @@
+#include "HostTest.h"
+
+//============================================================
+// How much of a day the core is awake under idle()
+//
+// Each virtual millisecond is either slept in WFI or spent in a
+// scheduler pass. The host can't count the board's cycles, so the
+// awake time is given in host ns of scheduler passes; a PROFILE build
+// on the board gives the real figure.
+
+#define DAY (24 * 3600000UL)
+#define SPIN_PASSES_PER_MS 20   // The old loop() on the board, a low guess
+
+static int16_t driftingProbe(unsigned probe, unsigned long now) {
+  return (int16_t)((18.0 + probe + 2.0 * sin(now / 3600000.0)) * 16);
+}
+
+HOST_TEST(sleepsBetweenTasks) {
+  hostProbesReset(3);
+  hostProbeSource(driftingProbe);
+  setup();
+
+  // The screen times out after the first minute
+  hostRun(SCREEN_TIMEOUT + 1000);
+  CHECK(!screenIsOn());
+
+  unsigned long start = millis();
+  unsigned long slept = hostSleptMillis;
+  unsigned long long passNs = 0;
+  unsigned long passes = 0;
+
+  while (millis() - start < DAY) {
+    uint32_t begin = hostCycles();
+
+    scheduler.run();
+    passNs += hostCycles() - begin;
+    passes++;
+
+    idle();
+  }
+
+  unsigned long sleptMs = hostSleptMillis - slept;
+  unsigned long awakePpm = (unsigned long)(passNs / (DAY / 1000));
+
+  BENCH("passesPerDay", "%lu", passes);
+  BENCH("sleptPpm", "%lu", (unsigned long)((unsigned long long)sleptMs * 1000000ULL / DAY));
+  BENCH("hostAwakePpm", "%lu", awakePpm);
+
+  // Every millisecond but the panel driver's own waits is slept
+  CHECK(sleptMs >= DAY - DAY / 1000);
+
+  // A pass per task event, a few a second, not thousands
+  CHECK(passes < DAY / 100);
+  CHECK(passes * 1000 < (unsigned long long)DAY * SPIN_PASSES_PER_MS);
+}
+
+// A button press ends the sleep, and the next pass turns the screen on
+HOST_TEST(buttonWakesIdle) {
+  hostSchedulePin(500, BTN_SELECT, LOW);
+  hostSchedulePin(600, BTN_SELECT, HIGH);
+
+  unsigned long start = millis();
+
+  for (;;) {
+    scheduler.run();
+
+    if (screenIsOn() || millis() - start >= 2000) {
+      break;
+    }
+
+    idle();
+  }
+
+  BENCH("wakeMs", "%lu", millis() - start);
+  CHECK(screenIsOn());
+  CHECK(millis() - start == 500);
+}
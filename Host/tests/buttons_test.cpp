@@ -0,0 +1,111 @@
+#include "HostTest.h"
+
+//============================================================
+// Replays timed edge sequences on the button pins
+
+#define BOUNCE_EDGES 4   // Extra edges either side of a clean change, 1ms apart
+
+// Schedules a press 'at' ms from now, held for 'hold' ms, with contact
+// bounce on both edges
+static void schedulePress(int pin, unsigned long at, unsigned long hold, unsigned bounces) {
+  for (unsigned b=0; b<bounces; b++) {
+    hostSchedulePin(at + b, pin, b % 2 ? HIGH : LOW);
+    hostSchedulePin(at + hold + b, pin, b % 2 ? LOW : HIGH);
+  }
+
+  hostSchedulePin(at + bounces, pin, LOW);
+  hostSchedulePin(at + hold + bounces, pin, HIGH);
+}
+
+static unsigned drainEvents(ButtonEventType type) {
+  ButtonEvent event;
+  unsigned count = 0;
+
+  while (buttons.nextEvent(event)) {
+    count += event.type == type;
+  }
+
+  return count;
+}
+
+HOST_TEST(releaseInsideWindowIsSettled) {
+  hostProbesReset(3);
+  setup();
+  hostAdvance(1000);
+
+  // Released 10ms after the press, inside the debounce window
+  hostSchedulePin(0, BTN_UP, LOW);
+  hostSchedulePin(10, BTN_UP, HIGH);
+  hostAdvance(15);
+
+  CHECK(buttons.isPressed(ButtonUp));
+  CHECK(buttons.needsSettling());
+  CHECK(buttons.settle() == BUTTON_DEBOUNCE - 15);
+  CHECK(buttons.isPressed(ButtonUp));
+
+  hostAdvance(BUTTON_DEBOUNCE);
+
+  CHECK(buttons.settle() == TASK_WAIT);
+  CHECK(!buttons.isPressed(ButtonUp));
+  CHECK(drainEvents(ButtonRelease) == 1);
+}
+
+HOST_TEST(bouncingPressIsOneEvent) {
+  schedulePress(BTN_DOWN, 0, 200, BOUNCE_EDGES);
+  hostAdvance(100);
+  buttons.settle();
+
+  CHECK(buttons.isPressed(ButtonDown));
+  CHECK(drainEvents(ButtonPress) == 1);
+
+  hostAdvance(200);
+  buttons.settle();
+
+  CHECK(!buttons.isPressed(ButtonDown));
+  CHECK(drainEvents(ButtonRelease) == 1);
+}
+
+// Opens the menu, then steps through it with bouncing Up and Down
+// presses, some held past a long press and some released inside the
+// debounce window. No pass of the scheduler may wait on a key.
+HOST_TEST(replayNeverStallsLoop) {
+  schedulePress(BTN_SELECT, 0, 80, BOUNCE_EDGES);
+  hostRun(500);
+  CHECK(menuOpen);
+
+  static const unsigned long holds[] = { 40, 10, 300, 1500, 8, 60, 3000, 20, 120, 15 };
+  unsigned long at = 0;
+  unsigned presses = sizeof(holds) / sizeof(holds[0]);
+
+  for (unsigned i=0; i<presses; i++) {
+    schedulePress(i % 2 ? BTN_DOWN : BTN_UP, at, holds[i], i % 3 ? BOUNCE_EDGES : 0);
+    at += holds[i] + 200;
+  }
+
+  unsigned long conversions = halCounters.conversions;
+  unsigned long start = millis();
+  unsigned long passes = 0;
+  unsigned long stalls = 0;
+
+  while (hostPinsPending() || millis() - start < at + 100) {
+    unsigned long before = millis();
+
+    scheduler.run();
+    passes++;
+    stalls += millis() != before;
+
+    idle();
+  }
+
+  BENCH("buttonReplayPasses", "%lu", passes);
+  BENCH("buttonReplayStalls", "%lu", stalls);
+
+  CHECK(stalls == 0);
+  CHECK(menuOpen);
+  CHECK(!buttons.isPressed(ButtonUp));
+  CHECK(!buttons.isPressed(ButtonDown));
+  CHECK(!buttons.needsSettling());
+
+  // Every probe kept converting while keys were held
+  CHECK(halCounters.conversions - conversions >= 3 * ((millis() - start) / SENSOR_INTERVAL));
+}
@@ -0,0 +1,88 @@
+#include "HostTest.h"
+
+//============================================================
+// Vessel channels: EEPROM banks and per-channel cost
+//
+// Built once for each of 1, 2, 4 and 8 channels. The host's ns are
+// not the board's, but the growth from one channel count to the next
+// is what to read.
+
+#define CONTROL_PASSES 20000
+#define EDIT_ROUNDS 600   // Enough to copy every channel's page across
+
+// Every channel's settings go through its own pair of 1K pages, and a
+// busy year of edits on all of them never overflows a pair
+HOST_TEST(settingsKeepToTheirBank) {
+  hostProbesReset(min(3 * CHANNELS, MAX_PROBES));
+  setup();
+
+  CHECK(EEPROM.PageBase0 == HAL_EEPROM_BANK_BASE(0));
+  CHECK(EEPROM.PageSize == HAL_EEPROM_PAGE_SIZE);
+#ifdef HAL_EEPROM_BANKED
+  for (unsigned b=1; b<HAL_EEPROM_BANKS; b++) {
+    CHECK(halEepromBanks[b - 1].PageBase0 == HAL_EEPROM_BANK_BASE(b));
+    CHECK(halEepromBanks[b - 1].PageBase1 == HAL_EEPROM_BANK_BASE(b) + HAL_EEPROM_PAGE_SIZE);
+    CHECK(halEepromBanks[b - 1].PageSize == HAL_EEPROM_PAGE_SIZE);
+  }
+#endif
+
+  for (unsigned round=0; round<EDIT_ROUNDS; round++) {
+    for (unsigned c=0; c<CHANNELS; c++) {
+      channels[c].settings.set(SettingTargetTemp, 15 + (round + c) % 10);
+    }
+
+    hostAdvance(SETTINGS_COMMIT_DELAY);
+
+    for (unsigned c=0; c<CHANNELS; c++) {
+      channels[c].settings.commit();
+    }
+  }
+
+  BENCH("eepromPageErases", "%lu", hostEepromErases);
+  CHECK(hostEepromFailures == 0);
+  CHECK(hostEepromErases >= CHANNELS);
+
+  for (unsigned c=0; c<CHANNELS; c++) {
+    SettingsStore reloaded;
+    unsigned long value = 0;
+
+    reloaded.load(c);
+    CHECK(reloaded.get(SettingTargetTemp, value));
+    CHECK(value == 15 + (EDIT_ROUNDS - 1 + c) % 10);
+  }
+}
+
+// One control pass decides for every vessel; its time and the state it
+// walks grow by a channel's worth each
+HOST_TEST(controlPassPerChannel) {
+  haveTemps = true;
+
+  uint32_t start = hostCycles();
+
+  for (unsigned i=0; i<CONTROL_PASSES; i++) {
+    hostAdvance(CONTROL_INTERVAL);
+
+    for (unsigned p=0; p<samples.count; p++) {
+      samples.temp[p] = 18 * TEMP_SCALE + (i + p) % 64 - 32;
+      samples.time[p] = millis();
+    }
+
+    controlTask();
+  }
+
+  unsigned long passNs = (hostCycles() - start) / CONTROL_PASSES;
+  unsigned long stateBytes = sizeof(channels) + sizeof(samples);
+
+#if CHANNELS > 1
+  stateBytes += sizeof(vesselDisplay);
+#endif
+
+  BENCH("channels", "%u", CHANNELS);
+  BENCH("channelBytes", "%lu", (unsigned long)sizeof(Channel));
+  BENCH("channelStateBytes", "%lu", stateBytes);
+  BENCH("controlPassNs", "%lu", passNs);
+  BENCH("controlNsPerChannel", "%lu", passNs / CHANNELS);
+
+  // A pass is a few us however many vessels there are
+  CHECK(passNs < 50000);
+}
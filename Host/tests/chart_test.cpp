@@ -0,0 +1,218 @@
+#include "HostTest.h"
+
+#include <new>
+
+//============================================================
+// Chart rendering on the framebuffer panel
+
+#define CHART_COLUMNS 192   // X_PIXELS on the 220 pixel panel
+
+// Every heap allocation the firmware makes goes through here
+static unsigned long heapAllocations = 0;
+
+void *operator new(size_t size) {
+  void *block = malloc(size ? size : 1);
+
+  if (!block) {
+    throw std::bad_alloc();
+  }
+
+  heapAllocations++;
+
+  return block;
+}
+
+void operator delete(void *block) noexcept {
+  free(block);
+}
+
+static int16_t driftingProbe(unsigned probe, unsigned long now) {
+  return (int16_t)((18.0 + probe + 2.0 * sin(now / 3600000.0)) * 16);
+}
+
+// The old plotPoints(), drawn over the logged columns: a per-pixel
+// power bar for each column the load was on, and three single pixels.
+// Where the pixels land doesn't change what they cost.
+class PerPixelColumns : public SampleLogReader {
+  public:
+  unsigned x;
+  unsigned long powerColumns;
+
+  PerPixelColumns() : x(X_ZERO + 1), powerColumns(0) { }
+
+  virtual void sampleRestored(const SampleRecord &record) {
+    if (record.powerOn) {
+      tft.drawLine(x, 46, x, 170 - 1, COLOR_DARKRED);
+      powerColumns++;
+    }
+
+    for (unsigned t=0; t<PROBE_ROLES; t++) {
+      tft.drawPixel(x, 100 + t, COLOR_BLUE);
+    }
+
+    x++;
+  }
+};
+
+// A redraw of a full chart against one of a nearly empty one: the data
+// costs at most one address window a column. The old path drawing the
+// same columns pixel by pixel is the baseline, and the new one takes a
+// tenth of its windows or less. The beer drifts either side of a 19 C
+// cooling target, so the load runs part of the time.
+HOST_TEST(redrawSendsAColumnABurst) {
+  hostProbesReset(3);
+  hostProbeSource(driftingProbe);
+  setup();
+  channels[0].control.setTargetTemp(19);
+  channels[0].control.setTempRange(1);
+  hostRun(60000UL);
+
+  unsigned long windows = halCounters.windows;
+  unsigned long spiBytes = halCounters.spiBytes;
+
+  chartDisplay.redraw();
+
+  unsigned long emptyWindows = halCounters.windows - windows;
+  unsigned long emptyBytes = halCounters.spiBytes - spiBytes;
+
+  hostRun(12 * 3600000UL);
+  windows = halCounters.windows;
+  spiBytes = halCounters.spiBytes;
+
+  unsigned long pixelWrites = hostTftPixelWrites;
+  unsigned long start = millis();
+
+  chartDisplay.redraw();
+
+  unsigned long fullWindows = halCounters.windows - windows;
+  unsigned long dataWindows = fullWindows - emptyWindows;
+  unsigned long dataBytes = halCounters.spiBytes - spiBytes - emptyBytes;
+
+  BENCH("redrawSpiBytes", "%lu", chartDisplay.getRedrawSpiBytes());
+  BENCH("redrawWindows", "%lu", fullWindows);
+  BENCH("redrawPixelWrites", "%lu", hostTftPixelWrites - pixelWrites);
+
+  CHECK(dataWindows <= CHART_COLUMNS);
+
+  // Only the driver's wait after clearing the panel
+  CHECK(millis() - start == 10);
+
+  PerPixelColumns perPixel;
+  SampleLog &log = chartDisplay.getSampleLog();
+
+  windows = halCounters.windows;
+  spiBytes = halCounters.spiBytes;
+  log.replay(perPixel, log.available(CHART_COLUMNS - 1));
+
+  unsigned long oldWindows = halCounters.windows - windows;
+  unsigned long oldBytes = halCounters.spiBytes - spiBytes;
+
+  BENCH("perPixelPowerColumns", "%lu", perPixel.powerColumns);
+  BENCH("perPixelDataWindows", "%lu", oldWindows);
+  BENCH("perPixelDataSpiBytes", "%lu", oldBytes);
+  BENCH("columnDataWindows", "%lu", dataWindows);
+  BENCH("columnDataSpiBytes", "%lu", dataBytes);
+
+  CHECK(perPixel.x == X_ZERO + CHART_COLUMNS);
+  CHECK(dataWindows * 10 <= oldWindows);
+
+  chartDisplay.redraw();
+}
+
+static void setProbes(double beer, double coolant, double air) {
+  hostProbe(0).raw = (int16_t)(beer * 16);
+  hostProbe(1).raw = (int16_t)(coolant * 16);
+  hostProbe(2).raw = (int16_t)(air * 16);
+}
+
+// The widest range, "-20.0/100.0", falls back to whole degrees and the
+// Air column still ends inside the panel
+HOST_TEST(readoutFitsWorstCase) {
+  hostProbeSource(0);
+  setProbes(18.0, 2.0, -20.0);
+  hostRun(3600000UL);
+  setProbes(18.0, 2.0, 100.0);
+  hostRun(3600000UL);
+
+  CHECK(hostTftText(0, 0, 4, 13) == "Beer");
+  CHECK(hostTftText(65, 0, 7, 13) == "Coolant");
+  CHECK(hostTftText(157, 0, 3, 13) == "Air");
+  CHECK(hostTftText(157, 18, 5, 12) == "100.0");
+  CHECK(hostTftText(157, 35, TEMP_RANGE_CHARS, 7) == "-20/100  ");
+  CHECK(157 + TEMP_RANGE_CHARS * 7 - 1 <= 220);
+}
+
+// A readout update sends only the characters that changed, and
+// allocates nothing. The sample is handed to the chart directly, past
+// the probe filter's smoothing, so exactly one digit moves and the
+// range stays as it was.
+HOST_TEST(readoutSendsChangedCharacters) {
+  setProbes(17.0, 2.0, 100.0);
+  hostRun(600000UL);
+  setProbes(19.25, 2.0, 100.0);
+  hostRun(600000UL);
+  CHECK(hostTftText(0, 18, 5, 12) == "19.3 ");
+
+  ProbeSamples sample = samples;
+
+  sample.temp[sample.roleProbe[0][beer]] = 19 * TEMP_SCALE;
+
+  unsigned long allocations = heapAllocations;
+
+  chartDisplay.addDataPoint(millis(), sample, 0, channels[0].isActive());
+
+  BENCH("readoutSpiBytesOneDigit", "%lu", chartDisplay.getReadoutSpiBytes());
+  BENCH("readoutAllocations", "%lu", heapAllocations - allocations);
+  CHECK(chartDisplay.getReadoutSpiBytes() == HAL_WINDOW_BYTES + 2 * 11 * 16);
+  CHECK(hostTftText(0, 18, 5, 12) == "19.0 ");
+
+  chartDisplay.addDataPoint(millis(), sample, 0, channels[0].isActive());
+  CHECK(chartDisplay.getReadoutSpiBytes() == 0);
+
+  // Formatting and drawing the readouts, changed or not, uses no heap
+  CHECK(heapAllocations == allocations);
+}
+
+// In scroll mode a column costs a scroll register write, the column
+// and its tick, however wide the band is. The readouts sit right of
+// the band, so they stay put while it scrolls and steady readings send
+// nothing.
+HOST_TEST(scrollSendsOneColumn) {
+  setProbes(18.0, 2.0, 20.0);
+  hostRun(3600000UL);
+
+  chartDisplay.setSpan(ChartDisplay::Span8HoursScroll);
+  chartDisplay.redraw();
+  hostRun(600000UL);
+
+  unsigned long columnMs = 12 * 3600000UL / CHART_COLUMNS;
+  unsigned long spiBytes = halCounters.spiBytes;
+  unsigned long registers = hostTftRegisterWrites;
+
+  hostRun(8 * columnMs);
+
+  unsigned long perColumn = (halCounters.spiBytes - spiBytes) / 8;
+  unsigned long column = HAL_WINDOW_BYTES + 2 * (170 - 46);
+  unsigned long tick = 11 * (HAL_WINDOW_BYTES + 2);
+
+  BENCH("scrollSpiBytesPerColumn", "%lu", perColumn);
+  CHECK(hostTftRegisterWrites - registers == 8);
+  CHECK(perColumn <= 4 + column + tick);
+
+  // The newest column shows at the right edge of the band, left of
+  // the panel, and the one before it next to it
+  for (unsigned x=155; x<=156; x++) {
+    bool beer = false;
+
+    for (unsigned y=46; y<170; y++) {
+      beer = beer || hostTftPixel(x, y) == COLOR_BLUE;
+    }
+
+    CHECK(beer);
+  }
+
+  CHECK(hostTftText(157, 0, 4, 7) == "Beer");
+  CHECK(hostTftText(157, 9, 5, 12) == "18.0 ");
+  CHECK(hostTftText(157, 40, 7, 7) == "Coolant");
+  CHECK(hostTftText(157, 89, 5, 12) == "20.0 ");
+}
@@ -0,0 +1,82 @@
+#include "HostTest.h"
+
+//============================================================
+// Sample encoding round trips and fuzz
+
+#define FUZZ_ROUNDS 1000000UL
+
+HOST_TEST(roundTripsEveryStep) {
+  StoreVal last = 0;
+
+  for (long temp = -20 * TEMP_SCALE; temp <= 100 * TEMP_SCALE; temp++) {
+    StoreVal val = tempToStoreVal(temp);
+
+    if (!CHECK(val != STORE_INVALID && tempFromStoreVal(val) == temp)) {
+      printf("  at %ld/16 Deg\n", temp);
+      return;
+    }
+
+    CHECK(temp == -20 * TEMP_SCALE || val == last + 1);
+    last = val;
+  }
+}
+
+HOST_TEST(disconnectedIsInvalid) {
+  CHECK(tempToStoreVal(TEMP_DISCONNECTED) == STORE_INVALID);
+  CHECK(tempToStoreVal(TEMP_DISCONNECTED - 1) == STORE_INVALID);
+  CHECK(tempToStoreVal(INT16_MIN) == STORE_INVALID);
+  CHECK(tempFromStoreVal(STORE_INVALID) == TEMP_DISCONNECTED);
+}
+
+HOST_TEST(clampsOutOfRange) {
+  CHECK(tempToStoreVal(-20 * TEMP_SCALE - 1) == 0);
+  CHECK(tempToStoreVal(TEMP_DISCONNECTED + 1) == 0);
+  CHECK(tempToStoreVal(INT16_MAX) != STORE_INVALID);
+  CHECK(tempFromStoreVal(STORE_MAX) == INT16_MAX);
+}
+
+// Any reading decodes to itself clamped to the range, or to
+// disconnected, and never to the invalid marker by accident
+HOST_TEST(fuzzReadings) {
+  srand(7);
+
+  for (unsigned long i=0; i<FUZZ_ROUNDS; i++) {
+    TempFixed temp = (TempFixed)(rand() & 0xFFFF);
+    StoreVal val = tempToStoreVal(temp);
+    TempFixed back = tempFromStoreVal(val);
+
+    if (temp <= TEMP_DISCONNECTED) {
+      if (!CHECK(val == STORE_INVALID && back == TEMP_DISCONNECTED)) {
+        return;
+      }
+    } else if (!CHECK(val != STORE_INVALID && back == max(temp, (TempFixed)(-20 * TEMP_SCALE)))) {
+      printf("  %d/16 Deg came back as %d/16\n", temp, back);
+      return;
+    }
+  }
+}
+
+// Buckets keep the mean exactly and the spreads to 255 steps
+HOST_TEST(fuzzBuckets) {
+  srand(11);
+
+  for (unsigned long i=0; i<FUZZ_ROUNDS; i++) {
+    HistoryBucket bucket;
+    StoreVal mean = rand() % STORE_INVALID;
+    StoreVal lo = mean - min((StoreVal)(rand() % 400), mean);
+    StoreVal hi = mean + min((StoreVal)(rand() % 400), (StoreVal)(STORE_MAX - mean));
+
+    bucket.set(0, lo, hi, mean);
+    bucket.set(1, STORE_INVALID, STORE_INVALID, STORE_INVALID);
+
+    bool ok = bucket.meanVal[0] == mean &&
+              bucket.getMin(0) == max((long)lo, (long)mean - HISTORY_SPREAD_MAX) &&
+              bucket.getMax(0) == min((long)hi, (long)mean + HISTORY_SPREAD_MAX) &&
+              bucket.getMin(1) == STORE_INVALID && bucket.getMax(1) == STORE_INVALID;
+
+    if (!CHECK(ok)) {
+      printf("  %u..%u mean %u\n", lo, hi, mean);
+      return;
+    }
+  }
+}
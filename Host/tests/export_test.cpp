@@ -0,0 +1,302 @@
+#include "HostTest.h"
+
+#include <algorithm>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+
+//============================================================
+// EXPORT of two weeks' history, decoded by Tools/history_export
+//
+// The tool's series is checked against the board's own: its columns
+// against the sample log and its hour and 4 hour buckets against the
+// first vessel's HistoryStore. Built again with two vessels, which see
+// the same signal on their probes, so the second's buckets must be
+// the first's. The UART is modelled at 115200 baud on the virtual
+// clock, so the export time is what the board would take.
+
+#define LOG_DAYS 14
+#define EXPORT_BAUD 115200
+#define DROP_AFTER 2048   // Bytes through before the link drops
+#define TEST_COLUMN_MILLIS 225000UL   // 12 hours over 192 columns
+#define HOUR_COLUMNS (HISTORY_TIER1_MILLIS / TEST_COLUMN_MILLIS)
+
+// Each vessel's probes read the same by role. Roles are handed out a
+// probe to each vessel in turn.
+static int16_t noisyProbe(unsigned probe, unsigned long now) {
+  double hours = now / 3600000.0;
+  unsigned role = probe / CHANNELS;
+
+  return (int16_t)((18.0 + 2.0 * role + 1.5 * sin(2 * PI * hours / 24) + 0.5 * sin(hours * 7.3 + role)) * 16);
+}
+
+static std::string tempPath(const char *name) {
+  char path[] = "/tmp/exportXXXXXX";
+  int fd = mkstemp(path);
+
+  close(fd);
+  unlink(path);
+
+  return std::string(path) + name;
+}
+
+class Row {
+  public:
+  unsigned channel;
+  unsigned long column;
+  unsigned long columns;
+  unsigned long mean[PROBE_ROLES];
+  unsigned long lo[PROBE_ROLES];
+  unsigned long hi[PROBE_ROLES];
+  unsigned long power;
+
+  bool matches(const SampleRecord &record) {
+    for (unsigned t=0; t<PROBE_ROLES; t++) {
+      if (mean[t] != record.vals[t] || lo[t] != record.vals[t] || hi[t] != record.vals[t]) {
+        return false;
+      }
+    }
+
+    return power == (record.powerOn ? 100UL : 0UL);
+  }
+
+  bool matches(HistoryBucket &bucket, bool spreads) {
+    for (unsigned t=0; t<PROBE_ROLES; t++) {
+      if (mean[t] != bucket.meanVal[t] || (spreads && (lo[t] != bucket.getMin(t) || hi[t] != bucket.getMax(t)))) {
+        return false;
+      }
+    }
+
+    return power == bucket.powerPercent;
+  }
+};
+
+// Where the newest bucket of 'tier' ends, in columns
+static unsigned long newestBucketEnd(unsigned tier) {
+  HistoryLog &log = chartDisplay.getTierLogs()[tier - 1];
+  HistoryRecord record;
+
+  return log.read(log.endSeq() - 1, record) ? record.logSeq : 0;
+}
+
+// The first vessel's logged bucket of 'tier' that ended at 'end', for
+// those older than the HistoryStore's ring
+static HistoryBucket *loggedBucket(unsigned tier, unsigned long end) {
+  static HistoryRecord record;
+  HistoryLog &log = chartDisplay.getTierLogs()[tier - 1];
+
+  for (unsigned long seq=log.firstSeq(); seq<log.endSeq(); seq++) {
+    if (log.read(seq, record) && record.channel == 0 && record.logSeq == end) {
+      return &record.bucket;
+    }
+  }
+
+  return 0;
+}
+
+// Each row matches the record or bucket it came from
+static bool matchesBoard(Row &row) {
+  if (row.columns == 1) {
+    SampleRecord record;
+
+    return row.channel == 0 && chartDisplay.getSampleLog().read(row.column, record) && row.matches(record);
+  }
+
+  unsigned tier = row.columns == HOUR_COLUMNS ? 1 : 2;
+  unsigned long end = newestBucketEnd(tier);
+  unsigned age = (end - row.column - row.columns) / row.columns;
+  HistoryBucket *bucket = chartDisplay.getHistory().getBucket(tier, age);
+
+  if (age >= chartDisplay.getHistory().getSize(tier)) {
+    bucket = loggedBucket(tier, row.column + row.columns);
+  }
+
+  // The first vessel's probes are read early at boot, so only its
+  // first bucket's spreads differ from the others'
+  bool boot = row.column < row.columns;
+
+  return (end - row.column) % row.columns == 0 && bucket && row.matches(*bucket, row.channel == 0 || !boot);
+}
+
+// The tool's rows for every vessel run without a gap from the first
+// bucket closed to the last, two weeks and more, and match the board
+static bool matchesSeries(const std::string &csv, unsigned long &rows) {
+  FILE *f = fopen(csv.c_str(), "r");
+  char line[256];
+  std::vector<Row> series[CHANNELS];
+  Row row;
+
+  rows = 0;
+
+  if (!f || !fgets(line, sizeof(line), f)) {
+    return false;
+  }
+
+  while (fscanf(f, "%u,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu", &row.channel, &row.column, &row.columns,
+                &row.mean[0], &row.mean[1], &row.mean[2], &row.lo[0], &row.hi[0], &row.lo[1], &row.hi[1],
+                &row.lo[2], &row.hi[2], &row.power) == 13) {
+    if (row.channel >= CHANNELS || !matchesBoard(row)) {
+      printf("  channel %u, column %lu\n", row.channel, row.column);
+      fclose(f);
+      return false;
+    }
+
+    series[row.channel].push_back(row);
+    rows++;
+  }
+
+  fclose(f);
+
+  for (unsigned c=0; c<CHANNELS; c++) {
+    std::vector<Row> &vessel = series[c];
+
+    if (vessel.empty()) {
+      return false;
+    }
+
+    for (unsigned i=1; i<vessel.size(); i++) {
+      if (vessel[i].column != vessel[i - 1].column + vessel[i - 1].columns) {
+        printf("  channel %u, gap at column %lu\n", c, vessel[i].column);
+        return false;
+      }
+    }
+
+    // Only the first vessel has the columns since the last hour closed
+    unsigned long end = c ? newestBucketEnd(1) : chartDisplay.getSampleLog().endSeq();
+
+    if (vessel.front().column > 1 || vessel.back().column + vessel.back().columns != end) {
+      printf("  channel %u, columns %lu to %lu\n", c, vessel.front().column, vessel.back().column + vessel.back().columns);
+      return false;
+    }
+  }
+
+  return series[0].back().column + 1 - series[0].front().column >= LOG_DAYS * 24 * HOUR_COLUMNS;
+}
+
+HOST_TEST(exportCoversTwoWeeks) {
+  hostProbesReset(3 * CHANNELS);
+  hostProbeSource(noisyProbe);
+  setup();
+  hostRun(LOG_DAYS * 24 * 3600000UL);
+
+  hostSerialCapture(true);
+  hostSerialSetBaud(EXPORT_BAUD);
+  hostSerialOutput().clear();
+  hostSerialInput("EXPORT\n", 7);
+
+  unsigned long start = millis();
+
+  hostRun(1);
+
+  while (historyExport.isBusy()) {
+    hostRun(1);
+  }
+
+  unsigned long elapsed = millis() - start;
+  std::string capture = tempPath(".bin");
+  std::string csv = tempPath(".csv");
+  FILE *f = fopen(capture.c_str(), "wb");
+
+  fwrite(hostSerialOutput().data(), 1, hostSerialOutput().size(), f);
+  fclose(f);
+
+  std::string command = std::string(HISTORY_EXPORT) + " -r -o " + csv + " " + capture + " 2>/dev/null";
+  unsigned long rows;
+
+  CHECK(system(command.c_str()) == 0);
+  CHECK(matchesSeries(csv, rows));
+
+  BENCH("exportRows", "%lu", rows);
+  BENCH("exportBytes", "%lu", (unsigned long)hostSerialOutput().size());
+  BENCH("exportBytesPerRowX100", "%lu", hostSerialOutput().size() * 100 / rows);
+  BENCH("exportMs", "%lu", elapsed);
+
+  unlink(capture.c_str());
+  unlink(csv.c_str());
+  hostSerialOutput().clear();
+}
+
+// The tool runs on a pty against the sketch. The link drops after
+// DROP_AFTER bytes, part way through the 4 hour buckets; the tool
+// hears nothing for its timeout, asks again from the record after the
+// last it got, and the series comes out whole.
+HOST_TEST(resumeAfterDrop) {
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+
+  if (!CHECK(master >= 0 && !grantpt(master) && !unlockpt(master))) {
+    return;
+  }
+
+  std::string slave = ptsname(master);
+  std::string csv = tempPath(".csv");
+  int fd = open(slave.c_str(), O_RDWR | O_NOCTTY);
+  struct termios tio;
+
+  tcgetattr(fd, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(fd, TCSANOW, &tio);
+
+  pid_t pid = fork();
+
+  if (pid == 0) {
+    close(master);
+    freopen("/dev/null", "w", stderr);
+    execl(HISTORY_EXPORT, "history_export", "-r", "-o", csv.c_str(), slave.c_str(), (char *)0);
+    _exit(127);
+  }
+
+  close(fd);
+
+  unsigned long through = 0;
+  unsigned long requests = 0;
+  bool dropping = false;
+  int status = -1;
+
+  while (waitpid(pid, &status, WNOHANG) == 0) {
+    struct pollfd p = { master, POLLIN, 0 };
+    char input[64];
+
+    if (poll(&p, 1, 0) > 0 && (p.revents & POLLIN)) {
+      ssize_t n = read(master, input, sizeof(input));
+
+      if (n > 0) {
+        hostSerialInput(input, n);
+        requests += std::count(input, input + n, '\n');
+        dropping = false;
+      }
+    }
+
+    hostRun(1);
+
+    std::string &output = hostSerialOutput();
+
+    if (!dropping && through + output.size() > DROP_AFTER && requests == 1) {
+      output.resize(DROP_AFTER - through);
+      dropping = true;
+    }
+
+    if (!dropping && !output.empty()) {
+      through += write(master, output.data(), output.size());
+    }
+
+    output.clear();
+
+    // Nothing to do until the tool speaks, which it does in real time
+    if (!historyExport.isBusy()) {
+      usleep(1000);
+    }
+  }
+
+  close(master);
+
+  unsigned long rows;
+
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  CHECK(requests == 2);
+  CHECK(matchesSeries(csv, rows));
+
+  unlink(csv.c_str());
+}
@@ -0,0 +1,171 @@
+#include "HostTest.h"
+
+//============================================================
+// Probe reading validation, alone and through the control loop
+
+#define DEG(t) ((TempFixed)((t) * TEMP_SCALE))
+#define SETTLE_READS 32   // More than the average needs to close a step
+
+// A filter that has seen a few steady readings at 'temp'
+static ProbeFilter steadyFilter(TempFixed temp) {
+  ProbeFilter filter;
+
+  for (unsigned i=0; i<3; i++) {
+    filter.update(temp);
+  }
+
+  return filter;
+}
+
+// A probe reads as disconnected until its first good reading, which
+// seeds the output without a ramp
+HOST_TEST(firstReadingSeeds) {
+  ProbeFilter filter;
+
+  CHECK(filter.isFaulted());
+  CHECK(filter.update(DEG(18)) == DEG(18));
+  CHECK(!filter.isFaulted());
+}
+
+HOST_TEST(oneBadReadingHolds) {
+  ProbeFilter filter = steadyFilter(DEG(18));
+
+  CHECK(filter.update(TEMP_DISCONNECTED) == DEG(18));
+  CHECK(!filter.isFaulted());
+
+  // And a good reading after it carries on as if it hadn't happened
+  CHECK(filter.update(DEG(18)) == DEG(18));
+  CHECK(filter.update(TEMP_DISCONNECTED) == DEG(18));
+  CHECK(!filter.isFaulted());
+}
+
+// Two bad readings fault the probe, and the controller it feeds holds
+// its load off
+HOST_TEST(twoBadReadingsFault) {
+  hostProbesReset(3);
+  setup();
+
+  LoadController &control = channels[0].control;
+  ProbeSamples fed = samples;
+  ProbeFilter filter = steadyFilter(DEG(15));
+  unsigned probe = fed.roleProbe[0][beer];
+
+  // Cooling well above the band switches the load on
+  control.setControlMode(LoadController::Cooling);
+  control.setStrategy(LoadController::Band);
+  control.setTargetTemp(10);
+  control.setDutyCycleOff(0);
+  hostAdvance(1000);
+
+  fed.temp[probe] = filter.update(DEG(15));
+  control.check(fed);
+  CHECK(control.getPowerControlState() == LoadController::Energised);
+  CHECK(hostPinLevel(loadControlPins[0][0]) == HIGH);
+
+  fed.temp[probe] = filter.update(TEMP_DISCONNECTED);
+  control.check(fed);
+  CHECK(control.getActiveState() != LoadController::Faulted);
+
+  fed.temp[probe] = filter.update(FILTER_MIN_TEMP - 1);
+  CHECK(filter.isFaulted());
+  CHECK(fed.temp[probe] == TEMP_DISCONNECTED);
+
+  control.check(fed);
+  CHECK(control.getActiveState() == LoadController::Faulted);
+  CHECK(control.getPowerControlState() == LoadController::Off);
+  CHECK(hostPinLevel(loadControlPins[0][0]) == LOW);
+}
+
+// Three good readings in a row bring a faulted probe back, seeded from
+// the third so the output doesn't ramp up from the fault
+HOST_TEST(threeGoodReadingsRecover) {
+  ProbeFilter filter = steadyFilter(DEG(18));
+
+  filter.update(TEMP_DISCONNECTED);
+  filter.update(TEMP_DISCONNECTED);
+  CHECK(filter.isFaulted());
+
+  CHECK(filter.update(DEG(20)) == TEMP_DISCONNECTED);
+  CHECK(filter.update(DEG(20)) == TEMP_DISCONNECTED);
+  CHECK(filter.isFaulted());
+
+  CHECK(filter.update(DEG(20)) == DEG(20));
+  CHECK(!filter.isFaulted());
+
+  // A bad reading part way through starts the count again
+  filter.update(TEMP_DISCONNECTED);
+  filter.update(TEMP_DISCONNECTED);
+  filter.update(DEG(20));
+  filter.update(DEG(20));
+  filter.update(TEMP_DISCONNECTED);
+  CHECK(filter.update(DEG(20)) == TEMP_DISCONNECTED);
+  CHECK(filter.update(DEG(20)) == TEMP_DISCONNECTED);
+  CHECK(filter.update(DEG(20)) == DEG(20));
+}
+
+// The median of three drops a single reading spike before it reaches
+// the average, in either direction
+HOST_TEST(spikeIsRejected) {
+  ProbeFilter filter = steadyFilter(DEG(18));
+
+  CHECK(filter.update(DEG(30)) == DEG(18));
+  CHECK(filter.update(DEG(18)) == DEG(18));
+  CHECK(filter.update(DEG(18)) == DEG(18));
+  CHECK(filter.update(DEG(5)) == DEG(18));
+  CHECK(filter.update(DEG(18)) == DEG(18));
+}
+
+// 85 Deg is the scratchpad's power-on value, so it counts as a bad
+// reading even though it is in range; values either side of it don't
+HOST_TEST(resetValueIsRejected) {
+  ProbeFilter filter = steadyFilter(DEG(18));
+
+  CHECK(filter.update(FILTER_RESET_TEMP) == DEG(18));
+  CHECK(filter.update(FILTER_RESET_TEMP) == TEMP_DISCONNECTED);
+  CHECK(filter.isFaulted());
+
+  ProbeFilter hot;
+
+  CHECK(hot.update(FILTER_RESET_TEMP + 1) == FILTER_RESET_TEMP + 1);
+  CHECK(hot.update(FILTER_RESET_TEMP - 1) != TEMP_DISCONNECTED);
+}
+
+// After a step the average closes a quarter of the gap each reading
+// and lands on the new value exactly, then stays there
+HOST_TEST(averageSettlesOnStep) {
+  static const TempFixed steps[][2] = {
+    { DEG(18), DEG(20) },
+    { DEG(20), DEG(18) },
+    { DEG(18), DEG(18) + 1 },
+    { DEG(18), DEG(18) - 1 },
+    { DEG(-10), DEG(40) }
+  };
+
+  for (unsigned s=0; s<sizeof(steps)/sizeof(steps[0]); s++) {
+    ProbeFilter filter = steadyFilter(steps[s][0]);
+    TempFixed last = steps[s][0];
+    unsigned reads = 0;
+
+    while (last != steps[s][1] && reads < SETTLE_READS) {
+      TempFixed out = filter.update(steps[s][1]);
+
+      // Monotonic towards the new value, never past it
+      CHECK(abs(steps[s][1] - out) <= abs(steps[s][1] - last));
+      last = out;
+      reads++;
+    }
+
+    CHECK(last == steps[s][1]);
+
+    for (unsigned i=0; i<SETTLE_READS; i++) {
+      CHECK(filter.update(steps[s][1]) == steps[s][1]);
+    }
+  }
+
+  // The first reading after the step is the median, so only the second
+  // reaches the average, which moves a quarter of the way
+  ProbeFilter filter = steadyFilter(DEG(18));
+
+  CHECK(filter.update(DEG(22)) == DEG(18));
+  CHECK(filter.update(DEG(22)) == DEG(19));
+}
@@ -0,0 +1,333 @@
+#include "HostTest.h"
+
+#include <vector>
+
+//============================================================
+// History tiers against a brute-force scan of the samples, and across
+// a restart
+
+#define FEED_DAYS 35   // Past the 30 day tier, so every ring has wrapped
+#define FEED_MILLIS 60000UL   // A sample a minute
+#define QUERY_COLUMNS 192   // The chart's width
+#define DAY_MILLIS (24UL * 3600000UL)
+
+static std::vector<StoreVal> fedVals[HISTORY_PROBES];
+static std::vector<bool> fedPower;
+
+// A daily swing with some fast noise, well inside a bucket's 8-bit
+// spread. The air probe is unplugged for eight hours on 4 hour
+// boundaries, so every bucket either has all its readings or none.
+static StoreVal feedVal(unsigned p, unsigned long i) {
+  if (p == 2 && i >= 2 * 1440 && i < 2 * 1440 + 8 * 60) {
+    return STORE_INVALID;
+  }
+
+  return (StoreVal)(600 + 40 * p + 30 * sin(2 * PI * i / 1440 + p) + (i * 7 + p * 13) % 11);
+}
+
+static bool feedPower(unsigned long i) {
+  return (i / 17) % 3 == 0;
+}
+
+// Min, max, mean and power of the samples fed in [from, to)
+class Scan {
+  public:
+  StoreVal lo[HISTORY_PROBES];
+  StoreVal hi[HISTORY_PROBES];
+  double mean[HISTORY_PROBES];
+  unsigned powerPercent;
+
+  Scan(unsigned long from, unsigned long to) {
+    unsigned long on = 0;
+
+    for (unsigned p=0; p<HISTORY_PROBES; p++) {
+      unsigned long sum = 0, count = 0;
+
+      lo[p] = STORE_INVALID;
+      hi[p] = 0;
+
+      for (unsigned long i=from; i<to; i++) {
+        if (fedVals[p][i] != STORE_INVALID) {
+          lo[p] = min(lo[p], fedVals[p][i]);
+          hi[p] = max(hi[p], fedVals[p][i]);
+          sum += fedVals[p][i];
+          count++;
+        }
+      }
+
+      mean[p] = count ? (double)sum / count : -1;
+    }
+
+    for (unsigned long i=from; i<to; i++) {
+      on += fedPower[i];
+    }
+
+    powerPercent = on * 100 / (to - from);
+  }
+
+  // Min and max exactly, the mean and power to within the rounding of
+  // the finer buckets it was made from
+  bool matches(HistoryBucket &bucket) {
+    for (unsigned p=0; p<HISTORY_PROBES; p++) {
+      if (mean[p] < 0) {
+        if (bucket.meanVal[p] != STORE_INVALID) {
+          return false;
+        }
+      } else if (bucket.getMin(p) != lo[p] || bucket.getMax(p) != hi[p] || fabs(bucket.meanVal[p] - mean[p]) > 1) {
+        return false;
+      }
+    }
+
+    return abs((int)bucket.powerPercent - (int)powerPercent) <= 1;
+  }
+};
+
+static HistoryStore store;
+
+// Feeds 'count' samples a minute apart, the first at 'start'
+static void feedStore(unsigned long start, unsigned long count) {
+  for (unsigned p=0; p<HISTORY_PROBES; p++) {
+    fedVals[p].clear();
+  }
+
+  fedPower.clear();
+  store.init(start);
+
+  for (unsigned long i=0; i<count; i++) {
+    StoreVal vals[HISTORY_PROBES];
+
+    for (unsigned p=0; p<HISTORY_PROBES; p++) {
+      vals[p] = feedVal(p, i);
+      fedVals[p].push_back(vals[p]);
+    }
+
+    fedPower.push_back(feedPower(i));
+    store.addSample(start + i * FEED_MILLIS, vals, feedPower(i));
+  }
+}
+
+// Buckets tier 't' has closed since the feed started
+static unsigned long closedBuckets(unsigned t) {
+  return (fedPower.size() - 1) * FEED_MILLIS / store.getBucketMillis(t);
+}
+
+// Samples in the bucket 'age' buckets back in tier 't'
+static Scan scanBucket(unsigned t, unsigned age, unsigned ages = 1) {
+  unsigned long samples = store.getBucketMillis(t) / FEED_MILLIS;
+  unsigned long newest = closedBuckets(t) - age;
+
+  return Scan((newest - ages) * samples, newest * samples);
+}
+
+HOST_TEST(tiersMatchBruteForce) {
+  feedStore(1000, FEED_DAYS * DAY_MILLIS / FEED_MILLIS + 17);
+
+  for (unsigned t=0; t<HISTORY_TIERS; t++) {
+    unsigned expected = min(closedBuckets(t), (unsigned long)store.getSize(t));
+    unsigned age;
+
+    for (age=0; store.getBucket(t, age); age++) {
+      if (!CHECK(scanBucket(t, age).matches(*store.getBucket(t, age)))) {
+        printf("  tier %u, age %u\n", t, age);
+        return;
+      }
+    }
+
+    CHECK(age == expected);
+  }
+
+  BENCH("historyBucketBytes", "%lu", (unsigned long)sizeof(HistoryBucket));
+  BENCH("historyStoreBytes", "%lu", (unsigned long)sizeof(HistoryStore));
+
+  // About 6.9 KB of buckets
+  CHECK(sizeof(HistoryBucket) == 14);
+  CHECK(sizeof(HistoryBucket) * (HISTORY_TIER0_BUCKETS + HISTORY_TIER1_BUCKETS + HISTORY_TIER2_BUCKETS) < 7000);
+}
+
+// Each column of the 7 and 30 day charts covers the buckets the
+// chart's width divides its tier into
+HOST_TEST(queriesMatchBruteForce) {
+  static const unsigned long spans[] = { 7 * DAY_MILLIS, 30 * DAY_MILLIS };
+
+  for (unsigned s=0; s<sizeof(spans)/sizeof(spans[0]); s++) {
+    unsigned t = store.tierForSpan(spans[s]);
+    unsigned long buckets = spans[s] / store.getBucketMillis(t);
+
+    CHECK(t == s + 1);
+
+    for (unsigned column=0; column<QUERY_COLUMNS; column++) {
+      unsigned newest = (QUERY_COLUMNS - column - 1) * buckets / QUERY_COLUMNS;
+      unsigned oldest = max((QUERY_COLUMNS - column) * buckets / QUERY_COLUMNS, (unsigned long)newest + 1);
+      HistoryBucket bucket;
+
+      CHECK(store.query(spans[s], QUERY_COLUMNS, column, bucket));
+
+      if (!CHECK(scanBucket(t, newest, oldest - newest).matches(bucket))) {
+        printf("  span %lu days, column %u\n", spans[s] / DAY_MILLIS, column);
+        return;
+      }
+    }
+  }
+}
+
+//============================================================
+// Restart
+
+static ProbeSamples fed;
+
+static void feedChart(ChartDisplay &chart, unsigned long timestamp, unsigned long i) {
+  for (unsigned r=0; r<PROBE_ROLES; r++) {
+    fed.temp[fed.roleProbe[0][r]] = tempFromStoreVal(feedVal(r, i));
+  }
+
+  chart.addDataPoint(timestamp, fed, 0, feedPower(i));
+}
+
+static bool sameBucket(HistoryBucket &a, HistoryBucket &b) {
+  for (unsigned p=0; p<HISTORY_PROBES; p++) {
+    if (a.meanVal[p] != b.meanVal[p] || a.belowMean[p] != b.belowMean[p] || a.aboveMean[p] != b.aboveMean[p]) {
+      return false;
+    }
+  }
+
+  return a.powerPercent == b.powerPercent;
+}
+
+// Closed buckets of tier 't', newest first
+static std::vector<HistoryBucket> snapshot(HistoryStore &history, unsigned t) {
+  std::vector<HistoryBucket> buckets;
+
+  for (unsigned age=0; history.getBucket(t, age); age++) {
+    buckets.push_back(*history.getBucket(t, age));
+  }
+
+  return buckets;
+}
+
+// The buckets in 'before' are in 'after', 'shift' buckets further back
+static bool sameTier(const std::vector<HistoryBucket> &before, HistoryStore &after, unsigned t, unsigned shift) {
+  for (unsigned age=0; age<before.size() && age + shift<after.getSize(t); age++) {
+    HistoryBucket bucket = before[age];
+
+    if (!after.getBucket(t, age + shift) || !sameBucket(bucket, *after.getBucket(t, age + shift))) {
+      printf("  tier %u, age %u\n", t, age);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// A month on the chart, then a restart. The 7 and 30 day tiers come
+// back from their logs bucket for bucket and carry on closing one an
+// hour; the 12 hour tier is rebuilt from the sample log's columns.
+HOST_TEST(tiersSurviveRestart) {
+  static ChartDisplay rebooted(tft);
+  static ChartDisplay again(tft);
+  unsigned long minutes = 31 * DAY_MILLIS / FEED_MILLIS;
+
+  hostFlashReset();
+  hostProbesReset(3);
+  setup();
+  chartDisplay.hide();
+  fed = samples;
+
+  unsigned long start = millis();
+  unsigned long writes = hostFlashWrites;
+  unsigned long columns = chartDisplay.getSampleLog().endSeq();
+
+  for (unsigned long i=0; i<minutes; i++) {
+    feedChart(chartDisplay, start + i * FEED_MILLIS, i);
+  }
+
+  chartDisplay.getSampleLog().flush();
+  columns = chartDisplay.getSampleLog().endSeq() - columns;
+
+  BENCH("historyLogHalfWordsPerDay", "%lu", (hostFlashWrites - writes - columns * SAMPLE_LOG_RECORD_WORDS) / 31);
+
+  std::vector<HistoryBucket> hours = snapshot(chartDisplay.getHistory(), 1);
+  std::vector<HistoryBucket> fourHours = snapshot(chartDisplay.getHistory(), 2);
+  unsigned long reads = hostFlashReads;
+
+  rebooted.init();
+  rebooted.hide();
+
+  BENCH("historyRestoreFlashReads", "%lu", hostFlashReads - reads);
+
+  HistoryStore &after = rebooted.getHistory();
+
+  CHECK(hours.size() == HISTORY_TIER1_BUCKETS);
+  CHECK(fourHours.size() == HISTORY_TIER2_BUCKETS);
+  CHECK(sameTier(hours, after, 1, 0));
+  CHECK(sameTier(fourHours, after, 2, 0));
+  CHECK(after.getBucket(0, HISTORY_TIER0_BUCKETS - 3) != 0);
+
+  // Columns since the last logged one are lost, so the open hour
+  // closes early; the next closes an hour after it
+  unsigned long now = millis();
+
+  for (unsigned long i=0; i<60; i++) {
+    feedChart(rebooted, now + i * FEED_MILLIS, minutes + i);
+  }
+
+  CHECK(sameTier(hours, after, 1, 1));
+  CHECK(after.getBucket(1, 0)->isValid());
+
+  for (unsigned long i=60; i<120; i++) {
+    feedChart(rebooted, now + i * FEED_MILLIS, minutes + i);
+  }
+
+  CHECK(sameTier(hours, after, 1, 2));
+
+  // And those are kept too
+  hours = snapshot(after, 1);
+  fourHours = snapshot(after, 2);
+  again.init();
+
+  CHECK(sameTier(hours, again.getHistory(), 1, 0));
+  CHECK(sameTier(fourHours, again.getHistory(), 2, 0));
+  CHECK(hostFlashViolations == 0);
+}
+
+// A power cut part way through a record loses that record only
+HOST_TEST(logSkipsTornRecord) {
+  for (long cut=0; cut<HISTORY_LOG_RECORD_WORDS; cut++) {
+    HistoryLog writer(HISTORY_TIER1_LOG_BASE, HISTORY_TIER1_LOG_PAGES);
+    HistoryBucket bucket;
+    HistoryRecord record;
+
+    hostFlashReset();
+    writer.init();
+    bucket.clear();
+
+    for (unsigned i=0; i<50; i++) {
+      bucket.meanVal[0] = i;
+      writer.append(0, i, bucket);
+    }
+
+    hostFlashCutAfter(cut);
+    writer.append(0, 50, bucket);
+    hostFlashCutAfter(-1);
+
+    HistoryLog reader(HISTORY_TIER1_LOG_BASE, HISTORY_TIER1_LOG_PAGES);
+
+    reader.init();
+    bucket.meanVal[0] = 51;
+    reader.append(0, 51, bucket);
+
+    HistoryLog again(HISTORY_TIER1_LOG_BASE, HISTORY_TIER1_LOG_PAGES);
+
+    again.init();
+
+    // Nothing written leaves nothing torn
+    unsigned long last = cut ? 52 : 51;
+    bool ok = again.endSeq() == last + 1 && (!cut || !again.read(51, record)) &&
+              again.read(50, record) && record.bucket.meanVal[0] == 49 &&
+              again.read(last, record) && record.logSeq == 51 && record.bucket.meanVal[0] == 51;
+
+    if (!CHECK(ok)) {
+      printf("  cut after %ld half words\n", cut);
+      return;
+    }
+  }
+}
@@ -0,0 +1,75 @@
+#include "HostTest.h"
+
+//============================================================
+// Control task lateness while the menu is in use
+//
+// The panel's SPI is clocked as on the board, so every draw takes as
+// long on the host's clock as it would there and holds up whatever
+// task is due behind it. The CPU's own time is not charged.
+
+#define BOARD_SPI_CLOCK 18000000UL
+#define HOLD_TIME 30000UL     // Milliseconds the key is held
+#define PRESS_PERIOD 1037UL   // Milliseconds, off the control task's beat
+
+// Milliseconds the panel takes to receive 'bytes'
+static unsigned long spiMillis(unsigned long bytes) {
+  return (bytes * 8 * 1000 + BOARD_SPI_CLOCK - 1) / BOARD_SPI_CLOCK;
+}
+
+// With Down held and the menu redrawn in and out of a submenu every
+// second, the control task waits at most for one full menu draw. The
+// blocking menu it replaced held the control loop for as long as the
+// key was down.
+HOST_TEST(controlRunsWithMenuHeld) {
+  hostProbesReset(3);
+  setup();
+  hostSetSpiClock(BOARD_SPI_CLOCK);
+  hostRun(60000UL);
+
+  unsigned long before = scheduler.getMaxLatency(controlTaskId);
+
+  // Any key wakes the screen, the next opens the menu
+  hostSchedulePin(0, BTN_SELECT, LOW);
+  hostSchedulePin(100, BTN_SELECT, HIGH);
+  hostSchedulePin(300, BTN_SELECT, LOW);
+  hostSchedulePin(400, BTN_SELECT, HIGH);
+  hostRun(1000);
+  CHECK(menuOpen);
+
+  unsigned long bytes = halCounters.spiBytes;
+
+  menuHandler.buttonPressed(ButtonSelect);
+  menuHandler.buttonPressed(ButtonBack);
+
+  unsigned long drawMillis = spiMillis((halCounters.spiBytes - bytes) / 2);
+
+  hostSetPin(BTN_DOWN, LOW);
+
+  for (unsigned long at=0; at<HOLD_TIME; at+=PRESS_PERIOD) {
+    hostSchedulePin(at + 100, BTN_SELECT, LOW);
+    hostSchedulePin(at + 200, BTN_SELECT, HIGH);
+    hostSchedulePin(at + 600, BTN_BACK, LOW);
+    hostSchedulePin(at + 700, BTN_BACK, HIGH);
+  }
+
+  unsigned long spiBytes = halCounters.spiBytes;
+  unsigned long start = millis();
+
+  hostRun(HOLD_TIME);
+
+  unsigned long worst = scheduler.getMaxLatency(controlTaskId);
+  unsigned long busyMillis = spiMillis(halCounters.spiBytes - spiBytes);
+
+  BENCH("menuDrawMs", "%lu", drawMillis);
+  BENCH("heldSpiMs", "%lu", busyMillis);
+  BENCH("heldMs", "%lu", millis() - start);
+  BENCH("controlLatencyIdleMs", "%lu", before);
+  BENCH("controlLatencyHeldMs", "%lu", worst);
+
+  hostSetPin(BTN_DOWN, HIGH);
+  hostSetSpiClock(0);
+
+  CHECK(menuOpen);
+  CHECK(busyMillis > HOLD_TIME / PRESS_PERIOD * drawMillis);
+  CHECK(worst <= drawMillis);
+}
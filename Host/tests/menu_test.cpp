@@ -0,0 +1,390 @@
+#include "HostTest.h"
+
+#include <malloc.h>
+#include <new>
+
+//============================================================
+// Menu open path: heap use, time and static size, against the
+// heap-built menu it replaced
+
+#define MENU_OPENS 1000
+
+// Every heap allocation the firmware makes goes through here, with the
+// bytes live and the most ever live at once, as the allocator sized them
+static unsigned long heapAllocations = 0;
+static unsigned long heapBytes = 0;
+static unsigned long heapPeakBytes = 0;
+
+void *operator new(size_t size) {
+  void *block = malloc(size ? size : 1);
+
+  if (!block) {
+    throw std::bad_alloc();
+  }
+
+  heapAllocations++;
+  heapBytes += malloc_usable_size(block);
+  heapPeakBytes = max(heapPeakBytes, heapBytes);
+
+  return block;
+}
+
+__attribute__((noinline)) void operator delete(void *block) noexcept {
+  if (block) {
+    heapBytes -= malloc_usable_size(block);
+    free(block);
+  }
+}
+
+//============================================================
+// The heap-built menu it replaced
+//
+// The old Menu and MenuHandler as they were, building today's tree
+// and drawing through the HAL, without the blocking key loop. One open
+// is: build the tree, find each selection by parsing the item strings,
+// and draw. Closing deletes the tree again.
+
+#define HEAP_MAX_CALLBACKS 5
+
+class HeapMenu {
+  public:
+  const char **items;
+  unsigned itemCount;
+  unsigned activeItem;
+  int selectedItem;
+  MenuCallback *callbacks[HEAP_MAX_CALLBACKS];
+  HeapMenu **subMenus;
+  char selectedValue[SELECTED_VALUE_MAX_LEN + 1];
+
+  HalDisplay *tft;
+  unsigned rowCount;
+  unsigned drawX;
+  unsigned drawY;
+  unsigned rowSpace;
+  unsigned rowWidth;
+  unsigned rowHeight;
+  unsigned drawColour;
+  unsigned topIndex;
+
+  HeapMenu(const char **items, unsigned itemCount)
+    : items(items),
+      itemCount(itemCount),
+      activeItem(0),
+      selectedItem(-1),
+      subMenus(new HeapMenu*[itemCount]),
+      rowCount(UINT_MAX),
+      topIndex(0) {
+    memset(subMenus, 0, itemCount * sizeof(HeapMenu*));
+    memset(callbacks, 0, HEAP_MAX_CALLBACKS * sizeof(MenuCallback*));
+    selectedValue[0] = 0;
+  }
+
+  ~HeapMenu() {
+    delete[] subMenus;
+  }
+
+  void updateSelectedValueText(void) {
+    unsigned length = 0;
+
+    selectedValue[0] = 0;
+
+    if (selectedItem >= 0) {
+      strncat(selectedValue, items[selectedItem], SELECTED_VALUE_MAX_LEN);
+      length += strlen(selectedValue);
+    }
+
+    for (unsigned i=0; i<itemCount; i++) {
+      if (subMenus[i]) {
+        const char *subMenuValue = subMenus[i]->getSelectedValue();
+
+        if (subMenuValue) {
+          if (length && (length < SELECTED_VALUE_MAX_LEN)) {
+            strcat(selectedValue, "/");
+            length++;
+          }
+
+          if (length < SELECTED_VALUE_MAX_LEN) {
+            snprintf(selectedValue + length, SELECTED_VALUE_MAX_LEN + 1 - length, "%s", subMenuValue);
+            length += strlen(subMenuValue);
+          }
+        }
+      }
+    }
+  }
+
+  const char *getSelectedValue(void) {
+    updateSelectedValueText();
+
+    return strlen(selectedValue) ? selectedValue : 0;
+  }
+
+  void setSelectedIndex(int index) {
+    if (index < 0) {
+      selectedItem = -1;
+      activeItem = 0;
+    } else if ((unsigned)index < itemCount) {
+      selectedItem = activeItem = index;
+    }
+  }
+
+  void drawItem(unsigned index) {
+    const char *selectedText = 0;
+    char *text = 0;
+    unsigned y = drawY + (index - topIndex) * rowSpace;
+
+    tft->setBackgroundColor(index==activeItem ? drawColour : COLOR_BLACK);
+
+    if (subMenus[index]) {
+      tft->drawTriangle(drawX + rowWidth - rowHeight / 2, y, drawX + rowWidth - rowHeight / 2, y + rowHeight, drawX + rowWidth, y + rowHeight / 2, drawColour);
+
+      selectedText = subMenus[index]->getSelectedValue();
+    }
+
+    if (selectedText) {
+      text = new char[strlen(items[index]) + strlen(selectedText) + 3];
+
+      sprintf(text, "%s: %s", items[index], selectedText);
+    }
+
+    tft->drawText(drawX, y, text ? text : items[index], index==activeItem ? COLOR_BLACK : drawColour);
+
+    delete[] text;
+  }
+
+  void draw(void) {
+    tft->fillRectangle(drawX, drawY, drawX + rowWidth, drawY + (rowCount - 1) * rowSpace + rowHeight, BACKGROUND_COLOUR);
+
+    for (unsigned i=0; i<min(rowCount, itemCount); i++) {
+      drawItem(topIndex + i);
+    }
+  }
+};
+
+class HeapMenuHandler {
+  public:
+  HalDisplay &tft;
+  LoadController &loadControl;
+  HeapMenu *menu;
+  HeapMenu *modeSub;
+  HeapMenu *controlSub;
+  HeapMenu *targetTempSub;
+  HeapMenu *tempRangeSub;
+  HeapMenu *dutyCycleSub;
+  HeapMenu *dutyCycleOnSub;
+  HeapMenu *dutyCycleOffSub;
+  HeapMenu *powerControlSub;
+  HeapMenu *chartSpanSub;
+#if CHANNELS > 1
+  HeapMenu *vesselSub;
+#endif
+
+  int findEntry(int val, const char **list, unsigned count) {
+    for (unsigned i=0; i<count; i++) {
+      if (val <= atoi(list[i])) {
+        return i;
+      }
+    }
+
+    return -1;
+  }
+
+  HeapMenuHandler(HalDisplay &tft, LoadController &lc)
+    : tft(tft),
+      loadControl(lc) {
+    menu = new HeapMenu(menuItems, NUMITEMS(menuItems));
+    modeSub = new HeapMenu(modeSubItems, NUMITEMS(modeSubItems));
+    controlSub = new HeapMenu(controlSubItems, NUMITEMS(controlSubItems));
+    targetTempSub = new HeapMenu(targetTempSubItems, NUMITEMS(targetTempSubItems));
+    tempRangeSub = new HeapMenu(tempRangeSubItems, NUMITEMS(tempRangeSubItems));
+    dutyCycleSub = new HeapMenu(dutyCycleSubItems, NUMITEMS(dutyCycleSubItems));
+    dutyCycleOnSub = new HeapMenu(dutyCycleOnSubItems, NUMITEMS(dutyCycleOnSubItems));
+    dutyCycleOffSub = new HeapMenu(dutyCycleOffSubItems, NUMITEMS(dutyCycleOffSubItems));
+    powerControlSub = new HeapMenu(powerControlSubItems, NUMITEMS(powerControlSubItems));
+    chartSpanSub = new HeapMenu(chartSpanSubItems, NUMITEMS(chartSpanSubItems));
+    menu->subMenus[0] = modeSub;
+    menu->subMenus[1] = controlSub;
+    menu->subMenus[2] = targetTempSub;
+    menu->subMenus[3] = tempRangeSub;
+    menu->subMenus[4] = dutyCycleSub;
+    menu->subMenus[5] = powerControlSub;
+    menu->subMenus[6] = chartSpanSub;
+#if CHANNELS > 1
+    vesselSub = new HeapMenu(vesselSubItems, CHANNELS);
+    menu->subMenus[7] = vesselSub;
+#endif
+    dutyCycleSub->subMenus[0] = dutyCycleOnSub;
+    dutyCycleSub->subMenus[1] = dutyCycleOffSub;
+  }
+
+  ~HeapMenuHandler() {
+    delete menu;
+    delete modeSub;
+    delete controlSub;
+    delete targetTempSub;
+    delete tempRangeSub;
+    delete dutyCycleSub;
+    delete dutyCycleOnSub;
+    delete dutyCycleOffSub;
+    delete powerControlSub;
+    delete chartSpanSub;
+#if CHANNELS > 1
+    delete vesselSub;
+#endif
+  }
+
+  void presentMenu(void) {
+    unsigned screenWidth = tft.maxX();
+    unsigned screenHeight = tft.maxY();
+
+    modeSub->setSelectedIndex(loadControl.getControlMode() == LoadController::Heating ? 0 : 1);
+    controlSub->setSelectedIndex(loadControl.getStrategy());
+    targetTempSub->setSelectedIndex(findEntry(loadControl.getTargetTemp(), targetTempSubItems, NUMITEMS(targetTempSubItems)));
+    tempRangeSub->setSelectedIndex(findEntry(loadControl.getTempRange(), tempRangeSubItems, NUMITEMS(tempRangeSubItems)));
+    dutyCycleOnSub->setSelectedIndex(findEntry(loadControl.getDutyCycleOn(), dutyCycleOnSubItems, NUMITEMS(dutyCycleOnSubItems)));
+    dutyCycleOffSub->setSelectedIndex(findEntry(loadControl.getDutyCycleOff(), dutyCycleOffSubItems, NUMITEMS(dutyCycleOffSubItems)));
+    powerControlSub->setSelectedIndex(loadControl.getPowerControlState() == LoadController::Energised ? 0 : 1);
+    chartSpanSub->setSelectedIndex(chartDisplay.getSpan());
+#if CHANNELS > 1
+    vesselSub->setSelectedIndex(0);
+#endif
+
+    for (int i=0; i<BORDER_WIDTH; i++) {
+      tft.drawRectangle(TLX+i, TLY+i, TLX+WIDTH-i, TLY+HEIGHT-i, MENU_COLOUR);
+    }
+    tft.fillRectangle(MENU_X, MENU_Y, MENU_X+MENU_WIDTH, MENU_Y+MENU_HEIGHT, BACKGROUND_COLOUR);
+    tft.setFont(Terminal11x16);
+
+    menu->tft = &tft;
+    menu->rowCount = NUM_ROWS;
+    menu->drawX = MENU_X+ROW_X_PAD;
+    menu->drawY = MENU_Y+ROW_Y_PAD;
+    menu->rowSpace = ROW_HEIGHT;
+    menu->rowWidth = MENU_WIDTH-2*ROW_X_PAD;
+    menu->rowHeight = tft.getFont().height;
+    menu->drawColour = MENU_COLOUR;
+    menu->draw();
+  }
+};
+
+// Opening the menu, walking into a submenu and back, and closing it
+// again touch only the static tree
+HOST_TEST(menuOpenAllocatesNothing) {
+  hostProbesReset(3);
+  setup();
+  hostRun(60000UL);
+
+  unsigned long allocations = heapAllocations;
+
+  openMenu();
+  menuHandler.buttonPressed(ButtonDown);
+  menuHandler.buttonPressed(ButtonSelect);
+  menuHandler.buttonPressed(ButtonBack);
+  closeMenu();
+
+  BENCH("menuOpenAllocations", "%lu", heapAllocations - allocations);
+  CHECK(heapAllocations == allocations);
+}
+
+// Host nanoseconds are a relative figure only; the SPI bytes are what
+// the panel sees. The heap-built menu built the tree and cleared the
+// rows twice on every open, and needed more heap while open than the
+// whole static tree takes.
+HOST_TEST(menuOpenLatency) {
+  unsigned long elapsed = 0;
+  unsigned long spiBytes = 0;
+
+  for (unsigned i=0; i<MENU_OPENS; i++) {
+    unsigned long bytes = halCounters.spiBytes;
+    uint32_t start = hostCycles();
+
+    openMenu();
+
+    elapsed += hostCycles() - start;
+    spiBytes += halCounters.spiBytes - bytes;
+    closeMenu();
+  }
+
+  unsigned long heapElapsed = 0;
+  unsigned long heapSpiBytes = 0;
+  unsigned long allocations = heapAllocations;
+
+  heapPeakBytes = heapBytes;
+
+  for (unsigned i=0; i<MENU_OPENS; i++) {
+    unsigned long bytes = halCounters.spiBytes;
+    uint32_t start = hostCycles();
+    HeapMenuHandler *handler = new HeapMenuHandler(tft, channels[0].control);
+
+    handler->presentMenu();
+
+    heapElapsed += hostCycles() - start;
+    heapSpiBytes += halCounters.spiBytes - bytes;
+    delete handler;
+  }
+
+  unsigned long treeBytes = sizeof(Menu) * (10 + (CHANNELS > 1)) + sizeof(MenuHandler);
+  unsigned long heapOpenBytes = heapPeakBytes - heapBytes;
+
+  BENCH("menuOpenNs", "%lu", elapsed / MENU_OPENS);
+  BENCH("menuOpenSpiBytes", "%lu", spiBytes / MENU_OPENS);
+  BENCH("menuTreeBytes", "%lu", treeBytes);
+  BENCH("heapMenuOpenNs", "%lu", heapElapsed / MENU_OPENS);
+  BENCH("heapMenuOpenSpiBytes", "%lu", heapSpiBytes / MENU_OPENS);
+  BENCH("heapMenuOpenAllocations", "%lu", (heapAllocations - allocations) / MENU_OPENS);
+  BENCH("heapMenuOpenBytes", "%lu", heapOpenBytes);
+  CHECK(menuHandler.isOpen() == false);
+
+  CHECK(elapsed < heapElapsed);
+  CHECK(spiBytes < heapSpiBytes);
+  CHECK(treeBytes < heapOpenBytes);
+}
+
+// A selection hands the item's value to the setter as it is
+HOST_TEST(selectionSetsValue) {
+  LoadController &control = channels[0].control;
+
+  control.setTargetTemp(20);
+
+  openMenu();
+  menuHandler.buttonPressed(ButtonDown);
+  menuHandler.buttonPressed(ButtonDown);
+  menuHandler.buttonPressed(ButtonSelect);
+  menuHandler.buttonPressed(ButtonDown);
+  menuHandler.buttonPressed(ButtonSelect);
+  closeMenu();
+
+  CHECK(control.getTargetTemp() == 21);
+}
+
+// Moving the cursor inside the window repaints two rows from the
+// cached summaries; past its edge, the six rows the window shows
+HOST_TEST(keyPressCost) {
+  channels[0].control.setTargetTemp(15);
+  openMenu();
+  menuHandler.buttonPressed(ButtonDown);
+  menuHandler.buttonPressed(ButtonDown);
+  menuHandler.buttonPressed(ButtonSelect);
+
+  unsigned long allocations = heapAllocations;
+  uint32_t start = hostCycles();
+
+  menuHandler.buttonPressed(ButtonDown);
+
+  uint32_t elapsed = hostCycles() - start;
+  unsigned long rowBytes = menuHandler.getKeySpiBytes();
+
+  for (unsigned i=0; i<5; i++) {
+    menuHandler.buttonPressed(ButtonDown);
+  }
+
+  unsigned long windowBytes = menuHandler.getKeySpiBytes();
+
+  BENCH("keyPressNs", "%lu", (unsigned long)elapsed);
+  BENCH("keyPressRowSpiBytes", "%lu", rowBytes);
+  BENCH("keyPressWindowSpiBytes", "%lu", windowBytes);
+  BENCH("keyPressAllocations", "%lu", heapAllocations - allocations);
+
+  CHECK(heapAllocations == allocations);
+  CHECK(rowBytes > 0 && rowBytes < windowBytes);
+  closeMenu();
+}
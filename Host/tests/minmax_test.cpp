@@ -0,0 +1,128 @@
+#include "HostTest.h"
+
+//============================================================
+// MinMaxTree against a brute-force scan, and what each costs a sample
+
+#define TEST_COLUMNS 192   // X_PIXELS on the 220 pixel panel
+#define TEST_UPDATES 200000UL
+
+class ScanMinMax {
+  public:
+  StoreVal columns[TEST_COLUMNS];
+
+  ScanMinMax() {
+    for (unsigned i=0; i<TEST_COLUMNS; i++) {
+      columns[i] = STORE_INVALID;
+    }
+  }
+
+  // The rescan updateMinMax() used to do on every sample
+  void scan(StoreVal &low, StoreVal &high) {
+    low = STORE_INVALID;
+    high = 0;
+
+    for (unsigned i=0; i<TEST_COLUMNS; i++) {
+      if (columns[i] != STORE_INVALID) {
+        low = min(low, columns[i]);
+        high = max(high, columns[i]);
+      }
+    }
+  }
+};
+
+static StoreVal randomVal(void) {
+  return rand() % 8 == 0 ? STORE_INVALID : rand() % STORE_INVALID;
+}
+
+HOST_TEST(matchesScan) {
+  for (unsigned columns=1; columns<=TEST_COLUMNS; columns+=TEST_COLUMNS/8) {
+    MinMaxTree<StoreVal, STORE_INVALID> tree;
+    ScanMinMax scan;
+
+    tree.init(columns);
+    srand(columns);
+
+    for (unsigned i=0; i<20000; i++) {
+      unsigned column = rand() % columns;
+      StoreVal val = randomVal();
+      StoreVal low, high;
+
+      tree.set(column, val);
+      scan.columns[column] = val;
+      scan.scan(low, high);
+
+      if (!CHECK(tree.getMin() == low && tree.getMax() == high && tree.get(column) == val)) {
+        return;
+      }
+    }
+  }
+}
+
+HOST_TEST(emptyIsInvalid) {
+  MinMaxTree<StoreVal, STORE_INVALID> tree;
+
+  tree.init(TEST_COLUMNS);
+
+  CHECK(tree.getMin() == STORE_INVALID);
+  CHECK(tree.getMax() == 0);
+
+  tree.set(5, 100);
+  tree.set(5, STORE_INVALID);
+
+  CHECK(tree.getMin() == STORE_INVALID);
+  CHECK(tree.getMax() == 0);
+}
+
+// Each sample writes the next column and the one after, as the chart
+// does, for all three probe roles
+HOST_TEST(benchmark) {
+  MinMaxTree<StoreVal, STORE_INVALID> trees[PROBE_ROLES];
+  ScanMinMax scans[PROBE_ROLES];
+  StoreVal vals[1024];
+  unsigned long sum = 0;
+
+  for (unsigned t=0; t<PROBE_ROLES; t++) {
+    trees[t].init(TEST_COLUMNS);
+  }
+
+  for (unsigned i=0; i<1024; i++) {
+    vals[i] = rand() % STORE_INVALID;
+  }
+
+  uint32_t start = halCycles();
+
+  for (unsigned long i=0; i<TEST_UPDATES; i++) {
+    unsigned column = i % TEST_COLUMNS;
+
+    for (unsigned t=0; t<PROBE_ROLES; t++) {
+      StoreVal low, high;
+
+      scans[t].columns[column] = vals[(i + t) % 1024];
+      scans[t].columns[(column + 1) % TEST_COLUMNS] = STORE_INVALID;
+      scans[t].scan(low, high);
+      sum += low + high;
+    }
+  }
+
+  uint32_t scanCycles = halCycles() - start;
+
+  start = halCycles();
+
+  for (unsigned long i=0; i<TEST_UPDATES; i++) {
+    unsigned column = i % TEST_COLUMNS;
+
+    for (unsigned t=0; t<PROBE_ROLES; t++) {
+      trees[t].set(column, vals[(i + t) % 1024]);
+      trees[t].set((column + 1) % TEST_COLUMNS, STORE_INVALID);
+      sum += trees[t].getMin() + trees[t].getMax();
+    }
+  }
+
+  uint32_t treeCycles = halCycles() - start;
+
+  BENCH("minMaxScanNsPerSample", "%.1f", (double)scanCycles / TEST_UPDATES);
+  BENCH("minMaxTreeNsPerSample", "%.1f", (double)treeCycles / TEST_UPDATES);
+  BENCH("minMaxChecksum", "%lu", sum);
+
+  CHECK(treeCycles < scanCycles);
+}
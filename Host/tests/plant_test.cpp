@@ -0,0 +1,112 @@
+#include "HostTest.h"
+
+//============================================================
+// The plant simulator's scenarios and the report they print
+
+#define SCENARIOS (sizeof(simScenarios) / sizeof(simScenarios[0]))
+
+class ScenarioReport {
+  public:
+  unsigned long overshoot;
+  unsigned long inBand;
+  unsigned long switches;
+  unsigned long cpu;
+};
+
+static ScenarioReport reports[SCENARIOS];
+
+// The value on the first "name value" line after 'from'
+static bool reportValue(const std::string &report, size_t &from, const char *name, unsigned long &value) {
+  size_t at = report.find(std::string("\n") + name + " ", from);
+
+  if (at == std::string::npos) {
+    return false;
+  }
+
+  from = at + 1;
+
+  return sscanf(report.c_str() + at + strlen(name) + 2, "%lu", &value) == 1;
+}
+
+// setup() runs every scenario. PID holds the band for most of each
+// run and, with its on time fixed for each window, switches the relay
+// at most twice a window.
+HOST_TEST(scenariosReport) {
+  hostSerialCapture(true);
+  setup();
+  hostSerialCapture(false);
+
+  const std::string &report = hostSerialOutput();
+  size_t from = 0;
+
+  for (unsigned i=0; i<SCENARIOS; i++) {
+    const SimScenario &scenario = simScenarios[i];
+    unsigned long &overshoot = reports[i].overshoot;
+    unsigned long &inBand = reports[i].inBand;
+    unsigned long &switches = reports[i].switches;
+    unsigned long &cpu = reports[i].cpu;
+
+    from = report.find(std::string("scenario ") + scenario.name + "\n", from);
+
+    if (!CHECK(from != std::string::npos)) {
+      return;
+    }
+
+    CHECK(reportValue(report, from, "overshootTenths", overshoot));
+    CHECK(reportValue(report, from, "inBandPercent", inBand));
+    CHECK(reportValue(report, from, "switches", switches));
+    CHECK(reportValue(report, from, "cpuMsPerDay", cpu));
+
+    BENCH(scenario.name, "overshootTenths %lu inBandPercent %lu switches %lu cpuMsPerDay %lu",
+          overshoot, inBand, switches, cpu);
+
+    CHECK(switches > 0);
+
+    if (scenario.strategy == LoadController::Pid) {
+      CHECK(inBand >= 60);
+      CHECK(switches <= 2 * scenario.days * (SIM_DAY / PID_WINDOW));
+    }
+  }
+}
+
+// Every simulated day gets its awake figure
+HOST_TEST(daysReport) {
+  const std::string &report = hostSerialOutput();
+  unsigned days = 0;
+
+  for (unsigned i=0; i<SCENARIOS; i++) {
+    days += simScenarios[i].days;
+  }
+
+  size_t from = 0;
+  unsigned long value;
+  unsigned found = 0;
+
+  while (reportValue(report, from, "awakePpm", value)) {
+    found++;
+  }
+
+  CHECK(found == days);
+}
+
+// Each band scenario against its PID twin, which follows it in the
+// table three places on. PID holds the band longer in every one. The
+// crash cool runs the band strategy without a duty cycle, as it needs
+// the chiller nearly all the time to reach 2 Deg, so it switches
+// rarely; elsewhere it switches every 30 s and PID far less.
+HOST_TEST(pidAgainstBand) {
+  const unsigned pairs = SCENARIOS / 2;
+
+  for (unsigned i=0; i<pairs; i++) {
+    const ScenarioReport &band = reports[i];
+    const ScenarioReport &pid = reports[i + pairs];
+
+    CHECK(simScenarios[i].strategy == LoadController::Band);
+    CHECK(simScenarios[i + pairs].strategy == LoadController::Pid);
+    CHECK(pid.inBand > band.inBand);
+
+    if (simScenarios[i].dutyCycleOff > 0) {
+      CHECK(pid.switches * 5 < band.switches);
+    }
+  }
+}
@@ -0,0 +1,104 @@
+#include "HostTest.h"
+
+//============================================================
+// Probe count scaling on the simulated bus
+
+#define SCALE_TIME 60000UL   // Milliseconds sampled at each count
+#define SCALE_RUNS 3
+#define SCALE_FIXED_BYTES 128   // Bus handle, count and role table
+
+class ScaleRun {
+  public:
+  unsigned long conversions;
+  unsigned long reads;
+  unsigned long passes;
+  unsigned long ns;
+};
+
+// Discovers 'probes' probes and polls them for SCALE_TIME, as the
+// sensor task would
+static ScaleRun sample(unsigned probes) {
+  TempSensors sensors;
+  ProbeSamples samples;
+  ScaleRun run = { 0, 0, 0, 0 };
+
+  hostProbesReset(probes);
+  sensors.init(TEMP_SENSORS_PIN, samples, channels);
+
+  unsigned long conversions = halCounters.conversions;
+  unsigned long reads = halCounters.sensorReads;
+  unsigned long start = millis();
+
+  while (millis() - start < SCALE_TIME) {
+    uint32_t begin = hostCycles();
+
+    sensors.poll(samples);
+    run.ns += hostCycles() - begin;
+    run.passes++;
+
+    hostAdvance(max(sensors.nextEvent(), 1UL));
+  }
+
+  run.conversions = halCounters.conversions - conversions;
+  run.reads = halCounters.sensorReads - reads;
+
+  return run;
+}
+
+// Bus work is the same per probe at every count, and the time spent
+// in poll() grows with the probe count and no faster. The host's ns
+// are noisy, so each count keeps the quickest of a few runs.
+HOST_TEST(costIsLinearInProbes) {
+  static const unsigned counts[] = { 1, 4, 8, 16 };
+  ScaleRun one = sample(1);
+  unsigned long nsPerProbe[sizeof(counts)/sizeof(counts[0])];
+
+  for (unsigned i=0; i<sizeof(counts)/sizeof(counts[0]); i++) {
+    unsigned n = counts[i];
+    ScaleRun run = sample(n);
+    char name[40];
+
+    for (unsigned r=1; r<SCALE_RUNS; r++) {
+      ScaleRun again = sample(n);
+
+      if (again.ns < run.ns) {
+        run = again;
+      }
+    }
+
+    nsPerProbe[i] = run.ns / n;
+
+    snprintf(name, sizeof(name), "conversions%u", n);
+    BENCH(name, "%lu", run.conversions);
+    snprintf(name, sizeof(name), "pollNs%u", n);
+    BENCH(name, "%lu", run.ns);
+    snprintf(name, sizeof(name), "pollNsPerProbe%u", n);
+    BENCH(name, "%lu", nsPerProbe[i]);
+
+    CHECK(run.conversions == n * one.conversions);
+    CHECK(run.reads == n * one.reads);
+  }
+
+  // Four times the probes is at least twice the work, and no more than
+  // half as much again per probe
+  CHECK(nsPerProbe[3] * 16 >= nsPerProbe[1] * 4 * 2);
+  CHECK(nsPerProbe[2] * 2 <= nsPerProbe[1] * 3);
+  CHECK(nsPerProbe[3] * 2 <= nsPerProbe[1] * 3);
+}
+
+// Per probe state is a fixed set of arrays sized for MAX_PROBES; all
+// but a small fixed part of the sensor and sample state is one of them
+HOST_TEST(memoryIsPerProbe) {
+  unsigned long slotBytes = sizeof(DeviceAddress) + sizeof(byte) + 2 * sizeof(bool) + 2 * sizeof(unsigned long) + sizeof(ProbeFilter)
+    + sizeof(TempFixed) + sizeof(unsigned long);
+  unsigned long totalBytes = sizeof(TempSensors) + sizeof(ProbeSamples);
+  unsigned long fixedBytes = totalBytes - MAX_PROBES * slotBytes;
+
+  BENCH("sensorBytes", "%lu", (unsigned long)sizeof(TempSensors));
+  BENCH("sampleBytes", "%lu", (unsigned long)sizeof(ProbeSamples));
+  BENCH("bytesPerProbe", "%lu", slotBytes);
+  BENCH("fixedBytes", "%lu", fixedBytes);
+
+  CHECK(totalBytes >= MAX_PROBES * slotBytes);
+  CHECK(fixedBytes < SCALE_FIXED_BYTES);
+}
@@ -0,0 +1,209 @@
+#include "HostTest.h"
+
+#include <unistd.h>
+
+//============================================================
+// updateTemps under the profiler, the float arithmetic it replaced, and
+// the profiler's own cost
+//
+// HAL_CPU_HZ is 1e9 on the host, so profiler cycles are host ns. The
+// host has an FPU, so the float kernels here are far cheaper than the
+// soft-float the STM32F1 runs; the board's own counts need a PROFILE
+// build on the board.
+
+#define KERNEL_CALLS 1000000UL
+#define KERNEL_HEIGHT 176   // Panel height the old macros were written for
+#define KERNEL_Y_ZERO (KERNEL_HEIGHT-5-1)
+#define KERNEL_Y_10DEG ((KERNEL_Y_ZERO+1-44)/4)
+
+static int16_t driftingProbe(unsigned probe, unsigned long now) {
+  return (int16_t)((18.0 + probe + 2.0 * sin(now / 3600000.0)) * 16);
+}
+
+// Mean and max of one profile point from a dump
+static bool profileLine(const char *name, unsigned long &count, unsigned long &mean, unsigned long &worst) {
+  hostSerialOutput().clear();
+  profiler.dump();
+
+  const std::string &dump = hostSerialOutput();
+  size_t at = dump.find(std::string(name) + " ");
+  unsigned long least;
+
+  return at != std::string::npos &&
+         sscanf(dump.c_str() + at + strlen(name), "%lu %lu %lu %lu", &count, &least, &mean, &worst) == 4;
+}
+
+HOST_TEST(updateTempsCycles) {
+  hostSerialCapture(true);
+  hostProbesReset(3);
+  hostProbeSource(driftingProbe);
+  setup();
+  hostRun(12 * 3600000UL);
+
+  // The periodic dump ends with each task's worst lateness
+  size_t at = hostSerialOutput().rfind("\nLatency Control ");
+  unsigned long controlLatency = ULONG_MAX;
+
+  CHECK(at != std::string::npos);
+  CHECK(sscanf(hostSerialOutput().c_str() + at, "\nLatency Control %lu", &controlLatency) == 1);
+  CHECK(controlLatency == scheduler.getMaxLatency(controlTaskId));
+  BENCH("controlLatencyMs", "%lu", controlLatency);
+
+  unsigned long count, mean, worst;
+
+  CHECK(profileLine("UpdateTemps", count, mean, worst));
+  BENCH("updateTempsCalls", "%lu", count);
+  BENCH("updateTempsMeanNs", "%lu", mean);
+  BENCH("updateTempsMaxNs", "%lu", worst);
+  hostSerialCapture(false);
+}
+
+// The old tempToY() and chart column, as they were in float
+static unsigned floatTempToY(float temp) {
+  return KERNEL_Y_ZERO - (unsigned)(temp / 40 * (4 * KERNEL_Y_10DEG));
+}
+
+static unsigned floatColumn(unsigned long elapsed, unsigned long chartWidth) {
+  return (float)(elapsed % chartWidth) / chartWidth * 192;
+}
+
+// The same in 1/16 degree steps and whole columns
+static int fixedTempToY(TempFixed temp) {
+  return KERNEL_Y_ZERO - (int)((long)temp * (4 * KERNEL_Y_10DEG) / (40 * TEMP_SCALE));
+}
+
+static unsigned fixedColumn(unsigned long elapsed, unsigned long columnMillis) {
+  return elapsed / columnMillis;
+}
+
+HOST_TEST(arithmeticKernels) {
+  volatile unsigned long sink = 0;
+  unsigned long columnMillis = 12 * 3600000UL / 192;
+  uint32_t start = hostCycles();
+
+  for (unsigned long i=0; i<KERNEL_CALLS; i++) {
+    sink += floatTempToY((i & 511) / 16.0f) + floatColumn(i * 997, 192 * columnMillis);
+  }
+
+  uint32_t floatNs = hostCycles() - start;
+
+  start = hostCycles();
+
+  for (unsigned long i=0; i<KERNEL_CALLS; i++) {
+    sink += fixedTempToY(i & 511) + fixedColumn(i * 997, columnMillis);
+  }
+
+  uint32_t fixedNs = hostCycles() - start;
+
+  BENCH("floatKernelPs", "%lu", (unsigned long)floatNs * 1000 / KERNEL_CALLS);
+  BENCH("fixedKernelPs", "%lu", (unsigned long)fixedNs * 1000 / KERNEL_CALLS);
+
+  // Both scale the same way to within rounding
+  for (TempFixed t=0; t<40 * TEMP_SCALE; t++) {
+    if (!CHECK(abs((int)floatTempToY(t / 16.0f) - fixedTempToY(t)) <= 1)) {
+      break;
+    }
+  }
+}
+
+#define OVERHEAD_RUN 3600000UL   // Milliseconds profiled
+#define EMPTY_SCOPES 100000UL
+
+// The "Overhead" line in a dump, per ten thousand
+static bool profileOverhead(unsigned long &overhead) {
+  hostSerialOutput().clear();
+  profiler.dump();
+
+  const std::string &dump = hostSerialOutput();
+  size_t at = dump.find("Overhead ");
+
+  return at != std::string::npos && sscanf(dump.c_str() + at, "Overhead %lu/10000", &overhead) == 1;
+}
+
+// The timers' share is of the cycles spent awake in scheduler passes,
+// which the loop itself can time, not of the wall time mostly slept in
+// idle(). The share worked out here from the test's own timing of an
+// empty scope should match the dump's to within the host's noise.
+HOST_TEST(overheadIsShareOfAwakeTime) {
+  unsigned long long loopNs = 0;
+  unsigned long start = millis();
+
+  hostSerialCapture(true);
+  profiler.reset();
+
+  while (millis() - start < OVERHEAD_RUN) {
+    uint32_t begin = hostCycles();
+
+    loop();
+    loopNs += hostCycles() - begin;
+  }
+
+  unsigned long long awake = profiler.getAwakeCycles();
+  unsigned long calls = profiler.getCalls();
+  unsigned long overhead = ULONG_MAX;
+
+  CHECK(profileOverhead(overhead));
+  hostSerialCapture(false);
+
+  // The same empty scope init() timed, many times over
+  uint32_t begin = hostCycles();
+
+  for (unsigned long i=0; i<EMPTY_SCOPES; i++) {
+    PROFILE_SCOPE(ProfileMenu);
+  }
+
+  unsigned long scopeNs = (hostCycles() - begin) / EMPTY_SCOPES;
+  unsigned long expected = (unsigned long)((unsigned long long)calls * scopeNs * 10000ULL / awake);
+  unsigned long wallShare = (unsigned long)((unsigned long long)calls * scopeNs * 10000ULL / (OVERHEAD_RUN * (HAL_CPU_HZ / 1000ULL)));
+
+  BENCH("profiledCalls", "%lu", calls);
+  BENCH("scopeNs", "%lu", (unsigned long)profiler.getScopeCycles());
+  BENCH("emptyScopeNs", "%lu", scopeNs);
+  BENCH("awakeNs", "%llu", awake);
+  BENCH("loopNs", "%llu", loopNs);
+  BENCH("overheadPer10000", "%lu", overhead);
+  BENCH("expectedPer10000", "%lu", expected);
+  BENCH("wallSharePer10000", "%lu", wallShare);
+
+  // Awake time is inside the loop's own time
+  CHECK(awake > 0 && awake <= loopNs);
+  CHECK(overhead > 0);
+  CHECK(overhead <= 2 * expected + 1 && expected <= 2 * overhead + 1);
+}
+
+// Symbols in 'binary' with "profile" in their name, in any case
+static unsigned profileSymbols(const char *binary) {
+  std::string command = std::string(HOST_NM) + " -C '" + binary + "'";
+  FILE *symbols = popen(command.c_str(), "r");
+  char line[512];
+  unsigned count = 0;
+
+  if (!symbols) {
+    return UINT_MAX;
+  }
+
+  while (fgets(line, sizeof(line), symbols)) {
+    count += strcasestr(line, "profile") != 0;
+  }
+
+  return pclose(symbols) == 0 ? count : UINT_MAX;
+}
+
+// The host runner is the same sketch built without PROFILE: none of
+// the profiler's table, scopes or task is left in it
+HOST_TEST(scopesCompileAway) {
+  char self[PATH_MAX];
+  ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+
+  CHECK(length > 0);
+  self[max(length, (ssize_t)0)] = 0;
+
+  unsigned with = profileSymbols(self);
+  unsigned without = profileSymbols(UNPROFILED_HOST);
+
+  BENCH("profileSymbols", "%u", with);
+  BENCH("unprofiledSymbols", "%u", without);
+
+  CHECK(with > 0 && with != UINT_MAX);
+  CHECK(without == 0);
+}
@@ -0,0 +1,186 @@
+#include "HostTest.h"
+
+//============================================================
+// Sample log on the flash stand-in: wrap, torn writes, the flash
+// guard, and what a boot and a day of logging cost
+
+#define TEST_COLUMN_MILLIS 225000UL   // 12 hours over 192 columns
+
+static void appendRecords(SampleLog &log, unsigned long count) {
+  for (unsigned long i=0; i<count; i++) {
+    unsigned long seq = log.endSeq();
+    StoreVal vals[PROBE_ROLES] = { (StoreVal)seq, (StoreVal)(seq >> 16), (StoreVal)(seq * 3) };
+
+    log.append(vals, seq & 1);
+  }
+
+  log.flush();
+}
+
+static bool recordMatches(const SampleRecord &record, unsigned long seq) {
+  return record.seq == seq && record.vals[0] == (StoreVal)seq && record.vals[1] == (StoreVal)(seq >> 16) &&
+         record.vals[2] == (StoreVal)(seq * 3) && record.powerOn == (bool)(seq & 1);
+}
+
+HOST_TEST(emptyLog) {
+  SampleLog log;
+
+  hostFlashReset();
+  log.init();
+
+  CHECK(log.endSeq() == 1);
+  CHECK(log.available(1000) == 0);
+}
+
+// Every length through two and a half trips round the log
+HOST_TEST(findsNewestAfterWrap) {
+  unsigned long maxReads = 0;
+
+  hostFlashReset();
+
+  for (unsigned long count=1; count<=SAMPLE_LOG_RECORDS * 5 / 2; count+=7) {
+    SampleLog writer;
+
+    hostFlashReset();
+    writer.init();
+    appendRecords(writer, count);
+
+    SampleLog reader;
+    SampleRecord record;
+    unsigned long reads = hostFlashReads;
+
+    reader.init();
+    maxReads = max(maxReads, hostFlashReads - reads);
+
+    // The page erased for the wrap is lost, the rest survives
+    unsigned expected = min(count, (unsigned long)SAMPLE_LOG_RECORDS - SAMPLE_LOG_PAGE_RECORDS);
+    unsigned available = reader.available(SAMPLE_LOG_RECORDS);
+
+    bool ok = reader.endSeq() == count + 1 && available >= expected &&
+              reader.read(count, record) && recordMatches(record, count) &&
+              reader.read(count + 1 - available, record) && recordMatches(record, count + 1 - available);
+
+    if (!CHECK(ok)) {
+      printf("  %lu records: end %lu, %u available\n", count, reader.endSeq(), available);
+      return;
+    }
+  }
+
+  BENCH("sampleLogBootFlashReads", "%lu", maxReads);
+  CHECK(hostFlashViolations == 0);
+}
+
+// Cuts the power after every half word of a batch, at the start of a
+// page and part way through one. The log comes back with the records
+// written before the cut and carries on from them.
+HOST_TEST(recoversFromTornBatch) {
+  static const unsigned long before[] = { SAMPLE_LOG_PAGE_RECORDS * 3, SAMPLE_LOG_PAGE_RECORDS * 3 + 10, SAMPLE_LOG_RECORDS };
+
+  for (unsigned b=0; b<sizeof(before)/sizeof(before[0]); b++) {
+    for (long cut=0; cut<=SAMPLE_LOG_BATCH * SAMPLE_LOG_RECORD_WORDS + 1; cut++) {
+      SampleLog writer;
+
+      hostFlashReset();
+      writer.init();
+      appendRecords(writer, before[b]);
+
+      hostFlashCutAfter(cut);
+      appendRecords(writer, SAMPLE_LOG_BATCH);
+      hostFlashCutAfter(-1);
+
+      SampleLog reader;
+      SampleRecord record;
+
+      reader.init();
+
+      unsigned long last = reader.endSeq() - 1;
+      bool ok = last >= before[b] && last <= before[b] + SAMPLE_LOG_BATCH &&
+                reader.read(last, record) && recordMatches(record, last) &&
+                reader.available(SAMPLE_LOG_RECORDS) >= 1;
+
+      appendRecords(reader, 1);
+
+      SampleLog again;
+
+      again.init();
+      ok = ok && again.endSeq() == last + 2 && again.read(last + 1, record) && recordMatches(record, last + 1);
+
+      if (!CHECK(ok)) {
+        printf("  cut after %ld half words, %lu records before\n", cut, before[b]);
+        return;
+      }
+    }
+  }
+}
+
+// A program image reaching into the log's pages turns the log off
+HOST_TEST(leavesProgramImageAlone) {
+  uint32_t imageEnd = hostFlashImageEnd;
+  SampleLog log;
+
+  hostFlashReset();
+  hostFlashImageEnd = SAMPLE_LOG_BASE + 100;
+  log.init();
+  appendRecords(log, SAMPLE_LOG_RECORDS);
+
+  CHECK(hostFlashWrites == 0);
+  CHECK(hostFlashErases == 0);
+  CHECK(hostFlashViolations == 0);
+  CHECK(log.available(SAMPLE_LOG_RECORDS) == 0);
+
+  halFlashErasePage(HAL_FLASH_BASE);
+  CHECK(hostFlashErases == 0);
+
+  hostFlashImageEnd = imageEnd;
+}
+
+// Boots the sketch on a log holding 12 hours of columns and more, then
+// logs a day
+HOST_TEST(bootAndDayOfLogging) {
+  SampleLog writer;
+
+  hostFlashReset();
+  writer.init();
+  appendRecords(writer, 600);
+
+  hostProbesReset(3);
+
+  unsigned long reads = hostFlashReads;
+  uint32_t start = halCycles();
+
+  setup();
+
+  uint32_t bootNs = halCycles() - start;
+
+  BENCH("bootToFirstFrameVirtualMs", "%lu", millis());
+  BENCH("bootToFirstFrameHostUs", "%lu", (unsigned long)bootNs / 1000);
+  BENCH("bootToFirstFrameSpiBytes", "%lu", halCounters.spiBytes);
+  BENCH("bootFlashReads", "%lu", hostFlashReads - reads);
+
+  // The restored columns are plotted: beer at the oldest and newest
+  unsigned beerColumns = 0;
+
+  for (unsigned x=X_ZERO+1; x<tft.maxX(); x++) {
+    for (unsigned y=44; y<tft.maxY()-6; y++) {
+      if (hostTftPixel(x, y) == COLOR_BLUE) {
+        beerColumns++;
+        break;
+      }
+    }
+  }
+
+  CHECK(beerColumns >= 190);
+
+  unsigned long erases = hostFlashErases;
+  unsigned long writes = hostFlashWrites;
+
+  hostRun(86400000UL);
+
+  BENCH("flashHalfWordsPerDay", "%lu", hostFlashWrites - writes);
+  BENCH("flashErasesPerDay", "%lu", hostFlashErases - erases);
+
+  // The columns, and a day's 1 and 4 hour history buckets
+  CHECK(hostFlashWrites - writes <= (86400000UL / TEST_COLUMN_MILLIS + SAMPLE_LOG_BATCH) * SAMPLE_LOG_RECORD_WORDS +
+                                    (86400000UL / HISTORY_TIER1_MILLIS + 86400000UL / HISTORY_TIER2_MILLIS) * HISTORY_LOG_RECORD_WORDS);
+  CHECK(hostFlashViolations == 0);
+}
@@ -0,0 +1,88 @@
+#include "HostTest.h"
+
+//============================================================
+// Y axis rescale against a full redraw
+//
+// Twelve hours of a lager near 12 C fill the chart on a half degree
+// scale, then the air probe jumps and the axis widens. The chart is fed
+// directly, a sample a minute, so the scale follows the fed values
+// rather than the probe filter.
+
+#define COLUMN_MS (12 * 3600000UL / 192)
+
+static ProbeSamples fed;
+static unsigned long fedTime = 0;
+
+static void feed(double beer, double coolant, double air, bool powerOn) {
+  fed.temp[fed.roleProbe[0][0]] = (TempFixed)(beer * TEMP_SCALE);
+  fed.temp[fed.roleProbe[0][1]] = (TempFixed)(coolant * TEMP_SCALE);
+  fed.temp[fed.roleProbe[0][2]] = (TempFixed)(air * TEMP_SCALE);
+
+  fedTime += 60000UL;
+  chartDisplay.addDataPoint(fedTime, fed, 0, powerOn);
+}
+
+HOST_TEST(rescaleAgainstRedraw) {
+  hostProbesReset(3);
+  setup();
+
+  fed = samples;
+  fedTime = millis();
+
+  for (unsigned m=0; m<12*60; m++) {
+    feed(12 + (m % 8) / 16.0, 11.5 + (m % 5) / 16.0, 12 + (m % 3) / 16.0, m % 20 < 5);
+
+    while (chartDisplay.rescale()) {
+    }
+  }
+
+  chartDisplay.redraw();
+
+  unsigned long redrawBytes = chartDisplay.getRedrawSpiBytes();
+  unsigned long spiBytes = halCounters.spiBytes;
+  unsigned long windows = halCounters.windows;
+  unsigned long worstPass = 0;
+  unsigned passes = 1;
+
+  // The sample itself redraws the gutter labels and the readouts
+  feed(12, 11.5, 30, false);
+
+  unsigned long sampleBytes = halCounters.spiBytes - spiBytes;
+  unsigned long passStart = halCounters.spiBytes;
+
+  while (chartDisplay.rescale()) {
+    worstPass = max(worstPass, halCounters.spiBytes - passStart);
+    passStart = halCounters.spiBytes;
+    passes++;
+  }
+
+  worstPass = max(worstPass, halCounters.spiBytes - passStart);
+
+  unsigned long rescaleBytes = halCounters.spiBytes - spiBytes;
+
+  BENCH("redrawSpiBytes", "%lu", redrawBytes);
+  BENCH("sampleSpiBytes", "%lu", sampleBytes);
+  BENCH("rescaleSpiBytes", "%lu", rescaleBytes);
+  BENCH("rescaleWindows", "%lu", halCounters.windows - windows);
+  BENCH("rescalePasses", "%u", passes);
+  BENCH("rescaleWorstPassSpiBytes", "%lu", worstPass);
+
+  // 0 to 40 C, labelled on the top gridline
+  CHECK(hostTftText(7, 43, 2, 7) == "40");
+  CHECK(rescaleBytes < redrawBytes / 2);
+  CHECK(passes == (220 - X_ZERO + RESCALE_COLUMNS - 1) / RESCALE_COLUMNS);
+  CHECK(worstPass < redrawBytes / 20);
+}
+
+// Three character labels fit the gutter, starting at its left edge
+HOST_TEST(wideLabelsFitGutter) {
+  feed(12, 11.5, 100, false);
+
+  while (chartDisplay.rescale()) {
+  }
+
+  // 0 to 160 C in steps of 40
+  CHECK(hostTftText(0, 43, 3, 7) == "160");
+  CHECK(hostTftText(0, 73, 3, 7) == "120");
+  CHECK(hostTftText(7, 104, 2, 7) == "80");
+}
@@ -0,0 +1,184 @@
+#include "HostTest.h"
+
+//============================================================
+// Settings store: flash wear over a year and torn writes
+
+#define EDITS_PER_DAY 5
+#define DAYS 365
+#define SCROLL_STEPS 4   // Values passed through while scrolling a menu
+#define FLASH_ENDURANCE 10000UL   // Erase cycles a page is rated for
+#define SERVICE_YEARS 20
+
+static void commitNow(SettingsStore &store) {
+  hostAdvance(SETTINGS_COMMIT_DELAY);
+  CHECK(store.commitDue());
+  store.commit();
+}
+
+// The old Settings::save(): every field a byte to an address at fixed
+// offsets, written with update() on each selection
+#define OLD_SETTINGS_ADDR 1
+
+static void oldSave(SettingId id, unsigned long value) {
+  int addr = OLD_SETTINGS_ADDR + id * sizeof(unsigned long);
+
+  for (unsigned i=0; i<sizeof(unsigned long); i++) {
+    halEepromUpdate(addr + i, value >> (8 * i));
+  }
+}
+
+// Five menu edits a day, each scrolling through a few values before
+// settling, with the commit task polling as it does on the board. The
+// old path wrote only the settled value, as its menu set nothing until
+// a selection.
+HOST_TEST(yearOfMenuUse) {
+  hostEepromReset();
+
+  for (unsigned day=0; day<DAYS; day++) {
+    for (unsigned edit=0; edit<EDITS_PER_DAY; edit++) {
+      oldSave((SettingId)((day + edit) % SettingControlStrategy), day * 10 + edit + SCROLL_STEPS - 1);
+    }
+  }
+
+  unsigned long oldErases = hostEepromErases;
+  SettingsStore store;
+  unsigned long eepromWrites = halCounters.eepromWrites;
+
+  hostEepromReset();
+  store.load(0);
+
+  for (unsigned day=0; day<DAYS; day++) {
+    for (unsigned edit=0; edit<EDITS_PER_DAY; edit++) {
+      SettingId id = (SettingId)((day + edit) % SettingControlStrategy);
+
+      for (unsigned step=0; step<SCROLL_STEPS; step++) {
+        store.set(id, day * 10 + edit + step);
+        hostAdvance(500);
+        CHECK(!store.commitDue());
+      }
+
+      commitNow(store);
+      hostAdvance(86400000UL / EDITS_PER_DAY);
+    }
+  }
+
+  unsigned long edits = DAYS * EDITS_PER_DAY;
+
+  BENCH("settingsEditsPerYear", "%lu", edits);
+  BENCH("settingsEepromWritesPerYear", "%lu", halCounters.eepromWrites - eepromWrites);
+  BENCH("settingsPageErasesPerYear", "%lu", hostEepromErases);
+  BENCH("oldSavePageErasesPerYear", "%lu", oldErases);
+
+  CHECK(hostEepromFailures == 0);
+  // No more wear than the byte per field layout it replaced
+  CHECK(hostEepromErases <= oldErases);
+  // The two pages share the erases
+  CHECK(hostEepromErases * SERVICE_YEARS < 2 * FLASH_ENDURANCE);
+
+  SettingsStore reloaded;
+  unsigned long value = 0;
+
+  reloaded.load(0);
+  CHECK(reloaded.get((SettingId)((DAYS - 1 + EDITS_PER_DAY - 1) % SettingControlStrategy), value));
+  CHECK(value == (DAYS - 1) * 10 + EDITS_PER_DAY - 1 + SCROLL_STEPS - 1);
+}
+
+// Cuts the power after every possible number of word writes while two
+// settings change and a third is saved for the first time, both when
+// each change is one word in place and when it is both words, moved to
+// the spare slot. After power-on each reads as before or after, and
+// the others are untouched.
+static void tornCommit(unsigned long high) {
+  for (long cut=0; cut<1000; cut++) {
+    SettingsStore store;
+
+    hostEepromReset();
+    store.load(0);
+
+    for (unsigned id=0; id<SettingPidKd; id++) {
+      store.set((SettingId)id, 1000 + id);
+    }
+
+    commitNow(store);
+
+    store.set(SettingTargetTemp, high << 16 | 42);
+    store.set(SettingTempRange, high << 16 | 43);
+    store.set(SettingPidKd, 44);   // Saved for the first time
+    hostEepromCutAfter(cut);
+    commitNow(store);
+    hostEepromCutAfter(-1);
+
+    SettingsStore after;
+    unsigned long value;
+
+    after.load(0);
+
+    for (unsigned id=0; id<SettingsCount; id++) {
+      bool ok = after.get((SettingId)id, value);
+
+      if (id == SettingPidKd) {
+        ok = !ok || value == 44;
+      } else if (id == SettingTargetTemp || id == SettingTempRange) {
+        ok = ok && (value == 1000 + id || value == (high << 16 | (42 + id - SettingTargetTemp)));
+      } else {
+        ok = ok && value == 1000 + id;
+      }
+
+      if (!CHECK(ok)) {
+        printf("  setting %u after %ld writes\n", id, cut);
+        return;
+      }
+    }
+
+    // Once the cut comes after the last write, the commit completed
+    if (after.get(SettingTempRange, value) && value == (high << 16 | 43) && after.get(SettingPidKd, value)) {
+      CHECK(after.get(SettingTargetTemp, value) && value == (high << 16 | 42));
+      BENCH(high ? "settingsTornSlotCuts" : "settingsTornInPlaceCuts", "%ld", cut);
+      return;
+    }
+  }
+
+  CHECK(!"commit never completed");
+}
+
+HOST_TEST(tornInPlace) {
+  tornCommit(0);
+}
+
+HOST_TEST(tornSlotSwitch) {
+  tornCommit(2);
+}
+
+// A store cut off before its header is written reads as unformatted,
+// with nothing saved
+HOST_TEST(tornFormat) {
+  for (long cut=0; cut<100; cut++) {
+    SettingsStore store;
+
+    hostEepromReset();
+    store.load(0);
+    store.set(SettingTargetTemp, 20);
+    store.set(SettingPidKp, 0x12345678);
+    hostEepromCutAfter(cut);
+    commitNow(store);
+    hostEepromCutAfter(-1);
+
+    SettingsStore after;
+    unsigned long value;
+
+    after.load(0);
+
+    if (!after.isFormatted()) {
+      CHECK(!after.get(SettingTargetTemp, value));
+      continue;
+    }
+
+    CHECK(after.get(SettingTargetTemp, value) && value == 20);
+    CHECK(after.get(SettingPidKp, value) && value == 0x12345678);
+    CHECK(!after.get(SettingPidKi, value));
+    BENCH("settingsTornFormatCuts", "%ld", cut);
+    return;
+  }
+
+  CHECK(!"format never completed");
+}
@@ -0,0 +1,25 @@
+#include "HostTest.h"
+
+//============================================================
+// Boots the sketch on three probes and runs it for ten minutes
+
+HOST_TEST(bootsAndRuns) {
+  hostProbesReset(3);
+
+  setup();
+  CHECK(sensors.haveTemps() == false);
+
+  hostRun(10 * 60000UL);
+
+  CHECK(sensors.haveTemps());
+  CHECK(halCounters.conversions > 0);
+  CHECK(halCounters.pixels > 0);
+  CHECK(hostTftPixelWrites > 0);
+  CHECK(hostSleptMillis > 0);
+  CHECK(hostFlashViolations == 0);
+}
+
+HOST_TEST(showsReadings) {
+  // Header in Terminal12x16, 13 pixels a character
+  CHECK(hostTftText(0, 0, 4, 13) == "Beer");
+}
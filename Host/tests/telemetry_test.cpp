@@ -0,0 +1,268 @@
+#include "HostTest.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+
+//============================================================
+// Telemetry through a pty into Tools/telemetry_decode
+//
+// Sixteen probes sampled at 1 Hz, drained at the 115200 baud link's
+// 11 bytes a millisecond. The decoder runs as its own process on the
+// pty's slave side and this feeds the master, as the USB serial
+// adapter would.
+
+#define LINK_BYTES_PER_MS 11   // 115200 baud, ten bits a byte
+#define LINK_PROBES 16
+#define LINK_SECONDS 20000UL
+#define LINK_FLUSH 4096        // Bytes kept back before writing the pty
+
+class DecoderProcess {
+  public:
+  std::string dir;
+  int master;
+  pid_t pid;
+  unsigned long bytes;   // Written to the link
+
+  DecoderProcess()
+    : master(-1),
+      pid(-1),
+      bytes(0) {
+    char path[] = "/tmp/telemetryXXXXXX";
+
+    dir = mkdtemp(path);
+  }
+
+  ~DecoderProcess() {
+    static const char *const files[] = { "samples.csv", "control.csv", "relay.csv", "stderr.txt" };
+
+    for (unsigned i=0; i<sizeof(files)/sizeof(files[0]); i++) {
+      unlink((dir + "/" + files[i]).c_str());
+    }
+
+    rmdir(dir.c_str());
+  }
+
+  // Raw mode is set before the decoder starts, so nothing written
+  // ahead of its own setup goes through the line discipline
+  bool start(void) {
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if (master < 0 || grantpt(master) || unlockpt(master)) {
+      return false;
+    }
+
+    std::string slave = ptsname(master);
+    int fd = open(slave.c_str(), O_RDWR | O_NOCTTY);
+    struct termios tio;
+
+    tcgetattr(fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+
+    pid = fork();
+
+    if (pid == 0) {
+      std::string log = dir + "/stderr.txt";
+
+      // The master stays with this process alone, so closing it here
+      // is what the decoder sees as the far end going away
+      close(master);
+      freopen(log.c_str(), "w", stderr);
+      execl(TELEMETRY_DECODE, "telemetry_decode", "-o", dir.c_str(), slave.c_str(), (char *)0);
+      _exit(127);
+    }
+
+    close(fd);
+
+    return pid > 0;
+  }
+
+  void feed(bool all) {
+    std::string &output = hostSerialOutput();
+
+    if (output.size() >= LINK_FLUSH || (all && !output.empty())) {
+      for (size_t sent = 0; sent < output.size(); ) {
+        ssize_t n = write(master, output.data() + sent, output.size() - sent);
+
+        if (n <= 0) {
+          break;
+        }
+
+        sent += n;
+        bytes += n;
+      }
+
+      output.clear();
+    }
+  }
+
+  unsigned long rows(const char *table) {
+    std::string path = dir + "/" + table + ".csv";
+    FILE *f = fopen(path.c_str(), "r");
+    unsigned long lines = 0;
+    int c;
+
+    if (!f) {
+      return 0;
+    }
+
+    while ((c = fgetc(f)) != EOF) {
+      lines += c == '\n';
+    }
+
+    fclose(f);
+
+    return lines ? lines - 1 : 0;
+  }
+
+  // Waits for 'expected' rows to reach the CSV, as they are flushed
+  bool waitRows(const char *table, unsigned long expected) {
+    for (unsigned i=0; i<2000 && rows(table) < expected; i++) {
+      usleep(1000);
+    }
+
+    return rows(table) == expected;
+  }
+
+  // Closing the master ends the decoder's read with EIO; a signal
+  // stops it as well. Either way it exits cleanly.
+  bool finish(int signal, unsigned long &frames, unsigned long &bad, unsigned long &crc, unsigned long &lost) {
+    int status;
+
+    if (signal) {
+      kill(pid, signal);
+    }
+
+    close(master);
+
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      return false;
+    }
+
+    std::string log = dir + "/stderr.txt";
+    FILE *f = fopen(log.c_str(), "r");
+    bool parsed = f && fscanf(f, "frames %lu, bad %lu, crc errors %lu, lost %lu", &frames, &bad, &crc, &lost) == 4;
+
+    if (f) {
+      fclose(f);
+    }
+
+    return parsed;
+  }
+};
+
+static ProbeSamples linkSamples;
+
+static void sampleAll(unsigned long now) {
+  linkSamples.count = LINK_PROBES;
+
+  for (unsigned p=0; p<LINK_PROBES; p++) {
+    linkSamples.temp[p] = (20 + p) * TEMP_SCALE + (now / 1000) % 32;
+    linkSamples.time[p] = now - 100;
+  }
+
+  telemetry.sendSamples(now, linkSamples, (1 << LINK_PROBES) - 1);
+}
+
+// Runs the link for 'seconds', sampling every second and draining
+// every millisecond, with 'writable' bytes a millisecond
+static void runLink(DecoderProcess &decoder, unsigned long seconds, unsigned writable) {
+  hostSerialSetWritable(writable);
+
+  for (unsigned long ms=0; ms<seconds * 1000; ms++) {
+    if (millis() % 1000 == 0) {
+      sampleAll(millis());
+    }
+
+    telemetry.drain();
+    decoder.feed(false);
+    hostAdvance(1);
+  }
+
+  decoder.feed(true);
+}
+
+// Every frame arrives across the 32 bit millisecond wrap, with no loss
+HOST_TEST(keepsUpAtOneHertz) {
+  DecoderProcess decoder;
+  unsigned long frames, bad, crc, lost;
+  unsigned long dropped = telemetry.dropped;
+  unsigned long sent;
+
+  hostSerialCapture(true);
+  hostSetMillis(0x100000000UL - LINK_SECONDS * 1000 / 2);
+
+  if (!CHECK(decoder.start())) {
+    return;
+  }
+
+  unsigned long start = telemetry.frames;
+
+  runLink(decoder, LINK_SECONDS, LINK_BYTES_PER_MS);
+  sent = telemetry.frames - start;
+
+  CHECK(decoder.waitRows("samples", sent * LINK_PROBES));
+  CHECK(decoder.finish(0, frames, bad, crc, lost));
+
+  BENCH("linkFrames", "%lu", frames);
+  BENCH("linkBytesPerFrame", "%lu", decoder.bytes / frames);
+  BENCH("linkUsePerMille", "%lu", decoder.bytes * 1000 / (LINK_SECONDS * 1000 * LINK_BYTES_PER_MS));
+
+  CHECK(frames == sent);
+  CHECK(telemetry.dropped == dropped);
+  CHECK(bad == 0 && crc == 0 && lost == 0);
+}
+
+// With the link stalled, frames that don't fit the ring are dropped
+// and the decoder counts exactly that many lost
+HOST_TEST(starvedLinkDropsFrames) {
+  DecoderProcess decoder;
+  unsigned long frames, bad, crc, lost;
+
+  if (!CHECK(decoder.start())) {
+    return;
+  }
+
+  unsigned long dropped = telemetry.dropped;
+  unsigned long start = telemetry.frames;
+
+  runLink(decoder, 10, LINK_BYTES_PER_MS);
+  runLink(decoder, 30, 0);
+  runLink(decoder, 10, LINK_BYTES_PER_MS);
+
+  unsigned long sent = telemetry.frames - start;
+
+  CHECK(decoder.waitRows("samples", sent * LINK_PROBES));
+  CHECK(decoder.finish(0, frames, bad, crc, lost));
+
+  BENCH("starvedDropped", "%lu", telemetry.dropped - dropped);
+
+  CHECK(telemetry.dropped > dropped);
+  CHECK(lost == telemetry.dropped - dropped);
+  CHECK(frames == sent);
+}
+
+// SIGTERM with the link still open: every row already decoded is in
+// the CSV and the summary is written
+HOST_TEST(signalStopsCleanly) {
+  DecoderProcess decoder;
+  unsigned long frames, bad, crc, lost;
+
+  if (!CHECK(decoder.start())) {
+    return;
+  }
+
+  unsigned long start = telemetry.frames;
+
+  runLink(decoder, 60, LINK_BYTES_PER_MS);
+
+  unsigned long sent = telemetry.frames - start;
+
+  CHECK(decoder.waitRows("samples", sent * LINK_PROBES));
+  CHECK(decoder.finish(SIGTERM, frames, bad, crc, lost));
+  CHECK(frames == sent);
+  CHECK(decoder.rows("samples") == sent * LINK_PROBES);
+}
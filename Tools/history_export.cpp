@@ -0,0 +1,581 @@
+//============================================================
+// History export client
+//
+// Pulls the history off the board with the EXPORT command (see
+// BrewMonitor/HistoryExport.h) and writes it out as one series per
+// vessel as CSV. If the link drops or goes quiet mid-stream it asks
+// again from the record after the last one it got, so nothing is
+// fetched twice.
+//
+//   g++ -std=c++11 -O2 -o history_export history_export.cpp
+//   history_export [-r] [-o history.csv] /dev/ttyUSB0
+//
+// Given a capture file instead of a serial device it just decodes it.
+//
+// Each row is a chart column or a bucket of the hour or 4 hour
+// history, whichever is the finest the board still has for that
+// stretch, oldest first. 'column' is where the row starts, counted in
+// the sample log's 225 second columns, and 'columns' how many it
+// covers; gaps while the board was off don't count. Temperatures are
+// the mean, min and max in degrees C, empty for a disconnected probe;
+// -r writes the raw stored values instead. Power is the percentage of
+// the time the load was on.
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define EXPORT_BAUD B115200
+#define EXPORT_RUN 0x80
+#define EXPORT_END 0xFF
+#define EXPORT_TIMEOUT 3000   // Milliseconds of silence before resuming
+#define EXPORT_ATTEMPTS 10
+#define SECTIONS 3   // 4 hour buckets, hour buckets, columns
+#define PROBES 3
+#define STORE_MIN_TEMP -20
+#define STORE_SCALE 16
+#define STORE_INVALID 0xFFFF
+
+// Sample log columns in a row of each section
+static const long sectionColumns[SECTIONS] = { 1, 16, 64 };
+
+class Row {
+  public:
+  unsigned section;
+  unsigned channel;
+  long column;
+  uint16_t mean[PROBES];
+  uint16_t lo[PROBES];
+  uint16_t hi[PROBES];
+  unsigned power;
+
+  long end(void) const {
+    return column + sectionColumns[section];
+  }
+};
+
+class Output {
+  private:
+  FILE *file;
+  bool raw;
+  std::vector<Row> rows[SECTIONS];
+
+  void value(uint16_t val) {
+    if (raw) {
+      fprintf(file, ",%u", val);
+    } else if (val == STORE_INVALID) {
+      fprintf(file, ",");
+    } else {
+      fprintf(file, ",%.4f", (double)val / STORE_SCALE + STORE_MIN_TEMP);
+    }
+  }
+
+  void write(const Row &row) {
+    fprintf(file, "%u,%ld,%ld", row.channel, row.column, sectionColumns[row.section]);
+
+    for (int t = 0; t < PROBES; t++) {
+      value(row.mean[t]);
+    }
+
+    for (int t = 0; t < PROBES; t++) {
+      value(row.lo[t]);
+      value(row.hi[t]);
+    }
+
+    fprintf(file, ",%u\n", row.power);
+  }
+
+  public:
+  unsigned long records;
+
+  Output(FILE *file, bool raw)
+    : file(file), raw(raw), records(0) {
+  }
+
+  void record(const Row &row) {
+    rows[row.section].push_back(row);
+    records++;
+  }
+
+  // Each vessel's rows from the finest section that has them. A
+  // coarser row the finer ones start part way through is kept whole,
+  // and the finer ones it covers dropped, so the series has no gaps.
+  void write(void) {
+    unsigned channels = 0;
+
+    fprintf(file, "channel,column,columns,beer,coolant,air,"
+                  "beer_min,beer_max,coolant_min,coolant_max,air_min,air_max,power\n");
+
+    for (int s = 0; s < SECTIONS; s++) {
+      for (const Row &row : rows[s]) {
+        channels = row.channel >= channels ? row.channel + 1 : channels;
+      }
+    }
+
+    for (unsigned c = 0; c < channels; c++) {
+      std::vector<Row> series;
+
+      for (int s = 0; s < SECTIONS; s++) {
+        std::vector<Row> coarser;
+
+        for (const Row &row : rows[s]) {
+          if (row.channel == c && (series.empty() || row.column < series.front().column)) {
+            coarser.push_back(row);
+          }
+        }
+
+        if (coarser.empty()) {
+          continue;
+        }
+
+        long from = coarser.back().end();
+
+        for (const Row &row : series) {
+          if (row.column >= from) {
+            coarser.push_back(row);
+          }
+        }
+
+        series.swap(coarser);
+      }
+
+      for (const Row &row : series) {
+        write(row);
+      }
+    }
+  }
+};
+
+//============================================================
+// Stream decoder, fed a byte at a time
+
+class Decoder {
+  private:
+  enum {
+    Magic,
+    Section,
+    FirstSeq,
+    Flags,
+    Delta,
+    Channel,
+    SeqStep,
+    LogDelta,
+    Mean,
+    Spread,
+    Power,
+    Count,
+    Crc,
+    Done
+  } state;
+
+  Output &output;
+  unsigned magic;
+  unsigned long varint;
+  unsigned shift;
+  uint16_t vals[PROBES];
+  int16_t delta[PROBES];
+  bool power;
+  unsigned pendingMask;
+  int deltaProbe;
+  Row bucket;
+  unsigned long logSeq;
+  uint8_t spread[2 * PROBES];
+  unsigned spreadBytes;
+  uint16_t crc;
+  unsigned long count;
+  unsigned crcBytes;
+  uint16_t crcReceived;
+
+  public:
+  unsigned section;         // Section being received
+  unsigned long nextSeq;    // Sequence number after the last record received, 0 for the section's first
+  bool started;
+  bool verified;
+  bool failed;
+
+  private:
+  void updateCrc(uint8_t b) {
+    crc ^= (uint16_t)b << 8;
+
+    for (int i = 0; i < 8; i++) {
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+
+  void updateCrc32(unsigned long v) {
+    for (int i = 0; i < 4; i++) {
+      updateCrc(v >> (8 * i));
+    }
+  }
+
+  bool varintByte(uint8_t b) {
+    varint |= (unsigned long)(b & 0x7F) << shift;
+    shift += 7;
+
+    return !(b & 0x80);
+  }
+
+  void resetVarint(void) {
+    varint = 0;
+    shift = 0;
+  }
+
+  long zigzag(void) {
+    return (long)(varint >> 1) ^ -(long)(varint & 1);
+  }
+
+  void emit(void) {
+    Row row;
+
+    for (int t = 0; t < PROBES; t++) {
+      vals[t] += delta[t];
+      updateCrc(vals[t]);
+      updateCrc(vals[t] >> 8);
+      row.mean[t] = row.lo[t] = row.hi[t] = vals[t];
+    }
+
+    updateCrc(power);
+    row.section = 0;
+    row.channel = 0;
+    row.column = nextSeq++;
+    row.power = power ? 100 : 0;
+    output.record(row);
+    count++;
+  }
+
+  void emitBucket(void) {
+    updateCrc32(nextSeq);
+    updateCrc(bucket.channel);
+    updateCrc32(logSeq);
+
+    for (int t = 0; t < PROBES; t++) {
+      updateCrc(vals[t]);
+      updateCrc(vals[t] >> 8);
+    }
+
+    for (int i = 0; i < 2 * PROBES; i++) {
+      updateCrc(spread[i]);
+    }
+
+    updateCrc(bucket.power);
+
+    for (int t = 0; t < PROBES; t++) {
+      bool valid = vals[t] != STORE_INVALID;
+
+      bucket.mean[t] = vals[t];
+      bucket.lo[t] = valid ? vals[t] - spread[t] : STORE_INVALID;
+      bucket.hi[t] = valid ? vals[t] + spread[PROBES + t] : STORE_INVALID;
+    }
+
+    bucket.section = section;
+    bucket.column = (long)logSeq - sectionColumns[section];
+    output.record(bucket);
+    nextSeq++;
+    count++;
+  }
+
+  // Moves on to the next changed value, or emits the record
+  void nextDelta(void) {
+    while (++deltaProbe < PROBES && !(pendingMask & (1 << deltaProbe))) {
+    }
+
+    if (deltaProbe < PROBES) {
+      resetVarint();
+      state = Delta;
+    } else {
+      emit();
+      state = Flags;
+    }
+  }
+
+  public:
+  Decoder(Output &output)
+    : output(output), section(SECTIONS - 1), nextSeq(0), started(false), verified(false), failed(false) {
+    reset();
+  }
+
+  // Expects a new stream, as after a fresh EXPORT command
+  void reset(void) {
+    state = Magic;
+    magic = 0;
+    verified = false;
+  }
+
+  bool finished(void) {
+    return state == Done;
+  }
+
+  void feed(uint8_t b) {
+    switch (state) {
+      case Magic:
+        // Skip anything before the magic, such as debug text
+        magic = "BMX2"[magic] == b ? magic + 1 : (b == 'B' ? 1 : 0);
+
+        if (magic == 4) {
+          state = Section;
+        }
+        break;
+      case Section:
+        if (b >= SECTIONS || (started && b != section)) {
+          fprintf(stderr, "Section %u, expected %u\n", b, section);
+          failed = true;
+        }
+
+        section = b < SECTIONS ? b : 0;
+        resetVarint();
+        state = FirstSeq;
+        break;
+      case FirstSeq:
+        if (varintByte(b)) {
+          if (started && nextSeq && varint != nextSeq) {
+            fprintf(stderr, "Resumed at %lu, expected %lu\n", varint, nextSeq);
+          }
+
+          nextSeq = varint;
+          started = true;
+          memset(vals, 0, sizeof(vals));
+          memset(delta, 0, sizeof(delta));
+          power = false;
+          logSeq = 0;
+          crc = 0xFFFF;
+          count = 0;
+          state = section ? Channel : Flags;
+        }
+        break;
+      case Flags:
+        if (b == EXPORT_END) {
+          resetVarint();
+          state = Count;
+        } else if (b & EXPORT_RUN) {
+          for (unsigned n = b & ~EXPORT_RUN; n; n--) {
+            emit();
+          }
+        } else {
+          power = b & 1;
+          pendingMask = b >> 1;
+          memset(delta, 0, sizeof(delta));
+          deltaProbe = -1;
+          nextDelta();
+        }
+        break;
+      case Delta:
+        if (varintByte(b)) {
+          delta[deltaProbe] = (int16_t)zigzag();
+          nextDelta();
+        }
+        break;
+      case Channel:
+        resetVarint();
+
+        if (b == EXPORT_END) {
+          state = Count;
+        } else {
+          bucket.channel = b;
+          state = SeqStep;
+        }
+        break;
+      case SeqStep:
+        if (varintByte(b)) {
+          nextSeq += varint;
+          resetVarint();
+          state = LogDelta;
+        }
+        break;
+      case LogDelta:
+        if (varintByte(b)) {
+          logSeq += zigzag();
+          deltaProbe = 0;
+          resetVarint();
+          state = Mean;
+        }
+        break;
+      case Mean:
+        if (varintByte(b)) {
+          vals[deltaProbe] += (int16_t)zigzag();
+          resetVarint();
+
+          if (++deltaProbe == PROBES) {
+            spreadBytes = 0;
+            state = Spread;
+          }
+        }
+        break;
+      case Spread:
+        spread[spreadBytes++] = b;
+
+        if (spreadBytes == 2 * PROBES) {
+          state = Power;
+        }
+        break;
+      case Power:
+        bucket.power = b;
+        emitBucket();
+        state = Channel;
+        break;
+      case Count:
+        if (varintByte(b)) {
+          if (varint != count) {
+            fprintf(stderr, "Count mismatch: %lu sent, %lu decoded\n", varint, count);
+            failed = true;
+          }
+
+          crcBytes = 0;
+          crcReceived = 0;
+          state = Crc;
+        }
+        break;
+      case Crc:
+        crcReceived |= (uint16_t)b << (8 * crcBytes++);
+
+        if (crcBytes == 2) {
+          if (crcReceived != crc) {
+            fprintf(stderr, "CRC mismatch in section %u\n", section);
+            failed = true;
+          }
+
+          if (section) {
+            // The next section starts from its oldest record
+            section--;
+            nextSeq = 0;
+            state = Section;
+          } else {
+            verified = !failed;
+            state = Done;
+          }
+        }
+        break;
+      case Done:
+        break;
+    }
+  }
+};
+
+static void setRaw(int fd) {
+  struct termios tio;
+
+  tcgetattr(fd, &tio);
+  cfmakeraw(&tio);
+  cfsetispeed(&tio, EXPORT_BAUD);
+  cfsetospeed(&tio, EXPORT_BAUD);
+  tcsetattr(fd, TCSANOW, &tio);
+}
+
+static void request(int fd, Decoder &decoder) {
+  char command[32];
+  int length = decoder.started
+    ? snprintf(command, sizeof(command), "\nEXPORT %u %lu\n", decoder.section, decoder.nextSeq)
+    : snprintf(command, sizeof(command), "\nEXPORT\n");
+
+  decoder.reset();
+
+  if (write(fd, command, length) != length) {
+    perror("write");
+    exit(1);
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *outPath = 0;
+  bool raw = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "ro:")) != -1) {
+    switch (opt) {
+      case 'r':
+        raw = true;
+        break;
+      case 'o':
+        outPath = optarg;
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-r] [-o file.csv] device\n", argv[0]);
+        return 2;
+    }
+  }
+
+  if (optind >= argc) {
+    fprintf(stderr, "Usage: %s [-r] [-o file.csv] device\n", argv[0]);
+    return 2;
+  }
+
+  FILE *out = outPath ? fopen(outPath, "w") : stdout;
+
+  if (!out) {
+    perror(outPath);
+    return 1;
+  }
+
+  int fd = open(argv[optind], O_RDWR | O_NOCTTY);
+
+  if (fd < 0) {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  bool live = isatty(fd);
+  Output output(out, raw);
+  Decoder decoder(output);
+  uint8_t buffer[1024];
+  unsigned long bytes = 0;
+  int attempts = 0;
+
+  if (live) {
+    setRaw(fd);
+    tcflush(fd, TCIOFLUSH);
+    request(fd, decoder);
+    attempts++;
+  }
+
+  while (!decoder.finished()) {
+    if (live) {
+      struct pollfd p = { fd, POLLIN, 0 };
+
+      if (poll(&p, 1, EXPORT_TIMEOUT) <= 0) {
+        if (attempts == EXPORT_ATTEMPTS) {
+          fprintf(stderr, "Giving up after %d attempts\n", attempts);
+          break;
+        }
+
+        fprintf(stderr, "Link quiet, resuming from %lu in section %u\n", decoder.nextSeq, decoder.section);
+        request(fd, decoder);
+        attempts++;
+        continue;
+      }
+    }
+
+    ssize_t count = read(fd, buffer, sizeof(buffer));
+
+    if (count <= 0) {
+      if (count < 0 && errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    bytes += count;
+
+    for (ssize_t i = 0; i < count && !decoder.finished(); i++) {
+      decoder.feed(buffer[i]);
+    }
+  }
+
+  output.write();
+
+  if (outPath) {
+    fclose(out);
+  }
+
+  fprintf(stderr, "%lu records, %lu bytes, %.2f bytes a record%s\n", output.records, bytes,
+          output.records ? (double)bytes / output.records : 0.0,
+          decoder.verified ? ", CRC ok" : (decoder.finished() ? ", CRC failed" : ", incomplete"));
+
+  return decoder.verified ? 0 : 1;
+}
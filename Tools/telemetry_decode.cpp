@@ -0,0 +1,458 @@
+//============================================================
+// Telemetry decoder
+//
+// Reads the binary stream a TELEMETRY build sends (see
+// BrewMonitor/Telemetry.h) from a serial device, pty or capture file
+// and writes it out as CSV, or as one raw little-endian file per
+// column for loading into numpy, pandas and the like.
+//
+//   g++ -std=c++11 -O2 -o telemetry_decode telemetry_decode.cpp
+//   telemetry_decode [-c] [-o dir] [/dev/ttyUSB0 | capture.bin]
+//
+// Without an input it reads stdin. Bad frames, CRC failures and gaps
+// in the sequence numbers are counted and reported on exit. CSV rows
+// are flushed as they are written; SIGINT or SIGTERM stops the read,
+// writes out the column files and reports as at the end of the input.
+
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/select.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define TELEMETRY_BAUD B115200
+#define TELEMETRY_HEADER 6
+#define TEMP_SCALE 16
+#define TEMP_DISCONNECTED (-127 * TEMP_SCALE)
+#define MAX_FRAME 1024
+
+enum {
+  TelemetrySample = 1,
+  TelemetryControl = 2,
+  TelemetryRelay = 3
+};
+
+static uint16_t crc16(const uint8_t *data, size_t length) {
+  uint16_t crc = 0xFFFF;
+
+  for (size_t i = 0; i < length; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+
+    for (int b = 0; b < 8; b++) {
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+
+  return crc;
+}
+
+// Returns the decoded length, or -1 if the frame is malformed
+static int cobsDecode(const uint8_t *in, size_t length, uint8_t *out) {
+  size_t i = 0, o = 0;
+
+  while (i < length) {
+    uint8_t code = in[i++];
+
+    if (code == 0 || i + code - 1 > length) {
+      return -1;
+    }
+
+    for (int k = 1; k < code; k++) {
+      out[o++] = in[i++];
+    }
+
+    if (code < 0xFF && i < length) {
+      out[o++] = 0;
+    }
+  }
+
+  return (int)o;
+}
+
+static uint16_t get16(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p) {
+  return get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+//============================================================
+// Output
+
+class Column {
+  public:
+  std::string name;
+  std::string type;
+  std::vector<uint8_t> data;
+
+  Column(const char *name, const char *type)
+    : name(name), type(type) {
+  }
+
+  template <class T> void add(T value) {
+    const uint8_t *p = (const uint8_t *)&value;
+
+    data.insert(data.end(), p, p + sizeof(value));
+  }
+};
+
+class Table {
+  public:
+  std::string name;
+  std::vector<Column> columns;
+  FILE *csv;
+
+  Table(const char *name)
+    : name(name), csv(0) {
+  }
+};
+
+class Writer {
+  private:
+  std::string dir;
+  bool columnar;
+  Table samples, control, relay;
+
+  private:
+  void open(Table &table, const char *header) {
+    if (!columnar) {
+      std::string path = dir + "/" + table.name + ".csv";
+
+      table.csv = fopen(path.c_str(), "w");
+
+      if (!table.csv) {
+        perror(path.c_str());
+        exit(1);
+      }
+
+      fprintf(table.csv, "%s\n", header);
+    }
+  }
+
+  void flushColumns(Table &table, FILE *schema) {
+    for (size_t c = 0; c < table.columns.size(); c++) {
+      Column &column = table.columns[c];
+      std::string path = dir + "/" + table.name + "." + column.name + "." + column.type;
+      FILE *f = fopen(path.c_str(), "wb");
+
+      if (!f) {
+        perror(path.c_str());
+        exit(1);
+      }
+
+      fwrite(column.data.data(), 1, column.data.size(), f);
+      fclose(f);
+
+      fprintf(schema, "%s.%s %s\n", table.name.c_str(), column.name.c_str(), column.type.c_str());
+    }
+  }
+
+  public:
+  Writer(const std::string &dir, bool columnar)
+    : dir(dir), columnar(columnar), samples("samples"), control("control"), relay("relay") {
+    samples.columns = { Column("time_ms", "u64"), Column("probe", "u8"), Column("temp_c", "f32"), Column("sampled_ms", "u64") };
+    control.columns = { Column("time_ms", "u64"), Column("channel", "u8"), Column("mode", "u8"), Column("strategy", "u8"),
+                        Column("state", "u8"), Column("target", "u8"), Column("range", "u8"), Column("pid_output", "u16") };
+    relay.columns = { Column("time_ms", "u64"), Column("channel", "u8"), Column("on", "u8") };
+
+    open(samples, "time_ms,probe,temp_c,sampled_ms");
+    open(control, "time_ms,channel,mode,strategy,state,target,range,pid_output");
+    open(relay, "time_ms,channel,on");
+  }
+
+  // Disconnected probes are an empty CSV field and NaN in columns
+  void sample(uint64_t time, unsigned probe, int16_t temp, unsigned age) {
+    bool valid = temp > TEMP_DISCONNECTED;
+    float degrees = valid ? (float)temp / TEMP_SCALE : NAN;
+
+    if (columnar) {
+      samples.columns[0].add(time);
+      samples.columns[1].add((uint8_t)probe);
+      samples.columns[2].add(degrees);
+      samples.columns[3].add(time - age);
+    } else if (valid) {
+      fprintf(samples.csv, "%llu,%u,%.4f,%llu\n", (unsigned long long)time, probe, degrees, (unsigned long long)(time - age));
+      fflush(samples.csv);
+    } else {
+      fprintf(samples.csv, "%llu,%u,,%llu\n", (unsigned long long)time, probe, (unsigned long long)(time - age));
+      fflush(samples.csv);
+    }
+  }
+
+  void controlState(uint64_t time, const uint8_t *body) {
+    if (columnar) {
+      control.columns[0].add(time);
+
+      for (int i = 0; i < 6; i++) {
+        control.columns[i + 1].add(body[i]);
+      }
+
+      control.columns[7].add(get16(body + 6));
+    } else {
+      fprintf(control.csv, "%llu,%u,%u,%u,%u,%u,%u,%u\n", (unsigned long long)time,
+              body[0], body[1], body[2], body[3], body[4], body[5], get16(body + 6));
+      fflush(control.csv);
+    }
+  }
+
+  void relaySwitch(uint64_t time, unsigned channel, bool on) {
+    if (columnar) {
+      relay.columns[0].add(time);
+      relay.columns[1].add((uint8_t)channel);
+      relay.columns[2].add((uint8_t)on);
+    } else {
+      fprintf(relay.csv, "%llu,%u,%u\n", (unsigned long long)time, channel, on);
+      fflush(relay.csv);
+    }
+  }
+
+  void close(void) {
+    if (columnar) {
+      std::string path = dir + "/schema.txt";
+      FILE *schema = fopen(path.c_str(), "w");
+
+      if (!schema) {
+        perror(path.c_str());
+        exit(1);
+      }
+
+      flushColumns(samples, schema);
+      flushColumns(control, schema);
+      flushColumns(relay, schema);
+      fclose(schema);
+    } else {
+      fclose(samples.csv);
+      fclose(control.csv);
+      fclose(relay.csv);
+    }
+  }
+};
+
+//============================================================
+// Decoding
+
+class Decoder {
+  private:
+  Writer &writer;
+  uint32_t lastTime;
+  uint64_t timeBase;    // Extends the 32 bit millisecond clock past its wrap
+  int lastSequence;
+
+  public:
+  unsigned long frames, bad, crcErrors, lost;
+
+  private:
+  bool bodyIs(int length, int expected) {
+    if (length != expected) {
+      bad++;
+      return false;
+    }
+
+    return true;
+  }
+
+  public:
+  Decoder(Writer &writer)
+    : writer(writer), lastTime(0), timeBase(0), lastSequence(-1), frames(0), bad(0), crcErrors(0), lost(0) {
+  }
+
+  void frame(const uint8_t *encoded, size_t length) {
+    uint8_t data[MAX_FRAME];
+    int size = cobsDecode(encoded, length, data);
+
+    if (size < TELEMETRY_HEADER + 2) {
+      bad++;
+      return;
+    }
+
+    if (crc16(data, size - 2) != get16(data + size - 2)) {
+      crcErrors++;
+      return;
+    }
+
+    uint8_t type = data[0];
+    uint8_t sequence = data[1];
+    uint32_t time = get32(data + 2);
+    const uint8_t *body = data + TELEMETRY_HEADER;
+    int bodyLength = size - TELEMETRY_HEADER - 2;
+
+    if (lastSequence >= 0) {
+      lost += (uint8_t)(sequence - lastSequence - 1);
+    }
+    lastSequence = sequence;
+
+    if (time < lastTime && lastTime - time > 0x80000000UL) {
+      timeBase += 0x100000000ULL;
+    }
+    lastTime = time;
+
+    uint64_t now = timeBase + time;
+
+    frames++;
+
+    switch (type) {
+      case TelemetrySample: {
+        if (bodyLength < 2) {
+          bad++;
+          break;
+        }
+
+        uint16_t mask = get16(body);
+        int count = __builtin_popcount(mask);
+
+        if (!bodyIs(bodyLength, 2 + 4 * count)) {
+          break;
+        }
+
+        const uint8_t *p = body + 2;
+
+        for (unsigned probe = 0; probe < 16; probe++) {
+          if (mask & (1 << probe)) {
+            writer.sample(now, probe, (int16_t)get16(p), get16(p + 2));
+            p += 4;
+          }
+        }
+        break;
+      }
+      case TelemetryControl:
+        if (bodyIs(bodyLength, 8)) {
+          writer.controlState(now, body);
+        }
+        break;
+      case TelemetryRelay:
+        if (bodyIs(bodyLength, 2)) {
+          writer.relaySwitch(now, body[0], body[1]);
+        }
+        break;
+      default:
+        bad++;
+        break;
+    }
+  }
+};
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stop(int signal) {
+  stopping = 1;
+}
+
+static void setRaw(int fd) {
+  struct termios tio;
+
+  if (tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, TELEMETRY_BAUD);
+    cfsetospeed(&tio, TELEMETRY_BAUD);
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+}
+
+int main(int argc, char **argv) {
+  std::string dir = ".";
+  bool columnar = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "co:")) != -1) {
+    switch (opt) {
+      case 'c':
+        columnar = true;
+        break;
+      case 'o':
+        dir = optarg;
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-c] [-o dir] [input]\n", argv[0]);
+        return 2;
+    }
+  }
+
+  int fd = 0;
+
+  if (optind < argc) {
+    fd = open(argv[optind], O_RDONLY | O_NOCTTY);
+
+    if (fd < 0) {
+      perror(argv[optind]);
+      return 1;
+    }
+  }
+
+  if (isatty(fd)) {
+    setRaw(fd);
+  }
+
+  // The signals stay blocked except inside pselect(), so a stop can't
+  // land between the check and the wait and leave the read blocked
+  struct sigaction action;
+  sigset_t blocked, waiting;
+
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = stop;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, 0);
+  sigaction(SIGTERM, &action, 0);
+
+  sigemptyset(&blocked);
+  sigaddset(&blocked, SIGINT);
+  sigaddset(&blocked, SIGTERM);
+  sigprocmask(SIG_BLOCK, &blocked, &waiting);
+
+  Writer writer(dir, columnar);
+  Decoder decoder(writer);
+  std::vector<uint8_t> frame;
+  uint8_t buffer[4096];
+  ssize_t count;
+
+  while (!stopping) {
+    fd_set input;
+
+    FD_ZERO(&input);
+    FD_SET(fd, &input);
+
+    if (pselect(fd + 1, &input, 0, 0, 0, &waiting) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      perror("pselect");
+      break;
+    }
+
+    // A pty returns EIO once the other end closes
+    if ((count = read(fd, buffer, sizeof(buffer))) <= 0) {
+      break;
+    }
+
+    for (ssize_t i = 0; i < count; i++) {
+      if (buffer[i] != 0) {
+        if (frame.size() < MAX_FRAME) {
+          frame.push_back(buffer[i]);
+        }
+      } else {
+        // Joining mid-stream costs one bad frame
+        if (!frame.empty()) {
+          decoder.frame(frame.data(), frame.size());
+        }
+
+        frame.clear();
+      }
+    }
+  }
+
+  writer.close();
+
+  fprintf(stderr, "frames %lu, bad %lu, crc errors %lu, lost %lu\n",
+          decoder.frames, decoder.bad, decoder.crcErrors, decoder.lost);
+
+  return 0;
+}